@@ -30,7 +30,8 @@ static const char *TAG = "catflapcam_encoder";
 
 #if CONFIG_CATFLAPCAM_SELECT_JPEG_HW_DRIVER
 /**
- * @brief JPEG hardware encoder handle to provide a single instance for all video streams
+ * @brief JPEG hardware encoder handle to provide a single instance for all video streams,
+ *        s_jpeg_hw_ref_count counts the encoders sharing it
  */
 static jpeg_encoder_handle_t s_jpeg_hw_handle;
 static uint32_t s_jpeg_hw_ref_count;
@@ -129,10 +130,10 @@ esp_err_t catflapcam_encoder_init(catflapcam_encoder_config_t *config, catflapca
 
 #if CONFIG_CATFLAPCAM_SELECT_JPEG_HW_DRIVER
     encoder->jpeg_enc_config = jpeg_enc_config;
-    if (!s_jpeg_hw_ref_count) {
-        s_jpeg_hw_ref_count++;
+    if (jpeg_handle) {
         s_jpeg_hw_handle = jpeg_handle;
     }
+    s_jpeg_hw_ref_count++;
 #else
     encoder->jpeg_handle = jpeg_handle;
 #endif
@@ -145,7 +146,10 @@ esp_err_t catflapcam_encoder_init(catflapcam_encoder_config_t *config, catflapca
 
 fail0:
 #if CONFIG_CATFLAPCAM_SELECT_JPEG_HW_DRIVER
-    jpeg_del_encoder_engine(jpeg_handle);
+    // Only delete the engine if this call created it, other encoders still hold the shared one
+    if (jpeg_handle) {
+        jpeg_del_encoder_engine(jpeg_handle);
+    }
 #else
     jpeg_enc_close(jpeg_handle);
 #endif
@@ -0,0 +1,453 @@
+/*
+ * SPDX-FileCopyrightText: 2024-2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "catflapcam_frame_broker.h"
+#include "main.h"
+
+struct catflapcam_frame_subscriber {
+    SemaphoreHandle_t ready;
+    TaskHandle_t notify;
+    uint64_t last_seq;
+    bool latest;
+    struct catflapcam_frame_subscriber *next;
+};
+
+typedef struct frame_slot {
+    catflapcam_frame_t frame;
+    uint8_t *own_data;
+    bool pinned;
+    int64_t pinned_us;
+    catflapcam_frame_source_buf_t src_buf;
+} frame_slot_t;
+
+typedef struct catflapcam_frame_broker {
+    catflapcam_frame_source_t source;
+    frame_slot_t slots[CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER];
+    int latest_slot;
+    uint64_t next_seq;
+    uint8_t index;
+    bool zero_copy;
+    uint8_t max_pinned;
+
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t stopped;
+    TaskHandle_t task;
+    volatile bool running;
+
+    catflapcam_frame_subscriber_t *subscribers;
+    uint32_t latest_subscribers;
+    catflapcam_frame_broker_stats_t stats;
+} catflapcam_frame_broker_t;
+
+static int pick_free_slot(catflapcam_frame_broker_t *broker)
+{
+    int best = -1;
+
+    for (int i = 0; i < CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER; i++) {
+        frame_slot_t *slot = &broker->slots[i];
+        if (i == broker->latest_slot || slot->frame.refcount > 0 || slot->pinned) {
+            continue;
+        }
+        if (best < 0 || slot->frame.seq < broker->slots[best].frame.seq) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+/*
+ * Pinned slots hand a dequeued V4L2 buffer straight to readers. Once a pinned slot is neither the latest
+ * frame nor referenced by a reader, its buffer is collected here so the capture task can queue it back.
+ */
+static int collect_idle_pins(catflapcam_frame_broker_t *broker, catflapcam_frame_source_buf_t *requeue)
+{
+    int count = 0;
+
+    for (int i = 0; i < CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER; i++) {
+        frame_slot_t *slot = &broker->slots[i];
+        if (!slot->pinned || slot->frame.refcount > 0 || i == broker->latest_slot) {
+            continue;
+        }
+        requeue[count++] = slot->src_buf;
+        slot->pinned = false;
+        slot->frame.data = slot->own_data;
+    }
+    return count;
+}
+
+/*
+ * A new frame may be pinned only while enough V4L2 buffers stay queued for the sensor and no reader has
+ * kept an older pin past CATFLAPCAM_FRAME_BROKER_PIN_MAX_MS; otherwise it falls back to the copy path.
+ * The latest slot is ignored when idle because publishing the new frame releases it.
+ */
+static bool can_pin_frame(catflapcam_frame_broker_t *broker, int64_t now_us)
+{
+    uint32_t pinned = 0;
+
+    if (!broker->zero_copy) {
+        return false;
+    }
+    for (int i = 0; i < CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER; i++) {
+        frame_slot_t *slot = &broker->slots[i];
+        if (!slot->pinned || (i == broker->latest_slot && slot->frame.refcount == 0)) {
+            continue;
+        }
+        if ((now_us - slot->pinned_us) > (int64_t)CATFLAPCAM_FRAME_BROKER_PIN_MAX_MS * 1000) {
+            return false;
+        }
+        pinned++;
+    }
+    return pinned < broker->max_pinned;
+}
+
+static void publish_slot(catflapcam_frame_broker_t *broker, int slot_index)
+{
+    broker->slots[slot_index].frame.seq = broker->next_seq++;
+    broker->latest_slot = slot_index;
+    broker->stats.frames_captured++;
+
+    for (catflapcam_frame_subscriber_t *sub = broker->subscribers; sub; sub = sub->next) {
+        xSemaphoreGive(sub->ready);
+        if (sub->notify) {
+            xTaskNotifyGive(sub->notify);
+        }
+    }
+}
+
+static void requeue_buffers(catflapcam_frame_broker_t *broker, const catflapcam_frame_source_buf_t *bufs, int count)
+{
+    for (int i = 0; i < count; i++) {
+        broker->source.requeue(broker->source.ctx, &bufs[i]);
+    }
+}
+
+/*
+ * Replaces `src_buf` with the newest buffer the source has already completed, queueing the older ones back
+ * unread. Only used while a latest-frame subscriber is connected.
+ */
+static void drain_ready_buffers(catflapcam_frame_broker_t *broker, catflapcam_frame_source_buf_t *src_buf)
+{
+    const catflapcam_frame_source_t *source = &broker->source;
+    catflapcam_frame_source_buf_t next;
+    uint32_t skipped = 0;
+
+    if (!source->dequeue_ready || !broker->latest_subscribers) {
+        return;
+    }
+    while (source->dequeue_ready(source->ctx, &next) == ESP_OK) {
+        source->requeue(source->ctx, src_buf);
+        *src_buf = next;
+        skipped++;
+    }
+    if (skipped) {
+        xSemaphoreTake(broker->lock, portMAX_DELAY);
+        broker->stats.frames_skipped += skipped;
+        xSemaphoreGive(broker->lock);
+    }
+}
+
+static void frame_broker_task(void *arg)
+{
+    catflapcam_frame_broker_t *broker = (catflapcam_frame_broker_t *)arg;
+    const catflapcam_frame_source_t *source = &broker->source;
+    catflapcam_frame_source_buf_t requeue[CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER];
+    int requeue_count;
+
+    while (broker->running) {
+        catflapcam_frame_source_buf_t src_buf = {0};
+
+        if (source->dequeue(source->ctx, &src_buf) != ESP_OK) {
+            if (broker->running) {
+                vTaskDelay(pdMS_TO_TICKS(10));
+            }
+            continue;
+        }
+        drain_ready_buffers(broker, &src_buf);
+        int64_t capture_us = esp_timer_get_time();
+
+        xSemaphoreTake(broker->lock, portMAX_DELAY);
+        requeue_count = collect_idle_pins(broker, requeue);
+        int slot_index = pick_free_slot(broker);
+        bool pin = false;
+        if (slot_index >= 0) {
+            broker->slots[slot_index].frame.refcount = 1;
+            pin = can_pin_frame(broker, capture_us);
+        } else {
+            broker->stats.frames_dropped++;
+        }
+        xSemaphoreGive(broker->lock);
+        requeue_buffers(broker, requeue, requeue_count);
+
+        if (slot_index < 0) {
+            source->requeue(source->ctx, &src_buf);
+            continue;
+        }
+
+        frame_slot_t *slot = &broker->slots[slot_index];
+        bool fits = src_buf.size > 0 && (pin || src_buf.size <= slot->frame.capacity);
+        if (fits && pin) {
+            slot->frame.data = (uint8_t *)src_buf.data;
+            slot->pinned = true;
+            slot->pinned_us = capture_us;
+            slot->src_buf = src_buf;
+        } else if (fits) {
+            memcpy(slot->own_data, src_buf.data, src_buf.size);
+            slot->frame.data = slot->own_data;
+        } else {
+            ESP_LOGW(TAG, "video%d: frame of %" PRIu32 " bytes does not fit broker slot (%" PRIu32 ")",
+                     broker->index, src_buf.size, slot->frame.capacity);
+        }
+        if (fits) {
+            slot->frame.size = src_buf.size;
+            slot->frame.capture_us = capture_us;
+        }
+        if (!slot->pinned) {
+            source->requeue(source->ctx, &src_buf);
+        }
+
+        xSemaphoreTake(broker->lock, portMAX_DELAY);
+        slot->frame.refcount = 0;
+        if (fits) {
+            publish_slot(broker, slot_index);
+            if (pin) {
+                broker->stats.frames_pinned++;
+            } else if (broker->zero_copy) {
+                broker->stats.pin_fallbacks++;
+            }
+        } else {
+            broker->stats.frames_dropped++;
+        }
+        requeue_count = collect_idle_pins(broker, requeue);
+        xSemaphoreGive(broker->lock);
+        requeue_buffers(broker, requeue, requeue_count);
+    }
+
+    xSemaphoreGive(broker->stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t catflapcam_frame_broker_new(const catflapcam_frame_broker_config_t *config, catflapcam_frame_broker_handle_t *ret_broker)
+{
+    esp_err_t ret = ESP_OK;
+
+    ESP_RETURN_ON_FALSE(config && ret_broker && config->source.dequeue && config->source.requeue && config->frame_capacity > 0,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid frame broker config");
+
+    catflapcam_frame_broker_t *broker = calloc(1, sizeof(catflapcam_frame_broker_t));
+    ESP_RETURN_ON_FALSE(broker, ESP_ERR_NO_MEM, TAG, "failed to alloc frame broker");
+    broker->source = config->source;
+    broker->index = config->index;
+    broker->zero_copy = config->zero_copy && config->max_pinned > 0;
+    broker->max_pinned = config->max_pinned;
+    broker->latest_slot = -1;
+    broker->next_seq = 1;
+
+    for (int i = 0; i < CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER; i++) {
+        frame_slot_t *slot = &broker->slots[i];
+        slot->own_data = heap_caps_aligned_calloc(CATFLAPCAM_FRAME_BROKER_BUF_ALIGN, 1, config->frame_capacity, MALLOC_CAP_SPIRAM);
+        ESP_GOTO_ON_FALSE(slot->own_data, ESP_ERR_NO_MEM, fail, TAG, "failed to alloc frame slot %d", i);
+        slot->frame.data = slot->own_data;
+        slot->frame.capacity = config->frame_capacity;
+    }
+
+    broker->lock = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(broker->lock, ESP_ERR_NO_MEM, fail, TAG, "failed to create frame broker lock");
+    broker->stopped = xSemaphoreCreateBinary();
+    ESP_GOTO_ON_FALSE(broker->stopped, ESP_ERR_NO_MEM, fail, TAG, "failed to create frame broker stop semaphore");
+
+    *ret_broker = broker;
+    return ESP_OK;
+
+fail:
+    catflapcam_frame_broker_free(broker);
+    return ret;
+}
+
+esp_err_t catflapcam_frame_broker_start(catflapcam_frame_broker_handle_t broker)
+{
+    char task_name[16];
+
+    ESP_RETURN_ON_FALSE(broker && !broker->task, ESP_ERR_INVALID_STATE, TAG, "frame broker already started");
+    snprintf(task_name, sizeof(task_name), "frame_broker%d", broker->index);
+
+    broker->running = true;
+    if (xTaskCreate(frame_broker_task, task_name, CATFLAPCAM_FRAME_BROKER_TASK_STACK_SIZE, broker,
+                    CATFLAPCAM_FRAME_BROKER_TASK_PRIORITY, &broker->task) != pdPASS) {
+        broker->running = false;
+        broker->task = NULL;
+        ESP_LOGE(TAG, "video%d: failed to create frame broker task", broker->index);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void catflapcam_frame_broker_free(catflapcam_frame_broker_handle_t broker)
+{
+    if (!broker) {
+        return;
+    }
+
+    if (broker->task) {
+        broker->running = false;
+        if (xSemaphoreTake(broker->stopped, pdMS_TO_TICKS(1000)) != pdPASS) {
+            ESP_LOGE(TAG, "video%d: frame broker task did not stop, leaking broker", broker->index);
+            return;
+        }
+        broker->task = NULL;
+    }
+
+    while (broker->subscribers) {
+        catflapcam_frame_broker_unsubscribe(broker, broker->subscribers);
+    }
+    for (int i = 0; i < CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER; i++) {
+        if (broker->slots[i].own_data) {
+            heap_caps_free(broker->slots[i].own_data);
+        }
+    }
+    if (broker->stopped) {
+        vSemaphoreDelete(broker->stopped);
+    }
+    if (broker->lock) {
+        vSemaphoreDelete(broker->lock);
+    }
+    free(broker);
+}
+
+esp_err_t catflapcam_frame_broker_subscribe(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t **ret_sub)
+{
+    ESP_RETURN_ON_FALSE(broker && ret_sub, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    catflapcam_frame_subscriber_t *sub = calloc(1, sizeof(catflapcam_frame_subscriber_t));
+    ESP_RETURN_ON_FALSE(sub, ESP_ERR_NO_MEM, TAG, "failed to alloc frame subscriber");
+    sub->ready = xSemaphoreCreateBinary();
+    if (!sub->ready) {
+        free(sub);
+        ESP_LOGE(TAG, "failed to create frame subscriber semaphore");
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(broker->lock, portMAX_DELAY);
+    sub->next = broker->subscribers;
+    broker->subscribers = sub;
+    broker->stats.subscribers++;
+    xSemaphoreGive(broker->lock);
+
+    *ret_sub = sub;
+    return ESP_OK;
+}
+
+void catflapcam_frame_broker_unsubscribe(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub)
+{
+    if (!broker || !sub) {
+        return;
+    }
+
+    xSemaphoreTake(broker->lock, portMAX_DELAY);
+    for (catflapcam_frame_subscriber_t **it = &broker->subscribers; *it; it = &(*it)->next) {
+        if (*it == sub) {
+            *it = sub->next;
+            broker->stats.subscribers--;
+            if (sub->latest) {
+                broker->latest_subscribers--;
+            }
+            break;
+        }
+    }
+    xSemaphoreGive(broker->lock);
+
+    vSemaphoreDelete(sub->ready);
+    free(sub);
+}
+
+void catflapcam_frame_broker_set_latest(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub, bool latest)
+{
+    if (!broker || !sub) {
+        return;
+    }
+
+    xSemaphoreTake(broker->lock, portMAX_DELAY);
+    if (sub->latest != latest) {
+        sub->latest = latest;
+        if (latest) {
+            broker->latest_subscribers++;
+        } else {
+            broker->latest_subscribers--;
+        }
+    }
+    xSemaphoreGive(broker->lock);
+}
+
+void catflapcam_frame_broker_set_notify(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub, TaskHandle_t task)
+{
+    if (!broker || !sub) {
+        return;
+    }
+
+    xSemaphoreTake(broker->lock, portMAX_DELAY);
+    sub->notify = task;
+    xSemaphoreGive(broker->lock);
+}
+
+esp_err_t catflapcam_frame_broker_acquire(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub,
+                                          TickType_t wait, catflapcam_frame_t **ret_frame)
+{
+    ESP_RETURN_ON_FALSE(broker && sub && ret_frame, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    TickType_t start = xTaskGetTickCount();
+    while (1) {
+        xSemaphoreTake(broker->lock, portMAX_DELAY);
+        if (broker->latest_slot >= 0 && broker->slots[broker->latest_slot].frame.seq > sub->last_seq) {
+            catflapcam_frame_t *frame = &broker->slots[broker->latest_slot].frame;
+            frame->refcount++;
+            sub->last_seq = frame->seq;
+            xSemaphoreGive(broker->lock);
+            *ret_frame = frame;
+            return ESP_OK;
+        }
+        xSemaphoreGive(broker->lock);
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= wait || xSemaphoreTake(sub->ready, wait - elapsed) != pdPASS) {
+            return ESP_ERR_TIMEOUT;
+        }
+    }
+}
+
+void catflapcam_frame_broker_release(catflapcam_frame_broker_handle_t broker, catflapcam_frame_t *frame)
+{
+    if (!broker || !frame) {
+        return;
+    }
+
+    xSemaphoreTake(broker->lock, portMAX_DELAY);
+    if (frame->refcount > 0) {
+        frame->refcount--;
+    } else {
+        ESP_LOGW(TAG, "video%d: frame seq=%" PRIu64 " released more often than acquired", broker->index, frame->seq);
+    }
+    xSemaphoreGive(broker->lock);
+}
+
+void catflapcam_frame_broker_get_stats(catflapcam_frame_broker_handle_t broker, catflapcam_frame_broker_stats_t *stats)
+{
+    if (!broker || !stats) {
+        return;
+    }
+
+    xSemaphoreTake(broker->lock, portMAX_DELAY);
+    *stats = broker->stats;
+    xSemaphoreGive(broker->lock);
+}
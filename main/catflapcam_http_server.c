@@ -4,11 +4,13 @@
  * SPDX-License-Identifier: ESPRESSIF MIT
  */
 
+#include <stdarg.h>
 #include <string.h>
 #include <time.h>
 #include <inttypes.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include "freertos/FreeRTOS.h"
@@ -21,6 +23,7 @@
 #include "catflapcam_config.h"
 #include "catflapcam_http_server.h"
 #include "catflapcam_storage.h"
+#include "catflapcam_stream.h"
 
 typedef struct request_desc {
     int index;
@@ -36,15 +39,18 @@ static const char *SNAPSHOTS_PAGE_HTML =
     ".card img{width:100%;height:auto;border-radius:6px;background:#ddd}.meta{font-size:12px;color:#444;padding-top:6px}"
     ".actions{display:flex;gap:8px;margin-top:8px}.btn{padding:8px 12px;border:none;border-radius:6px;color:#fff;font-weight:600;cursor:pointer}"
     ".btn-refresh{background:#1f6feb}.btn-open{background:#15803d;display:inline-block;text-decoration:none;text-align:center}.btn-del{background:#b91c1c;flex:1}"
-    "</style></head><body><div class='top'><h2>Snapshots</h2><button class='btn btn-refresh' onclick='load()'>Refresh</button></div>"
+    "</style></head><body><div class='top'><h2>Snapshots</h2><button class='btn btn-refresh' onclick='load(false)'>Refresh</button></div>"
     "<div id='status'>Loading...</div><div id='grid' class='grid'></div>"
+    "<div class='top'><button id='more' class='btn btn-refresh' style='display:none;margin:12px auto' onclick='load(true)'>Load more</button></div>"
     "<script>"
     "async function delSnapshot(name){if(!confirm('Delete '+name+'?')) return;"
-    "const r=await fetch('/api/snapshots/'+encodeURIComponent(name),{method:'DELETE'});if(!r.ok){alert('Delete failed');return;}load();}"
-    "async function load(){const status=document.getElementById('status');const grid=document.getElementById('grid');"
-    "status.textContent='Loading...';grid.innerHTML='';"
-    "try{const r=await fetch('/api/snapshots?limit=300',{cache:'no-store'});const j=await r.json();"
-    "status.textContent=`${j.snapshots.length} snapshot(s)`;"
+    "const r=await fetch('/api/snapshots/'+encodeURIComponent(name),{method:'DELETE'});if(!r.ok){alert('Delete failed');return;}load(false);}"
+    "let next=null;"
+    "async function load(more){const status=document.getElementById('status');const grid=document.getElementById('grid');"
+    "const btn=document.getElementById('more');status.textContent='Loading...';if(!more){grid.innerHTML='';next=null;}"
+    "try{const r=await fetch('/api/snapshots?limit=120'+(more&&next?'&before_seq='+next:''),{cache:'no-store'});const j=await r.json();"
+    "next=j.nextBeforeSeq;btn.style.display=next?'':'none';"
+    "status.textContent=`${grid.childElementCount+j.snapshots.length} of ${j.total} snapshot(s)`;"
     "for(const s of j.snapshots){const c=document.createElement('div');c.className='card';"
     "const a=document.createElement('a');a.href=s.url;a.target='_blank';const i=document.createElement('img');i.src=s.url;"
     "a.appendChild(i);const m=document.createElement('div');m.className='meta';m.textContent=s.name+' ('+s.size+' bytes)';"
@@ -53,7 +59,7 @@ static const char *SNAPSHOTS_PAGE_HTML =
     "const del=document.createElement('button');del.className='btn btn-del';del.textContent='Delete';del.onclick=()=>delSnapshot(s.name);"
     "act.appendChild(open);act.appendChild(del);"
     "c.appendChild(a);c.appendChild(m);c.appendChild(act);grid.appendChild(c);}}catch(e){status.textContent='Failed to load snapshots';}}"
-    "load();</script></body></html>";
+    "load(false);</script></body></html>";
 
 static bool constant_time_password_equals(const char *expected, const char *provided)
 {
@@ -156,12 +162,11 @@ fail0:
     return ret;
 }
 
-static esp_err_t decode_request(catflapcam_webcam_t *web_cam, httpd_req_t *req, request_desc_t *desc)
+/* Parses the `source` key of a query string that was already read. */
+static esp_err_t decode_source(catflapcam_webcam_t *web_cam, const char *query, request_desc_t *desc)
 {
-    char query[64];
     char source_value[8];
 
-    ESP_RETURN_ON_ERROR(httpd_req_get_url_query_str(req, query, sizeof(query)), TAG, "failed to get query string");
     ESP_RETURN_ON_ERROR(httpd_query_key_value(query, "source", source_value, sizeof(source_value)), TAG, "missing source query key");
 
     char *endp = NULL;
@@ -176,6 +181,75 @@ static esp_err_t decode_request(catflapcam_webcam_t *web_cam, httpd_req_t *req,
     return ESP_OK;
 }
 
+static esp_err_t decode_request(catflapcam_webcam_t *web_cam, httpd_req_t *req, request_desc_t *desc)
+{
+    char query[64];
+
+    ESP_RETURN_ON_ERROR(httpd_req_get_url_query_str(req, query, sizeof(query)), TAG, "failed to get query string");
+    return decode_source(web_cam, query, desc);
+}
+
+static esp_err_t query_get_long(const char *query, const char *key, long min, long max, long *out)
+{
+    char value[12];
+
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    char *endp = NULL;
+    long parsed = strtol(value, &endp, 10);
+    if (endp == value || *endp != '\0' || parsed < min || parsed > max) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *out = parsed;
+    return ESP_OK;
+}
+
+/*
+ * GET returns the region of interest of a source; POST with x, y, width and height (in 1/1000 of the frame)
+ * replaces it and persists it across reboots.
+ */
+static esp_err_t roi_handler(httpd_req_t *req)
+{
+    catflapcam_webcam_t *web_cam = (catflapcam_webcam_t *)req->user_ctx;
+    request_desc_t desc;
+    catflapcam_webcam_roi_t roi;
+    char query[96] = {0};
+    char body[96];
+    ESP_RETURN_ON_ERROR(decode_request(web_cam, req, &desc), TAG, "failed to decode request");
+    catflapcam_webcam_video_t *video = &web_cam->video[desc.index];
+
+    if (req->method == HTTP_POST) {
+        long x, y, width, height;
+
+        httpd_req_get_url_query_str(req, query, sizeof(query));
+        if (query_get_long(query, "x", 0, CATFLAPCAM_ROI_UNITS - 1, &x) != ESP_OK ||
+            query_get_long(query, "y", 0, CATFLAPCAM_ROI_UNITS - 1, &y) != ESP_OK ||
+            query_get_long(query, "width", 1, CATFLAPCAM_ROI_UNITS - x, &width) != ESP_OK ||
+            query_get_long(query, "height", 1, CATFLAPCAM_ROI_UNITS - y, &height) != ESP_OK) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid roi");
+        }
+        roi.x = (uint16_t)x;
+        roi.y = (uint16_t)y;
+        roi.width = (uint16_t)width;
+        roi.height = (uint16_t)height;
+        esp_err_t err = catflapcam_webcam_set_roi(video, &roi);
+        if (err == ESP_ERR_NOT_SUPPORTED) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "roi not supported for this source");
+        }
+        if (err != ESP_OK) {
+            return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "failed to set roi");
+        }
+    }
+
+    catflapcam_webcam_get_roi(video, &roi);
+    int len = snprintf(body, sizeof(body), "{\"x\":%u,\"y\":%u,\"width\":%u,\"height\":%u,\"units\":%d}",
+                       roi.x, roi.y, roi.width, roi.height, CATFLAPCAM_ROI_UNITS);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    return httpd_resp_send(req, body, len);
+}
+
 static esp_err_t camera_info_handler(httpd_req_t *req)
 {
     esp_err_t ret;
@@ -196,23 +270,216 @@ static esp_err_t snapshots_page_handler(httpd_req_t *req)
     return httpd_resp_sendstr(req, SNAPSHOTS_PAGE_HTML);
 }
 
+/* Buffers JSON text and sends it as HTTP chunks, so long responses need neither a cJSON tree nor one big string. */
+typedef struct json_stream {
+    httpd_req_t *req;
+    esp_err_t err;
+    size_t len;
+    char buf[CATFLAPCAM_JSON_STREAM_BUF_SIZE];
+} json_stream_t;
+
+static void json_stream_flush(json_stream_t *js)
+{
+    if (js->err == ESP_OK && js->len > 0) {
+        js->err = httpd_resp_send_chunk(js->req, js->buf, js->len);
+    }
+    js->len = 0;
+}
+
+static void __attribute__((format(printf, 2, 3))) json_stream_printf(json_stream_t *js, const char *fmt, ...)
+{
+    va_list args;
+
+    for (int attempt = 0; attempt < 2 && js->err == ESP_OK; attempt++) {
+        va_start(args, fmt);
+        int n = vsnprintf(js->buf + js->len, sizeof(js->buf) - js->len, fmt, args);
+        va_end(args);
+        if (n >= 0 && (size_t)n < sizeof(js->buf) - js->len) {
+            js->len += n;
+            return;
+        }
+        if (attempt == 0 && js->len > 0) {
+            json_stream_flush(js);
+        } else {
+            js->err = ESP_ERR_INVALID_SIZE;
+        }
+    }
+}
+
+/* Writes `prefix` (plain text) followed by `str` as one escaped JSON string. */
+static void json_stream_string(json_stream_t *js, const char *prefix, const char *str)
+{
+    json_stream_printf(js, "\"%s", prefix);
+    for (const char *p = str; *p; p++) {
+        unsigned char ch = (unsigned char)*p;
+        if (ch == '"' || ch == '\\') {
+            json_stream_printf(js, "\\%c", ch);
+        } else if (ch < 0x20) {
+            json_stream_printf(js, "\\u%04x", ch);
+        } else {
+            json_stream_printf(js, "%c", ch);
+        }
+    }
+    json_stream_printf(js, "\"");
+}
+
+/* Reads an unsigned decimal query value; ESP_ERR_NOT_FOUND when the key is absent. */
+static esp_err_t query_get_u64(const char *query, const char *key, uint64_t *out)
+{
+    char value[24];
+    char *endp = NULL;
+
+    if (httpd_query_key_value(query, key, value, sizeof(value)) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    errno = 0;
+    *out = strtoull(value, &endp, 10);
+    return (endp != value && *endp == '\0' && errno == 0 && value[0] != '-') ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+/*
+ * The version token of a snapshot: its ETag without quotes, and the `v` of its listed URL. The capture time is
+ * part of it because a seq (and so a name) is reused once the newest snapshots are deleted.
+ */
+static void format_snapshot_tag(uint64_t seq, uint32_t size, int64_t timestamp_ms, char *tag, size_t tag_size)
+{
+    snprintf(tag, tag_size, "%" PRIx64 "-%" PRIx32 "-%" PRIx64, seq, size, (uint64_t)timestamp_ms);
+}
+
+/*
+ * Pages newest-first through the snapshot index, optionally limited to a capture time range (`from`/`to`,
+ * epoch ms) and one camera (`source`). `before_seq` continues after the previous page, as given by
+ * `nextBeforeSeq`. Entries are copied out a page at a time, so the storage lock is never held while sending.
+ */
 static esp_err_t snapshots_list_handler(httpd_req_t *req)
+{
+    char query[160];
+    char tag[48];
+    char url[128];
+    uint64_t limit = CATFLAPCAM_SNAPSHOT_LIST_LIMIT;
+    uint64_t value = 0;
+    catflapcam_storage_query_t list_query = {
+        .source = -1,
+    };
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        const char *bad = NULL;
+        esp_err_t err = query_get_u64(query, "limit", &limit);
+        if (err == ESP_ERR_INVALID_ARG || limit == 0) {
+            bad = "invalid limit";
+        }
+        if (query_get_u64(query, "before_seq", &list_query.before_seq) == ESP_ERR_INVALID_ARG) {
+            bad = "invalid before_seq";
+        }
+        if ((err = query_get_u64(query, "from", &value)) != ESP_ERR_NOT_FOUND) {
+            list_query.from_ms = (int64_t)value;
+            bad = (err != ESP_OK || value > INT64_MAX) ? "invalid from" : bad;
+        }
+        if ((err = query_get_u64(query, "to", &value)) != ESP_ERR_NOT_FOUND) {
+            list_query.to_ms = (int64_t)value;
+            bad = (err != ESP_OK || value == 0 || value > INT64_MAX) ? "invalid to" : bad;
+        }
+        if ((err = query_get_u64(query, "source", &value)) != ESP_ERR_NOT_FOUND) {
+            list_query.source = (int)value;
+            bad = (err != ESP_OK || value >= CATFLAPCAM_STORAGE_SOURCE_UNKNOWN) ? "invalid source" : bad;
+        }
+        if (bad) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, bad);
+            return ESP_FAIL;
+        }
+    }
+    limit = MIN(limit, CATFLAPCAM_SNAPSHOT_LIST_MAX_LIMIT);
+
+    esp_err_t ret = ESP_OK;
+    json_stream_t *js = malloc(sizeof(json_stream_t));
+    catflapcam_storage_snapshot_info_t *infos = malloc(CATFLAPCAM_SNAPSHOT_LIST_PAGE * sizeof(catflapcam_storage_snapshot_info_t));
+    ESP_GOTO_ON_FALSE(js && infos, ESP_ERR_NO_MEM, out, TAG, "failed to alloc snapshot list buffers");
+    js->req = req;
+    js->err = ESP_OK;
+    js->len = 0;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    json_stream_printf(js, "{\"snapshots\":[");
+
+    size_t sent = 0;
+    uint32_t total = 0;
+    while (sent < limit && js->err == ESP_OK) {
+        size_t n = 0;
+        uint64_t next_seq = 0;
+        if (catflapcam_storage_list_snapshots(&list_query, infos, MIN(CATFLAPCAM_SNAPSHOT_LIST_PAGE, limit - sent), &n, &next_seq,
+                                              &total) != ESP_OK) {
+            list_query.before_seq = 0;
+            break;
+        }
+        for (size_t i = 0; i < n; i++) {
+            json_stream_printf(js, "%s{\"name\":", sent + i ? "," : "");
+            json_stream_string(js, "", infos[i].name);
+            format_snapshot_tag(infos[i].seq, infos[i].size, infos[i].timestamp_ms, tag, sizeof(tag));
+            snprintf(url, sizeof(url), "/snapshots/%s?v=%s", infos[i].name, tag);
+            json_stream_printf(js, ",\"url\":");
+            json_stream_string(js, "", url);
+            json_stream_printf(js, ",\"size\":%" PRIu32 ",\"seq\":%" PRIu64 ",\"timestampMs\":%" PRIi64, infos[i].size,
+                               infos[i].seq, infos[i].timestamp_ms);
+            if (infos[i].source == CATFLAPCAM_STORAGE_SOURCE_UNKNOWN) {
+                json_stream_printf(js, ",\"source\":null}");
+            } else {
+                json_stream_printf(js, ",\"source\":%u}", infos[i].source);
+            }
+        }
+        sent += n;
+        list_query.before_seq = next_seq;
+        if (next_seq == 0) {
+            break;
+        }
+    }
+    if (list_query.before_seq) {
+        json_stream_printf(js, "],\"total\":%" PRIu32 ",\"nextBeforeSeq\":%" PRIu64 "}", total, list_query.before_seq);
+    } else {
+        json_stream_printf(js, "],\"total\":%" PRIu32 ",\"nextBeforeSeq\":null}", total);
+    }
+    json_stream_flush(js);
+    ret = js->err;
+    if (ret == ESP_OK) {
+        ret = httpd_resp_send_chunk(req, NULL, 0);
+    }
+
+out:
+    free(infos);
+    free(js);
+    return ret;
+}
+
+static esp_err_t storage_benchmark_handler(httpd_req_t *req)
 {
     char query[64];
-    char limit_str[16];
-    long limit = 200;
+    char count_str[16];
+    long count = 16;
 
+    if (!catflapcam_storage_is_ready()) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "SD storage unavailable\n");
+        return ESP_FAIL;
+    }
     if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
-        httpd_query_key_value(query, "limit", limit_str, sizeof(limit_str)) == ESP_OK) {
+        httpd_query_key_value(query, "count", count_str, sizeof(count_str)) == ESP_OK) {
         char *endp = NULL;
-        long parsed = strtol(limit_str, &endp, 10);
-        if (endp != limit_str && *endp == '\0' && parsed > 0) {
-            limit = parsed;
+        count = strtol(count_str, &endp, 10);
+        if (endp == count_str || *endp != '\0') {
+            count = 0;
         }
     }
 
-    char *json = catflapcam_storage_list_json((size_t)limit);
-    ESP_RETURN_ON_FALSE(json, ESP_ERR_NO_MEM, TAG, "failed to build snapshots list json");
+    char *json = NULL;
+    esp_err_t err = catflapcam_storage_run_benchmark(count > 0 ? (uint32_t)count : 0, &json);
+    if (err == ESP_ERR_INVALID_ARG) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "count must be 1-64");
+        return ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(err));
+        return ESP_FAIL;
+    }
     httpd_resp_set_type(req, "application/json");
     httpd_resp_set_hdr(req, "Cache-Control", "no-store");
     esp_err_t ret = httpd_resp_sendstr(req, json);
@@ -269,6 +536,187 @@ static esp_err_t snapshots_delete_handler(httpd_req_t *req)
     return ESP_FAIL;
 }
 
+typedef struct delete_progress {
+    json_stream_t js;
+    uint32_t reports;
+} delete_progress_t;
+
+/* Sends each batch's progress as soon as it is done, which also keeps the connection alive on long deletes. */
+static void snapshots_delete_progress(uint32_t deleted, uint32_t remaining, void *arg)
+{
+    delete_progress_t *progress = (delete_progress_t *)arg;
+
+    json_stream_printf(&progress->js, "%s{\"deleted\":%" PRIu32 ",\"remaining\":%" PRIu32 "}", progress->reports++ ? "," : "",
+                       deleted, remaining);
+    json_stream_flush(&progress->js);
+}
+
+/*
+ * Deletes a range of snapshots by seq (`from_seq`/`to_seq`) and/or capture time (`from`/`to`, epoch ms), all
+ * inclusive. At least one bound is required. The response streams one progress entry per storage batch.
+ */
+static esp_err_t snapshots_delete_range_handler(httpd_req_t *req)
+{
+    char query[160];
+    const char *bad = NULL;
+    uint64_t value = 0;
+    int bounds = 0;
+    catflapcam_storage_range_t range = { 0 };
+
+    if (!catflapcam_storage_is_ready()) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, "SD storage unavailable\n");
+    }
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        esp_err_t err;
+        if ((err = query_get_u64(query, "from_seq", &range.from_seq)) != ESP_ERR_NOT_FOUND) {
+            bad = (err != ESP_OK || range.from_seq == 0) ? "invalid from_seq" : bad;
+            bounds++;
+        }
+        if ((err = query_get_u64(query, "to_seq", &range.to_seq)) != ESP_ERR_NOT_FOUND) {
+            bad = (err != ESP_OK || range.to_seq == 0) ? "invalid to_seq" : bad;
+            bounds++;
+        }
+        if ((err = query_get_u64(query, "from", &value)) != ESP_ERR_NOT_FOUND) {
+            range.from_ms = (int64_t)value;
+            bad = (err != ESP_OK || value == 0 || value > INT64_MAX) ? "invalid from" : bad;
+            bounds++;
+        }
+        if ((err = query_get_u64(query, "to", &value)) != ESP_ERR_NOT_FOUND) {
+            range.to_ms = (int64_t)value;
+            bad = (err != ESP_OK || value == 0 || value > INT64_MAX) ? "invalid to" : bad;
+            bounds++;
+        }
+    }
+    if (!bad && bounds == 0) {
+        bad = "no range given";
+    }
+    if (!bad && ((range.to_seq && range.from_seq > range.to_seq) || (range.to_ms && range.from_ms > range.to_ms))) {
+        bad = "empty range";
+    }
+    if (bad) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, bad);
+        return ESP_FAIL;
+    }
+
+    delete_progress_t *progress = calloc(1, sizeof(delete_progress_t));
+    ESP_RETURN_ON_FALSE(progress, ESP_ERR_NO_MEM, TAG, "failed to alloc delete progress");
+    progress->js.req = req;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    json_stream_printf(&progress->js, "{\"progress\":[");
+    json_stream_flush(&progress->js);
+
+    uint32_t deleted = 0;
+    esp_err_t err = catflapcam_storage_delete_range(&range, snapshots_delete_progress, progress, &deleted);
+    if (err == ESP_OK) {
+        json_stream_printf(&progress->js, "],\"deleted\":%" PRIu32 ",\"error\":null}", deleted);
+    } else {
+        json_stream_printf(&progress->js, "],\"deleted\":%" PRIu32 ",\"error\":\"%s\"}", deleted, esp_err_to_name(err));
+    }
+    json_stream_flush(&progress->js);
+
+    esp_err_t ret = progress->js.err;
+    if (ret == ESP_OK) {
+        ret = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    free(progress);
+    return ret;
+}
+
+/* True when If-None-Match is "*" or lists `etag` (a quoted tag; weak tags match too, as RFC 9110 asks). */
+static bool etag_matches(httpd_req_t *req, const char *etag)
+{
+    char value[160];
+
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    return strcmp(value, "*") == 0 || strstr(value, etag) != NULL;
+}
+
+static esp_err_t send_not_modified(httpd_req_t *req, const char *etag, const char *cache_control)
+{
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", cache_control);
+    return httpd_resp_send(req, NULL, 0);
+}
+
+/*
+ * Reads a single byte range ("bytes=a-b", "bytes=a-" or "bytes=-n") for a body of `size` bytes. ESP_ERR_NOT_FOUND
+ * means the whole body is sent: no Range, an If-Range for another version, several ranges or one that does not
+ * parse. ESP_ERR_INVALID_SIZE means the range lies past the end.
+ */
+static esp_err_t parse_range(httpd_req_t *req, const char *etag, uint32_t size, uint32_t *start, uint32_t *end)
+{
+    char value[64];
+    char *endp = NULL;
+
+    if (httpd_req_get_hdr_value_str(req, "Range", value, sizeof(value)) != ESP_OK || strncmp(value, "bytes=", 6) != 0 ||
+        strchr(value, ',')) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (httpd_req_get_hdr_value_len(req, "If-Range") > 0) {
+        char if_range[64];
+        if (httpd_req_get_hdr_value_str(req, "If-Range", if_range, sizeof(if_range)) != ESP_OK || strcmp(if_range, etag) != 0) {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+
+    const char *spec = value + 6;
+    if (*spec == '-') {
+        uint64_t suffix = strtoull(spec + 1, &endp, 10);
+        if (endp == spec + 1 || *endp != '\0') {
+            return ESP_ERR_NOT_FOUND;
+        }
+        if (suffix == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+        *start = suffix < size ? size - (uint32_t)suffix : 0;
+        *end = size - 1;
+        return ESP_OK;
+    }
+
+    uint64_t first = strtoull(spec, &endp, 10);
+    if (endp == spec || *endp != '-') {
+        return ESP_ERR_NOT_FOUND;
+    }
+    uint64_t last = size - 1;
+    const char *last_str = endp + 1;
+    if (*last_str != '\0') {
+        last = strtoull(last_str, &endp, 10);
+        if (endp == last_str || *endp != '\0' || last < first) {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+    if (first >= size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    *start = (uint32_t)first;
+    *end = (uint32_t)MIN(last, (uint64_t)size - 1);
+    return ESP_OK;
+}
+
+/* httpd_send() may take only part of the data; a failure leaves the connection to be closed by the server. */
+static esp_err_t send_raw(httpd_req_t *req, const char *data, size_t len)
+{
+    while (len > 0) {
+        int n = httpd_send(req, data, len);
+        if (n <= 0) {
+            return ESP_FAIL;
+        }
+        data += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+/*
+ * Snapshots never change once written. The URLs the listing hands out carry the snapshot's version (`v`), so
+ * they are cached for good; a bare name may be reused by a later snapshot and is revalidated by its ETag.
+ */
 static esp_err_t snapshot_file_handler(httpd_req_t *req)
 {
     if (!catflapcam_storage_is_ready()) {
@@ -283,49 +731,93 @@ static esp_err_t snapshot_file_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    char path[128];
-    if (catflapcam_storage_resolve_snapshot_path(name, path, sizeof(path)) != ESP_OK) {
+    catflapcam_storage_snapshot_loc_t loc;
+    if (catflapcam_storage_locate_snapshot(name, &loc) != ESP_OK) {
         httpd_resp_send_404(req);
         return ESP_FAIL;
     }
 
-    struct stat st;
-    if (stat(path, &st) != 0 || st.st_size <= 0) {
+    char tag[48];
+    char etag[52];
+    char query[80];
+    char version[48];
+    format_snapshot_tag(loc.seq, loc.size, loc.timestamp_ms, tag, sizeof(tag));
+    snprintf(etag, sizeof(etag), "\"%s\"", tag);
+    bool versioned = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+                     httpd_query_key_value(query, "v", version, sizeof(version)) == ESP_OK && strcmp(version, tag) == 0;
+    const char *cache_control = versioned ? "public, max-age=31536000, immutable" : "no-cache";
+    if (etag_matches(req, etag)) {
+        return send_not_modified(req, etag, cache_control);
+    }
+
+    uint32_t start = 0;
+    uint32_t end = loc.size - 1;
+    esp_err_t range = parse_range(req, etag, loc.size, &start, &end);
+    if (range == ESP_ERR_INVALID_SIZE) {
+        char range_str[48];
+        snprintf(range_str, sizeof(range_str), "bytes */%" PRIu32, loc.size);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        httpd_resp_set_hdr(req, "Content-Range", range_str);
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    FILE *fp = fopen(loc.path, "rb");
+    if (!fp && errno == ENOENT) {
         httpd_resp_send_404(req);
         return ESP_FAIL;
     }
-
-    FILE *fp = fopen(path, "rb");
-    if (!fp) {
-        ESP_LOGW(TAG, "failed to open snapshot '%s': errno=%d", path, errno);
+    if (!fp || fseek(fp, loc.offset + start, SEEK_SET) != 0) {
+        ESP_LOGW(TAG, "failed to open snapshot '%s': errno=%d", loc.path, errno);
+        if (fp) {
+            fclose(fp);
+        }
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "failed to open snapshot");
         return ESP_FAIL;
     }
 
-    char len_str[24];
-    snprintf(len_str, sizeof(len_str), "%lld", (long long)st.st_size);
-    httpd_resp_set_type(req, "image/jpeg");
-    httpd_resp_set_hdr(req, "Content-Length", len_str);
-    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
-
-    esp_err_t ret = ESP_OK;
-    char buf[2048];
-    while (!feof(fp)) {
-        size_t n = fread(buf, 1, sizeof(buf), fp);
+    /*
+     * httpd_resp_send() wants the whole body in memory and httpd_resp_send_chunk() adds chunked encoding, so the
+     * head with Content-Length is formatted here and the range follows raw, one buffer at a time.
+     */
+    char buf[CATFLAPCAM_SNAPSHOT_SEND_BUF_SIZE];
+    char range_hdr[80] = "";
+    uint32_t remaining = end - start + 1;
+    if (range == ESP_OK) {
+        snprintf(range_hdr, sizeof(range_hdr), "Content-Range: bytes %" PRIu32 "-%" PRIu32 "/%" PRIu32 "\r\n", start, end, loc.size);
+    }
+    int head_len = snprintf(buf, sizeof(buf),
+                            "HTTP/1.1 %s\r\nContent-Type: image/jpeg\r\nContent-Length: %" PRIu32 "\r\n%s"
+                            "Accept-Ranges: bytes\r\nETag: %s\r\nCache-Control: %s\r\n\r\n",
+                            range == ESP_OK ? "206 Partial Content" : "200 OK", remaining, range_hdr, etag, cache_control);
+    esp_err_t ret = (head_len > 0 && (size_t)head_len < sizeof(buf)) ? send_raw(req, buf, head_len) : ESP_FAIL;
+    while (ret == ESP_OK && remaining > 0) {
+        size_t n = fread(buf, 1, MIN(sizeof(buf), remaining), fp);
         if (n == 0) {
+            ESP_LOGW(TAG, "failed to read snapshot '%s': errno=%d", loc.path, errno);
+            ret = ESP_FAIL;
             break;
         }
-        ret = httpd_resp_send_chunk(req, buf, n);
-        if (ret != ESP_OK) {
-            break;
-        }
+        ret = send_raw(req, buf, n);
+        remaining -= n;
     }
     fclose(fp);
+    return ret;
+}
 
-    if (ret == ESP_OK) {
-        ret = httpd_resp_send_chunk(req, NULL, 0);
+/*
+ * The embedded UI files are served as built, gzip-compressed. Their names are not versioned, so browsers
+ * revalidate them; the ETag is a content hash that CMake computes at build time.
+ */
+static esp_err_t send_static_file(httpd_req_t *req, const char *type, const uint8_t *start, const uint8_t *end, const char *etag)
+{
+    if (etag_matches(req, etag)) {
+        return send_not_modified(req, etag, "no-cache");
     }
-    return ret;
+    httpd_resp_set_type(req, type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    return httpd_resp_send(req, (const char *)start, end - start);
 }
 
 static esp_err_t static_file_handler(httpd_req_t *req)
@@ -333,29 +825,20 @@ static esp_err_t static_file_handler(httpd_req_t *req)
     const char *uri = req->uri;
 
     if (strcmp(uri, "/") == 0) {
-        httpd_resp_set_type(req, "text/html");
-        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-        return httpd_resp_send(req, (const char *)index_html_gz_start, index_html_gz_end - index_html_gz_start);
+        return send_static_file(req, "text/html", index_html_gz_start, index_html_gz_end, "\"" CATFLAPCAM_ETAG_INDEX_HTML "\"");
     }
     if (strcmp(uri, "/loading.jpg") == 0) {
-        httpd_resp_set_type(req, "image/jpeg");
-        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-        return httpd_resp_send(req, (const char *)loading_jpg_gz_start, loading_jpg_gz_end - loading_jpg_gz_start);
+        return send_static_file(req, "image/jpeg", loading_jpg_gz_start, loading_jpg_gz_end, "\"" CATFLAPCAM_ETAG_LOADING_JPG "\"");
     }
     if (strcmp(uri, "/favicon.ico") == 0) {
-        httpd_resp_set_type(req, "image/x-icon");
-        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-        return httpd_resp_send(req, (const char *)favicon_ico_gz_start, favicon_ico_gz_end - favicon_ico_gz_start);
+        return send_static_file(req, "image/x-icon", favicon_ico_gz_start, favicon_ico_gz_end, "\"" CATFLAPCAM_ETAG_FAVICON_ICO "\"");
     }
     if (strcmp(uri, "/assets/index.js") == 0) {
-        httpd_resp_set_type(req, "application/javascript");
-        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-        return httpd_resp_send(req, (const char *)assets_index_js_gz_start, assets_index_js_gz_end - assets_index_js_gz_start);
+        return send_static_file(req, "application/javascript", assets_index_js_gz_start, assets_index_js_gz_end,
+                                "\"" CATFLAPCAM_ETAG_INDEX_JS "\"");
     }
     if (strcmp(uri, "/assets/index.css") == 0) {
-        httpd_resp_set_type(req, "text/css");
-        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
-        return httpd_resp_send(req, (const char *)assets_index_css_gz_start, assets_index_css_gz_end - assets_index_css_gz_start);
+        return send_static_file(req, "text/css", assets_index_css_gz_start, assets_index_css_gz_end, "\"" CATFLAPCAM_ETAG_INDEX_CSS "\"");
     }
 
     ESP_LOGW(TAG, "File not found: %s", uri);
@@ -363,132 +846,147 @@ static esp_err_t static_file_handler(httpd_req_t *req)
     return ESP_FAIL;
 }
 
+/* Checks a /stream request and hands its connection to the stream task, which sends the frames from then on. */
 static esp_err_t image_stream_handler(httpd_req_t *req)
 {
-    esp_err_t ret;
-    struct v4l2_buffer buf;
-    char http_string[128];
-    bool enc_locked = false;
-    bool io_locked = false;
-    uint32_t dropped_frames = 0;
-    TickType_t last_send_tick = 0;
-    catflapcam_webcam_video_t *video = (catflapcam_webcam_video_t *)req->user_ctx;
-
-    ESP_RETURN_ON_FALSE(snprintf(http_string, sizeof(http_string), "%" PRIu32, video->frame_rate) > 0, ESP_FAIL, TAG, "failed to format framerate buffer");
-    ESP_RETURN_ON_ERROR(httpd_resp_set_type(req, STREAM_CONTENT_TYPE), TAG, "failed to set content type");
-    ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*"), TAG, "failed to set access control allow origin");
-    ESP_RETURN_ON_ERROR(httpd_resp_set_hdr(req, "X-Framerate", http_string), TAG, "failed to set x framerate");
-
-    while (1) {
-        int hlen;
-        struct timespec ts;
-        uint32_t jpeg_encoded_size;
-
-        enc_locked = false;
-        io_locked = false;
-        if (video->capture_priority_active) {
-            vTaskDelay(pdMS_TO_TICKS(5));
-            continue;
-        }
-        if (xSemaphoreTake(video->io_mutex, pdMS_TO_TICKS(CATFLAPCAM_STREAM_IO_WAIT_MS)) != pdPASS) {
-            vTaskDelay(pdMS_TO_TICKS(1));
-            continue;
+    catflapcam_webcam_t *web_cam = (catflapcam_webcam_t *)req->user_ctx;
+    request_desc_t desc = {
+        .index = 0,
+    };
+    char query[96] = {0};
+    char value[8];
+    catflapcam_stream_options_t options = {0};
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_ERR_HTTPD_RESULT_TRUNC) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "query too long");
+    }
+    if (httpd_query_key_value(query, "source", value, sizeof(value)) != ESP_ERR_NOT_FOUND && decode_source(web_cam, query, &desc) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid source");
+    }
+    if (httpd_query_key_value(query, "latest", value, sizeof(value)) == ESP_OK) {
+        options.latest = strcmp(value, "1") == 0;
+    }
+    if (httpd_query_key_value(query, "roi", value, sizeof(value)) == ESP_OK) {
+        options.roi = strcmp(value, "1") == 0;
+    }
+    if (httpd_query_key_value(query, "fps", value, sizeof(value)) == ESP_OK) {
+        char *endp;
+        long fps = strtol(value, &endp, 10);
+        if (endp == value || *endp != '\0' || fps < 1 || fps > CATFLAPCAM_STREAM_MAX_FPS) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid fps");
         }
-        io_locked = true;
-        memset(&buf, 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        ESP_GOTO_ON_ERROR(ioctl(video->fd, VIDIOC_DQBUF, &buf), fail0, TAG, "failed to receive video frame");
-        if (!(buf.flags & V4L2_BUF_FLAG_DONE)) {
-            ESP_GOTO_ON_ERROR(ioctl(video->fd, VIDIOC_QBUF, &buf), fail0, TAG, "failed to queue video frame");
-            xSemaphoreGive(video->io_mutex);
-            io_locked = false;
-            continue;
+        options.fps = (uint32_t)fps;
+    }
+    if (httpd_query_key_value(query, "kbps", value, sizeof(value)) == ESP_OK) {
+        char *endp;
+        long kbps = strtol(value, &endp, 10);
+        if (endp == value || *endp != '\0' || kbps < 1 || kbps > CATFLAPCAM_STREAM_MAX_KBPS) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid kbps");
         }
+        options.kbps = (uint32_t)kbps;
+    }
+    catflapcam_webcam_video_t *video = &web_cam->video[desc.index];
+    if (!catflapcam_webcam_is_valid_video(video)) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
 
-        if (video->pixel_format == V4L2_PIX_FMT_JPEG) {
-            jpeg_encoded_size = buf.bytesused;
-            ESP_GOTO_ON_FALSE(jpeg_encoded_size > 0, ESP_ERR_INVALID_SIZE, fail0, TAG, "invalid jpeg frame size");
-            ESP_GOTO_ON_FALSE(video->stream_out_buf || (video->stream_out_buf = malloc(jpeg_encoded_size)),
-                              ESP_ERR_NO_MEM, fail0, TAG, "failed to alloc stream output buffer");
-            if (video->stream_out_size < jpeg_encoded_size) {
-                uint8_t *new_buf = realloc(video->stream_out_buf, jpeg_encoded_size);
-                ESP_GOTO_ON_FALSE(new_buf, ESP_ERR_NO_MEM, fail0, TAG, "failed to realloc stream output buffer");
-                video->stream_out_buf = new_buf;
-                video->stream_out_size = jpeg_encoded_size;
-            }
-            memcpy(video->stream_out_buf, video->buffer[buf.index], jpeg_encoded_size);
-        } else {
-            if (xSemaphoreTake(video->sem, pdMS_TO_TICKS(CATFLAPCAM_STREAM_ENC_WAIT_MS)) != pdPASS) {
-                dropped_frames++;
-                if ((dropped_frames % 30) == 0) {
-                    ESP_LOGW(TAG, "stream source=%d dropped_frames=%" PRIu32 " due to encoder contention", video->index, dropped_frames);
-                }
-                ESP_GOTO_ON_ERROR(ioctl(video->fd, VIDIOC_QBUF, &buf), fail0, TAG, "failed to queue video frame");
-                xSemaphoreGive(video->io_mutex);
-                io_locked = false;
-                vTaskDelay(pdMS_TO_TICKS(1));
-                continue;
-            }
-            enc_locked = true;
-            ESP_GOTO_ON_FALSE(video->stream_out_buf && video->stream_out_size > 0, ESP_ERR_NO_MEM, fail0, TAG, "stream output buffer not initialized");
-            ESP_GOTO_ON_ERROR(catflapcam_encoder_process(video->encoder_handle, video->buffer[buf.index], video->buffer_size,
-                              video->stream_out_buf, video->stream_out_size, &jpeg_encoded_size), fail0, TAG, "failed to encode video frame");
-        }
-
-        ESP_GOTO_ON_ERROR(ioctl(video->fd, VIDIOC_QBUF, &buf), fail0, TAG, "failed to queue video frame");
-        memset(&buf, 0, sizeof(buf));
-        if (enc_locked) {
-            xSemaphoreGive(video->sem);
-            enc_locked = false;
-        }
-        xSemaphoreGive(video->io_mutex);
-        io_locked = false;
-
-        ESP_GOTO_ON_ERROR(httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY)), fail0, TAG, "failed to send boundary");
-        ESP_GOTO_ON_ERROR(clock_gettime(CLOCK_MONOTONIC, &ts), fail0, TAG, "failed to get time");
-        ESP_GOTO_ON_FALSE((hlen = snprintf(http_string, sizeof(http_string), STREAM_PART, jpeg_encoded_size, (long)ts.tv_sec, (long)ts.tv_nsec)) > 0,
-                          ESP_FAIL, fail0, TAG, "failed to format part buffer");
-        ESP_GOTO_ON_ERROR(httpd_resp_send_chunk(req, http_string, hlen), fail0, TAG, "failed to send boundary");
-        ESP_GOTO_ON_ERROR(httpd_resp_send_chunk(req, (char *)video->stream_out_buf, jpeg_encoded_size), fail0, TAG, "failed to send jpeg");
-
-        if (CATFLAPCAM_STREAM_FRAME_INTERVAL_MS > 0) {
-            TickType_t now = xTaskGetTickCount();
-            if (last_send_tick != 0) {
-                TickType_t frame_ticks = pdMS_TO_TICKS(CATFLAPCAM_STREAM_FRAME_INTERVAL_MS);
-                TickType_t elapsed = now - last_send_tick;
-                if (elapsed < frame_ticks) {
-                    vTaskDelay(frame_ticks - elapsed);
-                }
-            }
-            last_send_tick = xTaskGetTickCount();
+    /* w or h asks for a downscaled variant; a missing side keeps the aspect ratio. */
+    uint64_t width = 0;
+    uint64_t height = 0;
+    uint64_t quality = CATFLAPCAM_JPEG_ENC_QUALITY;
+    if (query_get_u64(query, "w", &width) == ESP_ERR_INVALID_ARG || query_get_u64(query, "h", &height) == ESP_ERR_INVALID_ARG) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid size");
+    }
+    if (query_get_u64(query, "q", &quality) == ESP_ERR_INVALID_ARG || quality < 1 || quality > 100) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid q");
+    }
+    if (width > 0 || height > 0) {
+        if (width == 0) {
+            width = MIN(height, video->height) * video->width / video->height;
+        } else if (height == 0) {
+            height = MIN(width, video->width) * video->height / video->width;
+        }
+        width = MIN(width, video->width) / CATFLAPCAM_STREAM_VARIANT_ALIGN * CATFLAPCAM_STREAM_VARIANT_ALIGN;
+        height = MIN(height, video->height) / CATFLAPCAM_STREAM_VARIANT_ALIGN * CATFLAPCAM_STREAM_VARIANT_ALIGN;
+        if (width == 0 || height == 0) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid size");
+        }
+        if (options.roi) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "roi cannot be combined with w or h");
+        }
+        if (width < video->width || height < video->height) {
+            options.width = (uint32_t)width;
+            options.height = (uint32_t)height;
+            options.quality = (uint8_t)quality;
         }
     }
 
-    return ESP_OK;
-
-fail0:
-    if (enc_locked) {
-        xSemaphoreGive(video->sem);
+    esp_err_t err = catflapcam_stream_attach(req, video, &options);
+    if (err == ESP_ERR_NOT_SUPPORTED) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, options.roi ? "roi stream not supported for this source" :
+                                   "stream variants not supported for this source");
     }
-    if (io_locked) {
-        ioctl(video->fd, VIDIOC_QBUF, &buf);
-        xSemaphoreGive(video->io_mutex);
+    if (err == ESP_ERR_INVALID_ARG) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid size");
     }
-    return ret;
+    if (err == ESP_ERR_NO_MEM) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        return httpd_resp_sendstr(req, options.width ? "Too many stream clients or sizes\n" : "Too many stream clients\n");
+    }
+    if (err != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "failed to start stream");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
 }
 
 static esp_err_t capture_image_handler(httpd_req_t *req)
 {
     catflapcam_webcam_t *web_cam = (catflapcam_webcam_t *)req->user_ctx;
     request_desc_t desc;
+    char query[64] = {0};
+    char value[8];
+    long burst = 1;
+    long interval_ms = 0;
+    bool with_preroll = false;
     ESP_RETURN_ON_ERROR(decode_request(web_cam, req, &desc), TAG, "failed to decode request");
 
-    esp_err_t err = catflapcam_webcam_capture_snapshot(&web_cam->video[desc.index]);
+    httpd_req_get_url_query_str(req, query, sizeof(query));
+    if (httpd_query_key_value(query, "preroll", value, sizeof(value)) == ESP_OK) {
+        with_preroll = strcmp(value, "1") == 0;
+    }
+    if (httpd_query_key_value(query, "burst", value, sizeof(value)) == ESP_OK) {
+        char *endp = NULL;
+        burst = strtol(value, &endp, 10);
+        if (endp == value || *endp != '\0' || burst < 1 || burst > CATFLAPCAM_BURST_MAX_FRAMES) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid burst");
+        }
+    }
+    if (httpd_query_key_value(query, "interval_ms", value, sizeof(value)) == ESP_OK) {
+        char *endp = NULL;
+        interval_ms = strtol(value, &endp, 10);
+        if (endp == value || *endp != '\0' || interval_ms < 0 || interval_ms > CATFLAPCAM_BURST_MAX_INTERVAL_MS) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "invalid interval_ms");
+        }
+    }
+
+    esp_err_t err;
+    uint32_t saved = 0;
+    if (burst > 1) {
+        err = catflapcam_webcam_capture_burst(&web_cam->video[desc.index], (uint32_t)burst, (uint32_t)interval_ms, &saved);
+    } else {
+        err = catflapcam_webcam_capture_snapshot(&web_cam->video[desc.index], with_preroll);
+    }
     httpd_resp_set_hdr(req, "Cache-Control", "no-store");
     httpd_resp_set_hdr(req, "Content-Disposition", "inline");
     httpd_resp_set_type(req, "text/plain");
 
+    if (err == ESP_OK && burst > 1) {
+        char body[24];
+        int len = snprintf(body, sizeof(body), "OK %" PRIu32 "\n", saved);
+        return httpd_resp_send(req, body, len);
+    }
     if (err == ESP_OK) {
         return httpd_resp_send(req, "OK\n", 3);
     }
@@ -505,6 +1003,7 @@ esp_err_t catflapcam_http_server_start(catflapcam_webcam_t *web_cam)
     config.send_wait_timeout = CATFLAPCAM_HTTP_SEND_TIMEOUT_S;
     config.recv_wait_timeout = CATFLAPCAM_HTTP_SEND_TIMEOUT_S;
     config.lru_purge_enable = true;
+    config.max_uri_handlers = CATFLAPCAM_HTTP_MAX_URI_HANDLERS;
 
     httpd_uri_t static_file_uri = {
         .uri = "/*",
@@ -530,6 +1029,18 @@ esp_err_t catflapcam_http_server_start(catflapcam_webcam_t *web_cam)
         .handler = camera_info_handler,
         .user_ctx = (void *)web_cam,
     };
+    httpd_uri_t roi_get_uri = {
+        .uri = "/api/roi",
+        .method = HTTP_GET,
+        .handler = roi_handler,
+        .user_ctx = (void *)web_cam,
+    };
+    httpd_uri_t roi_set_uri = {
+        .uri = "/api/roi",
+        .method = HTTP_POST,
+        .handler = roi_handler,
+        .user_ctx = (void *)web_cam,
+    };
     httpd_uri_t snapshots_page_uri = {
         .uri = "/snapshots",
         .method = HTTP_GET,
@@ -548,42 +1059,57 @@ esp_err_t catflapcam_http_server_start(catflapcam_webcam_t *web_cam)
         .handler = snapshots_delete_handler,
         .user_ctx = NULL,
     };
+    httpd_uri_t snapshots_delete_range_uri = {
+        .uri = "/api/snapshots",
+        .method = HTTP_DELETE,
+        .handler = snapshots_delete_range_handler,
+        .user_ctx = NULL,
+    };
     httpd_uri_t snapshots_file_uri = {
         .uri = "/snapshots/*",
         .method = HTTP_GET,
         .handler = snapshot_file_handler,
         .user_ctx = NULL,
     };
+    httpd_uri_t storage_benchmark_uri = {
+        .uri = "/api/storage/benchmark",
+        .method = HTTP_GET,
+        .handler = storage_benchmark_handler,
+        .user_ctx = NULL,
+    };
     config.stack_size = CATFLAPCAM_STREAM_SERVER_STACK_SIZE;
     ESP_LOGI(TAG, "Starting stream server on port: '%d'", config.server_port);
     ESP_RETURN_ON_ERROR(httpd_start(&stream_httpd, &config), TAG, "failed to start control http server");
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &capture_image_uri), TAG, "failed to register capture handler");
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &ota_update_uri), TAG, "failed to register OTA handler");
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &camera_info_uri), TAG, "failed to register camera info handler");
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &roi_get_uri), TAG, "failed to register roi handler");
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &roi_set_uri), TAG, "failed to register roi handler");
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &snapshots_page_uri), TAG, "failed to register snapshots page handler");
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &snapshots_list_uri), TAG, "failed to register snapshots list handler");
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &snapshots_delete_uri), TAG, "failed to register snapshots delete handler");
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &snapshots_delete_range_uri), TAG,
+                        "failed to register snapshots range delete handler");
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &snapshots_file_uri), TAG, "failed to register snapshots file handler");
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &storage_benchmark_uri), TAG, "failed to register storage benchmark handler");
     ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &static_file_uri), TAG, "failed to register static file handler");
 
-    for (int i = 0; i < web_cam->video_count; i++) {
-        if (!catflapcam_webcam_is_valid_video(&web_cam->video[i])) {
-            continue;
-        }
-
-        httpd_uri_t stream_uri = {
-            .uri = "/stream",
-            .method = HTTP_GET,
-            .handler = image_stream_handler,
-            .user_ctx = (void *)&web_cam->video[i],
-        };
-
-        config.stack_size = CATFLAPCAM_STREAM_SERVER_STACK_SIZE;
-        config.server_port += 1;
-        config.ctrl_port += 1;
-        ESP_RETURN_ON_ERROR(httpd_start(&stream_httpd, &config), TAG, "failed to start stream http server for source=%d", i);
-        ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &stream_uri), TAG, "failed to register stream handler for source=%d", i);
-    }
+    /* One server on the next port takes the /stream requests of all cameras and hands them to the stream task. */
+    httpd_uri_t stream_uri = {
+        .uri = "/stream",
+        .method = HTTP_GET,
+        .handler = image_stream_handler,
+        .user_ctx = (void *)web_cam,
+    };
+    /* The handler only parses the query and queues the client; stream variants are built on the encode task. */
+    config.stack_size = CATFLAPCAM_STREAM_ACCEPT_STACK_SIZE;
+    config.server_port += 1;
+    config.ctrl_port += 1;
+    config.max_open_sockets = CATFLAPCAM_STREAM_MAX_CLIENTS + 1;
+    config.lru_purge_enable = false;
+    ESP_RETURN_ON_ERROR(catflapcam_stream_start(), TAG, "failed to start stream task");
+    ESP_RETURN_ON_ERROR(httpd_start(&stream_httpd, &config), TAG, "failed to start stream http server");
+    ESP_RETURN_ON_ERROR(httpd_register_uri_handler(stream_httpd, &stream_uri), TAG, "failed to register stream handler");
 
     return ESP_OK;
 }
@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: 2024-2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_jpeg_dec.h"
+#include "catflapcam_jpeg_scaler.h"
+#include "main.h"
+
+#define JPEG_SCALER_MAX_SHIFT 3 /* the decoder scales down by at most 1/8 */
+#define JPEG_SCALER_ALIGN_DOWN_8(x) ((x) & ~7U)
+
+typedef struct catflapcam_jpeg_scaler {
+    catflapcam_jpeg_scaler_config_t config;
+    jpeg_dec_handle_t dec;
+    uint32_t dec_width;
+    uint32_t dec_height;
+    uint8_t *dec_buf;
+    uint32_t dec_buf_size;
+    catflapcam_resize_handle_t resize;
+} catflapcam_jpeg_scaler_t;
+
+/*
+ * Picks the strongest power-of-two reduction that still leaves the cropped area at least at the destination
+ * size, so the resize pass only ever shrinks by less than 2x. The decoder requires scaled sizes to be
+ * multiples of 8.
+ */
+static void pick_decode_size(const catflapcam_jpeg_scaler_config_t *config, uint32_t crop_width, uint32_t crop_height,
+                             uint32_t *width, uint32_t *height)
+{
+    *width = config->src_width;
+    *height = config->src_height;
+
+    for (int shift = JPEG_SCALER_MAX_SHIFT; shift > 0; shift--) {
+        uint32_t w = JPEG_SCALER_ALIGN_DOWN_8(config->src_width >> shift);
+        uint32_t h = JPEG_SCALER_ALIGN_DOWN_8(config->src_height >> shift);
+        if (w * crop_width >= config->dst_width * config->src_width && h * crop_height >= config->dst_height * config->src_height) {
+            *width = w;
+            *height = h;
+            return;
+        }
+    }
+}
+
+esp_err_t catflapcam_jpeg_scaler_new(const catflapcam_jpeg_scaler_config_t *config, catflapcam_jpeg_scaler_handle_t *ret_scaler)
+{
+    esp_err_t ret = ESP_OK;
+    jpeg_dec_config_t dec_config = DEFAULT_JPEG_DEC_CONFIG();
+
+    ESP_RETURN_ON_FALSE(config && ret_scaler && config->src_width && config->src_height && config->dst_width && config->dst_height,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid jpeg scaler config");
+
+    bool cropped = config->crop_width && config->crop_height;
+    ESP_RETURN_ON_FALSE(!cropped || (config->crop_x + config->crop_width <= config->src_width &&
+                                     config->crop_y + config->crop_height <= config->src_height),
+                        ESP_ERR_INVALID_ARG, TAG, "crop outside source frame");
+    uint32_t crop_width = cropped ? config->crop_width : config->src_width;
+    uint32_t crop_height = cropped ? config->crop_height : config->src_height;
+
+    catflapcam_jpeg_scaler_t *scaler = calloc(1, sizeof(catflapcam_jpeg_scaler_t));
+    ESP_RETURN_ON_FALSE(scaler, ESP_ERR_NO_MEM, TAG, "failed to alloc jpeg scaler");
+    scaler->config = *config;
+
+    pick_decode_size(config, crop_width, crop_height, &scaler->dec_width, &scaler->dec_height);
+    dec_config.output_type = JPEG_PIXEL_FORMAT_RGB565_LE;
+    if (scaler->dec_width != config->src_width || scaler->dec_height != config->src_height) {
+        dec_config.scale.width = scaler->dec_width;
+        dec_config.scale.height = scaler->dec_height;
+    }
+    ESP_GOTO_ON_FALSE(jpeg_dec_open(&dec_config, &scaler->dec) == JPEG_ERR_OK, ESP_FAIL, fail, TAG, "failed to open jpeg decoder");
+
+    scaler->dec_buf_size = scaler->dec_width * scaler->dec_height * 2;
+    scaler->dec_buf = jpeg_calloc_align(scaler->dec_buf_size, 16);
+    ESP_GOTO_ON_FALSE(scaler->dec_buf, ESP_ERR_NO_MEM, fail, TAG, "failed to alloc jpeg decode buffer");
+
+    catflapcam_resize_config_t resize_config = {
+        .pixel_format = CATFLAPCAM_JPEG_SCALER_PIXEL_FORMAT,
+        .mode = config->mode,
+        .src_width = scaler->dec_width,
+        .src_height = scaler->dec_height,
+        .dst_width = config->dst_width,
+        .dst_height = config->dst_height,
+    };
+    if (cropped) {
+        /* The crop is applied by the resize pass, in decoded coordinates. */
+        resize_config.crop_x = config->crop_x * scaler->dec_width / config->src_width;
+        resize_config.crop_y = config->crop_y * scaler->dec_height / config->src_height;
+        resize_config.crop_width = MAX(1, crop_width * scaler->dec_width / config->src_width);
+        resize_config.crop_height = MAX(1, crop_height * scaler->dec_height / config->src_height);
+        resize_config.crop_width = MIN(resize_config.crop_width, scaler->dec_width - resize_config.crop_x);
+        resize_config.crop_height = MIN(resize_config.crop_height, scaler->dec_height - resize_config.crop_y);
+    }
+    ESP_GOTO_ON_ERROR(catflapcam_resize_new(&resize_config, &scaler->resize), fail, TAG, "failed to create jpeg scaler resize plan");
+
+    ESP_LOGI(TAG, "jpeg scaler: %" PRIu32 "x%" PRIu32 " decoded at %" PRIu32 "x%" PRIu32 ", resized to %" PRIu32 "x%" PRIu32,
+             config->src_width, config->src_height, scaler->dec_width, scaler->dec_height, config->dst_width, config->dst_height);
+    *ret_scaler = scaler;
+    return ESP_OK;
+
+fail:
+    catflapcam_jpeg_scaler_free(scaler);
+    return ret;
+}
+
+void catflapcam_jpeg_scaler_free(catflapcam_jpeg_scaler_handle_t scaler)
+{
+    if (!scaler) {
+        return;
+    }
+    if (scaler->resize) {
+        catflapcam_resize_free(scaler->resize);
+    }
+    if (scaler->dec_buf) {
+        jpeg_free_align(scaler->dec_buf);
+    }
+    if (scaler->dec) {
+        jpeg_dec_close(scaler->dec);
+    }
+    free(scaler);
+}
+
+esp_err_t catflapcam_jpeg_scaler_process(catflapcam_jpeg_scaler_handle_t scaler, const uint8_t *jpeg, uint32_t jpeg_size,
+                                         uint8_t *dst, uint32_t dst_size, uint32_t *ret_size)
+{
+    jpeg_dec_header_info_t info = {0};
+    int out_len = 0;
+    jpeg_dec_io_t io = {0};
+
+    ESP_RETURN_ON_FALSE(scaler && jpeg && jpeg_size && dst && ret_size, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    io.inbuf = (uint8_t *)jpeg;
+    io.inbuf_len = jpeg_size;
+    io.outbuf = scaler->dec_buf;
+    ESP_RETURN_ON_FALSE(jpeg_dec_parse_header(scaler->dec, &io, &info) == JPEG_ERR_OK, ESP_ERR_INVALID_RESPONSE, TAG, "failed to parse jpeg header");
+    ESP_RETURN_ON_FALSE(info.width == scaler->config.src_width && info.height == scaler->config.src_height, ESP_ERR_INVALID_SIZE, TAG,
+                        "unexpected jpeg size %ux%u", info.width, info.height);
+    ESP_RETURN_ON_FALSE(jpeg_dec_get_outbuf_len(scaler->dec, &out_len) == JPEG_ERR_OK && out_len > 0 && (uint32_t)out_len <= scaler->dec_buf_size,
+                        ESP_ERR_INVALID_SIZE, TAG, "jpeg decode buffer too small");
+    ESP_RETURN_ON_FALSE(jpeg_dec_process(scaler->dec, &io) == JPEG_ERR_OK, ESP_FAIL, TAG, "failed to decode jpeg frame");
+
+    return catflapcam_resize_process(scaler->resize, scaler->dec_buf, out_len, dst, dst_size, ret_size);
+}
@@ -0,0 +1,412 @@
+/*
+ * SPDX-FileCopyrightText: 2024-2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "linux/videodev2.h"
+#include "catflapcam_resize.h"
+#include "main.h"
+
+#define RESIZE_MAX_PLANES 3
+
+/*
+ * Resizing is separable: a vertical pass blends the contributing source rows into a Q8 row buffer, then a
+ * horizontal pass gathers each destination sample through the per-column tables. Both passes work on
+ * interleaved bytes, so every sample is independent and the inner loops stay branch-free.
+ */
+typedef struct resize_axis {
+    uint32_t *pos0;     /* first source sample (row index, or byte offset for columns) */
+    uint32_t *pos1;     /* bilinear: second sample; area: one past the last sample */
+    uint16_t *weight;   /* bilinear: Q8 weight of pos1 */
+    uint32_t *recip;    /* area: Q16 reciprocal of the box size */
+} resize_axis_t;
+
+typedef struct resize_plane {
+    const resize_axis_t *cols;
+    uint32_t count;     /* destination samples in this plane per row */
+    uint32_t offset;    /* byte offset of the plane inside a pixel group */
+    uint32_t step;      /* bytes between consecutive samples, identical for source and destination rows */
+    uint32_t size;      /* bytes copied per sample, more than one only when nearest gathers whole pixels */
+} resize_plane_t;
+
+typedef struct catflapcam_resize {
+    catflapcam_resize_config_t config;
+    uint32_t crop_x;
+    uint32_t crop_y;
+    uint32_t crop_width;
+    uint32_t crop_height;
+    int bpp;
+    bool expand_rgb565;
+    uint32_t row_bytes;
+    resize_axis_t rows;
+    resize_axis_t cols[2];
+    resize_plane_t planes[RESIZE_MAX_PLANES];
+    int plane_count;
+    uint16_t *vrow;
+    uint32_t *acc;
+    uint8_t *expand[2];
+    uint8_t *out_row;
+} catflapcam_resize_t;
+
+int catflapcam_resize_bytes_per_pixel(uint32_t pixel_format)
+{
+    switch (pixel_format) {
+    case V4L2_PIX_FMT_GREY:
+    case V4L2_PIX_FMT_SBGGR8:
+        return 1;
+    case V4L2_PIX_FMT_RGB565:
+    case V4L2_PIX_FMT_YUV422P:
+        return 2;
+    case V4L2_PIX_FMT_RGB24:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+static esp_err_t alloc_axis(resize_axis_t *axis, uint32_t count)
+{
+    axis->pos0 = calloc(count, sizeof(uint32_t));
+    axis->pos1 = calloc(count, sizeof(uint32_t));
+    axis->weight = calloc(count, sizeof(uint16_t));
+    axis->recip = calloc(count, sizeof(uint32_t));
+    ESP_RETURN_ON_FALSE(axis->pos0 && axis->pos1 && axis->weight && axis->recip, ESP_ERR_NO_MEM, TAG, "failed to alloc resize table");
+    return ESP_OK;
+}
+
+static void free_axis(resize_axis_t *axis)
+{
+    free(axis->pos0);
+    free(axis->pos1);
+    free(axis->weight);
+    free(axis->recip);
+    memset(axis, 0, sizeof(*axis));
+}
+
+static void build_axis(resize_axis_t *axis, catflapcam_resize_mode_t mode, uint32_t src_n, uint32_t dst_n, uint32_t step)
+{
+    for (uint32_t i = 0; i < dst_n; i++) {
+        uint32_t p0 = 0;
+        uint32_t p1 = 0;
+        uint32_t weight = 0;
+        uint32_t recip = 0;
+
+        switch (mode) {
+        case CATFLAPCAM_RESIZE_NEAREST:
+            p0 = (uint32_t)(((uint64_t)(2 * i + 1) * src_n) / (2 * dst_n));
+            p1 = p0;
+            break;
+        case CATFLAPCAM_RESIZE_BILINEAR: {
+            int64_t center_q8 = (int64_t)(((uint64_t)(2 * i + 1) * src_n * 256) / (2 * dst_n)) - 128;
+            if (center_q8 < 0) {
+                center_q8 = 0;
+            }
+            p0 = (uint32_t)(center_q8 >> 8);
+            weight = (uint32_t)(center_q8 & 0xff);
+            if (p0 >= src_n - 1) {
+                p0 = src_n - 1;
+                weight = 0;
+            }
+            p1 = weight ? p0 + 1 : p0;
+            break;
+        }
+        case CATFLAPCAM_RESIZE_AREA:
+            p0 = (uint32_t)(((uint64_t)i * src_n) / dst_n);
+            p1 = (uint32_t)(((uint64_t)(i + 1) * src_n) / dst_n);
+            if (p1 <= p0) {
+                p1 = p0 + 1;
+            }
+            recip = 65536 / (p1 - p0);
+            break;
+        }
+
+        axis->pos0[i] = p0 * step;
+        axis->pos1[i] = p1 * step;
+        axis->weight[i] = (uint16_t)weight;
+        axis->recip[i] = recip;
+    }
+}
+
+static void add_plane(catflapcam_resize_t *resize, const resize_axis_t *cols, uint32_t count, uint32_t offset,
+                      uint32_t step, uint32_t size)
+{
+    resize_plane_t *plane = &resize->planes[resize->plane_count++];
+    plane->cols = cols;
+    plane->count = count;
+    plane->offset = offset;
+    plane->step = step;
+    plane->size = size;
+}
+
+static void expand_rgb565_row(const uint8_t *restrict src, uint8_t *restrict dst, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x++) {
+        uint32_t v = src[2 * x] | (src[2 * x + 1] << 8);
+        uint32_t r = (v >> 11) & 0x1f;
+        uint32_t g = (v >> 5) & 0x3f;
+        uint32_t b = v & 0x1f;
+        dst[3 * x + 0] = (uint8_t)((r << 3) | (r >> 2));
+        dst[3 * x + 1] = (uint8_t)((g << 2) | (g >> 4));
+        dst[3 * x + 2] = (uint8_t)((b << 3) | (b >> 2));
+    }
+}
+
+static void pack_rgb565_row(const uint8_t *restrict src, uint8_t *restrict dst, uint32_t width)
+{
+    for (uint32_t x = 0; x < width; x++) {
+        uint32_t v = ((src[3 * x] >> 3) << 11) | ((src[3 * x + 1] >> 2) << 5) | (src[3 * x + 2] >> 3);
+        dst[2 * x] = (uint8_t)v;
+        dst[2 * x + 1] = (uint8_t)(v >> 8);
+    }
+}
+
+static void vertical_bilinear(const uint8_t *restrict a, const uint8_t *restrict b, uint32_t weight,
+                              uint16_t *restrict out, uint32_t n)
+{
+    uint32_t inv = 256 - weight;
+
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = (uint16_t)(a[i] * inv + b[i] * weight);
+    }
+}
+
+static void vertical_accumulate(const uint8_t *restrict row, uint32_t *restrict acc, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        acc[i] += row[i];
+    }
+}
+
+static void vertical_normalize(const uint32_t *restrict acc, uint32_t recip, uint16_t *restrict out, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        out[i] = (uint16_t)((acc[i] * recip) >> 8);
+    }
+}
+
+static void horizontal_nearest(const uint8_t *restrict row, const resize_plane_t *plane, uint8_t *restrict dst)
+{
+    const uint32_t *restrict pos0 = plane->cols->pos0;
+
+    switch (plane->size) {
+    case 2:
+        for (uint32_t x = 0; x < plane->count; x++) {
+            memcpy(&dst[x * 2], &row[pos0[x]], 2);
+        }
+        break;
+    case 3:
+        for (uint32_t x = 0; x < plane->count; x++) {
+            memcpy(&dst[x * 3], &row[pos0[x]], 3);
+        }
+        break;
+    default:
+        for (uint32_t x = 0; x < plane->count; x++) {
+            dst[x * plane->step + plane->offset] = row[pos0[x] + plane->offset];
+        }
+        break;
+    }
+}
+
+static void horizontal_bilinear(const uint16_t *restrict row, const resize_plane_t *plane, uint8_t *restrict dst)
+{
+    const uint32_t *restrict pos0 = plane->cols->pos0;
+    const uint32_t *restrict pos1 = plane->cols->pos1;
+    const uint16_t *restrict weight = plane->cols->weight;
+
+    for (uint32_t x = 0; x < plane->count; x++) {
+        uint32_t a = row[pos0[x] + plane->offset];
+        uint32_t b = row[pos1[x] + plane->offset];
+        dst[x * plane->step + plane->offset] = (uint8_t)((a * (256 - weight[x]) + b * weight[x] + (1u << 15)) >> 16);
+    }
+}
+
+static void horizontal_area(const uint16_t *restrict row, const resize_plane_t *plane, uint8_t *restrict dst)
+{
+    const uint32_t *restrict pos0 = plane->cols->pos0;
+    const uint32_t *restrict pos1 = plane->cols->pos1;
+    const uint32_t *restrict recip = plane->cols->recip;
+
+    for (uint32_t x = 0; x < plane->count; x++) {
+        uint32_t sum = 0;
+        for (uint32_t p = pos0[x]; p < pos1[x]; p += plane->step) {
+            sum += row[p + plane->offset];
+        }
+        dst[x * plane->step + plane->offset] = (uint8_t)((sum * recip[x] + (1u << 23)) >> 24);
+    }
+}
+
+/*
+ * Returns the cropped part of a source row; the tables index from the crop origin, so bytes outside the
+ * crop are never read.
+ */
+static const uint8_t *fetch_row(catflapcam_resize_t *resize, const uint8_t *src, uint32_t row, int slot)
+{
+    const uint8_t *src_row = src + ((row + resize->crop_y) * resize->config.src_width + resize->crop_x) * resize->bpp;
+
+    if (!resize->expand_rgb565) {
+        return src_row;
+    }
+    expand_rgb565_row(src_row, resize->expand[slot], resize->crop_width);
+    return resize->expand[slot];
+}
+
+esp_err_t catflapcam_resize_new(const catflapcam_resize_config_t *config, catflapcam_resize_handle_t *ret_resize)
+{
+    esp_err_t ret = ESP_OK;
+
+    ESP_RETURN_ON_FALSE(config && ret_resize && config->src_width && config->src_height && config->dst_width && config->dst_height,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid resize config");
+    int bpp = catflapcam_resize_bytes_per_pixel(config->pixel_format);
+    ESP_RETURN_ON_FALSE(bpp > 0, ESP_ERR_NOT_SUPPORTED, TAG, "pixel format not supported for resize");
+    ESP_RETURN_ON_FALSE(config->pixel_format != V4L2_PIX_FMT_YUV422P || (config->src_width % 2 == 0 && config->dst_width % 2 == 0),
+                        ESP_ERR_INVALID_ARG, TAG, "YUV422 resize needs even widths");
+    bool cropped = config->crop_width && config->crop_height;
+    ESP_RETURN_ON_FALSE(!cropped || (config->crop_x + config->crop_width <= config->src_width &&
+                                     config->crop_y + config->crop_height <= config->src_height),
+                        ESP_ERR_INVALID_ARG, TAG, "crop outside source frame");
+    ESP_RETURN_ON_FALSE(!cropped || config->pixel_format != V4L2_PIX_FMT_YUV422P || (config->crop_x % 2 == 0 && config->crop_width % 2 == 0),
+                        ESP_ERR_INVALID_ARG, TAG, "YUV422 crop needs even x and width");
+
+    catflapcam_resize_t *resize = calloc(1, sizeof(catflapcam_resize_t));
+    ESP_RETURN_ON_FALSE(resize, ESP_ERR_NO_MEM, TAG, "failed to alloc resize plan");
+    resize->config = *config;
+    resize->crop_x = cropped ? config->crop_x : 0;
+    resize->crop_y = cropped ? config->crop_y : 0;
+    resize->crop_width = cropped ? config->crop_width : config->src_width;
+    resize->crop_height = cropped ? config->crop_height : config->src_height;
+    resize->bpp = bpp;
+    resize->expand_rgb565 = config->pixel_format == V4L2_PIX_FMT_RGB565 && config->mode != CATFLAPCAM_RESIZE_NEAREST;
+
+    uint32_t src_w = resize->crop_width;
+    uint32_t dst_w = config->dst_width;
+    uint32_t work_bpp = resize->expand_rgb565 ? 3 : bpp;
+    resize->row_bytes = src_w * work_bpp;
+
+    ESP_GOTO_ON_ERROR(alloc_axis(&resize->rows, config->dst_height), fail, TAG, "failed to alloc row table");
+    build_axis(&resize->rows, config->mode, resize->crop_height, config->dst_height, 1);
+    ESP_GOTO_ON_ERROR(alloc_axis(&resize->cols[0], dst_w), fail, TAG, "failed to alloc column table");
+
+    if (config->pixel_format == V4L2_PIX_FMT_YUV422P) {
+        /* YUYV: luma is sampled per pixel, chroma once per pixel pair. */
+        build_axis(&resize->cols[0], config->mode, src_w, dst_w, 2);
+        ESP_GOTO_ON_ERROR(alloc_axis(&resize->cols[1], dst_w / 2), fail, TAG, "failed to alloc chroma table");
+        build_axis(&resize->cols[1], config->mode, src_w / 2, dst_w / 2, 4);
+        add_plane(resize, &resize->cols[0], dst_w, 0, 2, 1);
+        add_plane(resize, &resize->cols[1], dst_w / 2, 1, 4, 1);
+        add_plane(resize, &resize->cols[1], dst_w / 2, 3, 4, 1);
+    } else if (config->mode == CATFLAPCAM_RESIZE_NEAREST) {
+        /* Nearest picks whole pixels, so one pass copies all of their bytes, RGB565 included. */
+        build_axis(&resize->cols[0], config->mode, src_w, dst_w, work_bpp);
+        add_plane(resize, &resize->cols[0], dst_w, 0, work_bpp, work_bpp);
+    } else {
+        build_axis(&resize->cols[0], config->mode, src_w, dst_w, work_bpp);
+        for (uint32_t i = 0; i < work_bpp; i++) {
+            add_plane(resize, &resize->cols[0], dst_w, i, work_bpp, 1);
+        }
+    }
+
+    if (config->mode != CATFLAPCAM_RESIZE_NEAREST) {
+        resize->vrow = calloc(resize->row_bytes, sizeof(uint16_t));
+        ESP_GOTO_ON_FALSE(resize->vrow, ESP_ERR_NO_MEM, fail, TAG, "failed to alloc resize row buffer");
+    }
+    if (config->mode == CATFLAPCAM_RESIZE_AREA) {
+        resize->acc = calloc(resize->row_bytes, sizeof(uint32_t));
+        ESP_GOTO_ON_FALSE(resize->acc, ESP_ERR_NO_MEM, fail, TAG, "failed to alloc resize accumulator");
+    }
+    if (resize->expand_rgb565) {
+        for (int i = 0; i < 2; i++) {
+            resize->expand[i] = malloc(resize->row_bytes);
+            ESP_GOTO_ON_FALSE(resize->expand[i], ESP_ERR_NO_MEM, fail, TAG, "failed to alloc rgb565 row buffer");
+        }
+        resize->out_row = malloc(dst_w * 3);
+        ESP_GOTO_ON_FALSE(resize->out_row, ESP_ERR_NO_MEM, fail, TAG, "failed to alloc rgb565 output row");
+    }
+
+    *ret_resize = resize;
+    return ESP_OK;
+
+fail:
+    catflapcam_resize_free(resize);
+    return ret;
+}
+
+void catflapcam_resize_free(catflapcam_resize_handle_t resize)
+{
+    if (!resize) {
+        return;
+    }
+
+    free_axis(&resize->rows);
+    free_axis(&resize->cols[0]);
+    free_axis(&resize->cols[1]);
+    free(resize->vrow);
+    free(resize->acc);
+    free(resize->expand[0]);
+    free(resize->expand[1]);
+    free(resize->out_row);
+    free(resize);
+}
+
+esp_err_t catflapcam_resize_process(catflapcam_resize_handle_t resize, const uint8_t *src, uint32_t src_size,
+                                    uint8_t *dst, uint32_t dst_size, uint32_t *ret_size)
+{
+    ESP_RETURN_ON_FALSE(resize && src && dst, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    const catflapcam_resize_config_t *config = &resize->config;
+    uint32_t expected_src_size = config->src_width * config->src_height * resize->bpp;
+    uint32_t dst_stride = config->dst_width * resize->bpp;
+    uint32_t expected_dst_size = dst_stride * config->dst_height;
+    ESP_RETURN_ON_FALSE(src_size >= expected_src_size, ESP_ERR_INVALID_SIZE, TAG,
+                        "source frame too small (%" PRIu32 " < %" PRIu32 ")", src_size, expected_src_size);
+    ESP_RETURN_ON_FALSE(dst_size >= expected_dst_size, ESP_ERR_INVALID_SIZE, TAG, "resize buffer too small");
+
+    for (uint32_t y = 0; y < config->dst_height; y++) {
+        uint8_t *dst_row = dst + y * dst_stride;
+        uint8_t *out = resize->expand_rgb565 ? resize->out_row : dst_row;
+
+        switch (config->mode) {
+        case CATFLAPCAM_RESIZE_NEAREST: {
+            const uint8_t *row = fetch_row(resize, src, resize->rows.pos0[y], 0);
+            for (int i = 0; i < resize->plane_count; i++) {
+                horizontal_nearest(row, &resize->planes[i], out);
+            }
+            break;
+        }
+        case CATFLAPCAM_RESIZE_BILINEAR: {
+            const uint8_t *a = fetch_row(resize, src, resize->rows.pos0[y], 0);
+            const uint8_t *b = fetch_row(resize, src, resize->rows.pos1[y], 1);
+            vertical_bilinear(a, b, resize->rows.weight[y], resize->vrow, resize->row_bytes);
+            for (int i = 0; i < resize->plane_count; i++) {
+                horizontal_bilinear(resize->vrow, &resize->planes[i], out);
+            }
+            break;
+        }
+        case CATFLAPCAM_RESIZE_AREA:
+            memset(resize->acc, 0, resize->row_bytes * sizeof(uint32_t));
+            for (uint32_t r = resize->rows.pos0[y]; r < resize->rows.pos1[y]; r++) {
+                vertical_accumulate(fetch_row(resize, src, r, 0), resize->acc, resize->row_bytes);
+            }
+            vertical_normalize(resize->acc, resize->rows.recip[y], resize->vrow, resize->row_bytes);
+            for (int i = 0; i < resize->plane_count; i++) {
+                horizontal_area(resize->vrow, &resize->planes[i], out);
+            }
+            break;
+        }
+
+        if (resize->expand_rgb565) {
+            pack_rgb565_row(resize->out_row, dst_row, config->dst_width);
+        }
+    }
+
+    if (ret_size) {
+        *ret_size = expected_dst_size;
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: 2024-2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <assert.h>
+#include <string.h>
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "catflapcam_snapshot_pool.h"
+
+/* Called with the pool lock held. */
+static void recycle_job(catflapcam_snapshot_job_t *job)
+{
+    job->busy = false;
+    job->waited = false;
+    job->finished = false;
+    job->size = 0;
+    xSemaphoreGive(job->pool->free);
+}
+
+esp_err_t catflapcam_snapshot_pool_init(catflapcam_snapshot_pool_t *pool, uint32_t buf_size)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(pool->lock, ESP_ERR_NO_MEM, TAG, "failed to create snapshot job lock");
+    pool->free = xSemaphoreCreateCounting(CATFLAPCAM_SNAPSHOT_QUEUE_LEN, CATFLAPCAM_SNAPSHOT_QUEUE_LEN);
+    ESP_RETURN_ON_FALSE(pool->free, ESP_ERR_NO_MEM, TAG, "failed to create snapshot pool semaphore");
+
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        catflapcam_snapshot_job_t *job = &pool->jobs[i];
+        job->pool = pool;
+        job->buf = heap_caps_calloc(1, buf_size, MALLOC_CAP_SPIRAM);
+        ESP_RETURN_ON_FALSE(job->buf, ESP_ERR_NO_MEM, TAG, "failed to alloc snapshot buffer %d", i);
+        job->buf_size = buf_size;
+        job->done = xSemaphoreCreateBinary();
+        ESP_RETURN_ON_FALSE(job->done, ESP_ERR_NO_MEM, TAG, "failed to create snapshot completion semaphore");
+    }
+    return ESP_OK;
+}
+
+void catflapcam_snapshot_pool_deinit(catflapcam_snapshot_pool_t *pool)
+{
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        catflapcam_snapshot_job_t *job = &pool->jobs[i];
+        if (job->buf) {
+            heap_caps_free(job->buf);
+        }
+        if (job->done) {
+            vSemaphoreDelete(job->done);
+        }
+        memset(job, 0, sizeof(*job));
+    }
+    if (pool->free) {
+        vSemaphoreDelete(pool->free);
+        pool->free = NULL;
+    }
+    if (pool->lock) {
+        vSemaphoreDelete(pool->lock);
+        pool->lock = NULL;
+    }
+}
+
+esp_err_t catflapcam_snapshot_pool_claim(catflapcam_snapshot_pool_t *pool, bool waited, TickType_t wait, catflapcam_snapshot_job_t **ret_job)
+{
+    catflapcam_snapshot_job_t *job = NULL;
+
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(pool->free, wait) == pdPASS, ESP_ERR_TIMEOUT, TAG, "snapshot queue full");
+
+    xSemaphoreTake(pool->lock, portMAX_DELAY);
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        if (!pool->jobs[i].busy) {
+            job = &pool->jobs[i];
+            job->busy = true;
+            job->waited = waited;
+            break;
+        }
+    }
+    xSemaphoreGive(pool->lock);
+    /* The counting semaphore never exceeds the number of free jobs. */
+    assert(job);
+    *ret_job = job;
+    return ESP_OK;
+}
+
+void catflapcam_snapshot_pool_release(catflapcam_snapshot_job_t *job)
+{
+    xSemaphoreTake(job->pool->lock, portMAX_DELAY);
+    recycle_job(job);
+    xSemaphoreGive(job->pool->lock);
+}
+
+bool catflapcam_snapshot_pool_is_waited(catflapcam_snapshot_job_t *job)
+{
+    xSemaphoreTake(job->pool->lock, portMAX_DELAY);
+    bool waited = job->waited;
+    xSemaphoreGive(job->pool->lock);
+    return waited;
+}
+
+void catflapcam_snapshot_pool_finish(catflapcam_snapshot_job_t *job, esp_err_t result)
+{
+    xSemaphoreTake(job->pool->lock, portMAX_DELAY);
+    job->result = result;
+    job->finished = true;
+    if (job->waited) {
+        xSemaphoreGive(job->done);
+    } else {
+        recycle_job(job);
+    }
+    xSemaphoreGive(job->pool->lock);
+}
+
+/*
+ * The waiter and the finishing side meet under the pool lock: whichever comes second recycles the job. A
+ * completion given between a timed out take and the lock is picked up here, so `done` is empty on reuse.
+ */
+esp_err_t catflapcam_snapshot_pool_wait(catflapcam_snapshot_job_t *job, TickType_t wait)
+{
+    esp_err_t ret = ESP_ERR_TIMEOUT;
+
+    ESP_RETURN_ON_FALSE(job, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    bool done = xSemaphoreTake(job->done, wait) == pdPASS;
+    xSemaphoreTake(job->pool->lock, portMAX_DELAY);
+    if (!done && job->finished) {
+        xSemaphoreTake(job->done, 0);
+        done = true;
+    }
+    if (done) {
+        ret = job->result;
+        recycle_job(job);
+    } else {
+        job->waited = false;
+    }
+    xSemaphoreGive(job->pool->lock);
+    return ret;
+}
+
+esp_err_t catflapcam_snapshot_pool_drain(catflapcam_snapshot_pool_t *pool, TickType_t wait)
+{
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN && pool->free; i++) {
+        ESP_RETURN_ON_FALSE(xSemaphoreTake(pool->free, wait) == pdPASS, ESP_ERR_TIMEOUT, TAG, "snapshot jobs still in use");
+    }
+    return ESP_OK;
+}
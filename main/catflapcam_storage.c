@@ -1,19 +1,27 @@
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ctype.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include "cJSON.h"
 #include "driver/sdmmc_host.h"
 #include "esp_check.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
 #include "esp_vfs_fat.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "sdmmc_cmd.h"
 #if SOC_SDMMC_IO_POWER_EXTERNAL
 #include "sd_pwr_ctrl_by_on_chip_ldo.h"
@@ -25,28 +33,162 @@
 #define SNAPSHOT_NAME_PREFIX "snap-"
 #define SNAPSHOT_NAME_SUFFIX ".jpg"
 #define SNAPSHOT_NAME_MAX_LEN 64
+#define SNAPSHOT_SEQ_DIGITS 20
+#define SNAPSHOT_INDEX_SUFFIX_LEN 17
+#define SNAPSHOT_SHARD_SIZE 1000
+#define SNAPSHOT_SHARD_NAME_FMT "%06llu"
+#define SNAPSHOT_SHARD_NONE UINT64_MAX
+#define STORAGE_JOURNAL_MAGIC 0x58494643 /* "CFIX" */
+#define STORAGE_JOURNAL_VERSION 4
+#define STORAGE_JOURNAL_COMPACT_SLACK 1024
+#define STORAGE_JOURNAL_READ_RECORDS 64
+#define STORAGE_ALLOCATION_UNIT (16 * 1024)
+#define STORAGE_WRITE_BUF_ALIGN 64
+#define STORAGE_BENCH_DIR_NAME "bench"
+#define STORAGE_BENCH_MAX_COUNT 64
+#define STORAGE_LIST_SCAN_MAX 512
+#define STORAGE_DELETE_BATCH 256
+#define STORAGE_FREE_REFRESH_US (60 * 1000 * 1000LL)
+#define RETENTION_INTERVAL_MS 5000
+#define RETENTION_BATCH 16
+#define RETENTION_TASK_STACK_SIZE (1024 * 4)
+#define RETENTION_TASK_PRIORITY 2
+#define RETENTION_HEADROOM_FILES MAX(1, CATFLAPCAM_SNAPSHOT_MAX_FILES / 100)
+
+#if CONFIG_CATFLAPCAM_SNAPSHOT_STORE_SEGMENTS
+#define STORAGE_SEGMENTS 1
+#define STORAGE_JOURNAL_NAME "segments.jnl"
+#define STORAGE_JOURNAL_TMP_NAME "segments.tmp"
+#define SEGMENT_DIR_NAME "segments"
+#define SEGMENT_SIZE ((uint32_t)CONFIG_CATFLAPCAM_SNAPSHOT_SEGMENT_SIZE_KB * 1024)
+#define SEGMENT_COUNT CONFIG_CATFLAPCAM_SNAPSHOT_SEGMENT_COUNT
+#define SEGMENT_MAGIC 0x47455343        /* "CSEG" */
+#define SEGMENT_RECORD_MAGIC 0x32504e53 /* "SNP2" */
+#define SEGMENT_RECORD_ALIGN 16
+#define SEGMENT_NONE UINT16_MAX
+/* Segments are preallocated, so their space is bounded by the segment count and only the file count applies. */
+#define RETENTION_BUDGET_BYTES 0
+#define RETENTION_MIN_FREE_BYTES 0
+#define RETENTION_HEADROOM_BYTES 0
+#else
+#define STORAGE_SEGMENTS 0
+#define STORAGE_JOURNAL_NAME "snapshots.jnl"
+#define STORAGE_JOURNAL_TMP_NAME "snapshots.tmp"
+#define RETENTION_BUDGET_BYTES ((uint64_t)CONFIG_CATFLAPCAM_SNAPSHOT_BUDGET_MB << 20)
+#define RETENTION_MIN_FREE_BYTES ((uint64_t)CONFIG_CATFLAPCAM_SNAPSHOT_MIN_FREE_MB << 20)
+#define RETENTION_HEADROOM_BYTES ((uint64_t)CONFIG_CATFLAPCAM_SNAPSHOT_RETENTION_HEADROOM_MB << 20)
+#endif
 
-typedef struct snapshot_entry {
+/*
+ * One snapshot, kept in RAM so saves, evictions and listings never walk the directory. The name is rebuilt
+ * from the sequence number, its zero-padded width and whatever followed it in the file name. A size of 0
+ * means the file has not been stat()ed yet. `segment` and `offset` are only used by the segment store.
+ * Capture times follow the seq order closely enough for the time queries to binary-search them.
+ */
+typedef struct snapshot_index_entry {
     uint64_t seq;
-    off_t size;
-    char name[SNAPSHOT_NAME_MAX_LEN];
-} snapshot_entry_t;
+    int64_t timestamp_ms;       /* capture time, epoch ms; whole seconds from the name for scanned files */
+    uint32_t size;
+    uint32_t offset;
+    uint16_t segment;
+    uint8_t seq_digits;
+    uint8_t source;             /* camera index, CATFLAPCAM_STORAGE_SOURCE_UNKNOWN for scanned files */
+    char suffix[SNAPSHOT_INDEX_SUFFIX_LEN];
+} snapshot_index_entry_t;
+
+/* Ring of index entries in ascending seq order: eviction pops the front, saves push the back. */
+typedef struct snapshot_index {
+    snapshot_index_entry_t *entries;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    uint64_t bytes;             /* sum of the known entry sizes */
+} snapshot_index_t;
+
+typedef enum {
+    JOURNAL_RECORD_ADD = 1,
+    JOURNAL_RECORD_DEL = 2,
+    JOURNAL_RECORD_DROP_SEGMENT = 3, /* entry.segment was reclaimed: drop all of its entries */
+} journal_record_type_t;
+
+typedef struct journal_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+} journal_header_t;
+
+typedef struct journal_record {
+    uint8_t type;
+    uint8_t reserved[3];
+    uint32_t crc;
+    snapshot_index_entry_t entry;
+} journal_record_t;
+
+#if STORAGE_SEGMENTS
+/*
+ * Segment files are preallocated once and rewritten in place, so saving only writes data sectors. Each
+ * reuse bumps the segment generation; records of an older generation left behind the write position are
+ * ignored by the scan.
+ */
+typedef struct segment_header {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t size;
+    uint32_t reserved;
+    uint64_t first_seq;         /* next_seq when the segment was started; keeps sequence numbers unique after deletes */
+} segment_header_t;
+
+typedef struct segment_record_header {
+    uint32_t magic;
+    uint32_t generation;
+    uint32_t crc;
+    uint32_t reserved;
+    snapshot_index_entry_t entry;
+} segment_record_header_t;
+
+typedef struct segment_store {
+    uint32_t generation[SEGMENT_COUNT]; /* 0: never written */
+    uint32_t next_generation;
+    uint16_t current;
+    uint16_t next;                      /* segment the next advance writes, kept across a failed advance */
+    uint32_t write_offset;
+    FILE *fp;
+    char dir[96];
+} segment_store_t;
+#endif
 
 typedef struct storage_state {
     bool enabled;
     bool mounted;
     uint64_t next_seq;
-    uint64_t oldest_seq;
-    uint32_t file_count;
+    snapshot_index_t index;
+    uint64_t last_shard;
+    FILE *journal;
+    uint32_t journal_records;
+    char journal_path[96];
     SemaphoreHandle_t lock;
     sdmmc_card_t *card;
     sd_pwr_ctrl_handle_t pwr_ctrl_handle;
     char snapshot_dir[96];
+    uint8_t *write_buf;         /* one allocation unit of DMA-capable RAM, used under the lock */
+    uint32_t unsized;           /* entries rebuilt by a directory scan whose size is not known yet */
+    uint64_t free_bytes;        /* card free space, re-read every minute and adjusted per write in between */
+    bool free_known;
+    int64_t free_read_us;
+    uint64_t evicted;
+    TaskHandle_t retention_task;
+#if STORAGE_SEGMENTS
+    segment_store_t seg;
+#endif
 } storage_state_t;
 
 static const char *TAG = "catflapcam_storage";
 static storage_state_t s_storage = {
     .enabled = CATFLAPCAM_SDCARD_ENABLE,
+    .last_shard = SNAPSHOT_SHARD_NONE,
+#if STORAGE_SEGMENTS
+    .seg.current = SEGMENT_NONE,
+#endif
 };
 
 static bool parse_snapshot_seq(const char *name, uint64_t *seq)
@@ -77,109 +219,1147 @@ static bool parse_snapshot_seq(const char *name, uint64_t *seq)
         return true;
     }
 
-    if (*endp != '-') {
-        return false;
+    if (*endp != '-') {
+        return false;
+    }
+
+    size_t rem_len = strlen(endp);
+    if (rem_len <= suffix_len || strcmp(endp + rem_len - suffix_len, SNAPSHOT_NAME_SUFFIX) != 0) {
+        return false;
+    }
+
+    if (seq) {
+        *seq = (uint64_t)seq_ull;
+    }
+    return true;
+}
+
+static snapshot_index_entry_t *index_at(uint32_t pos)
+{
+    snapshot_index_t *index = &s_storage.index;
+    return &index->entries[(index->head + pos) % index->capacity];
+}
+
+static esp_err_t index_entry_name(const snapshot_index_entry_t *entry, char *name, size_t name_len)
+{
+    int n = snprintf(name, name_len, SNAPSHOT_NAME_PREFIX "%0*llu%s" SNAPSHOT_NAME_SUFFIX,
+                     entry->seq_digits, (unsigned long long)entry->seq, entry->suffix);
+    return (n > 0 && (size_t)n < name_len) ? ESP_OK : ESP_FAIL;
+}
+
+/*
+ * Snapshots live in one subdirectory per SNAPSHOT_SHARD_SIZE sequence numbers, so FAT create, open and
+ * unlink never search a directory of more than that many entries. The shard follows from the name alone.
+ */
+static uint64_t snapshot_shard(uint64_t seq)
+{
+    return seq / SNAPSHOT_SHARD_SIZE;
+}
+
+static esp_err_t build_snapshot_path(const char *name, char *path, size_t path_len)
+{
+    uint64_t seq = 0;
+
+    if (!parse_snapshot_seq(name, &seq)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int n = snprintf(path, path_len, "%s/" SNAPSHOT_SHARD_NAME_FMT "/%s", s_storage.snapshot_dir,
+                     (unsigned long long)snapshot_shard(seq), name);
+    return (n > 0 && (size_t)n < path_len) ? ESP_OK : ESP_FAIL;
+}
+
+#if !STORAGE_SEGMENTS
+static esp_err_t build_shard_path(uint64_t shard, char *path, size_t path_len)
+{
+    int n = snprintf(path, path_len, "%s/" SNAPSHOT_SHARD_NAME_FMT, s_storage.snapshot_dir, (unsigned long long)shard);
+    return (n > 0 && (size_t)n < path_len) ? ESP_OK : ESP_FAIL;
+}
+
+static bool is_shard_name(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 0 && strspn(name, "0123456789") == len;
+}
+
+static esp_err_t ensure_shard_dir(uint64_t seq)
+{
+    char path[112];
+    uint64_t shard = snapshot_shard(seq);
+
+    if (shard == s_storage.last_shard) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(build_shard_path(shard, path, sizeof(path)), TAG, "failed to build shard path");
+    if (mkdir(path, 0775) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "failed to create shard dir '%s': errno=%d", path, errno);
+        return ESP_FAIL;
+    }
+    s_storage.last_shard = shard;
+    return ESP_OK;
+}
+#endif
+
+static int64_t parse_suffix_timestamp_ms(const char *suffix)
+{
+    struct tm tm_file = {0};
+
+    if (sscanf(suffix, "-%4d%2d%2d-%2d%2d%2d", &tm_file.tm_year, &tm_file.tm_mon, &tm_file.tm_mday,
+               &tm_file.tm_hour, &tm_file.tm_min, &tm_file.tm_sec) != 6) {
+        return 0;
+    }
+    tm_file.tm_year -= 1900;
+    tm_file.tm_mon -= 1;
+    tm_file.tm_isdst = -1;
+    time_t t = mktime(&tm_file);
+    return t > 0 ? (int64_t)t * 1000 : 0;
+}
+
+static bool index_entry_from_name(const char *name, snapshot_index_entry_t *entry)
+{
+    uint64_t seq = 0;
+
+    if (!parse_snapshot_seq(name, &seq)) {
+        return false;
+    }
+
+    const char *digits = name + strlen(SNAPSHOT_NAME_PREFIX);
+    size_t seq_digits = strspn(digits, "0123456789");
+    size_t suffix_len = strlen(digits + seq_digits) - strlen(SNAPSHOT_NAME_SUFFIX);
+    if (seq_digits > UINT8_MAX || suffix_len >= SNAPSHOT_INDEX_SUFFIX_LEN) {
+        return false;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->seq = seq;
+    entry->seq_digits = (uint8_t)seq_digits;
+    memcpy(entry->suffix, digits + seq_digits, suffix_len);
+    entry->timestamp_ms = parse_suffix_timestamp_ms(entry->suffix);
+    entry->source = CATFLAPCAM_STORAGE_SOURCE_UNKNOWN;
+    return true;
+}
+
+/* Grows the ring and lays it out from slot 0 again. Only needed while the index is being rebuilt at mount. */
+static esp_err_t index_grow(void)
+{
+    snapshot_index_t *index = &s_storage.index;
+    uint32_t capacity = index->capacity ? index->capacity * 2 : CATFLAPCAM_SNAPSHOT_MAX_FILES;
+
+    snapshot_index_entry_t *entries = heap_caps_calloc(capacity, sizeof(snapshot_index_entry_t), MALLOC_CAP_SPIRAM);
+    ESP_RETURN_ON_FALSE(entries, ESP_ERR_NO_MEM, TAG, "failed to grow snapshot index");
+    for (uint32_t i = 0; i < index->count; i++) {
+        entries[i] = *index_at(i);
+    }
+    heap_caps_free(index->entries);
+    index->entries = entries;
+    index->capacity = capacity;
+    index->head = 0;
+    return ESP_OK;
+}
+
+static esp_err_t index_push_back(const snapshot_index_entry_t *entry)
+{
+    snapshot_index_t *index = &s_storage.index;
+
+    if (index->count == index->capacity) {
+        ESP_RETURN_ON_ERROR(index_grow(), TAG, "snapshot index full");
+    }
+    index->count++;
+    *index_at(index->count - 1) = *entry;
+    index->bytes += entry->size;
+    return ESP_OK;
+}
+
+static void index_pop_front(void)
+{
+    snapshot_index_t *index = &s_storage.index;
+
+    index->bytes -= index_at(0)->size;
+    if (index_at(0)->size == 0 && s_storage.unsized > 0) {
+        s_storage.unsized--;
+    }
+    index->head = (index->head + 1) % index->capacity;
+    index->count--;
+}
+
+/* Removes `n` consecutive entries by shifting whichever side of the ring is shorter. */
+static void index_remove_range(uint32_t pos, uint32_t n)
+{
+    snapshot_index_t *index = &s_storage.index;
+
+    for (uint32_t i = pos; i < pos + n; i++) {
+        index->bytes -= index_at(i)->size;
+        if (index_at(i)->size == 0 && s_storage.unsized > 0) {
+            s_storage.unsized--;
+        }
+    }
+    if (pos < index->count - pos - n) {
+        for (uint32_t i = pos; i > 0; i--) {
+            *index_at(i - 1 + n) = *index_at(i - 1);
+        }
+        index->head = (index->head + n) % index->capacity;
+        index->count -= n;
+        return;
+    }
+    for (uint32_t i = pos; i + n < index->count; i++) {
+        *index_at(i) = *index_at(i + n);
+    }
+    index->count -= n;
+}
+
+static void index_remove(uint32_t pos)
+{
+    index_remove_range(pos, 1);
+}
+
+/* Removes every entry stored in `segment`, wherever it sits in the index, and returns how many there were. */
+static uint32_t index_drop_segment(uint16_t segment)
+{
+    snapshot_index_t *index = &s_storage.index;
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        snapshot_index_entry_t entry = *index_at(i);
+        if (entry.segment != segment) {
+            *index_at(kept++) = entry;
+            continue;
+        }
+        index->bytes -= entry.size;
+        if (entry.size == 0 && s_storage.unsized > 0) {
+            s_storage.unsized--;
+        }
+    }
+    uint32_t dropped = index->count - kept;
+    index->count = kept;
+    return dropped;
+}
+
+/* Returns the position of the first entry with a seq not below `seq`, or the count if there is none. */
+static uint32_t index_lower_bound(uint64_t seq)
+{
+    uint32_t lo = 0;
+    uint32_t hi = s_storage.index.count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index_at(mid)->seq < seq) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Returns the position of the first entry with `seq`, or the count if there is none. */
+static uint32_t index_find(uint64_t seq)
+{
+    uint32_t pos = index_lower_bound(seq);
+    return (pos < s_storage.index.count && index_at(pos)->seq == seq) ? pos : s_storage.index.count;
+}
+
+static bool index_entry_equal(const snapshot_index_entry_t *lhs, const snapshot_index_entry_t *rhs)
+{
+    return lhs->seq == rhs->seq && lhs->seq_digits == rhs->seq_digits && strcmp(lhs->suffix, rhs->suffix) == 0;
+}
+
+/* Returns the position of the entry naming the same file as `key`, or the count if there is none. */
+static uint32_t index_find_entry(const snapshot_index_entry_t *key)
+{
+    uint32_t pos = index_find(key->seq);
+
+    for (; pos < s_storage.index.count && index_at(pos)->seq == key->seq; pos++) {
+        if (index_entry_equal(index_at(pos), key)) {
+            return pos;
+        }
+    }
+    return s_storage.index.count;
+}
+
+#if !STORAGE_SEGMENTS
+/* Removes a shard directory once the index holds nothing in it any more; `pos` is where its last entry was. */
+static void release_shard_if_empty(uint64_t shard, uint32_t pos)
+{
+    char path[112];
+
+    if ((pos > 0 && snapshot_shard(index_at(pos - 1)->seq) == shard) ||
+        (pos < s_storage.index.count && snapshot_shard(index_at(pos)->seq) == shard)) {
+        return;
+    }
+    if (build_shard_path(shard, path, sizeof(path)) != ESP_OK) {
+        return;
+    }
+    if (rmdir(path) != 0 && errno != ENOENT) {
+        ESP_LOGW(TAG, "shard dir '%s' not removed: errno=%d", path, errno);
+    }
+    if (shard == s_storage.last_shard) {
+        s_storage.last_shard = SNAPSHOT_SHARD_NONE;
+    }
+}
+#endif
+
+/* Recomputes the byte total after the index was rebuilt; entries left unsized by a scan are filled in later. */
+static void index_recount(void)
+{
+    snapshot_index_t *index = &s_storage.index;
+
+    index->bytes = 0;
+    s_storage.unsized = 0;
+    for (uint32_t i = 0; i < index->count; i++) {
+        index->bytes += index_at(i)->size;
+        s_storage.unsized += index_at(i)->size == 0;
+    }
+}
+
+static void index_fill_size(snapshot_index_entry_t *entry, uint32_t size)
+{
+    s_storage.index.bytes += size;
+    entry->size = size;
+    if (s_storage.unsized > 0) {
+        s_storage.unsized--;
+    }
+}
+
+static void index_update_next_seq(void)
+{
+    snapshot_index_t *index = &s_storage.index;
+    s_storage.next_seq = (index->count == 0) ? 1 : (index_at(index->count - 1)->seq + 1);
+}
+
+static int compare_index_entry_asc(const void *a, const void *b)
+{
+    const snapshot_index_entry_t *lhs = (const snapshot_index_entry_t *)a;
+    const snapshot_index_entry_t *rhs = (const snapshot_index_entry_t *)b;
+    if (lhs->seq < rhs->seq) {
+        return -1;
+    }
+    if (lhs->seq > rhs->seq) {
+        return 1;
+    }
+    return 0;
+}
+
+#if !STORAGE_SEGMENTS
+/*
+ * Moves snapshots left in the top-level directory by the flat layout into their shards. FAT rename only
+ * rewrites directory entries, so this costs one pass over the old directory, once.
+ */
+static esp_err_t migrate_flat_snapshots(void)
+{
+    uint32_t moved = 0;
+
+    DIR *dir = opendir(s_storage.snapshot_dir);
+    ESP_RETURN_ON_FALSE(dir, ESP_FAIL, TAG, "failed to open snapshot dir");
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint64_t seq = 0;
+        char old_path[128];
+        char new_path[128];
+        if (entry->d_type == DT_DIR || !parse_snapshot_seq(entry->d_name, &seq)) {
+            continue;
+        }
+        int n = snprintf(old_path, sizeof(old_path), "%s/%s", s_storage.snapshot_dir, entry->d_name);
+        if (n <= 0 || (size_t)n >= sizeof(old_path) || build_snapshot_path(entry->d_name, new_path, sizeof(new_path)) != ESP_OK ||
+            ensure_shard_dir(seq) != ESP_OK || rename(old_path, new_path) != 0) {
+            ESP_LOGW(TAG, "failed to move '%s' into its shard", entry->d_name);
+            continue;
+        }
+        moved++;
+    }
+    closedir(dir);
+
+    if (moved) {
+        ESP_LOGI(TAG, "moved %" PRIu32 " snapshots from the flat layout into shards", moved);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t scan_shard(const char *shard_name, uint32_t *skipped)
+{
+    esp_err_t ret = ESP_OK;
+    char path[112];
+
+    int n = snprintf(path, sizeof(path), "%s/%s", s_storage.snapshot_dir, shard_name);
+    ESP_RETURN_ON_FALSE(n > 0 && (size_t)n < sizeof(path), ESP_ERR_INVALID_SIZE, TAG, "shard path too long");
+    DIR *dir = opendir(path);
+    ESP_RETURN_ON_FALSE(dir, ESP_FAIL, TAG, "failed to open shard dir '%s'", path);
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        snapshot_index_entry_t index_entry;
+        if (!index_entry_from_name(entry->d_name, &index_entry)) {
+            if (parse_snapshot_seq(entry->d_name, NULL)) {
+                (*skipped)++;
+            }
+            continue;
+        }
+        /* More files than the ring size, e.g. after lowering the limit, grow it; saves evict the surplus. */
+        ESP_GOTO_ON_ERROR(index_push_back(&index_entry), out, TAG, "failed to index shard '%s'", shard_name);
+    }
+
+out:
+    closedir(dir);
+    return ret;
+}
+
+/*
+ * Walks the snapshot shards. Only used at mount when the journal is missing or damaged. Sizes are left
+ * unknown here, because stat() on FAT is itself a directory search; listings fill them in on first use.
+ */
+static esp_err_t scan_snapshot_index(void)
+{
+    esp_err_t ret = ESP_OK;
+    snapshot_index_t *index = &s_storage.index;
+    uint32_t skipped = 0;
+
+    ESP_RETURN_ON_ERROR(migrate_flat_snapshots(), TAG, "failed to migrate flat snapshot layout");
+
+    DIR *dir = opendir(s_storage.snapshot_dir);
+    ESP_RETURN_ON_FALSE(dir, ESP_FAIL, TAG, "failed to open snapshot dir");
+
+    index->head = 0;
+    index->count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type != DT_DIR || !is_shard_name(entry->d_name)) {
+            continue;
+        }
+        ESP_GOTO_ON_ERROR(scan_shard(entry->d_name, &skipped), out, TAG, "failed to scan snapshot shards");
+    }
+
+    qsort(index->entries, index->count, sizeof(snapshot_index_entry_t), compare_index_entry_asc);
+    if (skipped) {
+        ESP_LOGW(TAG, "%" PRIu32 " snapshot files have names too long to index and are ignored", skipped);
+    }
+
+out:
+    closedir(dir);
+    return ret;
+}
+#endif
+
+static uint32_t journal_record_crc(const journal_record_t *record)
+{
+    uint32_t crc = esp_rom_crc32_le(0, &record->type, sizeof(record->type));
+    return esp_rom_crc32_le(crc, (const uint8_t *)&record->entry, sizeof(record->entry));
+}
+
+/*
+ * A journal that may have missed a record is worse than none: drop it, so the next mount falls back to a
+ * directory scan instead of trusting a stale index.
+ */
+static void journal_discard(void)
+{
+    if (s_storage.journal) {
+        fclose(s_storage.journal);
+        s_storage.journal = NULL;
+    }
+    unlink(s_storage.journal_path);
+    ESP_LOGW(TAG, "snapshot journal discarded, the next mount will scan the snapshot dir");
+}
+
+static void journal_append(journal_record_type_t type, const snapshot_index_entry_t *entry)
+{
+    if (!s_storage.journal) {
+        return;
+    }
+
+    journal_record_t record = {
+        .type = type,
+        .entry = *entry,
+    };
+    record.crc = journal_record_crc(&record);
+    if (fwrite(&record, sizeof(record), 1, s_storage.journal) != 1) {
+        journal_discard();
+        return;
+    }
+    s_storage.journal_records++;
+}
+
+static void journal_sync(void)
+{
+    if (s_storage.journal && (fflush(s_storage.journal) != 0 || fsync(fileno(s_storage.journal)) != 0)) {
+        journal_discard();
+    }
+}
+
+static esp_err_t journal_write_checkpoint(const char *path)
+{
+    esp_err_t ret = ESP_OK;
+    journal_header_t header = {
+        .magic = STORAGE_JOURNAL_MAGIC,
+        .version = STORAGE_JOURNAL_VERSION,
+        .record_size = sizeof(journal_record_t),
+    };
+
+    FILE *fp = fopen(path, "wb");
+    ESP_RETURN_ON_FALSE(fp, ESP_FAIL, TAG, "failed to open '%s'", path);
+    ESP_GOTO_ON_FALSE(fwrite(&header, sizeof(header), 1, fp) == 1, ESP_FAIL, out, TAG, "failed to write journal header");
+    for (uint32_t i = 0; i < s_storage.index.count; i++) {
+        journal_record_t record = {
+            .type = JOURNAL_RECORD_ADD,
+            .entry = *index_at(i),
+        };
+        record.crc = journal_record_crc(&record);
+        ESP_GOTO_ON_FALSE(fwrite(&record, sizeof(record), 1, fp) == 1, ESP_FAIL, out, TAG, "failed to write journal record");
+    }
+    ESP_GOTO_ON_FALSE(fflush(fp) == 0 && fsync(fileno(fp)) == 0, ESP_FAIL, out, TAG, "failed to sync journal checkpoint");
+
+out:
+    if (fclose(fp) != 0 && ret == ESP_OK) {
+        ret = ESP_FAIL;
+    }
+    return ret;
+}
+
+/*
+ * Replaces the journal with one ADD record per indexed snapshot. The checkpoint is written next to the journal
+ * and renamed over it, so a power cut leaves either the old journal, the new one or none (and a rescan).
+ */
+static esp_err_t journal_checkpoint(void)
+{
+    esp_err_t ret = ESP_OK;
+    char tmp_path[112];
+
+    if (s_storage.journal) {
+        fclose(s_storage.journal);
+        s_storage.journal = NULL;
+    }
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s/%s", CATFLAPCAM_SDCARD_MOUNT_POINT, STORAGE_JOURNAL_TMP_NAME);
+    ESP_GOTO_ON_FALSE(n > 0 && (size_t)n < sizeof(tmp_path), ESP_ERR_INVALID_SIZE, fail, TAG, "journal path too long");
+    ESP_GOTO_ON_ERROR(journal_write_checkpoint(tmp_path), fail, TAG, "failed to write journal checkpoint");
+    if (unlink(s_storage.journal_path) != 0 && errno != ENOENT) {
+        ESP_GOTO_ON_FALSE(false, ESP_FAIL, fail, TAG, "failed to remove old journal: errno=%d", errno);
+    }
+    ESP_GOTO_ON_FALSE(rename(tmp_path, s_storage.journal_path) == 0, ESP_FAIL, fail, TAG, "failed to rename journal checkpoint: errno=%d", errno);
+
+    s_storage.journal = fopen(s_storage.journal_path, "ab");
+    ESP_GOTO_ON_FALSE(s_storage.journal, ESP_FAIL, fail, TAG, "failed to open journal for append");
+    s_storage.journal_records = s_storage.index.count;
+    return ESP_OK;
+
+fail:
+    unlink(tmp_path);
+    journal_discard();
+    return ret;
+}
+
+/* Every save adds an ADD and a DEL record once the ring is full, so the journal is compacted periodically. */
+static void journal_maybe_compact(void)
+{
+    if (s_storage.journal && s_storage.journal_records > 2 * s_storage.index.count + STORAGE_JOURNAL_COMPACT_SLACK) {
+        if (journal_checkpoint() != ESP_OK) {
+            ESP_LOGW(TAG, "failed to compact snapshot journal");
+        }
+    }
+}
+
+static esp_err_t journal_apply(const journal_record_t *record)
+{
+    snapshot_index_t *index = &s_storage.index;
+
+    switch (record->type) {
+    case JOURNAL_RECORD_ADD:
+        ESP_RETURN_ON_FALSE(index->count == 0 || record->entry.seq > index_at(index->count - 1)->seq, ESP_ERR_INVALID_STATE, TAG,
+                            "journal adds seq=%" PRIu64 " out of order", record->entry.seq);
+        return index_push_back(&record->entry);
+    case JOURNAL_RECORD_DEL: {
+        uint32_t pos = index_find_entry(&record->entry);
+        if (pos < index->count) {
+            index_remove(pos);
+        }
+        return ESP_OK;
+    }
+    case JOURNAL_RECORD_DROP_SEGMENT:
+        index_drop_segment(record->entry.segment);
+        return ESP_OK;
+    default:
+        ESP_LOGE(TAG, "unknown journal record type %u", record->type);
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+}
+
+/*
+ * Rebuilds the index by replaying the journal, which is read sequentially instead of walking the directory.
+ * Any mismatch, CRC failure or torn trailing record rejects the whole journal.
+ */
+static esp_err_t load_snapshot_journal(void)
+{
+    esp_err_t ret = ESP_OK;
+    journal_header_t header;
+    journal_record_t *records = NULL;
+    struct stat st;
+
+    FILE *fp = fopen(s_storage.journal_path, "rb");
+    if (!fp) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    ESP_GOTO_ON_FALSE(fstat(fileno(fp), &st) == 0, ESP_FAIL, out, TAG, "failed to stat journal");
+    ESP_GOTO_ON_FALSE(fread(&header, sizeof(header), 1, fp) == 1 && header.magic == STORAGE_JOURNAL_MAGIC &&
+                      header.version == STORAGE_JOURNAL_VERSION && header.record_size == sizeof(journal_record_t),
+                      ESP_ERR_INVALID_VERSION, out, TAG, "journal header mismatch");
+    ESP_GOTO_ON_FALSE((st.st_size - sizeof(header)) % sizeof(journal_record_t) == 0, ESP_ERR_INVALID_SIZE, out, TAG,
+                      "journal ends in a torn record");
+
+    records = malloc(STORAGE_JOURNAL_READ_RECORDS * sizeof(journal_record_t));
+    ESP_GOTO_ON_FALSE(records, ESP_ERR_NO_MEM, out, TAG, "failed to alloc journal read buffer");
+
+    s_storage.index.head = 0;
+    s_storage.index.count = 0;
+    s_storage.journal_records = 0;
+    size_t n;
+    while ((n = fread(records, sizeof(journal_record_t), STORAGE_JOURNAL_READ_RECORDS, fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            ESP_GOTO_ON_FALSE(journal_record_crc(&records[i]) == records[i].crc, ESP_ERR_INVALID_CRC, out, TAG,
+                              "journal record %" PRIu32 " fails its CRC", s_storage.journal_records);
+            ESP_GOTO_ON_ERROR(journal_apply(&records[i]), out, TAG, "failed to apply journal record %" PRIu32, s_storage.journal_records);
+            s_storage.journal_records++;
+        }
+    }
+    ESP_GOTO_ON_FALSE(!ferror(fp), ESP_FAIL, out, TAG, "failed to read journal");
+
+out:
+    free(records);
+    fclose(fp);
+    return ret;
+}
+
+/*
+ * Writes `prefix` then `data` to `fd`, whose position is `offset`, through the DMA-capable staging buffer.
+ * Except for the first and last, every write() covers one whole allocation unit at a cluster-aligned offset,
+ * which FATFS passes to the SDMMC driver as a single multi-block transfer instead of sector-sized bounces.
+ */
+static esp_err_t write_clusters(int fd, uint32_t offset, const void *prefix, size_t prefix_len, const uint8_t *data, size_t len)
+{
+    const uint8_t *parts[] = {prefix, data};
+    size_t part_lens[] = {prefix_len, len};
+    size_t room = STORAGE_ALLOCATION_UNIT - offset % STORAGE_ALLOCATION_UNIT;
+    size_t fill = 0;
+
+    for (int i = 0; i < 2; i++) {
+        const uint8_t *src = parts[i];
+        size_t left = part_lens[i];
+        while (left > 0) {
+            size_t n = MIN(left, room - fill);
+            memcpy(s_storage.write_buf + fill, src, n);
+            fill += n;
+            src += n;
+            left -= n;
+            if (fill == room) {
+                ESP_RETURN_ON_FALSE(write(fd, s_storage.write_buf, fill) == (ssize_t)fill, ESP_FAIL, TAG, "write failed: errno=%d", errno);
+                fill = 0;
+                room = STORAGE_ALLOCATION_UNIT;
+            }
+        }
+    }
+    if (fill > 0) {
+        ESP_RETURN_ON_FALSE(write(fd, s_storage.write_buf, fill) == (ssize_t)fill, ESP_FAIL, TAG, "write failed: errno=%d", errno);
+    }
+    return ESP_OK;
+}
+
+/* Creates `path` holding exactly `data`; a partially written file is removed. */
+static esp_err_t write_file_clusters(const char *path, const uint8_t *data, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0664);
+    ESP_RETURN_ON_FALSE(fd >= 0, ESP_FAIL, TAG, "failed to open '%s': errno=%d", path, errno);
+
+    /* Growing the file first allocates its cluster chain in one pass instead of one cluster per write. */
+    if (ftruncate(fd, len) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        ESP_LOGD(TAG, "failed to preallocate '%s': errno=%d", path, errno);
+    }
+    bool ok = write_clusters(fd, 0, NULL, 0, data, len) == ESP_OK;
+    ok = (close(fd) == 0) && ok;
+    if (!ok) {
+        unlink(path);
+        ESP_LOGE(TAG, "failed to write '%s'", path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+#if STORAGE_SEGMENTS
+static uint32_t segment_align(uint32_t len)
+{
+    return (len + SEGMENT_RECORD_ALIGN - 1) & ~(uint32_t)(SEGMENT_RECORD_ALIGN - 1);
+}
+
+static esp_err_t build_segment_path(uint16_t segment, char *path, size_t path_len)
+{
+    int n = snprintf(path, path_len, "%s/seg-%04u.dat", s_storage.seg.dir, (unsigned)segment);
+    return (n > 0 && (size_t)n < path_len) ? ESP_OK : ESP_FAIL;
+}
+
+static uint32_t segment_record_crc(const segment_record_header_t *header)
+{
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&header->generation, sizeof(header->generation));
+    return esp_rom_crc32_le(crc, (const uint8_t *)&header->entry, sizeof(header->entry));
+}
+
+/* Reads the record header at `offset` and checks that it was written by the segment's current generation. */
+static esp_err_t read_segment_record(FILE *fp, uint16_t segment, uint32_t offset, segment_record_header_t *header)
+{
+    if ((uint64_t)offset + sizeof(*header) > SEGMENT_SIZE || fseek(fp, offset, SEEK_SET) != 0 || fread(header, sizeof(*header), 1, fp) != 1) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (header->magic != SEGMENT_RECORD_MAGIC || header->generation != s_storage.seg.generation[segment] ||
+        header->crc != segment_record_crc(header) || header->entry.segment != segment || header->entry.offset != offset ||
+        header->entry.size == 0 || (uint64_t)offset + sizeof(*header) + header->entry.size > SEGMENT_SIZE) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+/* A missing segment file, or one created with another segment size, counts as never written. */
+static void load_segment_headers(void)
+{
+    segment_store_t *seg = &s_storage.seg;
+
+    seg->next_generation = 1;
+    for (uint16_t i = 0; i < SEGMENT_COUNT; i++) {
+        char path[128];
+        segment_header_t header;
+
+        seg->generation[i] = 0;
+        if (build_segment_path(i, path, sizeof(path)) != ESP_OK) {
+            continue;
+        }
+        FILE *fp = fopen(path, "rb");
+        if (!fp) {
+            continue;
+        }
+        if (fread(&header, sizeof(header), 1, fp) == 1 && header.magic == SEGMENT_MAGIC && header.size == SEGMENT_SIZE) {
+            seg->generation[i] = header.generation;
+            if (header.generation >= seg->next_generation) {
+                seg->next_generation = header.generation + 1;
+            }
+        }
+        fclose(fp);
+    }
+}
+
+/*
+ * Walks the valid records of one segment, optionally indexing them, and returns where the next record goes.
+ * `next_seq`, when given, receives the lowest sequence number that this segment has not used.
+ */
+static uint32_t walk_segment(uint16_t segment, bool index_records, uint64_t *next_seq)
+{
+    char path[128];
+    segment_header_t seg_header;
+    segment_record_header_t header;
+    uint32_t offset = sizeof(segment_header_t);
+
+    if (build_segment_path(segment, path, sizeof(path)) != ESP_OK) {
+        return offset;
+    }
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return offset;
+    }
+    if (next_seq && fread(&seg_header, sizeof(seg_header), 1, fp) == 1) {
+        *next_seq = seg_header.first_seq;
+    }
+    while (read_segment_record(fp, segment, offset, &header) == ESP_OK) {
+        if (index_records && index_push_back(&header.entry) != ESP_OK) {
+            break;
+        }
+        if (next_seq && header.entry.seq >= *next_seq) {
+            *next_seq = header.entry.seq + 1;
+        }
+        offset += segment_align(sizeof(header) + header.entry.size);
+    }
+    fclose(fp);
+    return offset;
+}
+
+/* Rebuilds the index from the record headers, oldest segment generation first. */
+static esp_err_t scan_segments(void)
+{
+    segment_store_t *seg = &s_storage.seg;
+    uint32_t last_generation = 0;
+
+    s_storage.index.head = 0;
+    s_storage.index.count = 0;
+    while (1) {
+        uint16_t next = SEGMENT_NONE;
+        for (uint16_t i = 0; i < SEGMENT_COUNT; i++) {
+            if (seg->generation[i] > last_generation && (next == SEGMENT_NONE || seg->generation[i] < seg->generation[next])) {
+                next = i;
+            }
+        }
+        if (next == SEGMENT_NONE) {
+            break;
+        }
+        walk_segment(next, true, NULL);
+        last_generation = seg->generation[next];
+    }
+    qsort(s_storage.index.entries, s_storage.index.count, sizeof(snapshot_index_entry_t), compare_index_entry_asc);
+    return ESP_OK;
+}
+
+/* Drops journal entries that point into segments which no longer exist in their recorded generation. */
+static void prune_segment_index(void)
+{
+    snapshot_index_t *index = &s_storage.index;
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        snapshot_index_entry_t entry = *index_at(i);
+        if (entry.segment < SEGMENT_COUNT && s_storage.seg.generation[entry.segment] != 0) {
+            *index_at(kept++) = entry;
+        }
+    }
+    index->count = kept;
+}
+
+static esp_err_t segment_open(uint16_t segment)
+{
+    segment_store_t *seg = &s_storage.seg;
+    char path[128];
+    struct stat st;
+
+    ESP_RETURN_ON_ERROR(build_segment_path(segment, path, sizeof(path)), TAG, "failed to build segment path");
+    if (stat(path, &st) != 0 || st.st_size != SEGMENT_SIZE) {
+        /* Seeking past the end allocates the whole cluster chain without writing the data area. */
+        FILE *fp = fopen(path, "wb");
+        ESP_RETURN_ON_FALSE(fp, ESP_FAIL, TAG, "failed to create segment '%s'", path);
+        bool ok = fseek(fp, SEGMENT_SIZE - 1, SEEK_SET) == 0 && fputc(0, fp) != EOF;
+        ok = (fclose(fp) == 0) && ok;
+        ESP_RETURN_ON_FALSE(ok, ESP_FAIL, TAG, "failed to preallocate segment '%s'", path);
+    }
+    seg->fp = fopen(path, "r+b");
+    ESP_RETURN_ON_FALSE(seg->fp, ESP_FAIL, TAG, "failed to open segment '%s'", path);
+    return ESP_OK;
+}
+
+/*
+ * Moves writing on to the next segment in rotation. Any snapshots that segment still holds are dropped from the
+ * index in one journal record before its header is rewritten. A failed advance retries the same segment.
+ */
+static esp_err_t segment_advance(uint64_t first_seq)
+{
+    segment_store_t *seg = &s_storage.seg;
+    uint16_t next = seg->next;
+
+    if (seg->fp) {
+        fclose(seg->fp);
+        seg->fp = NULL;
+    }
+    seg->current = SEGMENT_NONE;
+
+    uint32_t dropped = index_drop_segment(next);
+    if (seg->generation[next] != 0) {
+        snapshot_index_entry_t drop = {
+            .segment = next,
+        };
+        journal_append(JOURNAL_RECORD_DROP_SEGMENT, &drop);
+        journal_sync();
+    }
+
+    ESP_RETURN_ON_ERROR(segment_open(next), TAG, "failed to open segment %u", (unsigned)next);
+    segment_header_t header = {
+        .magic = SEGMENT_MAGIC,
+        .generation = seg->next_generation,
+        .size = SEGMENT_SIZE,
+        .first_seq = first_seq,
+    };
+    if (fseek(seg->fp, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, seg->fp) != 1 || fflush(seg->fp) != 0) {
+        fclose(seg->fp);
+        seg->fp = NULL;
+        ESP_LOGE(TAG, "failed to write header of segment %u", (unsigned)next);
+        return ESP_FAIL;
+    }
+    seg->generation[next] = seg->next_generation++;
+    seg->current = next;
+    seg->next = (next + 1) % SEGMENT_COUNT;
+    seg->write_offset = sizeof(header);
+    ESP_LOGI(TAG, "snapshot segment %u started (generation %" PRIu32 ", %" PRIu32 " snapshots reclaimed)",
+             (unsigned)next, seg->generation[next], dropped);
+    return ESP_OK;
+}
+
+/*
+ * Continues writing after the last valid record of the newest segment. Index entries past that point were
+ * journaled but never written, so they are dropped. Records stay in their segment after a delete, so the
+ * sequence counter never goes back below what the newest segment has used.
+ */
+static esp_err_t segment_resume(void)
+{
+    segment_store_t *seg = &s_storage.seg;
+    snapshot_index_t *index = &s_storage.index;
+    uint16_t newest = SEGMENT_NONE;
+
+    for (uint16_t i = 0; i < SEGMENT_COUNT; i++) {
+        if (seg->generation[i] != 0 && (newest == SEGMENT_NONE || seg->generation[i] > seg->generation[newest])) {
+            newest = i;
+        }
+    }
+    if (newest == SEGMENT_NONE) {
+        return ESP_OK;
+    }
+
+    uint64_t next_seq = 0;
+    seg->write_offset = walk_segment(newest, false, &next_seq);
+    while (index->count > 0 && index_at(index->count - 1)->segment == newest && index_at(index->count - 1)->offset >= seg->write_offset) {
+        journal_append(JOURNAL_RECORD_DEL, index_at(index->count - 1));
+        index->count--;
+    }
+    journal_sync();
+    if (next_seq > s_storage.next_seq) {
+        s_storage.next_seq = next_seq;
+    }
+    seg->next = (newest + 1) % SEGMENT_COUNT;
+    ESP_RETURN_ON_ERROR(segment_open(newest), TAG, "failed to open segment %u", (unsigned)newest);
+    seg->current = newest;
+    return ESP_OK;
+}
+
+static esp_err_t segment_place(snapshot_index_entry_t *entry)
+{
+    segment_store_t *seg = &s_storage.seg;
+    uint32_t need = segment_align(sizeof(segment_record_header_t) + entry->size);
+
+    ESP_RETURN_ON_FALSE(need <= SEGMENT_SIZE - sizeof(segment_header_t), ESP_ERR_INVALID_SIZE, TAG, "snapshot larger than a segment");
+    if (seg->current == SEGMENT_NONE || seg->write_offset + need > SEGMENT_SIZE) {
+        ESP_RETURN_ON_ERROR(segment_advance(entry->seq), TAG, "failed to start a new segment");
+    }
+    entry->segment = seg->current;
+    entry->offset = seg->write_offset;
+    seg->write_offset += need;
+    return ESP_OK;
+}
+
+static esp_err_t segment_write_record(const snapshot_index_entry_t *entry, const uint8_t *jpg, size_t jpg_len)
+{
+    segment_store_t *seg = &s_storage.seg;
+    FILE *fp = seg->fp;
+    char path[128];
+
+    /* A batch that crossed into a new segment still has records placed in the previous one. */
+    if (entry->segment != seg->current || !fp) {
+        ESP_RETURN_ON_ERROR(build_segment_path(entry->segment, path, sizeof(path)), TAG, "failed to build segment path");
+        fp = fopen(path, "r+b");
+        ESP_RETURN_ON_FALSE(fp, ESP_FAIL, TAG, "failed to open segment '%s'", path);
+    }
+
+    segment_record_header_t header = {
+        .magic = SEGMENT_RECORD_MAGIC,
+        .generation = seg->generation[entry->segment],
+        .entry = *entry,
+    };
+    header.crc = segment_record_crc(&header);
+    bool ok = fflush(fp) == 0 && lseek(fileno(fp), entry->offset, SEEK_SET) == (off_t)entry->offset &&
+              write_clusters(fileno(fp), entry->offset, &header, sizeof(header), jpg, jpg_len) == ESP_OK;
+    if (fp != seg->fp) {
+        ok = (fclose(fp) == 0) && ok;
+    }
+    ESP_RETURN_ON_FALSE(ok, ESP_FAIL, TAG, "failed to write snapshot seq=%" PRIu64 " to segment %u", entry->seq, (unsigned)entry->segment);
+
+    return index_push_back(entry);
+}
+#endif
+
+/* Rebuilds the in-RAM index from the journal, falling back to a directory scan that writes a new checkpoint. */
+static esp_err_t build_snapshot_index(void)
+{
+    int n = snprintf(s_storage.journal_path, sizeof(s_storage.journal_path), "%s/%s", CATFLAPCAM_SDCARD_MOUNT_POINT, STORAGE_JOURNAL_NAME);
+    ESP_RETURN_ON_FALSE(n > 0 && n < (int)sizeof(s_storage.journal_path), ESP_ERR_INVALID_SIZE, TAG, "journal path too long");
+    if (!s_storage.index.entries) {
+        ESP_RETURN_ON_ERROR(index_grow(), TAG, "failed to alloc snapshot index");
     }
 
-    size_t rem_len = strlen(endp);
-    if (rem_len <= suffix_len || strcmp(endp + rem_len - suffix_len, SNAPSHOT_NAME_SUFFIX) != 0) {
-        return false;
+#if STORAGE_SEGMENTS
+    load_segment_headers();
+#endif
+    esp_err_t ret = load_snapshot_journal();
+    if (ret == ESP_OK) {
+#if STORAGE_SEGMENTS
+        prune_segment_index();
+#endif
+        s_storage.journal = fopen(s_storage.journal_path, "ab");
+        if (!s_storage.journal) {
+            journal_discard();
+        }
+        journal_maybe_compact();
+        ESP_LOGI(TAG, "snapshot index loaded from journal (%" PRIu32 " records)", s_storage.journal_records);
+        return ESP_OK;
     }
 
-    if (seq) {
-        *seq = (uint64_t)seq_ull;
+#if STORAGE_SEGMENTS
+    ESP_LOGW(TAG, "snapshot journal unusable (%s), scanning snapshot segments", esp_err_to_name(ret));
+    ESP_RETURN_ON_ERROR(scan_segments(), TAG, "failed to scan snapshot segments");
+#else
+    ESP_LOGW(TAG, "snapshot journal unusable (%s), scanning snapshot dir", esp_err_to_name(ret));
+    ESP_RETURN_ON_ERROR(scan_snapshot_index(), TAG, "failed to scan snapshot dir");
+#endif
+    if (journal_checkpoint() != ESP_OK) {
+        ESP_LOGW(TAG, "failed to write snapshot journal, continuing without it");
     }
-    return true;
+    return ESP_OK;
 }
 
-static esp_err_t build_snapshot_name(uint64_t seq, char *name, size_t name_len)
+static uint64_t cluster_bytes(uint64_t size)
 {
-    time_t now = time(NULL);
-    struct tm tm_now = {0};
-    localtime_r(&now, &tm_now);
-    int year = tm_now.tm_year + 1900;
-    int month = tm_now.tm_mon + 1;
-    int day = tm_now.tm_mday;
-    int hour = tm_now.tm_hour;
-    int minute = tm_now.tm_min;
-    int second = tm_now.tm_sec;
-
-    int n = snprintf(name, name_len, SNAPSHOT_NAME_PREFIX "%020llu-%04d%02d%02d-%02d%02d%02d" SNAPSHOT_NAME_SUFFIX,
-                     (unsigned long long)seq, year, month, day, hour, minute, second);
-    return (n > 0 && (size_t)n < name_len) ? ESP_OK : ESP_FAIL;
+    return (size + STORAGE_ALLOCATION_UNIT - 1) / STORAGE_ALLOCATION_UNIT * STORAGE_ALLOCATION_UNIT;
 }
 
-static esp_err_t build_snapshot_path(const char *name, char *path, size_t path_len)
+/* FatFs keeps its free cluster count up to date once it has been computed at mount, so re-reading it is cheap. */
+static void refresh_free_space(void)
 {
-    int n = snprintf(path, path_len, "%s/%s", s_storage.snapshot_dir, name);
-    return (n > 0 && (size_t)n < path_len) ? ESP_OK : ESP_FAIL;
+    s_storage.free_read_us = esp_timer_get_time();
+#if !STORAGE_SEGMENTS
+    uint64_t total_bytes = 0;
+    uint64_t free_bytes = 0;
+    esp_err_t ret = esp_vfs_fat_info(CATFLAPCAM_SDCARD_MOUNT_POINT, &total_bytes, &free_bytes);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "failed to read card free space: %s", esp_err_to_name(ret));
+        return;
+    }
+    s_storage.free_bytes = free_bytes;
+    s_storage.free_known = true;
+#endif
 }
 
-static esp_err_t scan_snapshot_state(uint64_t *oldest_seq, uint64_t *newest_seq, uint32_t *file_count)
+#if !STORAGE_SEGMENTS
+static void note_space_used(uint32_t size)
 {
-    DIR *dir = opendir(s_storage.snapshot_dir);
-    ESP_RETURN_ON_FALSE(dir, ESP_FAIL, TAG, "failed to open snapshot dir");
+    s_storage.free_bytes -= MIN(s_storage.free_bytes, cluster_bytes(size));
+}
 
-    uint64_t min_seq = UINT64_MAX;
-    uint64_t max_seq = 0;
-    uint32_t count = 0;
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        uint64_t seq = 0;
-        if (!parse_snapshot_seq(entry->d_name, &seq)) {
-            continue;
-        }
-        if (seq < min_seq) {
-            min_seq = seq;
-        }
-        if (seq > max_seq) {
-            max_seq = seq;
-        }
-        count++;
-    }
-    closedir(dir);
+static void note_space_freed(uint32_t size)
+{
+    s_storage.free_bytes += cluster_bytes(size);
+}
+#endif
 
-    if (count == 0) {
-        *oldest_seq = 0;
-        *newest_seq = 0;
-    } else {
-        *oldest_seq = min_seq;
-        *newest_seq = max_seq;
+/* Evicts the `count` oldest snapshots straight from the front of the index. */
+static esp_err_t delete_oldest_snapshots(uint32_t count)
+{
+    ESP_RETURN_ON_FALSE(s_storage.index.count > 0, ESP_ERR_NOT_FOUND, TAG, "no snapshot found to evict");
+
+    for (uint32_t i = 0; i < count && s_storage.index.count > 0; i++) {
+#if STORAGE_SEGMENTS
+        /* The space comes back when the segment is reclaimed; only the index entry goes now. */
+        journal_append(JOURNAL_RECORD_DEL, index_at(0));
+        index_pop_front();
+#else
+        char name[SNAPSHOT_NAME_MAX_LEN];
+        char path[128];
+        ESP_RETURN_ON_ERROR(index_entry_name(index_at(0), name, sizeof(name)), TAG, "failed to build oldest snapshot name");
+        ESP_RETURN_ON_ERROR(build_snapshot_path(name, path, sizeof(path)), TAG, "failed to build oldest snapshot path");
+        if (unlink(path) != 0 && errno != ENOENT) {
+            ESP_LOGW(TAG, "failed to delete oldest snapshot '%s': errno=%d", path, errno);
+            return ESP_FAIL;
+        }
+        uint64_t shard = snapshot_shard(index_at(0)->seq);
+        note_space_freed(index_at(0)->size);
+        journal_append(JOURNAL_RECORD_DEL, index_at(0));
+        index_pop_front();
+        release_shard_if_empty(shard, 0);
+#endif
+        s_storage.evicted++;
     }
-    *file_count = count;
     return ESP_OK;
 }
 
-static esp_err_t delete_oldest_snapshot(void)
+/*
+ * Counts the oldest snapshots that have to go for the index plus `add_count` new snapshots of `add_bytes` to
+ * stay `headroom` steps of retention headroom inside the file count, the byte budget and the free space
+ * watermark. Without headroom the watermark is not applied, the new snapshots only have to fit on the card.
+ */
+static uint32_t retention_excess(uint32_t add_count, uint64_t add_bytes, uint32_t headroom)
 {
-    DIR *dir = opendir(s_storage.snapshot_dir);
-    ESP_RETURN_ON_FALSE(dir, ESP_FAIL, TAG, "failed to open snapshot dir");
+    const snapshot_index_t *index = &s_storage.index;
+    uint32_t max_files = CATFLAPCAM_SNAPSHOT_MAX_FILES - MIN(headroom * RETENTION_HEADROOM_FILES, CATFLAPCAM_SNAPSHOT_MAX_FILES / 2);
+    uint64_t slack = headroom * RETENTION_HEADROOM_BYTES;
+    uint64_t budget = RETENTION_BUDGET_BYTES - MIN(slack, RETENTION_BUDGET_BYTES / 2);
+    uint64_t want_free = add_bytes + (uint64_t)add_count * STORAGE_ALLOCATION_UNIT;
+    uint64_t bytes = index->bytes + add_bytes;
+    uint64_t free_bytes = s_storage.free_bytes;
+    uint32_t n = 0;
+
+    if (headroom > 0 && RETENTION_MIN_FREE_BYTES > 0) {
+        want_free += RETENTION_MIN_FREE_BYTES + slack;
+    }
+    while (n < index->count && (index->count - n + add_count > max_files || (RETENTION_BUDGET_BYTES > 0 && bytes > budget) ||
+                                (s_storage.free_known && free_bytes < want_free))) {
+        uint32_t size = index_at(n)->size;
+        bytes -= MIN(bytes, size);
+        free_bytes += cluster_bytes(size);
+        n++;
+    }
+    return n;
+}
 
-    uint64_t min_seq = UINT64_MAX;
-    char oldest_name[SNAPSHOT_NAME_MAX_LEN] = {0};
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        uint64_t seq = 0;
-        if (!parse_snapshot_seq(entry->d_name, &seq)) {
+/* Stats a few of the entries a directory scan left unsized, oldest first, so the byte budget sees them. */
+static void fill_unknown_sizes(uint32_t budget)
+{
+    if (s_storage.unsized == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < s_storage.index.count && s_storage.unsized > 0 && budget > 0; i++) {
+        snapshot_index_entry_t *entry = index_at(i);
+        char name[SNAPSHOT_NAME_MAX_LEN];
+        char path[128];
+        struct stat st;
+        if (entry->size != 0) {
             continue;
         }
-        if (seq < min_seq) {
-            min_seq = seq;
-            strlcpy(oldest_name, entry->d_name, sizeof(oldest_name));
+        budget--;
+        if (index_entry_name(entry, name, sizeof(name)) == ESP_OK && build_snapshot_path(name, path, sizeof(path)) == ESP_OK &&
+            stat(path, &st) == 0 && st.st_size > 0) {
+            index_fill_size(entry, (uint32_t)st.st_size);
+        } else if (s_storage.unsized > 0) {
+            s_storage.unsized--;
         }
     }
-    closedir(dir);
-
-    ESP_RETURN_ON_FALSE(oldest_name[0] != '\0', ESP_ERR_NOT_FOUND, TAG, "no snapshot found to evict");
-
-    char path[128];
-    ESP_RETURN_ON_ERROR(build_snapshot_path(oldest_name, path, sizeof(path)), TAG, "failed to build oldest snapshot path");
+    /* Checkpoint once all are known, so the next boot loads the sizes instead of stat()ing every file again. */
+    if (s_storage.unsized == 0 && s_storage.journal && journal_checkpoint() != ESP_OK) {
+        ESP_LOGW(TAG, "failed to checkpoint snapshot sizes");
+    }
+}
 
-    if (unlink(path) != 0) {
-        ESP_LOGW(TAG, "failed to delete oldest snapshot '%s': errno=%d", path, errno);
-        return ESP_FAIL;
+/*
+ * Keeps the snapshots inside the retention limits ahead of the saves: once they come within one headroom of a
+ * limit, the oldest are evicted a batch at a time, dropping the lock in between, until they are two away.
+ */
+static void retention_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(RETENTION_INTERVAL_MS));
+        if (xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) != pdPASS) {
+            continue;
+        }
+        if (esp_timer_get_time() - s_storage.free_read_us >= STORAGE_FREE_REFRESH_US) {
+            refresh_free_space();
+        }
+        fill_unknown_sizes(RETENTION_BATCH * 4);
+
+        uint64_t evicted = s_storage.evicted;
+        bool locked = true;
+        if (retention_excess(0, 0, 1) > 0) {
+            uint32_t excess;
+            while ((excess = retention_excess(0, 0, 2)) > 0) {
+                if (delete_oldest_snapshots(MIN(excess, RETENTION_BATCH)) != ESP_OK) {
+                    break;
+                }
+                journal_sync();
+                xSemaphoreGive(s_storage.lock);
+                if (xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) != pdPASS) {
+                    locked = false;
+                    break;
+                }
+            }
+        }
+        if (locked) {
+            if (s_storage.evicted != evicted) {
+                ESP_LOGI(TAG, "retention evicted %" PRIu64 " snapshots (files=%" PRIu32 ", bytes=%" PRIu64 ", free=%" PRIu64 ")",
+                         s_storage.evicted - evicted, s_storage.index.count, s_storage.index.bytes, s_storage.free_bytes);
+                journal_maybe_compact();
+            }
+            xSemaphoreGive(s_storage.lock);
+        }
     }
-    return ESP_OK;
 }
 
 static esp_err_t mount_sdcard(int slot, int width)
@@ -211,7 +1391,7 @@ static esp_err_t mount_sdcard(int slot, int width)
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
         .format_if_mount_failed = CATFLAPCAM_SDCARD_FORMAT_IF_MOUNT_FAILED,
         .max_files = 8,
-        .allocation_unit_size = 16 * 1024,
+        .allocation_unit_size = STORAGE_ALLOCATION_UNIT,
         .disk_status_check_enable = false,
         .use_one_fat = false,
     };
@@ -236,6 +1416,10 @@ esp_err_t catflapcam_storage_init(void)
         s_storage.lock = xSemaphoreCreateMutex();
         ESP_RETURN_ON_FALSE(s_storage.lock, ESP_ERR_NO_MEM, TAG, "failed to create storage mutex");
     }
+    if (!s_storage.write_buf) {
+        s_storage.write_buf = heap_caps_aligned_alloc(STORAGE_WRITE_BUF_ALIGN, STORAGE_ALLOCATION_UNIT, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+        ESP_RETURN_ON_FALSE(s_storage.write_buf, ESP_ERR_NO_MEM, TAG, "failed to alloc storage write buffer");
+    }
 
     esp_err_t ret = mount_sdcard(CATFLAPCAM_SDCARD_SLOT, CATFLAPCAM_SDCARD_BUS_WIDTH);
     if (ret != ESP_OK && CATFLAPCAM_SDCARD_BUS_WIDTH > 1) {
@@ -254,14 +1438,32 @@ esp_err_t catflapcam_storage_init(void)
         ESP_LOGE(TAG, "failed to create snapshot dir '%s': errno=%d", s_storage.snapshot_dir, errno);
         return ESP_FAIL;
     }
+#if STORAGE_SEGMENTS
+    n = snprintf(s_storage.seg.dir, sizeof(s_storage.seg.dir), "%s/%s", CATFLAPCAM_SDCARD_MOUNT_POINT, SEGMENT_DIR_NAME);
+    ESP_RETURN_ON_FALSE(n > 0 && n < (int)sizeof(s_storage.seg.dir), ESP_ERR_INVALID_SIZE, TAG, "segment dir path too long");
+    if (mkdir(s_storage.seg.dir, 0775) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "failed to create segment dir '%s': errno=%d", s_storage.seg.dir, errno);
+        return ESP_FAIL;
+    }
+#endif
 
-    uint64_t newest_seq = 0;
-    ESP_RETURN_ON_ERROR(scan_snapshot_state(&s_storage.oldest_seq, &newest_seq, &s_storage.file_count), TAG, "failed to scan snapshot state");
-    s_storage.next_seq = (s_storage.file_count == 0) ? 1 : (newest_seq + 1);
+    ESP_RETURN_ON_ERROR(build_snapshot_index(), TAG, "failed to build snapshot index");
+    index_update_next_seq();
+#if STORAGE_SEGMENTS
+    ESP_RETURN_ON_ERROR(segment_resume(), TAG, "failed to resume snapshot segments");
+#endif
+    index_recount();
+    refresh_free_space();
     s_storage.mounted = true;
+    if (!s_storage.retention_task &&
+        xTaskCreate(retention_task, "storage_retention", RETENTION_TASK_STACK_SIZE, NULL, RETENTION_TASK_PRIORITY,
+                    &s_storage.retention_task) != pdPASS) {
+        ESP_LOGW(TAG, "failed to create retention task, saves will evict inline");
+    }
 
-    ESP_LOGI(TAG, "SD snapshot storage ready at %s (files=%" PRIu32 ", next_seq=%" PRIu64 ", max_files=%d)",
-             s_storage.snapshot_dir, s_storage.file_count, s_storage.next_seq, CATFLAPCAM_SNAPSHOT_MAX_FILES);
+    ESP_LOGI(TAG, "SD snapshot storage ready at %s (files=%" PRIu32 ", bytes=%" PRIu64 ", free=%" PRIu64 ", next_seq=%" PRIu64 ", max_files=%d)",
+             s_storage.snapshot_dir, s_storage.index.count, s_storage.index.bytes, s_storage.free_bytes, s_storage.next_seq,
+             CATFLAPCAM_SNAPSHOT_MAX_FILES);
     return ESP_OK;
 }
 
@@ -270,194 +1472,547 @@ bool catflapcam_storage_is_ready(void)
     return s_storage.enabled && s_storage.mounted;
 }
 
+static int64_t epoch_ms_now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+static esp_err_t make_snapshot_entry(uint64_t seq, const catflapcam_storage_blob_t *blob, int64_t now_ms, snapshot_index_entry_t *entry)
+{
+    struct tm tm_now = {0};
+
+    memset(entry, 0, sizeof(*entry));
+    entry->seq = seq;
+    entry->timestamp_ms = blob->timestamp_ms ? blob->timestamp_ms : now_ms;
+    entry->size = (uint32_t)blob->len;
+    entry->seq_digits = SNAPSHOT_SEQ_DIGITS;
+    entry->source = blob->source;
+    time_t t = (time_t)(entry->timestamp_ms / 1000);
+    localtime_r(&t, &tm_now);
+    /* Each field is clamped to its width, so the suffix always fills SNAPSHOT_INDEX_SUFFIX_LEN exactly. */
+    int len = snprintf(entry->suffix, sizeof(entry->suffix), "-%04u%02u%02u-%02u%02u%02u", (unsigned)(tm_now.tm_year + 1900) % 10000u,
+                       (unsigned)(tm_now.tm_mon + 1) % 100u, (unsigned)tm_now.tm_mday % 100u, (unsigned)tm_now.tm_hour % 100u,
+                       (unsigned)tm_now.tm_min % 100u, (unsigned)tm_now.tm_sec % 100u);
+    ESP_RETURN_ON_FALSE(len == SNAPSHOT_INDEX_SUFFIX_LEN - 1, ESP_ERR_INVALID_SIZE, TAG, "bad snapshot name suffix");
+    return ESP_OK;
+}
+
+#if !STORAGE_SEGMENTS
+static esp_err_t write_snapshot_file(const snapshot_index_entry_t *entry, const uint8_t *jpg, size_t jpg_len)
+{
+    char name[SNAPSHOT_NAME_MAX_LEN];
+    char path[128];
+    ESP_RETURN_ON_ERROR(index_entry_name(entry, name, sizeof(name)), TAG, "failed to build snapshot name");
+    ESP_RETURN_ON_ERROR(build_snapshot_path(name, path, sizeof(path)), TAG, "failed to build snapshot path");
+    ESP_RETURN_ON_ERROR(ensure_shard_dir(entry->seq), TAG, "failed to create shard for '%s'", name);
+
+    ESP_RETURN_ON_ERROR(write_file_clusters(path, jpg, jpg_len), TAG, "failed to write snapshot '%s'", name);
+    note_space_used(jpg_len);
+
+    ESP_RETURN_ON_ERROR(index_push_back(entry), TAG, "failed to index snapshot '%s'", name);
+    return ESP_OK;
+}
+#endif
+
 esp_err_t catflapcam_storage_save_snapshot(const uint8_t *jpg, size_t jpg_len)
 {
-    ESP_RETURN_ON_FALSE(jpg && jpg_len > 0, ESP_ERR_INVALID_ARG, TAG, "invalid jpeg buffer");
+    catflapcam_storage_blob_t blob = {
+        .data = jpg,
+        .len = jpg_len,
+        .source = CATFLAPCAM_STORAGE_SOURCE_UNKNOWN,
+    };
+
+    return catflapcam_storage_save_snapshots(&blob, 1, NULL);
+}
+
+esp_err_t catflapcam_storage_save_snapshots(const catflapcam_storage_blob_t *blobs, size_t count, size_t *saved)
+{
+    size_t done = 0;
+
+    if (saved) {
+        *saved = 0;
+    }
+    ESP_RETURN_ON_FALSE(blobs && count > 0 && count <= CATFLAPCAM_SNAPSHOT_MAX_FILES, ESP_ERR_INVALID_ARG, TAG, "invalid snapshot batch");
+    for (size_t i = 0; i < count; i++) {
+        ESP_RETURN_ON_FALSE(blobs[i].data && blobs[i].len > 0, ESP_ERR_INVALID_ARG, TAG, "invalid jpeg buffer");
+    }
     ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD storage not ready");
 
     ESP_RETURN_ON_FALSE(xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) == pdPASS,
                         ESP_ERR_TIMEOUT, TAG, "timeout waiting for storage lock");
 
     esp_err_t ret = ESP_OK;
-    if (s_storage.file_count >= CATFLAPCAM_SNAPSHOT_MAX_FILES) {
-        ret = delete_oldest_snapshot();
-        if (ret == ESP_OK) {
-            uint64_t newest_seq = 0;
-            ret = scan_snapshot_state(&s_storage.oldest_seq, &newest_seq, &s_storage.file_count);
+    int64_t now_ms = epoch_ms_now();
+    size_t placed = 0;
+    uint64_t batch_bytes = 0;
+    snapshot_index_entry_t *entries = calloc(count, sizeof(snapshot_index_entry_t));
+    ESP_GOTO_ON_FALSE(entries, ESP_ERR_NO_MEM, out, TAG, "failed to alloc snapshot batch");
+    for (size_t i = 0; i < count; i++) {
+        batch_bytes += blobs[i].len;
+    }
+    /* The retention task normally keeps the limits clear; this is only the hard stop when it falls behind. */
+    uint32_t excess = retention_excess(count, batch_bytes, 0);
+    if (excess > 0) {
+        if (s_storage.retention_task) {
+            ESP_LOGW(TAG, "retention behind, evicting %" PRIu32 " snapshots inline", excess);
         }
-        ESP_GOTO_ON_ERROR(ret, out, TAG, "failed to evict oldest snapshot");
+        ESP_GOTO_ON_ERROR(delete_oldest_snapshots(excess), out, TAG, "failed to evict oldest snapshots");
     }
 
-    char name[SNAPSHOT_NAME_MAX_LEN];
-    char path[128];
-    ESP_GOTO_ON_ERROR(build_snapshot_name(s_storage.next_seq, name, sizeof(name)), out, TAG, "failed to build snapshot name");
-    ESP_GOTO_ON_ERROR(build_snapshot_path(name, path, sizeof(path)), out, TAG, "failed to build snapshot path");
-
-    FILE *fp = fopen(path, "wb");
-    ESP_GOTO_ON_FALSE(fp, ESP_FAIL, out, TAG, "failed to open snapshot path '%s'", path);
-    size_t written = fwrite(jpg, 1, jpg_len, fp);
-    int flush_ret = fflush(fp);
-    int close_ret = fclose(fp);
-    ESP_GOTO_ON_FALSE(written == jpg_len && flush_ret == 0 && close_ret == 0, ESP_FAIL, out, TAG, "failed to write snapshot '%s'", path);
+    /* Journal records go to the card ahead of the data, so a power cut can leave a stale entry but never an unindexed snapshot. */
+    for (placed = 0; placed < count; placed++) {
+        ESP_GOTO_ON_ERROR(make_snapshot_entry(s_storage.next_seq + placed, &blobs[placed], now_ms, &entries[placed]), out, TAG,
+                          "failed to name snapshot %u/%u", (unsigned)(placed + 1), (unsigned)count);
+#if STORAGE_SEGMENTS
+        ESP_GOTO_ON_ERROR(segment_place(&entries[placed]), out, TAG, "failed to place snapshot %u/%u",
+                          (unsigned)(placed + 1), (unsigned)count);
+#endif
+        journal_append(JOURNAL_RECORD_ADD, &entries[placed]);
+    }
+    journal_sync();
 
-    s_storage.file_count++;
-    if (s_storage.file_count == 1) {
-        s_storage.oldest_seq = s_storage.next_seq;
+    for (done = 0; done < count; done++) {
+#if STORAGE_SEGMENTS
+        ret = segment_write_record(&entries[done], blobs[done].data, blobs[done].len);
+#else
+        ret = write_snapshot_file(&entries[done], blobs[done].data, blobs[done].len);
+#endif
+        ESP_GOTO_ON_ERROR(ret, out, TAG, "failed to save snapshot %u/%u", (unsigned)(done + 1), (unsigned)count);
     }
-    s_storage.next_seq++;
 
 out:
+    for (size_t i = done; i < placed && ret != ESP_OK; i++) {
+        journal_append(JOURNAL_RECORD_DEL, &entries[i]);
+    }
+#if STORAGE_SEGMENTS
+    /* A scan stops at the first invalid record, so unwritten space is reused rather than left as a hole. */
+    if (done < placed && entries[done].segment == s_storage.seg.current) {
+        s_storage.seg.write_offset = entries[done].offset;
+    }
+    if (done > 0 && s_storage.seg.fp) {
+        fsync(fileno(s_storage.seg.fp));
+    }
+#endif
+    free(entries);
+    s_storage.next_seq += done;
+    journal_sync();
+    journal_maybe_compact();
     xSemaphoreGive(s_storage.lock);
+    if (done > 0 && s_storage.retention_task) {
+        xTaskNotifyGive(s_storage.retention_task);
+    }
+    if (saved) {
+        *saved = done;
+    }
     return ret;
 }
 
-static int compare_snapshot_desc(const void *a, const void *b)
+/* Returns the position of the first entry captured after `to_ms`, assuming capture times ascend with seq. */
+static uint32_t index_time_upper_bound(int64_t to_ms)
 {
-    const snapshot_entry_t *lhs = (const snapshot_entry_t *)a;
-    const snapshot_entry_t *rhs = (const snapshot_entry_t *)b;
-    if (lhs->seq > rhs->seq) {
-        return -1;
+    uint32_t lo = 0;
+    uint32_t hi = s_storage.index.count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index_at(mid)->timestamp_ms <= to_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
-    if (lhs->seq < rhs->seq) {
-        return 1;
+    return lo;
+}
+
+/* Returns the position of the first entry captured at or after `from_ms`. */
+static uint32_t index_time_lower_bound(int64_t from_ms)
+{
+    uint32_t lo = 0;
+    uint32_t hi = s_storage.index.count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index_at(mid)->timestamp_ms < from_ms) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
     }
-    return 0;
+    return lo;
 }
 
-char *catflapcam_storage_list_json(size_t limit)
+esp_err_t catflapcam_storage_list_snapshots(const catflapcam_storage_query_t *query, catflapcam_storage_snapshot_info_t *infos,
+                                           size_t max, size_t *ret_count, uint64_t *ret_next_seq, uint32_t *ret_total)
 {
-    if (!catflapcam_storage_is_ready()) {
-        return strdup("{\"snapshots\":[]}");
+    ESP_RETURN_ON_FALSE(query && infos && max > 0 && ret_count && ret_next_seq, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    *ret_count = 0;
+    *ret_next_seq = 0;
+    if (ret_total) {
+        *ret_total = 0;
     }
+    ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD storage not ready");
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) == pdPASS,
+                        ESP_ERR_TIMEOUT, TAG, "timeout waiting for storage lock");
 
-    if (limit == 0) {
-        limit = 200;
+    uint32_t pos = query->before_seq ? index_lower_bound(query->before_seq) : s_storage.index.count;
+    if (query->to_ms > 0) {
+        pos = MIN(pos, index_time_upper_bound(query->to_ms));
     }
-    if (limit > 2000) {
-        limit = 2000;
+    size_t n = 0;
+    uint32_t scanned = 0;
+    while (pos > 0 && n < max) {
+        const snapshot_index_entry_t *entry = index_at(pos - 1);
+        if (entry->timestamp_ms < query->from_ms) {
+            pos = 0;
+            break;
+        }
+        /* A source filter can skip many entries; the caller continues from the cursor rather than the lock being held. */
+        if (scanned++ == STORAGE_LIST_SCAN_MAX) {
+            break;
+        }
+        pos--;
+        if ((query->source >= 0 && entry->source != query->source) ||
+            index_entry_name(entry, infos[n].name, sizeof(infos[n].name)) != ESP_OK) {
+            continue;
+        }
+        infos[n].seq = entry->seq;
+        infos[n].timestamp_ms = entry->timestamp_ms;
+        infos[n].size = entry->size;
+        infos[n].source = entry->source;
+        n++;
     }
-
-    if (xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) != pdPASS) {
-        return strdup("{\"snapshots\":[]}");
+    *ret_count = n;
+    *ret_next_seq = pos > 0 ? index_at(pos)->seq : 0;
+    if (ret_total) {
+        *ret_total = s_storage.index.count;
     }
+    xSemaphoreGive(s_storage.lock);
+    return ESP_OK;
+}
 
-    DIR *dir = opendir(s_storage.snapshot_dir);
-    if (!dir) {
-        xSemaphoreGive(s_storage.lock);
-        return strdup("{\"snapshots\":[]}");
-    }
+esp_err_t catflapcam_storage_locate_snapshot(const char *name, catflapcam_storage_snapshot_loc_t *loc)
+{
+    ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD storage not ready");
+    ESP_RETURN_ON_FALSE(name && loc, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
 
-    snapshot_entry_t *entries = calloc(limit, sizeof(snapshot_entry_t));
-    if (!entries) {
-        closedir(dir);
-        xSemaphoreGive(s_storage.lock);
-        return strdup("{\"snapshots\":[]}");
+    snapshot_index_entry_t key;
+    ESP_RETURN_ON_FALSE(parse_snapshot_seq(name, NULL) && index_entry_from_name(name, &key), ESP_ERR_INVALID_ARG, TAG, "invalid snapshot name");
+
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) == pdPASS,
+                        ESP_ERR_TIMEOUT, TAG, "timeout waiting for storage lock");
+
+    esp_err_t ret = ESP_OK;
+    uint32_t pos = index_find_entry(&key);
+#if STORAGE_SEGMENTS
+    segment_record_header_t header;
+    ESP_GOTO_ON_FALSE(pos < s_storage.index.count, ESP_ERR_NOT_FOUND, out, TAG, "snapshot not indexed");
+    snapshot_index_entry_t entry = *index_at(pos);
+    ESP_GOTO_ON_ERROR(build_segment_path(entry.segment, loc->path, sizeof(loc->path)), out, TAG, "failed to build segment path");
+
+    /* The record header is checked so a reclaimed or torn record is reported as missing instead of served. */
+    FILE *fp = fopen(loc->path, "rb");
+    ESP_GOTO_ON_FALSE(fp, ESP_ERR_NOT_FOUND, out, TAG, "segment '%s' missing", loc->path);
+    ret = read_segment_record(fp, entry.segment, entry.offset, &header);
+    fclose(fp);
+    ESP_GOTO_ON_FALSE(ret == ESP_OK && index_entry_equal(&header.entry, &entry), ESP_ERR_NOT_FOUND, out, TAG, "stale snapshot record");
+    loc->offset = entry.offset + sizeof(header);
+    loc->size = entry.size;
+    loc->seq = entry.seq;
+    loc->timestamp_ms = entry.timestamp_ms;
+#else
+    struct stat st;
+    ESP_GOTO_ON_ERROR(build_snapshot_path(name, loc->path, sizeof(loc->path)), out, TAG, "failed to build snapshot path");
+    loc->offset = 0;
+    loc->size = (pos < s_storage.index.count) ? index_at(pos)->size : 0;
+    loc->seq = key.seq;
+    loc->timestamp_ms = (pos < s_storage.index.count) ? index_at(pos)->timestamp_ms : key.timestamp_ms;
+    if (loc->size == 0) {
+        ESP_GOTO_ON_FALSE(stat(loc->path, &st) == 0 && st.st_size > 0, ESP_ERR_NOT_FOUND, out, TAG, "snapshot file missing");
+        loc->size = (uint32_t)st.st_size;
     }
+#endif
 
-    size_t count = 0;
-    size_t min_index = 0;
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        uint64_t seq = 0;
-        if (!parse_snapshot_seq(entry->d_name, &seq)) {
-            continue;
-        }
+out:
+    xSemaphoreGive(s_storage.lock);
+    return ret;
+}
 
-        if (count >= limit && seq <= entries[min_index].seq) {
-            continue;
-        }
+esp_err_t catflapcam_storage_delete_snapshot(const char *name)
+{
+    ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD storage not ready");
+    ESP_RETURN_ON_FALSE(name, ESP_ERR_INVALID_ARG, TAG, "invalid snapshot name");
 
-        size_t dst_index = count < limit ? count : min_index;
-        snapshot_entry_t *dst = &entries[dst_index];
-        memset(dst, 0, sizeof(*dst));
-        dst->seq = seq;
-        strlcpy(dst->name, entry->d_name, sizeof(dst->name));
+    snapshot_index_entry_t key;
+    ESP_RETURN_ON_FALSE(parse_snapshot_seq(name, NULL), ESP_ERR_INVALID_ARG, TAG, "invalid snapshot name");
 
-        char file_path[128];
-        if (build_snapshot_path(entry->d_name, file_path, sizeof(file_path)) == ESP_OK) {
-            struct stat st;
-            if (stat(file_path, &st) == 0) {
-                dst->size = st.st_size;
-            }
-        }
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) == pdPASS,
+                        ESP_ERR_TIMEOUT, TAG, "timeout waiting for storage lock");
 
-        if (count < limit) {
-            count++;
-        }
+    esp_err_t ret = ESP_OK;
+#if STORAGE_SEGMENTS
+    /* The record stays in its segment until the segment is reclaimed; the journal entry hides it. */
+    ESP_GOTO_ON_FALSE(index_entry_from_name(name, &key), ESP_ERR_NOT_FOUND, out, TAG, "invalid snapshot name");
+    uint32_t pos = index_find_entry(&key);
+    ESP_GOTO_ON_FALSE(pos < s_storage.index.count, ESP_ERR_NOT_FOUND, out, TAG, "snapshot not indexed");
+    journal_append(JOURNAL_RECORD_DEL, index_at(pos));
+    journal_sync();
+    index_remove(pos);
+#else
+    char path[128];
+    ESP_GOTO_ON_ERROR(build_snapshot_path(name, path, sizeof(path)), out, TAG, "failed to build snapshot path");
 
-        if (count == limit) {
-            min_index = 0;
-            for (size_t i = 1; i < count; i++) {
-                if (entries[i].seq < entries[min_index].seq) {
-                    min_index = i;
-                }
-            }
+    if (unlink(path) != 0) {
+        ret = (errno == ENOENT) ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+        goto out;
+    }
+
+    if (index_entry_from_name(name, &key)) {
+        uint32_t pos = index_find_entry(&key);
+        if (pos < s_storage.index.count) {
+            note_space_freed(index_at(pos)->size);
+            journal_append(JOURNAL_RECORD_DEL, index_at(pos));
+            journal_sync();
+            index_remove(pos);
+            release_shard_if_empty(snapshot_shard(key.seq), pos);
         }
     }
-    closedir(dir);
+    index_update_next_seq();
+#endif
+
+out:
     xSemaphoreGive(s_storage.lock);
+    return ret;
+}
 
-    qsort(entries, count, sizeof(snapshot_entry_t), compare_snapshot_desc);
+/* Returns the positions [start, end) of the entries inside `range`; zero bounds are open. */
+static void index_range(const catflapcam_storage_range_t *range, uint32_t *start, uint32_t *end)
+{
+    *start = MAX(index_lower_bound(range->from_seq), range->from_ms > 0 ? index_time_lower_bound(range->from_ms) : 0);
+    *end = s_storage.index.count;
+    if (range->to_seq > 0 && range->to_seq < UINT64_MAX) {
+        *end = MIN(*end, index_lower_bound(range->to_seq + 1));
+    }
+    if (range->to_ms > 0) {
+        *end = MIN(*end, index_time_upper_bound(range->to_ms));
+    }
+    *end = MAX(*end, *start);
+}
 
-    cJSON *root = cJSON_CreateObject();
-    cJSON *array = cJSON_CreateArray();
-    cJSON_AddItemToObject(root, "snapshots", array);
+/*
+ * Deletes up to `max` consecutive entries from `pos` on, with their files. A batch stops at a shard boundary so
+ * the shard it emptied can be released. Entries deleted before a failure are still taken out of the index.
+ */
+static esp_err_t delete_index_block(uint32_t pos, uint32_t max, uint32_t *deleted)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t n = 0;
 
-    size_t out_count = (count < limit) ? count : limit;
-    for (size_t i = 0; i < out_count; i++) {
-        char url[112];
-        cJSON *item = cJSON_CreateObject();
-        cJSON_AddStringToObject(item, "name", entries[i].name);
-        snprintf(url, sizeof(url), "/snapshots/%s", entries[i].name);
-        cJSON_AddStringToObject(item, "url", url);
-        cJSON_AddNumberToObject(item, "size", (double)entries[i].size);
-        cJSON_AddNumberToObject(item, "seq", (double)entries[i].seq);
-        cJSON_AddItemToArray(array, item);
+#if STORAGE_SEGMENTS
+    /* As for a single delete, the records stay in their segments until those are reclaimed. */
+    for (; n < max; n++) {
+        journal_append(JOURNAL_RECORD_DEL, index_at(pos + n));
+    }
+    index_remove_range(pos, n);
+#else
+    uint64_t shard = snapshot_shard(index_at(pos)->seq);
+    for (; n < max && snapshot_shard(index_at(pos + n)->seq) == shard; n++) {
+        const snapshot_index_entry_t *entry = index_at(pos + n);
+        char name[SNAPSHOT_NAME_MAX_LEN];
+        char path[128];
+        ESP_GOTO_ON_ERROR(index_entry_name(entry, name, sizeof(name)), out, TAG, "failed to build snapshot name");
+        ESP_GOTO_ON_ERROR(build_snapshot_path(name, path, sizeof(path)), out, TAG, "failed to build snapshot path");
+        ESP_GOTO_ON_FALSE(unlink(path) == 0 || errno == ENOENT, ESP_FAIL, out, TAG, "failed to delete snapshot '%s': errno=%d", path, errno);
+        note_space_freed(entry->size);
+        journal_append(JOURNAL_RECORD_DEL, entry);
     }
-    free(entries);
 
-    char *json = cJSON_PrintUnformatted(root);
-    cJSON_Delete(root);
-    return json ? json : strdup("{\"snapshots\":[]}");
+out:
+    if (n > 0) {
+        index_remove_range(pos, n);
+        release_shard_if_empty(shard, pos);
+    }
+#endif
+    *deleted = n;
+    return ret;
 }
 
-esp_err_t catflapcam_storage_resolve_snapshot_path(const char *name, char *out_path, size_t out_path_len)
+esp_err_t catflapcam_storage_delete_range(const catflapcam_storage_range_t *range, catflapcam_storage_progress_cb_t progress, void *arg,
+                                          uint32_t *ret_deleted)
 {
+    ESP_RETURN_ON_FALSE(range && ret_deleted, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    *ret_deleted = 0;
     ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD storage not ready");
-    ESP_RETURN_ON_FALSE(name && out_path && out_path_len > 0, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) == pdPASS,
+                        ESP_ERR_TIMEOUT, TAG, "timeout waiting for storage lock");
 
-    uint64_t seq = 0;
-    ESP_RETURN_ON_FALSE(parse_snapshot_seq(name, &seq), ESP_ERR_INVALID_ARG, TAG, "invalid snapshot name");
-    (void)seq;
-    return build_snapshot_path(name, out_path, out_path_len);
+    esp_err_t ret = ESP_OK;
+    catflapcam_storage_range_t bounds = *range;
+    uint32_t start = 0;
+    uint32_t end = 0;
+
+    /* Pin the newest seq in range now, so snapshots saved while the range is being deleted are kept. */
+    index_range(&bounds, &start, &end);
+    if (end > start) {
+        bounds.to_seq = index_at(end - 1)->seq;
+    }
+    while (end > start) {
+        uint32_t n = 0;
+        ret = delete_index_block(start, MIN(end - start, STORAGE_DELETE_BATCH), &n);
+        journal_sync();
+        *ret_deleted += n;
+        if (ret != ESP_OK) {
+            break;
+        }
+        /* Saves and listings get the lock between batches; the range is looked up again afterwards. */
+        xSemaphoreGive(s_storage.lock);
+        if (progress) {
+            progress(*ret_deleted, end - start - n, arg);
+        }
+        ESP_RETURN_ON_FALSE(xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) == pdPASS,
+                            ESP_ERR_TIMEOUT, TAG, "timeout waiting for storage lock");
+        index_range(&bounds, &start, &end);
+    }
+    if (*ret_deleted > 0) {
+#if !STORAGE_SEGMENTS
+        index_update_next_seq();
+#endif
+        journal_maybe_compact();
+        ESP_LOGI(TAG, "deleted %" PRIu32 " snapshots (files=%" PRIu32 ", bytes=%" PRIu64 ")", *ret_deleted, s_storage.index.count,
+                 s_storage.index.bytes);
+    }
+    xSemaphoreGive(s_storage.lock);
+    return ret;
 }
 
-esp_err_t catflapcam_storage_delete_snapshot(const char *name)
+void catflapcam_storage_get_usage(catflapcam_storage_usage_t *usage)
 {
-    ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD storage not ready");
-    ESP_RETURN_ON_FALSE(name, ESP_ERR_INVALID_ARG, TAG, "invalid snapshot name");
+    if (!usage) {
+        return;
+    }
+    memset(usage, 0, sizeof(*usage));
+    if (!catflapcam_storage_is_ready() || xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) != pdPASS) {
+        return;
+    }
+    usage->snapshots = s_storage.index.count;
+    usage->snapshot_bytes = s_storage.index.bytes;
+    usage->free_bytes = s_storage.free_known ? s_storage.free_bytes : 0;
+    usage->evicted = s_storage.evicted;
+    xSemaphoreGive(s_storage.lock);
+}
 
-    uint64_t seq = 0;
-    ESP_RETURN_ON_FALSE(parse_snapshot_seq(name, &seq), ESP_ERR_INVALID_ARG, TAG, "invalid snapshot name");
-    (void)seq;
+/* The stdio path snapshots used before write_file_clusters(), kept so the benchmark can compare the two. */
+static esp_err_t write_file_stdio(const char *path, const uint8_t *data, size_t len)
+{
+    FILE *fp = fopen(path, "wb");
+    ESP_RETURN_ON_FALSE(fp, ESP_FAIL, TAG, "failed to open '%s'", path);
+    size_t written = fwrite(data, 1, len, fp);
+    int flush_ret = fflush(fp);
+    int close_ret = fclose(fp);
+    ESP_RETURN_ON_FALSE(written == len && flush_ret == 0 && close_ret == 0, ESP_FAIL, TAG, "failed to write '%s'", path);
+    return ESP_OK;
+}
 
-    ESP_RETURN_ON_FALSE(xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) == pdPASS,
-                        ESP_ERR_TIMEOUT, TAG, "timeout waiting for storage lock");
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t lhs = *(const uint32_t *)a;
+    uint32_t rhs = *(const uint32_t *)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
 
+/* Times `count` writes of one size through one path into the bench dir, then removes the files. */
+static esp_err_t run_benchmark_pass(const char *dir, bool stdio, const uint8_t *jpg, uint32_t size, uint32_t count,
+                                    uint32_t *latency_us, cJSON *results)
+{
     esp_err_t ret = ESP_OK;
     char path[128];
-    ESP_GOTO_ON_ERROR(build_snapshot_path(name, path, sizeof(path)), out, TAG, "failed to build snapshot path");
+    int64_t total_us = 0;
+    uint32_t done = 0;
+
+    for (done = 0; done < count; done++) {
+        snprintf(path, sizeof(path), "%s/bench-%02" PRIu32 ".jpg", dir, done);
+        ESP_GOTO_ON_FALSE(xSemaphoreTake(s_storage.lock, pdMS_TO_TICKS(2000)) == pdPASS, ESP_ERR_TIMEOUT, out, TAG,
+                          "timeout waiting for storage lock");
+        int64_t t_start_us = esp_timer_get_time();
+        ret = stdio ? write_file_stdio(path, jpg, size) : write_file_clusters(path, jpg, size);
+        int64_t t_done_us = esp_timer_get_time();
+        xSemaphoreGive(s_storage.lock);
+        ESP_GOTO_ON_ERROR(ret, out, TAG, "benchmark write failed");
+        latency_us[done] = (uint32_t)(t_done_us - t_start_us);
+        total_us += t_done_us - t_start_us;
+    }
 
-    if (unlink(path) != 0) {
-        ret = (errno == ENOENT) ? ESP_ERR_NOT_FOUND : ESP_FAIL;
-        goto out;
+    qsort(latency_us, count, sizeof(latency_us[0]), compare_u32);
+    cJSON *item = cJSON_CreateObject();
+    cJSON_AddStringToObject(item, "path", stdio ? "stdio" : "clusters");
+    cJSON_AddNumberToObject(item, "size", size);
+    cJSON_AddNumberToObject(item, "count", count);
+    cJSON_AddNumberToObject(item, "mbPerSec", total_us > 0 ? (double)size * count / (double)total_us : 0);
+    cJSON_AddNumberToObject(item, "p50Ms", latency_us[(count - 1) / 2] / 1000.0);
+    cJSON_AddNumberToObject(item, "p99Ms", latency_us[(count * 99 + 99) / 100 - 1] / 1000.0);
+    cJSON_AddItemToArray(results, item);
+
+out:
+    for (uint32_t i = 0; i <= done && i < count; i++) {
+        snprintf(path, sizeof(path), "%s/bench-%02" PRIu32 ".jpg", dir, i);
+        unlink(path);
+    }
+    return ret;
+}
+
+esp_err_t catflapcam_storage_run_benchmark(uint32_t count, char **ret_json)
+{
+    static const uint32_t sizes[] = {16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024};
+    esp_err_t ret = ESP_OK;
+    char dir[96];
+    uint8_t *jpg = NULL;
+    uint32_t *latency_us = NULL;
+    cJSON *root = NULL;
+
+    ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD storage not ready");
+    ESP_RETURN_ON_FALSE(ret_json && count > 0 && count <= STORAGE_BENCH_MAX_COUNT, ESP_ERR_INVALID_ARG, TAG, "invalid benchmark count");
+
+    int n = snprintf(dir, sizeof(dir), "%s/%s", CATFLAPCAM_SDCARD_MOUNT_POINT, STORAGE_BENCH_DIR_NAME);
+    ESP_RETURN_ON_FALSE(n > 0 && n < (int)sizeof(dir), ESP_ERR_INVALID_SIZE, TAG, "bench dir path too long");
+    if (mkdir(dir, 0775) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "failed to create bench dir '%s': errno=%d", dir, errno);
+        return ESP_FAIL;
     }
 
-    uint64_t newest_seq = 0;
-    ESP_GOTO_ON_ERROR(scan_snapshot_state(&s_storage.oldest_seq, &newest_seq, &s_storage.file_count), out, TAG, "failed to rescan snapshot state");
-    s_storage.next_seq = (s_storage.file_count == 0) ? 1 : (newest_seq + 1);
+    /* Synthetic JPEGs: SOI, incompressible filler, EOI. Only the byte count matters to the card. */
+    uint32_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    jpg = heap_caps_malloc(max_size, MALLOC_CAP_SPIRAM);
+    latency_us = calloc(count, sizeof(uint32_t));
+    root = cJSON_CreateObject();
+    ESP_GOTO_ON_FALSE(jpg && latency_us && root, ESP_ERR_NO_MEM, out, TAG, "failed to alloc benchmark buffers");
+    uint32_t lcg = 0x12345678;
+    for (uint32_t i = 0; i < max_size; i++) {
+        lcg = lcg * 1664525 + 1013904223;
+        jpg[i] = (uint8_t)(lcg >> 24);
+    }
+    jpg[0] = 0xff;
+    jpg[1] = 0xd8;
+
+    cJSON_AddNumberToObject(root, "allocationUnit", STORAGE_ALLOCATION_UNIT);
+    cJSON *results = cJSON_CreateArray();
+    cJSON_AddItemToObject(root, "results", results);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        jpg[sizes[i] - 2] = 0xff;
+        jpg[sizes[i] - 1] = 0xd9;
+        for (int stdio = 0; stdio < 2; stdio++) {
+            ESP_GOTO_ON_ERROR(run_benchmark_pass(dir, stdio, jpg, sizes[i], count, latency_us, results), out, TAG,
+                              "benchmark of %" PRIu32 " byte files failed", sizes[i]);
+        }
+    }
+    *ret_json = cJSON_PrintUnformatted(root);
+    ESP_GOTO_ON_FALSE(*ret_json, ESP_ERR_NO_MEM, out, TAG, "failed to print benchmark json");
 
 out:
-    xSemaphoreGive(s_storage.lock);
+    rmdir(dir);
+    cJSON_Delete(root);
+    free(latency_us);
+    heap_caps_free(jpg);
     return ret;
 }
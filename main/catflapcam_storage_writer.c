@@ -0,0 +1,289 @@
+/*
+ * SPDX-FileCopyrightText: 2024-2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <inttypes.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "catflapcam_storage_writer.h"
+#include "main.h"
+
+/* One submitted batch; the blob table and a private copy of the JPEG bytes follow the header. */
+typedef struct storage_write {
+    int64_t submit_us;
+    size_t count;
+    uint32_t bytes;
+    bool waited;
+    bool finished;
+    esp_err_t result;
+    size_t saved;
+    SemaphoreHandle_t done;
+    catflapcam_storage_writer_done_cb_t done_cb;
+    void *done_ctx;
+    catflapcam_storage_blob_t blobs[];
+} storage_write_t;
+
+typedef struct storage_writer {
+    QueueHandle_t queue;
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+    uint32_t queued_bytes;
+    int64_t busy_us;
+    catflapcam_storage_writer_stats_t stats;
+} storage_writer_t;
+
+static const uint32_t s_latency_bounds_ms[] = CATFLAPCAM_STORAGE_WRITER_LATENCY_BOUNDS_MS;
+static storage_writer_t s_writer;
+
+static void free_write(storage_write_t *write)
+{
+    if (write->done) {
+        vSemaphoreDelete(write->done);
+    }
+    heap_caps_free(write);
+}
+
+/* Called with the writer lock held. A waited write is freed by its waiter, any other one here. */
+static void finish_write(storage_write_t *write, esp_err_t result, size_t saved)
+{
+    write->result = result;
+    write->saved = saved;
+    write->finished = true;
+    if (write->done_cb) {
+        write->done_cb(result, saved, write->done_ctx);
+    }
+    if (write->waited) {
+        xSemaphoreGive(write->done);
+    } else {
+        free_write(write);
+    }
+}
+
+static void record_latency(int64_t latency_us)
+{
+    uint32_t latency_ms = (uint32_t)(latency_us / 1000);
+    size_t bucket = 0;
+
+    while (bucket < sizeof(s_latency_bounds_ms) / sizeof(s_latency_bounds_ms[0]) && latency_ms >= s_latency_bounds_ms[bucket]) {
+        bucket++;
+    }
+    s_writer.stats.latency_ms[bucket]++;
+}
+
+/* Commits the taken writes as one storage batch; the card keeps their order, so `saved` splits front to back. */
+static void commit_writes(storage_write_t **writes, size_t write_count, size_t blob_count)
+{
+    catflapcam_storage_blob_t blobs[CATFLAPCAM_STORAGE_WRITER_BATCH_MAX];
+    const catflapcam_storage_blob_t *batch = writes[0]->blobs;
+    size_t saved = 0;
+    uint64_t saved_bytes = 0;
+
+    if (write_count > 1) {
+        size_t n = 0;
+        for (size_t i = 0; i < write_count; i++) {
+            memcpy(&blobs[n], writes[i]->blobs, writes[i]->count * sizeof(blobs[0]));
+            n += writes[i]->count;
+        }
+        batch = blobs;
+    }
+
+    int64_t t_start_us = esp_timer_get_time();
+    esp_err_t ret = catflapcam_storage_save_snapshots(batch, blob_count, &saved);
+    int64_t t_done_us = esp_timer_get_time();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "storage writer: saved %u/%u snapshots: %s", (unsigned)saved, (unsigned)blob_count, esp_err_to_name(ret));
+    }
+    for (size_t i = 0; i < saved; i++) {
+        saved_bytes += batch[i].len;
+    }
+
+    xSemaphoreTake(s_writer.lock, portMAX_DELAY);
+    s_writer.stats.batches++;
+    s_writer.stats.snapshots += saved;
+    s_writer.stats.bytes += saved_bytes;
+    s_writer.busy_us += t_done_us - t_start_us;
+    for (size_t i = 0, offset = 0; i < write_count; i++) {
+        size_t count = writes[i]->count;
+        size_t write_saved = saved > offset ? MIN(saved - offset, count) : 0;
+        bool complete = write_saved == count;
+        if (complete) {
+            s_writer.stats.writes++;
+        } else {
+            s_writer.stats.failed++;
+        }
+        record_latency(t_done_us - writes[i]->submit_us);
+        finish_write(writes[i], complete ? ESP_OK : (ret != ESP_OK ? ret : ESP_FAIL), write_saved);
+        offset += count;
+    }
+    xSemaphoreGive(s_writer.lock);
+}
+
+static void storage_writer_task(void *arg)
+{
+    storage_write_t *writes[CATFLAPCAM_STORAGE_WRITER_QUEUE_LEN];
+    storage_write_t *write = NULL;
+
+    while (1) {
+        size_t write_count = 0;
+        size_t blob_count = 0;
+
+        xQueuePeek(s_writer.queue, &write, portMAX_DELAY);
+
+        /* Writes are only taken off the queue under the lock, so a producer dropping the oldest never races this. */
+        xSemaphoreTake(s_writer.lock, portMAX_DELAY);
+        while (xQueuePeek(s_writer.queue, &write, 0) == pdPASS &&
+               (write_count == 0 || blob_count + write->count <= CATFLAPCAM_STORAGE_WRITER_BATCH_MAX)) {
+            xQueueReceive(s_writer.queue, &write, 0);
+            s_writer.queued_bytes -= write->bytes;
+            writes[write_count++] = write;
+            blob_count += write->count;
+        }
+        xSemaphoreGive(s_writer.lock);
+
+        if (write_count > 0) {
+            commit_writes(writes, write_count, blob_count);
+        }
+    }
+}
+
+esp_err_t catflapcam_storage_writer_start(void)
+{
+    ESP_RETURN_ON_FALSE(!s_writer.task, ESP_ERR_INVALID_STATE, TAG, "storage writer already started");
+
+    s_writer.lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(s_writer.lock, ESP_ERR_NO_MEM, TAG, "failed to create storage writer lock");
+    s_writer.queue = xQueueCreate(CATFLAPCAM_STORAGE_WRITER_QUEUE_LEN, sizeof(storage_write_t *));
+    ESP_RETURN_ON_FALSE(s_writer.queue, ESP_ERR_NO_MEM, TAG, "failed to create storage writer queue");
+    ESP_RETURN_ON_FALSE(xTaskCreate(storage_writer_task, "storage_writer", CATFLAPCAM_STORAGE_WRITER_TASK_STACK_SIZE, NULL,
+                                    CATFLAPCAM_STORAGE_WRITER_TASK_PRIORITY, &s_writer.task) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "failed to create storage writer task");
+    ESP_LOGI(TAG, "storage writer started (queue %d writes, %d KB)", CATFLAPCAM_STORAGE_WRITER_QUEUE_LEN,
+             CATFLAPCAM_STORAGE_WRITER_QUEUE_KB);
+    return ESP_OK;
+}
+
+esp_err_t catflapcam_storage_writer_submit(const catflapcam_storage_blob_t *blobs, size_t count, catflapcam_storage_writer_policy_t policy,
+                                           uint32_t wait_ms, size_t *saved, catflapcam_storage_writer_done_cb_t done_cb, void *done_ctx)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t bytes = 0;
+
+    if (saved) {
+        *saved = 0;
+    }
+    ESP_RETURN_ON_FALSE(s_writer.task, ESP_ERR_INVALID_STATE, TAG, "storage writer not started");
+    ESP_RETURN_ON_FALSE(blobs && count > 0, ESP_ERR_INVALID_ARG, TAG, "invalid snapshot batch");
+    ESP_RETURN_ON_FALSE(!done_cb || wait_ms == 0, ESP_ERR_INVALID_ARG, TAG, "completion callback needs wait_ms 0");
+    for (size_t i = 0; i < count; i++) {
+        ESP_RETURN_ON_FALSE(blobs[i].data && blobs[i].len > 0, ESP_ERR_INVALID_ARG, TAG, "invalid jpeg buffer");
+        bytes += blobs[i].len;
+    }
+    ESP_RETURN_ON_FALSE(bytes <= CATFLAPCAM_STORAGE_WRITER_QUEUE_KB * 1024, ESP_ERR_INVALID_SIZE, TAG, "snapshot batch larger than storage queue");
+
+    storage_write_t *write = heap_caps_malloc(sizeof(storage_write_t) + count * sizeof(catflapcam_storage_blob_t) + bytes, MALLOC_CAP_SPIRAM);
+    ESP_RETURN_ON_FALSE(write, ESP_ERR_NO_MEM, TAG, "failed to alloc storage write");
+    memset(write, 0, sizeof(*write));
+    uint8_t *data = (uint8_t *)&write->blobs[count];
+    int64_t now_ms = 0;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(data, blobs[i].data, blobs[i].len);
+        write->blobs[i] = blobs[i];
+        write->blobs[i].data = data;
+        data += blobs[i].len;
+        /* Stamp the time here; the batch may sit in the queue for a while before it reaches the card. */
+        if (write->blobs[i].timestamp_ms == 0) {
+            if (now_ms == 0) {
+                struct timeval tv;
+                gettimeofday(&tv, NULL);
+                now_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+            }
+            write->blobs[i].timestamp_ms = now_ms;
+        }
+    }
+    write->count = count;
+    write->bytes = bytes;
+    write->done_cb = done_cb;
+    write->done_ctx = done_ctx;
+    if (wait_ms > 0) {
+        write->done = xSemaphoreCreateBinary();
+        ESP_GOTO_ON_FALSE(write->done, ESP_ERR_NO_MEM, fail, TAG, "failed to create storage write semaphore");
+        write->waited = true;
+    }
+
+    xSemaphoreTake(s_writer.lock, portMAX_DELAY);
+    while (uxQueueSpacesAvailable(s_writer.queue) == 0 || s_writer.queued_bytes + bytes > CATFLAPCAM_STORAGE_WRITER_QUEUE_KB * 1024) {
+        storage_write_t *oldest = NULL;
+        if (policy != CATFLAPCAM_STORAGE_WRITER_DROP_OLDEST || xQueueReceive(s_writer.queue, &oldest, 0) != pdPASS) {
+            s_writer.stats.rejected++;
+            xSemaphoreGive(s_writer.lock);
+            ESP_LOGW(TAG, "storage queue full, rejected a batch of %u snapshots", (unsigned)count);
+            ret = ESP_ERR_NO_MEM;
+            goto fail;
+        }
+        s_writer.queued_bytes -= oldest->bytes;
+        s_writer.stats.dropped++;
+        ESP_LOGW(TAG, "storage queue full, dropped a queued batch of %u snapshots", (unsigned)oldest->count);
+        finish_write(oldest, ESP_ERR_NO_MEM, 0);
+    }
+    write->submit_us = esp_timer_get_time();
+    xQueueSend(s_writer.queue, &write, 0);
+    s_writer.queued_bytes += bytes;
+    s_writer.stats.max_queued = MAX(s_writer.stats.max_queued, (uint32_t)uxQueueMessagesWaiting(s_writer.queue));
+    xSemaphoreGive(s_writer.lock);
+
+    if (!write->waited) {
+        return ESP_OK;
+    }
+
+    bool done = xSemaphoreTake(write->done, pdMS_TO_TICKS(wait_ms)) == pdPASS;
+    xSemaphoreTake(s_writer.lock, portMAX_DELAY);
+    if (!done && write->finished) {
+        xSemaphoreTake(write->done, 0);
+        done = true;
+    }
+    if (done) {
+        ret = write->result;
+        if (saved) {
+            *saved = write->saved;
+        }
+        free_write(write);
+    } else {
+        /* Hand the write back to the writer task, which frees it once it is committed. */
+        write->waited = false;
+        ret = ESP_ERR_TIMEOUT;
+    }
+    xSemaphoreGive(s_writer.lock);
+    return ret;
+
+fail:
+    free_write(write);
+    return ret;
+}
+
+void catflapcam_storage_writer_get_stats(catflapcam_storage_writer_stats_t *stats)
+{
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (!s_writer.task) {
+        return;
+    }
+    xSemaphoreTake(s_writer.lock, portMAX_DELAY);
+    *stats = s_writer.stats;
+    stats->queued = uxQueueMessagesWaiting(s_writer.queue);
+    stats->queued_bytes = s_writer.queued_bytes;
+    stats->bytes_per_sec = s_writer.busy_us > 0 ? (uint32_t)(s_writer.stats.bytes * 1000000 / s_writer.busy_us) : 0;
+    xSemaphoreGive(s_writer.lock);
+}
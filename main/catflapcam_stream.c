@@ -0,0 +1,474 @@
+/*
+ * SPDX-FileCopyrightText: 2024-2025 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: ESPRESSIF MIT
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include "esp_check.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "catflapcam_stream.h"
+#include "main.h"
+
+#define STREAM_HEAD_SIZE 256
+
+/*
+ * One viewer. A part is the `head` text followed by `size` bytes of `data`, which points into the broker
+ * frame, a JPEG of the client's feed or variant, or its spill buffer.
+ */
+typedef struct stream_client {
+    httpd_req_t *req;               /* async copy of the /stream request, owned by the stream task */
+    int fd;
+    catflapcam_webcam_video_t *video;
+    catflapcam_frame_subscriber_t *sub;
+    catflapcam_webcam_feed_t *feed;     /* JPEGs from the camera's encode task, or NULL to read the broker */
+    catflapcam_webcam_variant_t *variant;
+    bool latest;
+
+    /* Governor: a part starts no sooner than `interval_us` after the previous one, and only while the
+     * token bucket of `rate` bytes per second is not in debt. */
+    int64_t interval_us;
+    int64_t target_us;
+    uint32_t rate;
+    int64_t tokens;
+    int64_t refill_us;
+    int64_t send_avg_us;
+    uint64_t last_seq;
+    uint64_t skipped;
+    catflapcam_stream_client_stats_t stats;     /* copied out under the engine lock */
+
+    bool busy;
+    catflapcam_frame_t *frame;
+    catflapcam_webcam_jpeg_t *jpeg;
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t head_len;
+    uint32_t sent;
+    char head[STREAM_HEAD_SIZE];
+    int64_t part_us;
+    int64_t sent_us;
+    int64_t progress_us;
+    int64_t next_us;
+
+    uint8_t *spill;
+    uint32_t spill_size;
+    struct stream_client *next;
+} stream_client_t;
+
+typedef struct stream_engine {
+    SemaphoreHandle_t lock;
+    TaskHandle_t task;
+    stream_client_t *attached;      /* handed over by httpd workers, not picked up by the task yet */
+    stream_client_t *clients;       /* changed only by the task, under the lock */
+    catflapcam_stream_stats_t stats;
+} stream_engine_t;
+
+static const uint32_t s_gap_bounds_ms[] = CATFLAPCAM_STREAM_GAP_BOUNDS_MS;
+static stream_engine_t s_stream;
+
+static void stream_stats_add(uint64_t *counter)
+{
+    xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+    (*counter)++;
+    xSemaphoreGive(s_stream.lock);
+}
+
+/* Gives the shared frame or JPEG of the current part back; `data` is left alone. */
+static void stream_client_unref(stream_client_t *client)
+{
+    catflapcam_frame_broker_release(client->video->broker, client->frame);
+    client->frame = NULL;
+    catflapcam_webcam_release_feed_jpeg(client->video, client->jpeg);
+    client->jpeg = NULL;
+}
+
+static void stream_client_free(stream_client_t *client)
+{
+    stream_client_unref(client);
+    catflapcam_frame_broker_unsubscribe(client->video->broker, client->sub);
+    if (client->variant) {
+        catflapcam_webcam_close_variant(client->video, client->variant, client->latest);
+    } else {
+        catflapcam_webcam_close_feed(client->video, client->feed, client->latest);
+    }
+    heap_caps_free(client->spill);
+    if (client->req) {
+        httpd_sess_trigger_close(client->req->handle, client->fd);
+        httpd_req_async_handler_complete(client->req);
+    }
+    free(client);
+
+    xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+    s_stream.stats.clients--;
+    xSemaphoreGive(s_stream.lock);
+}
+
+/* Takes the newest frame the client has not seen and starts its part; ESP_ERR_NOT_FOUND when there is none. */
+static esp_err_t stream_client_next_part(stream_client_t *client, int64_t now_us)
+{
+    catflapcam_webcam_video_t *video = client->video;
+    catflapcam_frame_t *frame = NULL;
+    int64_t capture_us;
+    uint64_t seq;
+    struct timespec ts;
+
+    if (client->feed) {
+        if (catflapcam_webcam_acquire_feed_jpeg(video, client->feed, client->last_seq, &client->jpeg) != ESP_OK) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        capture_us = client->jpeg->capture_us;
+        seq = client->jpeg->seq;
+        client->data = client->jpeg->buf;
+        client->size = client->jpeg->size;
+    } else {
+        if (catflapcam_frame_broker_acquire(video->broker, client->sub, 0, &frame) != ESP_OK) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        capture_us = frame->capture_us;
+        seq = frame->seq;
+        client->frame = frame;
+        client->data = frame->data;
+        client->size = frame->size;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    int len = snprintf(client->head, sizeof(client->head), STREAM_BOUNDARY STREAM_PART, client->size, (long)ts.tv_sec, (long)ts.tv_nsec,
+                       (long)(capture_us / 1000000), (long)(capture_us % 1000000), seq);
+    if (client->size == 0 || len <= 0 || (size_t)len >= sizeof(client->head)) {
+        stream_client_unref(client);
+        ESP_LOGE(TAG, "stream source=%d: invalid jpeg frame of %" PRIu32 " bytes", video->index, client->size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if (client->last_seq != 0 && seq > client->last_seq + 1) {
+        client->skipped += seq - client->last_seq - 1;
+    }
+    client->last_seq = seq;
+    client->head_len = len;
+    client->sent = 0;
+    client->part_us = now_us;
+    client->busy = true;
+    return ESP_OK;
+}
+
+/*
+ * Schedules the next part once one is sent. A client whose parts take longer to drain than its frame
+ * interval is congested; it then waits as long again as a part takes, so it leaves the air to others and
+ * skips the frames captured meanwhile rather than queueing them.
+ */
+static void stream_client_pace(stream_client_t *client, int64_t now_us)
+{
+    int64_t send_us = now_us - client->part_us;
+    uint32_t bytes = client->head_len + client->size;
+
+    client->send_avg_us = client->send_avg_us ? (client->send_avg_us * 3 + send_us) / 4 : send_us;
+    bool congested = client->send_avg_us > client->target_us;
+    int64_t interval_us = congested ? MAX(client->interval_us, 2 * client->send_avg_us) : client->interval_us;
+    client->next_us = client->part_us + interval_us;
+
+    if (client->rate > 0) {
+        int64_t burst = (int64_t)client->rate * CATFLAPCAM_STREAM_BUCKET_MS / 1000;
+        client->tokens = MIN(client->tokens + (now_us - client->refill_us) * client->rate / 1000000, burst) - bytes;
+        client->refill_us = now_us;
+        if (client->tokens < 0) {
+            client->next_us = MAX(client->next_us, now_us - client->tokens * 1000000 / client->rate);
+        }
+    }
+
+    xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+    if (client->sent_us > 0) {
+        uint32_t gap_ms = (uint32_t)((now_us - client->sent_us) / 1000);
+        size_t bucket = 0;
+        while (bucket < sizeof(s_gap_bounds_ms) / sizeof(s_gap_bounds_ms[0]) && gap_ms >= s_gap_bounds_ms[bucket]) {
+            bucket++;
+        }
+        client->stats.gap_ms[bucket]++;
+        client->stats.gap_max_ms = MAX(client->stats.gap_max_ms, gap_ms);
+    }
+    client->sent_us = now_us;
+    s_stream.stats.frames_sent++;
+    client->stats.frames_sent++;
+    client->stats.frames_skipped += client->skipped;
+    client->stats.bytes_sent += bytes;
+    client->stats.send_ms = client->send_avg_us / 1000;
+    client->stats.interval_ms = interval_us / 1000;
+    client->stats.congested = congested;
+    xSemaphoreGive(s_stream.lock);
+    client->skipped = 0;
+}
+
+/* Writes as much of the current part as the socket takes without blocking; head and JPEG go out in one sendmsg. */
+static esp_err_t stream_client_send(stream_client_t *client, int64_t now_us)
+{
+    while (client->busy) {
+        struct iovec iov[2];
+        struct msghdr msg = {
+            .msg_iov = iov,
+        };
+        if (client->sent < client->head_len) {
+            iov[msg.msg_iovlen++] = (struct iovec) {
+                .iov_base = client->head + client->sent,
+                .iov_len = client->head_len - client->sent,
+            };
+        }
+        if (client->size > 0) {
+            size_t offset = client->sent > client->head_len ? client->sent - client->head_len : 0;
+            iov[msg.msg_iovlen++] = (struct iovec) {
+                .iov_base = (void *)(client->data + offset),
+                .iov_len = client->size - offset,
+            };
+        }
+
+        ssize_t n = sendmsg(client->fd, &msg, MSG_DONTWAIT);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? ESP_OK : ESP_FAIL;
+        }
+        client->sent += n;
+        client->progress_us = now_us;
+        if (client->sent < client->head_len + client->size) {
+            continue;
+        }
+
+        client->busy = false;
+        stream_client_unref(client);
+        client->data = NULL;
+        if (client->size > 0) {
+            stream_client_pace(client, now_us);
+        }
+    }
+    return ESP_OK;
+}
+
+/*
+ * A client that is slow to take its part must not keep a broker slot or a shared JPEG from everyone else,
+ * so the rest of its part is sent from a copy in its own PSRAM buffer.
+ */
+static esp_err_t stream_client_spill(stream_client_t *client)
+{
+    if (client->size > client->spill_size) {
+        uint8_t *buf = heap_caps_realloc(client->spill, client->size, MALLOC_CAP_SPIRAM);
+        ESP_RETURN_ON_FALSE(buf, ESP_ERR_NO_MEM, TAG, "failed to alloc stream spill buffer");
+        client->spill = buf;
+        client->spill_size = client->size;
+    }
+    memcpy(client->spill, client->data, client->size);
+    client->data = client->spill;
+    stream_client_unref(client);
+    stream_stats_add(&s_stream.stats.spills);
+    return ESP_OK;
+}
+
+/* Advances one client; a failed client is closed by the caller. */
+static esp_err_t stream_client_poll(stream_client_t *client, int64_t now_us)
+{
+    esp_err_t ret = ESP_OK;
+
+    if (!client->busy && now_us >= client->next_us) {
+        ret = stream_client_next_part(client, now_us);
+        if (ret == ESP_ERR_NOT_FOUND) {
+            return ESP_OK;
+        }
+        ESP_RETURN_ON_ERROR(ret, TAG, "stream source=%d: failed to prepare part", client->video->index);
+    }
+    if (!client->busy) {
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_ERROR(stream_client_send(client, now_us), TAG, "stream source=%d: client closed the connection", client->video->index);
+    if (!client->busy) {
+        return ESP_OK;
+    }
+    if (now_us - client->progress_us > CATFLAPCAM_HTTP_SEND_TIMEOUT_S * 1000000LL) {
+        stream_stats_add(&s_stream.stats.clients_dropped);
+        ESP_LOGW(TAG, "stream source=%d: client took no data for %d s, closing", client->video->index, CATFLAPCAM_HTTP_SEND_TIMEOUT_S);
+        return ESP_ERR_TIMEOUT;
+    }
+    if ((client->frame || client->jpeg) && now_us - client->part_us > CATFLAPCAM_STREAM_HOLD_MAX_MS * 1000LL) {
+        return stream_client_spill(client);
+    }
+    return ESP_OK;
+}
+
+/*
+ * Serves every stream client of every camera. Sockets are written without blocking, so a slow client only
+ * falls behind on its own. The task only sends: JPEGs are encoded by each camera's encode task. It sleeps on
+ * task notifications from the frame brokers, the encode tasks and attaching clients, or in select() on the
+ * sockets that are full, polling for new frames while it does.
+ */
+static void stream_task(void *arg)
+{
+    while (1) {
+        int64_t now_us = esp_timer_get_time();
+        int64_t wait_us = INT64_MAX;
+        int max_fd = -1;
+        fd_set write_fds;
+        FD_ZERO(&write_fds);
+
+        xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+        while (s_stream.attached) {
+            stream_client_t *client = s_stream.attached;
+            s_stream.attached = client->next;
+            client->next = s_stream.clients;
+            s_stream.clients = client;
+        }
+        xSemaphoreGive(s_stream.lock);
+
+        for (stream_client_t **it = &s_stream.clients; *it;) {
+            stream_client_t *client = *it;
+            if (stream_client_poll(client, now_us) != ESP_OK) {
+                xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+                *it = client->next;
+                xSemaphoreGive(s_stream.lock);
+                stream_client_free(client);
+                continue;
+            }
+            if (client->busy) {
+                FD_SET(client->fd, &write_fds);
+                max_fd = MAX(max_fd, client->fd);
+            } else if (client->next_us > now_us) {
+                wait_us = MIN(wait_us, client->next_us - now_us);
+            }
+            it = &client->next;
+        }
+
+        if (max_fd >= 0) {
+            struct timeval tv = {
+                .tv_sec = 0,
+                .tv_usec = MIN(wait_us, CATFLAPCAM_STREAM_POLL_MS * 1000LL),
+            };
+            select(max_fd + 1, NULL, &write_fds, NULL, &tv);
+        } else {
+            ulTaskNotifyTake(pdTRUE, wait_us == INT64_MAX ? portMAX_DELAY : pdMS_TO_TICKS(wait_us / 1000) + 1);
+        }
+    }
+}
+
+esp_err_t catflapcam_stream_start(void)
+{
+    ESP_RETURN_ON_FALSE(!s_stream.task, ESP_ERR_INVALID_STATE, TAG, "stream task already started");
+
+    s_stream.lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(s_stream.lock, ESP_ERR_NO_MEM, TAG, "failed to create stream lock");
+    ESP_RETURN_ON_FALSE(xTaskCreate(stream_task, "stream", CATFLAPCAM_STREAM_TASK_STACK_SIZE, NULL, CATFLAPCAM_STREAM_TASK_PRIORITY,
+                                    &s_stream.task) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "failed to create stream task");
+    ESP_LOGI(TAG, "stream task started (max %d clients)", CATFLAPCAM_STREAM_MAX_CLIENTS);
+    return ESP_OK;
+}
+
+esp_err_t catflapcam_stream_attach(httpd_req_t *req, catflapcam_webcam_video_t *video, const catflapcam_stream_options_t *options)
+{
+    esp_err_t ret = ESP_OK;
+    bool counted = false;
+
+    ESP_RETURN_ON_FALSE(req && video && options, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(s_stream.task, ESP_ERR_INVALID_STATE, TAG, "stream task not started");
+
+    stream_client_t *client = calloc(1, sizeof(stream_client_t));
+    ESP_RETURN_ON_FALSE(client, ESP_ERR_NO_MEM, TAG, "failed to alloc stream client");
+    client->video = video;
+    client->latest = options->latest;
+    if (options->fps > 0) {
+        client->interval_us = 1000000 / options->fps;
+    } else if (!options->latest) {
+        client->interval_us = CATFLAPCAM_STREAM_FRAME_INTERVAL_MS * 1000LL;
+    }
+    client->target_us = client->interval_us > 0 ? client->interval_us : 1000000 / MAX(video->frame_rate, 1);
+    client->rate = options->kbps * 1000 / 8;
+    client->stats.source = video->index;
+    client->stats.fps = options->fps;
+    client->stats.kbps = options->kbps;
+    client->stats.interval_ms = client->interval_us / 1000;
+
+    xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+    if (s_stream.stats.clients < CATFLAPCAM_STREAM_MAX_CLIENTS) {
+        s_stream.stats.clients++;
+        counted = true;
+    }
+    xSemaphoreGive(s_stream.lock);
+    ESP_GOTO_ON_FALSE(counted, ESP_ERR_NO_MEM, fail, TAG, "all %d stream clients taken", CATFLAPCAM_STREAM_MAX_CLIENTS);
+
+    if (options->roi) {
+        ESP_GOTO_ON_FALSE(catflapcam_webcam_open_feed(video, true, options->latest, s_stream.task, &client->feed) == ESP_OK,
+                          ESP_ERR_NOT_SUPPORTED, fail, TAG, "roi stream not supported for source=%d", video->index);
+    } else if (options->width > 0) {
+        ESP_GOTO_ON_ERROR(catflapcam_webcam_open_variant(video, options->width, options->height, options->quality, options->latest,
+                                                         s_stream.task, &client->variant),
+                          fail, TAG, "stream variant not available for source=%d", video->index);
+        client->feed = &client->variant->feed;
+    } else if (video->pixel_format != V4L2_PIX_FMT_JPEG) {
+        ESP_GOTO_ON_ERROR(catflapcam_webcam_open_feed(video, false, options->latest, s_stream.task, &client->feed),
+                          fail, TAG, "failed to open stream feed for source=%d", video->index);
+    }
+
+    /* The multipart body is not chunked; the response header is the client's first part and the stream ends with the connection. */
+    int len = snprintf(client->head, sizeof(client->head), STREAM_RESPONSE_HEAD,
+                       options->fps > 0 ? MIN(options->fps, video->frame_rate) : video->frame_rate);
+    ESP_GOTO_ON_FALSE(len > 0 && (size_t)len < sizeof(client->head), ESP_FAIL, fail, TAG, "failed to format stream header");
+    client->head_len = len;
+    client->busy = true;
+
+    if (!client->feed) {
+        ESP_GOTO_ON_ERROR(catflapcam_frame_broker_subscribe(video->broker, &client->sub), fail, TAG, "failed to subscribe to frame broker");
+        catflapcam_frame_broker_set_latest(video->broker, client->sub, options->latest);
+        catflapcam_frame_broker_set_notify(video->broker, client->sub, s_stream.task);
+    }
+    ESP_GOTO_ON_ERROR(httpd_req_async_handler_begin(req, &client->req), fail, TAG, "failed to detach stream request");
+    client->fd = httpd_req_to_sockfd(client->req);
+    client->progress_us = esp_timer_get_time();
+    client->refill_us = client->progress_us;
+
+    xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+    client->next = s_stream.attached;
+    s_stream.attached = client;
+    xSemaphoreGive(s_stream.lock);
+    xTaskNotifyGive(s_stream.task);
+    return ESP_OK;
+
+fail:
+    if (counted) {
+        stream_client_free(client);
+    } else {
+        free(client);
+    }
+    return ret;
+}
+
+void catflapcam_stream_get_stats(catflapcam_stream_stats_t *stats)
+{
+    if (!stats) {
+        return;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if (!s_stream.lock) {
+        return;
+    }
+    xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+    *stats = s_stream.stats;
+    xSemaphoreGive(s_stream.lock);
+}
+
+size_t catflapcam_stream_get_client_stats(catflapcam_stream_client_stats_t *stats, size_t max)
+{
+    size_t count = 0;
+
+    if (!stats || !s_stream.lock) {
+        return 0;
+    }
+    xSemaphoreTake(s_stream.lock, portMAX_DELAY);
+    for (stream_client_t *client = s_stream.clients; client && count < max; client = client->next) {
+        stats[count++] = client->stats;
+    }
+    xSemaphoreGive(s_stream.lock);
+    return count;
+}
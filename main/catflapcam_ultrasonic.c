@@ -106,10 +106,10 @@ static void ultrasonic_trigger_task(void *arg)
         if (err == ESP_OK && distance_cm > 0 && distance_cm <= CATFLAPCAM_ULTRASONIC_DISTANCE_CM) {
             int64_t now_us = esp_timer_get_time();
             if ((now_us - last_capture_us) >= min_interval_us) {
-                err = catflapcam_webcam_capture_snapshot(&s_web_cam->video[s_ultrasonic_source_index]);
+                err = catflapcam_webcam_submit_snapshot(&s_web_cam->video[s_ultrasonic_source_index], true, NULL);
                 if (err == ESP_OK) {
                     last_capture_us = now_us;
-                    ESP_LOGI(TAG, "ultrasonic trigger: captured/saved snapshot from source=%d at distance=%.1f cm",
+                    ESP_LOGI(TAG, "ultrasonic trigger: queued snapshot from source=%d at distance=%.1f cm",
                              s_ultrasonic_source_index, distance_cm);
                 } else {
                     ESP_LOGW(TAG, "ultrasonic trigger capture failed: %s", esp_err_to_name(err));
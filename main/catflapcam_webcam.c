@@ -11,12 +11,20 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/time.h>
 #include "cJSON.h"
 #include "esp_check.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_timer.h"
+#include "nvs.h"
 #include "catflapcam_config.h"
+#include "catflapcam_jpeg_scaler.h"
+#include "catflapcam_resize.h"
 #include "catflapcam_storage.h"
+#include "catflapcam_storage_writer.h"
+#include "catflapcam_stream.h"
 #include "catflapcam_webcam.h"
 
 bool catflapcam_webcam_is_valid_video(catflapcam_webcam_video_t *video)
@@ -24,150 +32,171 @@ bool catflapcam_webcam_is_valid_video(catflapcam_webcam_video_t *video)
     return video && video->fd != -1;
 }
 
-static esp_err_t ensure_buffer_capacity(uint8_t **buf, uint32_t *buf_size, uint32_t required_size)
+/*
+ * Format of the snapshot-size frames handed to the snapshot encoder: the sensor format for raw sources, the
+ * decoder output for downscaled JPEG sources, or 0 when snapshots keep the captured JPEG as is.
+ */
+static uint32_t snapshot_raw_format(const catflapcam_webcam_video_t *video)
 {
-    if (*buf_size >= required_size) {
-        return ESP_OK;
+    if (video->pixel_format != V4L2_PIX_FMT_JPEG) {
+        return video->pixel_format;
     }
+    return video->snapshot_scaler ? CATFLAPCAM_JPEG_SCALER_PIXEL_FORMAT : 0;
+}
 
-    uint8_t *new_buf = realloc(*buf, required_size);
-    ESP_RETURN_ON_FALSE(new_buf, ESP_ERR_NO_MEM, TAG, "failed to allocate %" PRIu32 " bytes", required_size);
-    *buf = new_buf;
-    *buf_size = required_size;
-    return ESP_OK;
+static uint32_t snapshot_raw_size(const catflapcam_webcam_video_t *video)
+{
+    return CATFLAPCAM_SNAPSHOT_WIDTH * CATFLAPCAM_SNAPSHOT_HEIGHT * catflapcam_resize_bytes_per_pixel(snapshot_raw_format(video));
 }
 
-static int bytes_per_pixel(uint32_t pixel_format)
+static esp_err_t resize_frame_for_snapshot(catflapcam_webcam_video_t *video, const uint8_t *src, uint32_t src_size,
+                                           uint8_t *dst, uint32_t dst_capacity, uint32_t *out_size)
 {
-    switch (pixel_format) {
-    case V4L2_PIX_FMT_GREY:
-    case V4L2_PIX_FMT_SBGGR8:
-        return 1;
-    case V4L2_PIX_FMT_RGB565:
-    case V4L2_PIX_FMT_YUV422P:
-        return 2;
-    case V4L2_PIX_FMT_RGB24:
-        return 3;
-    default:
-        return 0;
+    esp_err_t ret;
+
+    ESP_RETURN_ON_FALSE(video->snapshot_resize || video->snapshot_scaler, ESP_ERR_NOT_SUPPORTED, TAG, "pixel format not supported for snapshot resize");
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(video->resize_lock, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_ENC_WAIT_MS)) == pdPASS,
+                        ESP_ERR_TIMEOUT, TAG, "failed to take resize lock");
+    if (video->snapshot_scaler) {
+        ret = catflapcam_jpeg_scaler_process(video->snapshot_scaler, src, src_size, dst, dst_capacity, out_size);
+    } else {
+        ret = catflapcam_resize_process(video->snapshot_resize, src, src_size, dst, dst_capacity, out_size);
     }
+    xSemaphoreGive(video->resize_lock);
+    return ret;
 }
 
-static void resize_nearest_gray(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h)
+static bool roi_is_valid(const catflapcam_webcam_roi_t *roi)
 {
-    for (int y = 0; y < dst_h; y++) {
-        int sy = (y * src_h) / dst_h;
-        const uint8_t *src_row = src + (sy * src_w);
-        uint8_t *dst_row = dst + (y * dst_w);
-        for (int x = 0; x < dst_w; x++) {
-            int sx = (x * src_w) / dst_w;
-            dst_row[x] = src_row[sx];
-        }
+    return roi->width > 0 && roi->height > 0 && roi->x + roi->width <= CATFLAPCAM_ROI_UNITS &&
+           roi->y + roi->height <= CATFLAPCAM_ROI_UNITS;
+}
+
+static void roi_to_crop(const catflapcam_webcam_video_t *video, const catflapcam_webcam_roi_t *roi,
+                        uint32_t *x, uint32_t *y, uint32_t *width, uint32_t *height)
+{
+    *x = video->width * roi->x / CATFLAPCAM_ROI_UNITS;
+    *y = video->height * roi->y / CATFLAPCAM_ROI_UNITS;
+    *width = MAX(1, video->width * roi->width / CATFLAPCAM_ROI_UNITS);
+    *height = MAX(1, video->height * roi->height / CATFLAPCAM_ROI_UNITS);
+    if (video->pixel_format == V4L2_PIX_FMT_YUV422P) {
+        /* YUYV chroma is shared by pixel pairs, so the crop must start and end on a pair. */
+        *x &= ~1U;
+        *width = MAX(2, *width & ~1U);
     }
+    *width = MIN(*width, video->width - *x);
+    *height = MIN(*height, video->height - *y);
 }
 
-static void resize_nearest_rgb565(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h)
+/*
+ * Builds the snapshot resize stage for `roi`: a resize plan for raw sources or a scaled decoder for JPEG
+ * sources. The crop is part of the plan's tables, so no cropped copy of the frame is ever made.
+ */
+static esp_err_t new_snapshot_resize(catflapcam_webcam_video_t *video, const catflapcam_webcam_roi_t *roi,
+                                     catflapcam_resize_handle_t *ret_resize, catflapcam_jpeg_scaler_handle_t *ret_scaler)
 {
-    const uint16_t *src16 = (const uint16_t *)src;
-    uint16_t *dst16 = (uint16_t *)dst;
+    uint32_t crop_x, crop_y, crop_width, crop_height;
 
-    for (int y = 0; y < dst_h; y++) {
-        int sy = (y * src_h) / dst_h;
-        const uint16_t *src_row = src16 + (sy * src_w);
-        uint16_t *dst_row = dst16 + (y * dst_w);
-        for (int x = 0; x < dst_w; x++) {
-            int sx = (x * src_w) / dst_w;
-            dst_row[x] = src_row[sx];
-        }
+    roi_to_crop(video, roi, &crop_x, &crop_y, &crop_width, &crop_height);
+    if (video->pixel_format == V4L2_PIX_FMT_JPEG) {
+        catflapcam_jpeg_scaler_config_t scaler_config = {
+            .src_width = video->width,
+            .src_height = video->height,
+            .dst_width = CATFLAPCAM_SNAPSHOT_WIDTH,
+            .dst_height = CATFLAPCAM_SNAPSHOT_HEIGHT,
+            .mode = CATFLAPCAM_SNAPSHOT_RESIZE_MODE,
+            .crop_x = crop_x,
+            .crop_y = crop_y,
+            .crop_width = crop_width,
+            .crop_height = crop_height,
+        };
+        return catflapcam_jpeg_scaler_new(&scaler_config, ret_scaler);
     }
+
+    catflapcam_resize_config_t resize_config = {
+        .pixel_format = video->pixel_format,
+        .mode = CATFLAPCAM_SNAPSHOT_RESIZE_MODE,
+        .src_width = video->width,
+        .src_height = video->height,
+        .dst_width = CATFLAPCAM_SNAPSHOT_WIDTH,
+        .dst_height = CATFLAPCAM_SNAPSHOT_HEIGHT,
+        .crop_x = crop_x,
+        .crop_y = crop_y,
+        .crop_width = crop_width,
+        .crop_height = crop_height,
+    };
+    return catflapcam_resize_new(&resize_config, ret_resize);
 }
 
-static void resize_nearest_rgb24(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h)
+static void load_roi(catflapcam_webcam_video_t *video)
 {
-    for (int y = 0; y < dst_h; y++) {
-        int sy = (y * src_h) / dst_h;
-        const uint8_t *src_row = src + (sy * src_w * 3);
-        uint8_t *dst_row = dst + (y * dst_w * 3);
-        for (int x = 0; x < dst_w; x++) {
-            int sx = (x * src_w) / dst_w;
-            const uint8_t *src_px = src_row + (sx * 3);
-            uint8_t *dst_px = dst_row + (x * 3);
-            dst_px[0] = src_px[0];
-            dst_px[1] = src_px[1];
-            dst_px[2] = src_px[2];
-        }
+    nvs_handle_t nvs;
+    char key[8];
+    catflapcam_webcam_roi_t roi;
+    size_t len = sizeof(roi);
+
+    video->roi = (catflapcam_webcam_roi_t) {
+        .width = CATFLAPCAM_ROI_UNITS,
+        .height = CATFLAPCAM_ROI_UNITS,
+    };
+    if (nvs_open(CATFLAPCAM_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
     }
+    snprintf(key, sizeof(key), "roi%d", video->index);
+    if (nvs_get_blob(nvs, key, &roi, &len) == ESP_OK && len == sizeof(roi) && roi_is_valid(&roi)) {
+        video->roi = roi;
+    }
+    nvs_close(nvs);
 }
 
-static void resize_nearest_yuyv(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h)
+static esp_err_t save_roi(const catflapcam_webcam_video_t *video)
 {
-    for (int y = 0; y < dst_h; y++) {
-        int sy = (y * src_h) / dst_h;
-        for (int x = 0; x < dst_w; x += 2) {
-            int sx0 = (x * src_w) / dst_w;
-            int sx1 = ((x + 1) * src_w) / dst_w;
-            int sx_even = sx0 & ~1;
-            int src_pair_offset = (sy * src_w + sx_even) * 2;
-
-            uint8_t y0 = src[src_pair_offset + 0];
-            uint8_t u = src[src_pair_offset + 1];
-            uint8_t y1 = src[src_pair_offset + 2];
-            uint8_t v = src[src_pair_offset + 3];
-
-            if (sx0 != sx_even) {
-                y0 = y1;
-            }
-            if (sx1 == sx_even) {
-                y1 = src[src_pair_offset + 0];
-            }
+    esp_err_t ret;
+    nvs_handle_t nvs;
+    char key[8];
+
+    ESP_RETURN_ON_ERROR(nvs_open(CATFLAPCAM_NVS_NAMESPACE, NVS_READWRITE, &nvs), TAG, "failed to open nvs");
+    snprintf(key, sizeof(key), "roi%d", video->index);
+    ret = nvs_set_blob(nvs, key, &video->roi, sizeof(video->roi));
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+    return ret;
+}
 
-            int dst_pair_offset = (y * dst_w + x) * 2;
-            dst[dst_pair_offset + 0] = y0;
-            dst[dst_pair_offset + 1] = u;
-            dst[dst_pair_offset + 2] = y1;
-            dst[dst_pair_offset + 3] = v;
-        }
-    }
-}
-
-static esp_err_t resize_frame_for_snapshot(catflapcam_webcam_video_t *video, const uint8_t *src, uint32_t src_size, uint8_t **out_buf, uint32_t *out_size)
-{
-    int bpp = bytes_per_pixel(video->pixel_format);
-    ESP_RETURN_ON_FALSE(bpp > 0, ESP_ERR_NOT_SUPPORTED, TAG, "pixel format not supported for snapshot resize");
-
-    uint32_t expected_src_size = video->width * video->height * bpp;
-    ESP_RETURN_ON_FALSE(src_size >= expected_src_size, ESP_ERR_INVALID_SIZE, TAG,
-                        "source frame too small (%" PRIu32 " < %" PRIu32 ")", src_size, expected_src_size);
-
-    uint32_t dst_size = CATFLAPCAM_SNAPSHOT_WIDTH * CATFLAPCAM_SNAPSHOT_HEIGHT * bpp;
-    ESP_RETURN_ON_ERROR(ensure_buffer_capacity(&video->snapshot_resize_buf, &video->snapshot_resize_buf_size, dst_size),
-                        TAG, "failed to alloc resize buffer");
-
-    switch (video->pixel_format) {
-    case V4L2_PIX_FMT_GREY:
-    case V4L2_PIX_FMT_SBGGR8:
-        resize_nearest_gray(src, video->width, video->height, video->snapshot_resize_buf,
-                            CATFLAPCAM_SNAPSHOT_WIDTH, CATFLAPCAM_SNAPSHOT_HEIGHT);
-        break;
-    case V4L2_PIX_FMT_RGB565:
-        resize_nearest_rgb565(src, video->width, video->height, video->snapshot_resize_buf,
-                              CATFLAPCAM_SNAPSHOT_WIDTH, CATFLAPCAM_SNAPSHOT_HEIGHT);
-        break;
-    case V4L2_PIX_FMT_RGB24:
-        resize_nearest_rgb24(src, video->width, video->height, video->snapshot_resize_buf,
-                             CATFLAPCAM_SNAPSHOT_WIDTH, CATFLAPCAM_SNAPSHOT_HEIGHT);
-        break;
-    case V4L2_PIX_FMT_YUV422P:
-        resize_nearest_yuyv(src, video->width, video->height, video->snapshot_resize_buf,
-                            CATFLAPCAM_SNAPSHOT_WIDTH, CATFLAPCAM_SNAPSHOT_HEIGHT);
-        break;
-    default:
-        return ESP_ERR_NOT_SUPPORTED;
+esp_err_t catflapcam_webcam_set_roi(catflapcam_webcam_video_t *video, const catflapcam_webcam_roi_t *roi)
+{
+    catflapcam_resize_handle_t resize = NULL;
+    catflapcam_jpeg_scaler_handle_t scaler = NULL;
+
+    ESP_RETURN_ON_FALSE(video && roi && roi_is_valid(roi), ESP_ERR_INVALID_ARG, TAG, "invalid region of interest");
+    ESP_RETURN_ON_FALSE(video->resize_lock, ESP_ERR_NOT_SUPPORTED, TAG, "video%d: snapshots are not resized", video->index);
+    ESP_RETURN_ON_ERROR(new_snapshot_resize(video, roi, &resize, &scaler), TAG, "failed to build resize plan for region of interest");
+
+    if (xSemaphoreTake(video->resize_lock, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_ENC_WAIT_MS)) != pdPASS) {
+        catflapcam_resize_free(resize);
+        catflapcam_jpeg_scaler_free(scaler);
+        ESP_LOGE(TAG, "failed to take resize lock");
+        return ESP_ERR_TIMEOUT;
     }
+    catflapcam_resize_handle_t old_resize = video->snapshot_resize;
+    catflapcam_jpeg_scaler_handle_t old_scaler = video->snapshot_scaler;
+    video->snapshot_resize = resize;
+    video->snapshot_scaler = scaler;
+    video->roi = *roi;
+    xSemaphoreGive(video->resize_lock);
+
+    catflapcam_resize_free(old_resize);
+    catflapcam_jpeg_scaler_free(old_scaler);
+    ESP_LOGI(TAG, "video%d: region of interest x=%u y=%u width=%u height=%u", video->index,
+             roi->x, roi->y, roi->width, roi->height);
+    return save_roi(video);
+}
 
-    *out_buf = video->snapshot_resize_buf;
-    *out_size = dst_size;
-    return ESP_OK;
+void catflapcam_webcam_get_roi(catflapcam_webcam_video_t *video, catflapcam_webcam_roi_t *roi)
+{
+    *roi = video->roi;
 }
 
 static void release_video_buffers(catflapcam_webcam_video_t *video)
@@ -200,7 +229,7 @@ char *catflapcam_webcam_get_cameras_json(catflapcam_webcam_t *web_cam)
 
         cJSON *camera = cJSON_CreateObject();
         cJSON_AddNumberToObject(camera, "index", i);
-        assert(snprintf(src_str, sizeof(src_str), ":%d/stream", i + 81) > 0);
+        assert(snprintf(src_str, sizeof(src_str), ":81/stream?source=%d", i) > 0);
         cJSON_AddStringToObject(camera, "src", src_str);
         cJSON_AddNumberToObject(camera, "currentFrameRate", web_cam->video[i].frame_rate);
         cJSON_AddNumberToObject(camera, "currentImageFormat", 0);
@@ -216,6 +245,13 @@ char *catflapcam_webcam_get_cameras_json(catflapcam_webcam_t *web_cam)
         cJSON_AddNumberToObject(current_resolution, "height", web_cam->video[i].height);
         cJSON_AddItemToObject(camera, "currentResolution", current_resolution);
 
+        cJSON *roi = cJSON_CreateObject();
+        cJSON_AddNumberToObject(roi, "x", web_cam->video[i].roi.x);
+        cJSON_AddNumberToObject(roi, "y", web_cam->video[i].roi.y);
+        cJSON_AddNumberToObject(roi, "width", web_cam->video[i].roi.width);
+        cJSON_AddNumberToObject(roi, "height", web_cam->video[i].roi.height);
+        cJSON_AddItemToObject(camera, "roi", roi);
+
         cJSON *image_formats = cJSON_CreateArray();
         cJSON *image_format = cJSON_CreateObject();
         cJSON_AddNumberToObject(image_format, "id", 0);
@@ -248,9 +284,124 @@ char *catflapcam_webcam_get_cameras_json(catflapcam_webcam_t *web_cam)
         }
         cJSON_AddItemToArray(image_formats, image_format);
         cJSON_AddItemToObject(camera, "imageFormats", image_formats);
+
+        catflapcam_frame_broker_stats_t broker_stats = {0};
+        catflapcam_frame_broker_get_stats(web_cam->video[i].broker, &broker_stats);
+        cJSON *stats = cJSON_CreateObject();
+        cJSON_AddNumberToObject(stats, "framesCaptured", (double)broker_stats.frames_captured);
+        cJSON_AddNumberToObject(stats, "framesDropped", (double)broker_stats.frames_dropped);
+        cJSON_AddNumberToObject(stats, "framesSkipped", (double)broker_stats.frames_skipped);
+        cJSON_AddNumberToObject(stats, "subscribers", broker_stats.subscribers);
+        if (web_cam->video[i].pixel_format == V4L2_PIX_FMT_JPEG) {
+            cJSON_AddNumberToObject(stats, "framesZeroCopy", (double)broker_stats.frames_pinned);
+            cJSON_AddNumberToObject(stats, "zeroCopyFallbacks", (double)broker_stats.pin_fallbacks);
+        }
+        if (web_cam->video[i].pixel_format != V4L2_PIX_FMT_JPEG) {
+            cJSON_AddNumberToObject(stats, "jpegCacheHits", (double)web_cam->video[i].stream_feed.hits);
+            cJSON_AddNumberToObject(stats, "jpegCacheMisses", (double)web_cam->video[i].stream_feed.misses);
+            cJSON_AddNumberToObject(stats, "jpegDropped", (double)web_cam->video[i].stream_feed.dropped);
+        }
+        if (web_cam->video[i].roi_raw) {
+            cJSON *roi_stream = cJSON_CreateObject();
+            cJSON_AddNumberToObject(roi_stream, "viewers", web_cam->video[i].roi_feed.users);
+            cJSON_AddNumberToObject(roi_stream, "jpegCacheHits", (double)web_cam->video[i].roi_feed.hits);
+            cJSON_AddNumberToObject(roi_stream, "jpegCacheMisses", (double)web_cam->video[i].roi_feed.misses);
+            cJSON_AddNumberToObject(roi_stream, "jpegDropped", (double)web_cam->video[i].roi_feed.dropped);
+            cJSON_AddItemToObject(stats, "roiStream", roi_stream);
+        }
+        if (web_cam->video[i].preroll) {
+            uint32_t preroll_frames = web_cam->video[i].preroll_head;
+            uint32_t preroll_len = web_cam->video[i].preroll_len;
+            cJSON_AddNumberToObject(stats, "prerollFrames", preroll_frames < preroll_len ? preroll_frames : preroll_len);
+            cJSON_AddNumberToObject(stats, "prerollSkipped", (double)web_cam->video[i].preroll_skipped);
+        }
+        if (web_cam->video[i].encode_worker) {
+            cJSON *variants = cJSON_AddArrayToObject(stats, "variants");
+            xSemaphoreTake(web_cam->video[i].feed_lock, portMAX_DELAY);
+            for (int j = 0; j < CATFLAPCAM_STREAM_VARIANT_MAX; j++) {
+                const catflapcam_webcam_variant_t *variant = web_cam->video[i].variants[j];
+                if (!variant) {
+                    continue;
+                }
+                cJSON *entry = cJSON_CreateObject();
+                cJSON_AddNumberToObject(entry, "width", variant->width);
+                cJSON_AddNumberToObject(entry, "height", variant->height);
+                cJSON_AddNumberToObject(entry, "quality", variant->quality);
+                cJSON_AddNumberToObject(entry, "viewers", variant->feed.users);
+                cJSON_AddNumberToObject(entry, "jpegCacheHits", (double)variant->feed.hits);
+                cJSON_AddNumberToObject(entry, "jpegCacheMisses", (double)variant->feed.misses);
+                cJSON_AddNumberToObject(entry, "jpegDropped", (double)variant->feed.dropped);
+                cJSON_AddItemToArray(variants, entry);
+            }
+            xSemaphoreGive(web_cam->video[i].feed_lock);
+        }
+        cJSON_AddItemToObject(camera, "stats", stats);
         cJSON_AddItemToArray(cameras, camera);
     }
 
+    catflapcam_storage_writer_stats_t writer_stats;
+    catflapcam_storage_writer_get_stats(&writer_stats);
+    cJSON *storage = cJSON_CreateObject();
+    cJSON_AddNumberToObject(storage, "queued", writer_stats.queued);
+    cJSON_AddNumberToObject(storage, "queuedBytes", writer_stats.queued_bytes);
+    cJSON_AddNumberToObject(storage, "maxQueued", writer_stats.max_queued);
+    cJSON_AddNumberToObject(storage, "writes", (double)writer_stats.writes);
+    cJSON_AddNumberToObject(storage, "failed", (double)writer_stats.failed);
+    cJSON_AddNumberToObject(storage, "rejected", (double)writer_stats.rejected);
+    cJSON_AddNumberToObject(storage, "dropped", (double)writer_stats.dropped);
+    cJSON_AddNumberToObject(storage, "batches", (double)writer_stats.batches);
+    cJSON_AddNumberToObject(storage, "snapshots", (double)writer_stats.snapshots);
+    cJSON_AddNumberToObject(storage, "bytes", (double)writer_stats.bytes);
+    cJSON_AddNumberToObject(storage, "bytesPerSec", writer_stats.bytes_per_sec);
+    const int latency_bounds_ms[] = CATFLAPCAM_STORAGE_WRITER_LATENCY_BOUNDS_MS;
+    cJSON_AddItemToObject(storage, "latencyBoundsMs", cJSON_CreateIntArray(latency_bounds_ms, sizeof(latency_bounds_ms) / sizeof(latency_bounds_ms[0])));
+    cJSON *latency = cJSON_AddArrayToObject(storage, "latencyMs");
+    for (int i = 0; i < CATFLAPCAM_STORAGE_WRITER_LATENCY_BUCKETS; i++) {
+        cJSON_AddItemToArray(latency, cJSON_CreateNumber(writer_stats.latency_ms[i]));
+    }
+    catflapcam_storage_usage_t usage;
+    catflapcam_storage_get_usage(&usage);
+    cJSON_AddNumberToObject(storage, "storedSnapshots", usage.snapshots);
+    cJSON_AddNumberToObject(storage, "storedBytes", (double)usage.snapshot_bytes);
+    cJSON_AddNumberToObject(storage, "freeBytes", (double)usage.free_bytes);
+    cJSON_AddNumberToObject(storage, "evicted", (double)usage.evicted);
+    cJSON_AddItemToObject(root, "storage", storage);
+
+    catflapcam_stream_stats_t stream_stats;
+    catflapcam_stream_get_stats(&stream_stats);
+    cJSON *stream = cJSON_CreateObject();
+    cJSON_AddNumberToObject(stream, "clients", stream_stats.clients);
+    cJSON_AddNumberToObject(stream, "maxClients", CATFLAPCAM_STREAM_MAX_CLIENTS);
+    cJSON_AddNumberToObject(stream, "framesSent", (double)stream_stats.frames_sent);
+    cJSON_AddNumberToObject(stream, "spills", (double)stream_stats.spills);
+    cJSON_AddNumberToObject(stream, "clientsDropped", (double)stream_stats.clients_dropped);
+    const int gap_bounds_ms[] = CATFLAPCAM_STREAM_GAP_BOUNDS_MS;
+    cJSON_AddItemToObject(stream, "gapBoundsMs", cJSON_CreateIntArray(gap_bounds_ms, sizeof(gap_bounds_ms) / sizeof(gap_bounds_ms[0])));
+    cJSON *viewers = cJSON_CreateArray();
+    catflapcam_stream_client_stats_t *client_stats = calloc(CATFLAPCAM_STREAM_MAX_CLIENTS, sizeof(catflapcam_stream_client_stats_t));
+    size_t client_count = client_stats ? catflapcam_stream_get_client_stats(client_stats, CATFLAPCAM_STREAM_MAX_CLIENTS) : 0;
+    for (size_t i = 0; i < client_count; i++) {
+        cJSON *viewer = cJSON_CreateObject();
+        cJSON_AddNumberToObject(viewer, "source", client_stats[i].source);
+        cJSON_AddNumberToObject(viewer, "fps", client_stats[i].fps);
+        cJSON_AddNumberToObject(viewer, "kbps", client_stats[i].kbps);
+        cJSON_AddNumberToObject(viewer, "intervalMs", client_stats[i].interval_ms);
+        cJSON_AddNumberToObject(viewer, "sendMs", client_stats[i].send_ms);
+        cJSON_AddBoolToObject(viewer, "congested", client_stats[i].congested);
+        cJSON_AddNumberToObject(viewer, "framesSent", (double)client_stats[i].frames_sent);
+        cJSON_AddNumberToObject(viewer, "framesSkipped", (double)client_stats[i].frames_skipped);
+        cJSON_AddNumberToObject(viewer, "bytesSent", (double)client_stats[i].bytes_sent);
+        cJSON_AddNumberToObject(viewer, "gapMaxMs", client_stats[i].gap_max_ms);
+        cJSON *gaps = cJSON_AddArrayToObject(viewer, "gapMs");
+        for (int j = 0; j < CATFLAPCAM_STREAM_GAP_BUCKETS; j++) {
+            cJSON_AddItemToArray(gaps, cJSON_CreateNumber(client_stats[i].gap_ms[j]));
+        }
+        cJSON_AddItemToArray(viewers, viewer);
+    }
+    free(client_stats);
+    cJSON_AddItemToObject(stream, "viewers", viewers);
+    cJSON_AddItemToObject(root, "stream", stream);
+
     char *output = cJSON_Print(root);
     cJSON_Delete(root);
     return output;
@@ -304,93 +455,1235 @@ esp_err_t catflapcam_webcam_set_camera_jpeg_quality(catflapcam_webcam_video_t *v
     return ret;
 }
 
-esp_err_t catflapcam_webcam_capture_snapshot(catflapcam_webcam_video_t *video)
+/* Storage writer callback of a waited job: its result is only known once the batch is on the card. */
+static void snapshot_write_done(esp_err_t result, size_t saved, void *ctx)
 {
-    esp_err_t ret = ESP_OK;
-    esp_err_t storage_err = ESP_OK;
-    struct v4l2_buffer buf;
-    uint32_t jpeg_encoded_size = 0;
+    if (result != ESP_OK) {
+        ESP_LOGW(TAG, "failed to save snapshot to SD: %s", esp_err_to_name(result));
+    }
+    catflapcam_snapshot_pool_finish((catflapcam_snapshot_job_t *)ctx, result);
+}
+
+/*
+ * The pre-trigger ring is written and flushed only by the snapshot worker task, so inserting a frame
+ * needs no lock and never blocks the frame broker or stream clients.
+ */
+static void capture_preroll_frame(catflapcam_webcam_video_t *video)
+{
+    catflapcam_frame_t *frame = NULL;
     const uint8_t *jpeg_src = NULL;
+    uint32_t jpeg_size = 0;
+
+    if (catflapcam_frame_broker_acquire(video->broker, video->preroll_sub, 0, &frame) != ESP_OK) {
+        return;
+    }
+    uint64_t seq = frame->seq;
+    int64_t capture_us = frame->capture_us;
+
+    if (!snapshot_raw_format(video)) {
+        jpeg_src = frame->data;
+        jpeg_size = frame->size;
+    } else {
+        uint32_t raw_size = 0;
+        esp_err_t ret = resize_frame_for_snapshot(video, frame->data, frame->size, video->preroll_scratch,
+                                                  snapshot_raw_size(video), &raw_size);
+        catflapcam_frame_broker_release(video->broker, frame);
+        frame = NULL;
+        if (ret != ESP_OK || xSemaphoreTake(video->sem, pdMS_TO_TICKS(CATFLAPCAM_STREAM_ENC_WAIT_MS)) != pdPASS) {
+            video->preroll_skipped++;
+            return;
+        }
+        ret = catflapcam_encoder_process(video->snapshot_encoder_handle, video->preroll_scratch, raw_size,
+                                         video->snapshot_out_buf, video->snapshot_out_size, &jpeg_size);
+        xSemaphoreGive(video->sem);
+        if (ret != ESP_OK) {
+            video->preroll_skipped++;
+            return;
+        }
+        jpeg_src = video->snapshot_out_buf;
+    }
+
+    if (jpeg_size > 0 && jpeg_size <= video->preroll_slot_size) {
+        catflapcam_webcam_preroll_entry_t *entry = &video->preroll[video->preroll_head % video->preroll_len];
+        memcpy(entry->buf, jpeg_src, jpeg_size);
+        entry->size = jpeg_size;
+        entry->seq = seq;
+        entry->capture_us = capture_us;
+        video->preroll_head++;
+    } else {
+        video->preroll_skipped++;
+    }
+    catflapcam_frame_broker_release(video->broker, frame);
+}
+
+/* Converts an esp_timer capture time to wall-clock epoch ms for the snapshot index. */
+static int64_t capture_epoch_ms(int64_t capture_us)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - (esp_timer_get_time() - capture_us) / 1000;
+}
+
+/*
+ * Returns the ring frames captured before `before_seq` that have not been stored yet, oldest first.
+ */
+static size_t collect_preroll_blobs(catflapcam_webcam_video_t *video, uint64_t before_seq, catflapcam_storage_blob_t *blobs,
+                                    uint64_t *last_seq)
+{
+    size_t count = 0;
+
+    if (!video->preroll) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < video->preroll_len; i++) {
+        catflapcam_webcam_preroll_entry_t *entry = &video->preroll[(video->preroll_head + i) % video->preroll_len];
+        if (entry->size == 0 || entry->seq <= video->preroll_flushed_seq || entry->seq >= before_seq) {
+            continue;
+        }
+        blobs[count].data = entry->buf;
+        blobs[count].len = entry->size;
+        blobs[count].timestamp_ms = capture_epoch_ms(entry->capture_us);
+        blobs[count].source = (uint8_t)video->index;
+        *last_seq = entry->seq;
+        count++;
+    }
+    return count;
+}
+
+/*
+ * Worker stage of the snapshot pipeline: encode the staged frame (raw sources only) and queue it for SD.
+ * Runs on the snapshot worker task, so neither the V4L2 buffers nor the stream clients wait on the card,
+ * and the worker itself never does either: a waited job is completed by snapshot_write_done, in which
+ * case `pending` is set and the job belongs to the storage writer until then.
+ */
+static esp_err_t encode_and_save_snapshot(catflapcam_webcam_video_t *video, catflapcam_snapshot_job_t *job, bool *pending)
+{
+    esp_err_t ret = ESP_OK;
+    const uint8_t *jpeg_src = job->buf;
+    uint32_t jpeg_encoded_size = job->size;
+    int64_t t_start_us = esp_timer_get_time();
+
+    *pending = false;
+    if (snapshot_raw_format(video)) {
+        ESP_RETURN_ON_FALSE(xSemaphoreTake(video->sem, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_ENC_WAIT_MS)) == pdPASS,
+                            ESP_ERR_TIMEOUT, TAG, "failed to take semaphore");
+        ret = catflapcam_encoder_process(video->snapshot_encoder_handle, job->buf, job->size,
+                                         video->snapshot_out_buf, video->snapshot_out_size, &jpeg_encoded_size);
+        xSemaphoreGive(video->sem);
+        ESP_RETURN_ON_ERROR(ret, TAG, "failed to encode video frame");
+        jpeg_src = (const uint8_t *)video->snapshot_out_buf;
+    }
+    int64_t t_encode_done_us = esp_timer_get_time();
+
+    ESP_RETURN_ON_FALSE(jpeg_src && jpeg_encoded_size > 0, ESP_ERR_INVALID_SIZE, TAG, "invalid jpeg data");
+    catflapcam_storage_blob_t blobs[CATFLAPCAM_PREROLL_FRAMES + 1];
+    uint64_t preroll_last_seq = 0;
+    size_t preroll_count = job->with_preroll ? collect_preroll_blobs(video, job->frame_seq, blobs, &preroll_last_seq) : 0;
+
+    blobs[preroll_count].data = jpeg_src;
+    blobs[preroll_count].len = jpeg_encoded_size;
+    blobs[preroll_count].timestamp_ms = capture_epoch_ms(job->capture_us);
+    blobs[preroll_count].source = (uint8_t)video->index;
+
+    /*
+     * A caller waiting on the result gets an error when the card falls behind; triggered captures prefer the newest.
+     * The writer copies the batch, so the job buffer and the ring are free again once this returns.
+     */
+    bool waited = catflapcam_snapshot_pool_is_waited(job);
+    ret = catflapcam_storage_writer_submit(blobs, preroll_count + 1,
+                                           waited ? CATFLAPCAM_STORAGE_WRITER_REJECT : CATFLAPCAM_STORAGE_WRITER_DROP_OLDEST,
+                                           0, NULL, waited ? snapshot_write_done : NULL, job);
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "failed to queue snapshot for SD: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    *pending = waited;
+    if (preroll_count > 0) {
+        video->preroll_flushed_seq = preroll_last_seq;
+    }
+    int64_t t_queued_us = esp_timer_get_time();
+
+    ESP_LOGI(TAG,
+             "snapshot queued preroll=%u bytes=%" PRIu32 " capture=%" PRIi64 "ms queue=%" PRIi64 "ms encode=%" PRIi64 "ms submit=%" PRIi64 "ms total=%" PRIi64 "ms",
+             (unsigned)preroll_count, jpeg_encoded_size, (job->grab_us - job->submit_us) / 1000,
+             (t_start_us - job->grab_us) / 1000, (t_encode_done_us - t_start_us) / 1000, (t_queued_us - t_encode_done_us) / 1000,
+             (t_queued_us - job->submit_us) / 1000);
+    return ESP_OK;
+}
+
+static void snapshot_worker_task(void *arg)
+{
+    catflapcam_webcam_video_t *video = (catflapcam_webcam_video_t *)arg;
+    catflapcam_snapshot_job_t *job = NULL;
+
+    int64_t next_preroll_us = 0;
+
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (video->preroll) {
+            int64_t now_us = esp_timer_get_time();
+            if (now_us >= next_preroll_us) {
+                capture_preroll_frame(video);
+                next_preroll_us = now_us + (int64_t)CATFLAPCAM_PREROLL_INTERVAL_MS * 1000;
+            }
+            wait = pdMS_TO_TICKS((next_preroll_us - now_us) / 1000);
+        }
+        if (xQueueReceive(video->snapshot_queue, &job, wait) != pdPASS) {
+            continue;
+        }
+        if (!job) {
+            break;
+        }
+
+        bool pending = false;
+        esp_err_t ret = encode_and_save_snapshot(video, job, &pending);
+        if (pending) {
+            continue;
+        }
+
+        catflapcam_snapshot_pool_finish(job, ret);
+    }
+
+    xSemaphoreGive(video->snapshot_worker_stopped);
+    vTaskDelete(NULL);
+}
+
+esp_err_t catflapcam_webcam_submit_snapshot(catflapcam_webcam_video_t *video, bool with_preroll, catflapcam_snapshot_job_t **ret_job)
+{
+    esp_err_t ret = ESP_OK;
+    catflapcam_frame_t *frame = NULL;
+    catflapcam_snapshot_job_t *job = NULL;
+    int64_t t0_us = esp_timer_get_time();
+
+    ESP_RETURN_ON_FALSE(video->snapshot_worker, ESP_ERR_NOT_SUPPORTED, TAG, "snapshots not supported for video%d", video->index);
+    ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD snapshot storage not ready");
+    ESP_RETURN_ON_ERROR(catflapcam_snapshot_pool_claim(&video->snapshot_pool, ret_job != NULL, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_LOCK_WAIT_MS), &job),
+                        TAG, "failed to claim snapshot job");
+    if (xSemaphoreTake(video->snapshot_lock, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_LOCK_WAIT_MS)) != pdPASS) {
+        catflapcam_snapshot_pool_release(job);
+        ESP_LOGE(TAG, "failed to take snapshot lock");
+        return ESP_ERR_TIMEOUT;
+    }
+    job->with_preroll = with_preroll;
+
+    ESP_GOTO_ON_ERROR(catflapcam_frame_broker_acquire(video->broker, video->snapshot_sub, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_FRAME_WAIT_MS), &frame),
+                      fail, TAG, "failed to receive video frame");
+
+    if (!snapshot_raw_format(video)) {
+        ESP_GOTO_ON_FALSE(frame->size <= job->buf_size, ESP_ERR_INVALID_SIZE, fail, TAG, "JPEG frame too large for snapshot buffer");
+        if (video->width != CATFLAPCAM_SNAPSHOT_WIDTH || video->height != CATFLAPCAM_SNAPSHOT_HEIGHT) {
+            ESP_LOGW(TAG, "snapshot resize unavailable for JPEG source (%" PRIu32 "x%" PRIu32 "); storing original frame",
+                     video->width, video->height);
+        }
+        memcpy(job->buf, frame->data, frame->size);
+        job->size = frame->size;
+    } else {
+        ESP_GOTO_ON_ERROR(resize_frame_for_snapshot(video, frame->data, frame->size, job->buf, job->buf_size, &job->size),
+                          fail, TAG, "failed to resize frame for snapshot");
+    }
+    job->frame_seq = frame->seq;
+    job->capture_us = frame->capture_us;
+    catflapcam_frame_broker_release(video->broker, frame);
+    frame = NULL;
+    xSemaphoreGive(video->snapshot_lock);
+
+    job->submit_us = t0_us;
+    job->grab_us = esp_timer_get_time();
+    if (ret_job) {
+        *ret_job = job;
+    }
+    /* The queue holds as many entries as the job pool, so a claimed job always fits. */
+    xQueueSend(video->snapshot_queue, &job, portMAX_DELAY);
+    return ESP_OK;
+
+fail:
+    catflapcam_frame_broker_release(video->broker, frame);
+    xSemaphoreGive(video->snapshot_lock);
+    catflapcam_snapshot_pool_release(job);
+    return ret;
+}
+
+esp_err_t catflapcam_webcam_wait_snapshot(catflapcam_webcam_video_t *video, catflapcam_snapshot_job_t *job, TickType_t wait)
+{
+    ESP_RETURN_ON_FALSE(video && job, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    return catflapcam_snapshot_pool_wait(job, wait);
+}
+
+esp_err_t catflapcam_webcam_capture_snapshot(catflapcam_webcam_video_t *video, bool with_preroll)
+{
+    catflapcam_snapshot_job_t *job = NULL;
+
+    ESP_RETURN_ON_ERROR(catflapcam_webcam_submit_snapshot(video, with_preroll, &job), TAG, "failed to submit snapshot");
+    return catflapcam_webcam_wait_snapshot(video, job, pdMS_TO_TICKS(CATFLAPCAM_SNAPSHOT_DONE_WAIT_MS));
+}
+
+static esp_err_t ensure_burst_buffers(catflapcam_webcam_video_t *video)
+{
+    if (!video->burst_arena) {
+        video->burst_arena = heap_caps_malloc(CATFLAPCAM_BURST_ARENA_SIZE, MALLOC_CAP_SPIRAM);
+        ESP_RETURN_ON_FALSE(video->burst_arena, ESP_ERR_NO_MEM, TAG, "failed to alloc burst arena");
+    }
+    if (snapshot_raw_format(video)) {
+        if (!video->burst_scratch) {
+            video->burst_scratch = heap_caps_malloc(snapshot_raw_size(video), MALLOC_CAP_SPIRAM);
+            ESP_RETURN_ON_FALSE(video->burst_scratch, ESP_ERR_NO_MEM, TAG, "failed to alloc burst scratch buffer");
+        }
+        if (!video->burst_out_buf) {
+            ESP_RETURN_ON_ERROR(catflapcam_encoder_alloc_output_buffer(video->snapshot_encoder_handle, &video->burst_out_buf, &video->burst_out_size),
+                                TAG, "failed to alloc burst output buf");
+        }
+    }
+    return ESP_OK;
+}
+
+static esp_err_t encode_burst_frame(catflapcam_webcam_video_t *video, const catflapcam_frame_t *frame, uint8_t *dst,
+                                    uint32_t dst_capacity, uint32_t *out_size)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t raw_size = 0;
+    uint32_t jpeg_size = 0;
+
+    if (!snapshot_raw_format(video)) {
+        ESP_RETURN_ON_FALSE(frame->size <= dst_capacity, ESP_ERR_NO_MEM, TAG, "burst arena full");
+        memcpy(dst, frame->data, frame->size);
+        *out_size = frame->size;
+        return ESP_OK;
+    }
+
+    ESP_RETURN_ON_ERROR(resize_frame_for_snapshot(video, frame->data, frame->size, video->burst_scratch,
+                                                  snapshot_raw_size(video), &raw_size),
+                        TAG, "failed to resize frame for burst");
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(video->sem, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_ENC_WAIT_MS)) == pdPASS,
+                        ESP_ERR_TIMEOUT, TAG, "failed to take semaphore");
+    ret = catflapcam_encoder_process(video->snapshot_encoder_handle, video->burst_scratch, raw_size,
+                                     video->burst_out_buf, video->burst_out_size, &jpeg_size);
+    xSemaphoreGive(video->sem);
+    ESP_RETURN_ON_ERROR(ret, TAG, "failed to encode burst frame");
+    ESP_RETURN_ON_FALSE(jpeg_size <= dst_capacity, ESP_ERR_NO_MEM, TAG, "burst arena full");
+
+    memcpy(dst, video->burst_out_buf, jpeg_size);
+    *out_size = jpeg_size;
+    return ESP_OK;
+}
+
+/*
+ * Grabs `count` frames at sensor rate (at least `interval_ms` apart), encodes them back-to-back into the
+ * burst arena and commits them to storage as one batch with a single eviction pass.
+ */
+esp_err_t catflapcam_webcam_capture_burst(catflapcam_webcam_video_t *video, uint32_t count, uint32_t interval_ms, uint32_t *ret_saved)
+{
+    esp_err_t ret = ESP_OK;
+    catflapcam_storage_blob_t blobs[CATFLAPCAM_BURST_MAX_FRAMES];
+    uint32_t grabbed = 0;
+    uint32_t arena_used = 0;
+    size_t saved = 0;
+    int64_t last_capture_us = 0;
     int64_t t0_us = esp_timer_get_time();
-    int64_t t_capture_done_us = 0;
-    int64_t t_encode_done_us = 0;
-    int64_t t_save_done_us = 0;
-    bool enc_locked = false;
 
-    video->capture_priority_active = true;
+    if (ret_saved) {
+        *ret_saved = 0;
+    }
+    ESP_RETURN_ON_FALSE(count > 0 && count <= CATFLAPCAM_BURST_MAX_FRAMES && interval_ms <= CATFLAPCAM_BURST_MAX_INTERVAL_MS,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid burst parameters");
+    ESP_RETURN_ON_FALSE(video->snapshot_worker, ESP_ERR_NOT_SUPPORTED, TAG, "snapshots not supported for video%d", video->index);
     ESP_RETURN_ON_FALSE(catflapcam_storage_is_ready(), ESP_ERR_INVALID_STATE, TAG, "SD snapshot storage not ready");
+    ESP_RETURN_ON_FALSE(xSemaphoreTake(video->burst_lock, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_LOCK_WAIT_MS)) == pdPASS,
+                        ESP_ERR_TIMEOUT, TAG, "burst already running");
+    ESP_GOTO_ON_ERROR(ensure_burst_buffers(video), out, TAG, "failed to alloc burst buffers");
+
+    while (grabbed < count) {
+        catflapcam_frame_t *frame = NULL;
+        uint32_t jpeg_size = 0;
+
+        ESP_GOTO_ON_ERROR(catflapcam_frame_broker_acquire(video->broker, video->burst_sub, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_FRAME_WAIT_MS), &frame),
+                          out, TAG, "failed to receive video frame");
+        if (grabbed > 0 && (frame->capture_us - last_capture_us) < (int64_t)interval_ms * 1000) {
+            catflapcam_frame_broker_release(video->broker, frame);
+            continue;
+        }
+        last_capture_us = frame->capture_us;
+        int64_t timestamp_ms = capture_epoch_ms(frame->capture_us);
+        ret = encode_burst_frame(video, frame, video->burst_arena + arena_used, CATFLAPCAM_BURST_ARENA_SIZE - arena_used, &jpeg_size);
+        catflapcam_frame_broker_release(video->broker, frame);
+        if (ret == ESP_ERR_NO_MEM && grabbed > 0) {
+            ESP_LOGW(TAG, "burst arena full after %" PRIu32 "/%" PRIu32 " frames", grabbed, count);
+            ret = ESP_OK;
+            break;
+        }
+        ESP_GOTO_ON_ERROR(ret, out, TAG, "failed to capture burst frame %" PRIu32, grabbed);
+
+        blobs[grabbed].data = video->burst_arena + arena_used;
+        blobs[grabbed].len = jpeg_size;
+        blobs[grabbed].timestamp_ms = timestamp_ms;
+        blobs[grabbed].source = (uint8_t)video->index;
+        arena_used += jpeg_size;
+        grabbed++;
+    }
+    int64_t t_capture_done_us = esp_timer_get_time();
+
+    ret = catflapcam_storage_writer_submit(blobs, grabbed, CATFLAPCAM_STORAGE_WRITER_REJECT, CATFLAPCAM_SNAPSHOT_DONE_WAIT_MS, &saved,
+                                           NULL, NULL);
+    int64_t t_save_done_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "burst saved frames=%u/%" PRIu32 " bytes=%" PRIu32 " capture=%" PRIi64 "ms save=%" PRIi64 "ms",
+             (unsigned)saved, count, arena_used, (t_capture_done_us - t0_us) / 1000, (t_save_done_us - t_capture_done_us) / 1000);
+
+out:
+    xSemaphoreGive(video->burst_lock);
+    if (ret_saved) {
+        *ret_saved = saved;
+    }
+    return ret;
+}
+
+static void deinit_snapshot_pipeline(catflapcam_webcam_video_t *video)
+{
+    catflapcam_snapshot_job_t *stop = NULL;
+
+    if (video->snapshot_worker) {
+        xQueueSend(video->snapshot_queue, &stop, portMAX_DELAY);
+        if (xSemaphoreTake(video->snapshot_worker_stopped, pdMS_TO_TICKS(CATFLAPCAM_SNAPSHOT_DONE_WAIT_MS)) != pdPASS) {
+            ESP_LOGE(TAG, "video%d: snapshot worker did not stop, leaking snapshot pipeline", video->index);
+            return;
+        }
+        video->snapshot_worker = NULL;
+    }
+    /* Waited jobs still on the storage writer's queue come back through snapshot_write_done. */
+    if (catflapcam_snapshot_pool_drain(&video->snapshot_pool, pdMS_TO_TICKS(CATFLAPCAM_SNAPSHOT_DONE_WAIT_MS)) != ESP_OK) {
+        ESP_LOGE(TAG, "video%d: snapshot writes still pending, leaking snapshot pipeline", video->index);
+        return;
+    }
+
+    if (video->burst_sub) {
+        catflapcam_frame_broker_unsubscribe(video->broker, video->burst_sub);
+        video->burst_sub = NULL;
+    }
+    if (video->burst_arena) {
+        heap_caps_free(video->burst_arena);
+        video->burst_arena = NULL;
+    }
+    if (video->burst_scratch) {
+        heap_caps_free(video->burst_scratch);
+        video->burst_scratch = NULL;
+    }
+    if (video->burst_out_buf) {
+        catflapcam_encoder_free_output_buffer(video->snapshot_encoder_handle, video->burst_out_buf);
+        video->burst_out_buf = NULL;
+        video->burst_out_size = 0;
+    }
+    if (video->burst_lock) {
+        vSemaphoreDelete(video->burst_lock);
+        video->burst_lock = NULL;
+    }
+    if (video->preroll_sub) {
+        catflapcam_frame_broker_unsubscribe(video->broker, video->preroll_sub);
+        video->preroll_sub = NULL;
+    }
+    if (video->preroll_arena) {
+        heap_caps_free(video->preroll_arena);
+        video->preroll_arena = NULL;
+    }
+    if (video->preroll_scratch) {
+        heap_caps_free(video->preroll_scratch);
+        video->preroll_scratch = NULL;
+    }
+    free(video->preroll);
+    video->preroll = NULL;
+    video->preroll_len = 0;
+
+    catflapcam_snapshot_pool_deinit(&video->snapshot_pool);
+    if (video->snapshot_worker_stopped) {
+        vSemaphoreDelete(video->snapshot_worker_stopped);
+        video->snapshot_worker_stopped = NULL;
+    }
+    if (video->snapshot_queue) {
+        vQueueDelete(video->snapshot_queue);
+        video->snapshot_queue = NULL;
+    }
+    if (video->snapshot_resize) {
+        catflapcam_resize_free(video->snapshot_resize);
+        video->snapshot_resize = NULL;
+    }
+    if (video->snapshot_scaler) {
+        catflapcam_jpeg_scaler_free(video->snapshot_scaler);
+        video->snapshot_scaler = NULL;
+    }
+    if (video->resize_lock) {
+        vSemaphoreDelete(video->resize_lock);
+        video->resize_lock = NULL;
+    }
+}
+
+static esp_err_t init_preroll_ring(catflapcam_webcam_video_t *video, uint32_t len)
+{
+    video->preroll_slot_size = ((uint32_t)CATFLAPCAM_PREROLL_BUDGET_KB * 1024) / len;
+    video->preroll_arena = heap_caps_calloc(len, video->preroll_slot_size, MALLOC_CAP_SPIRAM);
+    ESP_RETURN_ON_FALSE(video->preroll_arena, ESP_ERR_NO_MEM, TAG, "failed to alloc pre-trigger ring");
+    if (snapshot_raw_format(video)) {
+        video->preroll_scratch = heap_caps_calloc(1, snapshot_raw_size(video), MALLOC_CAP_SPIRAM);
+        ESP_RETURN_ON_FALSE(video->preroll_scratch, ESP_ERR_NO_MEM, TAG, "failed to alloc pre-trigger scratch buffer");
+    }
+    ESP_RETURN_ON_ERROR(catflapcam_frame_broker_subscribe(video->broker, &video->preroll_sub), TAG, "failed to subscribe pre-trigger ring");
+
+    video->preroll = calloc(len, sizeof(catflapcam_webcam_preroll_entry_t));
+    ESP_RETURN_ON_FALSE(video->preroll, ESP_ERR_NO_MEM, TAG, "failed to alloc pre-trigger ring entries");
+    for (uint32_t i = 0; i < len; i++) {
+        video->preroll[i].buf = video->preroll_arena + i * video->preroll_slot_size;
+    }
+    video->preroll_len = len;
+    return ESP_OK;
+}
+
+static esp_err_t init_snapshot_pipeline(catflapcam_webcam_video_t *video)
+{
+    char task_name[16];
+
+    load_roi(video);
+    if (video->pixel_format == V4L2_PIX_FMT_JPEG && video->snapshot_encoder_handle) {
+        if (new_snapshot_resize(video, &video->roi, &video->snapshot_resize, &video->snapshot_scaler) != ESP_OK) {
+            ESP_LOGW(TAG, "video%d: JPEG snapshot downscale unavailable, storing original frames", video->index);
+        }
+    }
+
+    uint32_t buf_size = snapshot_raw_format(video) ? snapshot_raw_size(video) : video->buffer_size;
+    if (buf_size == 0) {
+        ESP_LOGW(TAG, "video%d: pixel format not supported for snapshots", video->index);
+        return ESP_OK;
+    }
+
+    if (snapshot_raw_format(video)) {
+        video->resize_lock = xSemaphoreCreateMutex();
+        ESP_RETURN_ON_FALSE(video->resize_lock, ESP_ERR_NO_MEM, TAG, "failed to create resize lock");
+    }
+    if (video->pixel_format != V4L2_PIX_FMT_JPEG) {
+        ESP_RETURN_ON_ERROR(new_snapshot_resize(video, &video->roi, &video->snapshot_resize, &video->snapshot_scaler),
+                            TAG, "failed to create snapshot resize plan");
+    }
+
+    ESP_RETURN_ON_ERROR(catflapcam_snapshot_pool_init(&video->snapshot_pool, buf_size), TAG, "failed to init snapshot job pool");
+    video->snapshot_queue = xQueueCreate(CATFLAPCAM_SNAPSHOT_QUEUE_LEN, sizeof(catflapcam_snapshot_job_t *));
+    ESP_RETURN_ON_FALSE(video->snapshot_queue, ESP_ERR_NO_MEM, TAG, "failed to create snapshot queue");
+    video->snapshot_worker_stopped = xSemaphoreCreateBinary();
+    ESP_RETURN_ON_FALSE(video->snapshot_worker_stopped, ESP_ERR_NO_MEM, TAG, "failed to create snapshot stop semaphore");
+
+    video->burst_lock = xSemaphoreCreateMutex();
+    ESP_RETURN_ON_FALSE(video->burst_lock, ESP_ERR_NO_MEM, TAG, "failed to create burst lock");
+    ESP_RETURN_ON_ERROR(catflapcam_frame_broker_subscribe(video->broker, &video->burst_sub), TAG, "failed to subscribe burst path");
+
+    uint32_t preroll_len = CATFLAPCAM_PREROLL_FRAMES;
+    if (preroll_len > 0) {
+        ESP_RETURN_ON_ERROR(init_preroll_ring(video, preroll_len), TAG, "failed to init pre-trigger ring");
+    }
+
+    snprintf(task_name, sizeof(task_name), "snapshot%d", video->index);
+    ESP_RETURN_ON_FALSE(xTaskCreate(snapshot_worker_task, task_name, CATFLAPCAM_SNAPSHOT_TASK_STACK_SIZE, video,
+                                    CATFLAPCAM_SNAPSHOT_TASK_PRIORITY, &video->snapshot_worker) == pdPASS,
+                        ESP_FAIL, TAG, "failed to create snapshot worker task");
+    return ESP_OK;
+}
+
+static void free_stream_jpeg_cache(catflapcam_webcam_video_t *video)
+{
+    for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+        catflapcam_webcam_jpeg_t *jpeg = &video->stream_feed.cache[i];
+        if (jpeg->buf && video->encoder_handle) {
+            catflapcam_encoder_free_output_buffer(video->encoder_handle, jpeg->buf);
+        }
+        memset(jpeg, 0, sizeof(*jpeg));
+    }
+}
+
+static void v4l2_fill_source_buf(catflapcam_webcam_video_t *video, const struct v4l2_buffer *buf, catflapcam_frame_source_buf_t *src_buf)
+{
+    src_buf->index = buf->index;
+    src_buf->data = video->buffer[buf->index];
+    src_buf->size = (video->pixel_format == V4L2_PIX_FMT_JPEG) ? buf->bytesused : video->buffer_size;
+    if (!(buf->flags & V4L2_BUF_FLAG_DONE)) {
+        src_buf->size = 0;
+    }
+}
+
+static esp_err_t v4l2_frame_dequeue(void *ctx, catflapcam_frame_source_buf_t *src_buf)
+{
+    catflapcam_webcam_video_t *video = (catflapcam_webcam_video_t *)ctx;
+    struct v4l2_buffer buf;
+
     memset(&buf, 0, sizeof(buf));
     buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
     buf.memory = V4L2_MEMORY_MMAP;
+    if (ioctl(video->fd, VIDIOC_DQBUF, &buf) != 0) {
+        return ESP_FAIL;
+    }
+
+    v4l2_fill_source_buf(video, &buf, src_buf);
+    return ESP_OK;
+}
 
-    ESP_GOTO_ON_FALSE(xSemaphoreTake(video->io_mutex, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_IO_WAIT_MS)) == pdPASS,
-                      ESP_ERR_TIMEOUT, out, TAG, "failed to take camera io mutex");
-    ESP_GOTO_ON_ERROR(ioctl(video->fd, VIDIOC_DQBUF, &buf), out_unlock_io, TAG, "failed to receive video frame");
-    if (!(buf.flags & V4L2_BUF_FLAG_DONE)) {
-        ret = ESP_ERR_INVALID_RESPONSE;
-        goto out_qbuf;
+/*
+ * The frame broker task is the only reader of the capture queue, so the descriptor is switched to
+ * non-blocking just for this dequeue.
+ */
+static esp_err_t v4l2_frame_dequeue_ready(void *ctx, catflapcam_frame_source_buf_t *src_buf)
+{
+    catflapcam_webcam_video_t *video = (catflapcam_webcam_video_t *)ctx;
+    struct v4l2_buffer buf;
+    int flags;
+    int ret;
+
+    flags = fcntl(video->fd, F_GETFL);
+    if (flags < 0 || fcntl(video->fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    ret = ioctl(video->fd, VIDIOC_DQBUF, &buf);
+    fcntl(video->fd, F_SETFL, flags);
+    if (ret != 0) {
+        return ESP_ERR_NOT_FOUND;
     }
-    t_capture_done_us = esp_timer_get_time();
+
+    v4l2_fill_source_buf(video, &buf, src_buf);
+    return ESP_OK;
+}
+
+static esp_err_t v4l2_frame_requeue(void *ctx, const catflapcam_frame_source_buf_t *src_buf)
+{
+    catflapcam_webcam_video_t *video = (catflapcam_webcam_video_t *)ctx;
+    struct v4l2_buffer buf;
+
+    memset(&buf, 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = src_buf->index;
+    if (ioctl(video->fd, VIDIOC_QBUF, &buf) != 0) {
+        ESP_LOGW(TAG, "video%d: failed to queue frame buffer %" PRIu32 " back", video->index, src_buf->index);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+static void free_stream_variant(catflapcam_webcam_variant_t *variant)
+{
+    for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+        if (variant->feed.cache[i].buf) {
+            catflapcam_encoder_free_output_buffer(variant->encoder, variant->feed.cache[i].buf);
+        }
+    }
+    if (variant->encoder) {
+        catflapcam_encoder_deinit(variant->encoder);
+    }
+    if (variant->resize) {
+        catflapcam_resize_free(variant->resize);
+    }
+    if (variant->scaler) {
+        catflapcam_jpeg_scaler_free(variant->scaler);
+    }
+    heap_caps_free(variant->raw);
+    free(variant);
+}
+
+/* A stream variant asked for by the stream accept handler, which waits on `done` while the encode task builds it. */
+typedef struct variant_request {
+    uint32_t width;
+    uint32_t height;
+    uint8_t quality;
+    bool latest;
+    TaskHandle_t notify;
+    SemaphoreHandle_t done;
+    esp_err_t result;
+    catflapcam_webcam_variant_t *variant;
+} variant_request_t;
+
+/* Builds the downscale stage, encoder and JPEG cache of one stream size; the frame is never cropped. */
+static esp_err_t new_stream_variant(catflapcam_webcam_video_t *video, uint32_t width, uint32_t height, uint8_t quality,
+                                    catflapcam_webcam_variant_t **ret_variant)
+{
+    esp_err_t ret = ESP_OK;
+    uint32_t raw_format = video->pixel_format == V4L2_PIX_FMT_JPEG ? CATFLAPCAM_JPEG_SCALER_PIXEL_FORMAT : video->pixel_format;
+
+    ESP_RETURN_ON_FALSE(catflapcam_resize_bytes_per_pixel(raw_format) > 0, ESP_ERR_NOT_SUPPORTED, TAG,
+                        "video%d: pixel format not supported for stream variants", video->index);
+    catflapcam_webcam_variant_t *variant = calloc(1, sizeof(catflapcam_webcam_variant_t));
+    ESP_RETURN_ON_FALSE(variant, ESP_ERR_NO_MEM, TAG, "failed to alloc stream variant");
+    variant->width = width;
+    variant->height = height;
+    variant->quality = quality;
 
     if (video->pixel_format == V4L2_PIX_FMT_JPEG) {
-        jpeg_src = (const uint8_t *)video->buffer[buf.index];
-        jpeg_encoded_size = buf.bytesused;
-        if (video->width != CATFLAPCAM_SNAPSHOT_WIDTH || video->height != CATFLAPCAM_SNAPSHOT_HEIGHT) {
-            ESP_LOGW(TAG, "snapshot resize unavailable for JPEG source (%" PRIu32 "x%" PRIu32 "); storing original frame",
-                     video->width, video->height);
+        catflapcam_jpeg_scaler_config_t scaler_config = {
+            .src_width = video->width,
+            .src_height = video->height,
+            .dst_width = width,
+            .dst_height = height,
+            .mode = CATFLAPCAM_SNAPSHOT_RESIZE_MODE,
+        };
+        ESP_GOTO_ON_ERROR(catflapcam_jpeg_scaler_new(&scaler_config, &variant->scaler), fail, TAG, "failed to create variant decoder");
+    } else {
+        catflapcam_resize_config_t resize_config = {
+            .pixel_format = video->pixel_format,
+            .mode = CATFLAPCAM_SNAPSHOT_RESIZE_MODE,
+            .src_width = video->width,
+            .src_height = video->height,
+            .dst_width = width,
+            .dst_height = height,
+        };
+        ESP_GOTO_ON_ERROR(catflapcam_resize_new(&resize_config, &variant->resize), fail, TAG, "failed to create variant resize plan");
+    }
+    variant->raw_size = width * height * catflapcam_resize_bytes_per_pixel(raw_format);
+    variant->raw = heap_caps_malloc(variant->raw_size, MALLOC_CAP_SPIRAM);
+    ESP_GOTO_ON_FALSE(variant->raw, ESP_ERR_NO_MEM, fail, TAG, "failed to alloc variant frame");
+
+    catflapcam_encoder_config_t encoder_config = {
+        .width = width,
+        .height = height,
+        .pixel_format = raw_format,
+        .quality = quality,
+    };
+    ESP_GOTO_ON_ERROR(catflapcam_encoder_init(&encoder_config, &variant->encoder), fail, TAG, "failed to init variant encoder");
+    for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+        catflapcam_webcam_jpeg_t *jpeg = &variant->feed.cache[i];
+        ESP_GOTO_ON_ERROR(catflapcam_encoder_alloc_output_buffer(variant->encoder, &jpeg->buf, &jpeg->buf_size),
+                          fail, TAG, "failed to alloc variant jpeg cache buf %d", i);
+    }
+    *ret_variant = variant;
+    return ESP_OK;
+
+fail:
+    free_stream_variant(variant);
+    return ret;
+}
+
+/* Downscales `frame` to the variant size and encodes it; only the encode task uses a variant's stages. */
+static esp_err_t encode_variant_jpeg(catflapcam_webcam_variant_t *variant, const catflapcam_frame_t *frame, catflapcam_webcam_jpeg_t *jpeg)
+{
+    uint32_t raw_size = 0;
+
+    if (variant->scaler) {
+        ESP_RETURN_ON_ERROR(catflapcam_jpeg_scaler_process(variant->scaler, frame->data, frame->size, variant->raw, variant->raw_size, &raw_size),
+                            TAG, "failed to decode stream variant");
+    } else {
+        ESP_RETURN_ON_ERROR(catflapcam_resize_process(variant->resize, frame->data, frame->size, variant->raw, variant->raw_size, &raw_size),
+                            TAG, "failed to resize stream variant");
+    }
+    ESP_RETURN_ON_ERROR(catflapcam_encoder_process(variant->encoder, variant->raw, raw_size, jpeg->buf, jpeg->buf_size, &jpeg->size),
+                        TAG, "failed to encode stream variant");
+    return ESP_OK;
+}
+
+static void free_stream_variants(catflapcam_webcam_video_t *video)
+{
+    for (int i = 0; i < CATFLAPCAM_STREAM_VARIANT_MAX; i++) {
+        if (video->variants[i]) {
+            free_stream_variant(video->variants[i]);
+            video->variants[i] = NULL;
+        }
+    }
+}
+
+/* Claims the oldest free entry of a feed that has readers; a frame is dropped for it when every entry is still being sent. */
+static catflapcam_webcam_jpeg_t *feed_claim_locked(catflapcam_webcam_feed_t *feed)
+{
+    catflapcam_webcam_jpeg_t *jpeg = NULL;
+
+    if (feed->users == 0) {
+        return NULL;
+    }
+    for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+        catflapcam_webcam_jpeg_t *entry = &feed->cache[i];
+        if (entry->refcount == 0 && (!jpeg || entry->seq < jpeg->seq)) {
+            jpeg = entry;
+        }
+    }
+    if (jpeg) {
+        jpeg->seq = 0;
+        jpeg->size = 0;
+        jpeg->refcount = 1;
+    } else {
+        feed->dropped++;
+    }
+    return jpeg;
+}
+
+static catflapcam_webcam_jpeg_t *feed_claim(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed)
+{
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    catflapcam_webcam_jpeg_t *jpeg = feed_claim_locked(feed);
+    xSemaphoreGive(video->feed_lock);
+    return jpeg;
+}
+
+/* A claimed entry keeps the variant from being recycled while the encode task works on it. */
+static bool feed_in_use(const catflapcam_webcam_feed_t *feed)
+{
+    for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+        if (feed->cache[i].refcount > 0) {
+            return true;
         }
+    }
+    return feed->users > 0;
+}
+
+static bool feed_publish(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, catflapcam_webcam_jpeg_t *jpeg,
+                         const catflapcam_frame_t *frame, esp_err_t ret)
+{
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    jpeg->refcount = 0;
+    if (ret == ESP_OK) {
+        jpeg->seq = frame->seq;
+        jpeg->capture_us = frame->capture_us;
+        feed->misses++;
     } else {
-        uint8_t *resize_src = NULL;
-        uint32_t resize_src_size = 0;
+        feed->dropped++;
+    }
+    xSemaphoreGive(video->feed_lock);
+    return ret == ESP_OK;
+}
 
-        ESP_GOTO_ON_ERROR(resize_frame_for_snapshot(video, (const uint8_t *)video->buffer[buf.index], video->buffer_size,
-                                                    &resize_src, &resize_src_size),
-                          out_qbuf, TAG, "failed to resize frame for snapshot");
-        ESP_GOTO_ON_FALSE(xSemaphoreTake(video->sem, pdMS_TO_TICKS(CATFLAPCAM_CAPTURE_ENC_WAIT_MS)) == pdPASS,
-                          ESP_ERR_TIMEOUT, out_qbuf, TAG, "failed to take semaphore");
-        enc_locked = true;
+static esp_err_t encode_stream_jpeg(catflapcam_webcam_video_t *video, const catflapcam_frame_t *frame, catflapcam_webcam_jpeg_t *jpeg)
+{
+    esp_err_t ret;
 
-        ret = catflapcam_encoder_process(video->snapshot_encoder_handle, resize_src, resize_src_size,
-                                         video->snapshot_out_buf, video->snapshot_out_size, &jpeg_encoded_size);
-        xSemaphoreGive(video->sem);
-        enc_locked = false;
-        ESP_GOTO_ON_ERROR(ret, out_qbuf, TAG, "failed to encode video frame");
-        jpeg_src = (const uint8_t *)video->snapshot_out_buf;
+    if (xSemaphoreTake(video->sem, pdMS_TO_TICKS(CATFLAPCAM_STREAM_ENC_WAIT_MS)) != pdPASS) {
+        return ESP_ERR_TIMEOUT;
     }
-    t_encode_done_us = esp_timer_get_time();
+    ret = catflapcam_encoder_process(video->encoder_handle, frame->data, frame->size, jpeg->buf, jpeg->buf_size, &jpeg->size);
+    xSemaphoreGive(video->sem);
+    ESP_RETURN_ON_ERROR(ret, TAG, "video%d: failed to encode stream frame", video->index);
+    return ESP_OK;
+}
+
+/* Encodes the region of interest of `frame` at snapshot size, i.e. exactly what the snapshot path stores. */
+static esp_err_t encode_roi_jpeg(catflapcam_webcam_video_t *video, const catflapcam_frame_t *frame, catflapcam_webcam_jpeg_t *jpeg)
+{
+    esp_err_t ret;
+    uint32_t raw_size = 0;
 
-    ESP_GOTO_ON_FALSE(jpeg_src && jpeg_encoded_size > 0, ESP_ERR_INVALID_SIZE, out_qbuf, TAG, "invalid jpeg data");
-    storage_err = catflapcam_storage_save_snapshot(jpeg_src, jpeg_encoded_size);
-    if (storage_err != ESP_OK) {
-        ESP_LOGW(TAG, "failed to save snapshot to SD: %s", esp_err_to_name(storage_err));
+    ESP_RETURN_ON_ERROR(resize_frame_for_snapshot(video, frame->data, frame->size, video->roi_raw, snapshot_raw_size(video), &raw_size),
+                        TAG, "failed to resize region of interest");
+    if (xSemaphoreTake(video->sem, pdMS_TO_TICKS(CATFLAPCAM_STREAM_ENC_WAIT_MS)) != pdPASS) {
+        return ESP_ERR_TIMEOUT;
     }
-    t_save_done_us = esp_timer_get_time();
+    ret = catflapcam_encoder_process(video->snapshot_encoder_handle, video->roi_raw, raw_size, jpeg->buf, jpeg->buf_size, &jpeg->size);
+    xSemaphoreGive(video->sem);
+    ESP_RETURN_ON_ERROR(ret, TAG, "video%d: failed to encode region of interest", video->index);
+    return ESP_OK;
+}
 
-    ESP_GOTO_ON_ERROR(ioctl(video->fd, VIDIOC_QBUF, &buf), out_unlock_io, TAG, "failed to queue frame buffer back");
-    memset(&buf, 0, sizeof(buf));
-    xSemaphoreGive(video->io_mutex);
-    video->capture_priority_active = false;
-    ESP_LOGI(TAG,
-             "snapshot saved bytes=%" PRIu32 " capture=%" PRIi64 "ms encode=%" PRIi64 "ms save=%" PRIi64 "ms total=%" PRIi64 "ms",
-             jpeg_encoded_size, (t_capture_done_us - t0_us) / 1000, (t_encode_done_us - t_capture_done_us) / 1000,
-             (t_save_done_us - t_encode_done_us) / 1000, (t_save_done_us - t0_us) / 1000);
-    return storage_err;
+/* The encode task is only woken by the broker while some feed of the camera has a reader. */
+static void feed_add_reader(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, bool latest, TaskHandle_t notify)
+{
+    feed->users++;
+    video->feed_notify = notify;
+    if (video->feed_readers++ == 0) {
+        catflapcam_frame_broker_set_notify(video->broker, video->encode_sub, video->encode_worker);
+    }
+    if (latest && video->feed_latest++ == 0) {
+        catflapcam_frame_broker_set_latest(video->broker, video->encode_sub, true);
+    }
+}
 
-out_qbuf:
-    if (enc_locked) {
-        xSemaphoreGive(video->sem);
+static void feed_remove_reader(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, bool latest)
+{
+    if (feed->users == 0) {
+        return;
+    }
+    feed->users--;
+    if (--video->feed_readers == 0) {
+        catflapcam_frame_broker_set_notify(video->broker, video->encode_sub, NULL);
+    }
+    if (latest && --video->feed_latest == 0) {
+        catflapcam_frame_broker_set_latest(video->broker, video->encode_sub, false);
+    }
+}
+
+static void free_roi_feed(catflapcam_webcam_video_t *video)
+{
+    for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+        catflapcam_webcam_jpeg_t *jpeg = &video->roi_feed.cache[i];
+        if (jpeg->buf) {
+            catflapcam_encoder_free_output_buffer(video->snapshot_encoder_handle, jpeg->buf);
+        }
+        memset(jpeg, 0, sizeof(*jpeg));
+    }
+    heap_caps_free(video->roi_raw);
+    video->roi_raw = NULL;
+}
+
+/* The region of interest feed is only allocated once somebody watches it, and then kept. */
+static esp_err_t init_roi_feed(catflapcam_webcam_video_t *video)
+{
+    esp_err_t ret = ESP_OK;
+    uint8_t *raw = heap_caps_malloc(snapshot_raw_size(video), MALLOC_CAP_SPIRAM);
+
+    ESP_RETURN_ON_FALSE(raw, ESP_ERR_NO_MEM, TAG, "failed to alloc region of interest frame");
+    for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+        catflapcam_webcam_jpeg_t *jpeg = &video->roi_feed.cache[i];
+        ESP_GOTO_ON_ERROR(catflapcam_encoder_alloc_output_buffer(video->snapshot_encoder_handle, &jpeg->buf, &jpeg->buf_size),
+                          fail, TAG, "failed to alloc region of interest jpeg buf %d", i);
     }
-    if (ioctl(video->fd, VIDIOC_QBUF, &buf) != ESP_OK) {
-        ESP_LOGW(TAG, "failed to queue frame buffer back");
+    video->roi_raw = raw;
+    return ESP_OK;
+
+fail:
+    video->roi_raw = raw;
+    free_roi_feed(video);
+    return ret;
+}
+
+/*
+ * Opens the full-size stream feed of a non-JPEG camera, or its region of interest feed. `notify` is woken
+ * whenever a feed of the camera has a new JPEG; `latest` puts the frame broker in latest-frame mode while
+ * the reader is open.
+ */
+esp_err_t catflapcam_webcam_open_feed(catflapcam_webcam_video_t *video, bool roi, bool latest, TaskHandle_t notify,
+                                      catflapcam_webcam_feed_t **ret_feed)
+{
+    esp_err_t ret = ESP_OK;
+
+    ESP_RETURN_ON_FALSE(video && ret_feed, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(video->encode_worker, ESP_ERR_NOT_SUPPORTED, TAG, "video%d: no encode task", video->index);
+    if (roi) {
+        ESP_RETURN_ON_FALSE(video->resize_lock && video->snapshot_encoder_handle, ESP_ERR_NOT_SUPPORTED, TAG,
+                            "video%d: no region of interest encoder", video->index);
+    } else {
+        ESP_RETURN_ON_FALSE(video->encoder_handle, ESP_ERR_NOT_SUPPORTED, TAG, "video%d: frames are streamed as captured", video->index);
+    }
+
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    if (roi && !video->roi_raw) {
+        ESP_GOTO_ON_ERROR(init_roi_feed(video), out, TAG, "video%d: failed to init region of interest feed", video->index);
     }
-out_unlock_io:
-    xSemaphoreGive(video->io_mutex);
+    *ret_feed = roi ? &video->roi_feed : &video->stream_feed;
+    feed_add_reader(video, *ret_feed, latest, notify);
+
 out:
-    video->capture_priority_active = false;
-    memset(&buf, 0, sizeof(buf));
+    xSemaphoreGive(video->feed_lock);
     return ret;
 }
 
+void catflapcam_webcam_close_feed(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, bool latest)
+{
+    if (!video || !feed) {
+        return;
+    }
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    feed_remove_reader(video, feed, latest);
+    xSemaphoreGive(video->feed_lock);
+}
+
+/*
+ * Finds the variant of the given size and quality, or else the slot a new one would take: an empty one, or one
+ * nobody reads or encodes. Called with the feed lock held; returns -1 when every slot is busy.
+ */
+static int find_stream_variant(catflapcam_webcam_video_t *video, uint32_t width, uint32_t height, uint8_t quality,
+                               catflapcam_webcam_variant_t **ret_variant)
+{
+    int empty = -1;
+    int unused = -1;
+
+    *ret_variant = NULL;
+    for (int i = 0; i < CATFLAPCAM_STREAM_VARIANT_MAX; i++) {
+        catflapcam_webcam_variant_t *variant = video->variants[i];
+        if (variant && variant->width == width && variant->height == height && variant->quality == quality) {
+            *ret_variant = variant;
+            return i;
+        }
+        if (!variant && empty < 0) {
+            empty = i;
+        } else if (variant && !feed_in_use(&variant->feed) && unused < 0) {
+            unused = i;
+        }
+    }
+    return empty >= 0 ? empty : unused;
+}
+
+/*
+ * Builds the variant a stream client asked for and opens it for that client. Runs on the encode task, whose
+ * stack is sized for the decoder and encoder, so the stream accept handler only queues the request and waits.
+ * Only this task installs variants; the handler may still have opened an existing one meanwhile.
+ */
+static void build_requested_variant(catflapcam_webcam_video_t *video, variant_request_t *request, bool stop)
+{
+    esp_err_t ret = ESP_OK;
+    catflapcam_webcam_variant_t *variant = NULL;
+    catflapcam_webcam_variant_t *created = NULL;
+    catflapcam_webcam_variant_t *evicted = NULL;
+    bool installed = false;
+
+    ESP_GOTO_ON_FALSE(!stop, ESP_ERR_INVALID_STATE, out, TAG, "video%d: encode task stopping", video->index);
+    ESP_GOTO_ON_ERROR(new_stream_variant(video, request->width, request->height, request->quality, &created),
+                      out, TAG, "video%d: failed to create stream variant", video->index);
+
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    int slot = find_stream_variant(video, request->width, request->height, request->quality, &variant);
+    if (!variant && slot >= 0) {
+        evicted = video->variants[slot];
+        video->variants[slot] = created;
+        variant = created;
+        installed = true;
+    }
+    if (variant) {
+        feed_add_reader(video, &variant->feed, request->latest, request->notify);
+    }
+    xSemaphoreGive(video->feed_lock);
+
+    if (evicted) {
+        free_stream_variant(evicted);
+    }
+    if (!installed) {
+        free_stream_variant(created);
+    }
+    ESP_GOTO_ON_FALSE(variant, ESP_ERR_NO_MEM, out, TAG, "video%d: all %d stream variants in use", video->index, CATFLAPCAM_STREAM_VARIANT_MAX);
+    if (installed) {
+        ESP_LOGI(TAG, "video%d: stream variant %" PRIu32 "x%" PRIu32 " q%d created", video->index, request->width, request->height,
+                 request->quality);
+    }
+
+out:
+    request->result = ret;
+    request->variant = variant;
+    /* The request lives on the waiting handler's stack; it is gone once this is given. */
+    xSemaphoreGive(request->done);
+}
+
+/*
+ * Opens the stream variant of the given size and quality, shared by every client that asks for it. Variants
+ * nobody uses stay pooled until their slot is needed for another size, so reconnecting viewers skip the setup.
+ * A new variant is built by the encode task, which pauses encoding for that long; the stream task keeps going.
+ */
+esp_err_t catflapcam_webcam_open_variant(catflapcam_webcam_video_t *video, uint32_t width, uint32_t height, uint8_t quality,
+                                         bool latest, TaskHandle_t notify, catflapcam_webcam_variant_t **ret_variant)
+{
+    catflapcam_webcam_variant_t *variant = NULL;
+    bool queued = false;
+    int slot;
+
+    ESP_RETURN_ON_FALSE(video && ret_variant, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(video->encode_worker, ESP_ERR_NOT_SUPPORTED, TAG, "video%d: no stream variants", video->index);
+    ESP_RETURN_ON_FALSE(width >= CATFLAPCAM_STREAM_VARIANT_ALIGN && height >= CATFLAPCAM_STREAM_VARIANT_ALIGN &&
+                        width % CATFLAPCAM_STREAM_VARIANT_ALIGN == 0 && height % CATFLAPCAM_STREAM_VARIANT_ALIGN == 0 &&
+                        width <= video->width && height <= video->height && quality >= 1 && quality <= 100,
+                        ESP_ERR_INVALID_ARG, TAG, "invalid stream variant %" PRIu32 "x%" PRIu32 " q%d", width, height, quality);
+
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    slot = find_stream_variant(video, width, height, quality, &variant);
+    if (variant) {
+        feed_add_reader(video, &variant->feed, latest, notify);
+    }
+    xSemaphoreGive(video->feed_lock);
+    if (variant) {
+        *ret_variant = variant;
+        return ESP_OK;
+    }
+    ESP_RETURN_ON_FALSE(slot >= 0, ESP_ERR_NO_MEM, TAG, "video%d: all %d stream variants in use", video->index, CATFLAPCAM_STREAM_VARIANT_MAX);
+
+    variant_request_t request = {
+        .width = width,
+        .height = height,
+        .quality = quality,
+        .latest = latest,
+        .notify = notify,
+        .done = xSemaphoreCreateBinary(),
+    };
+    variant_request_t *request_ptr = &request;
+    ESP_RETURN_ON_FALSE(request.done, ESP_ERR_NO_MEM, TAG, "failed to create variant request semaphore");
+
+    /* Queued under the feed lock, so a stopping encode task still answers every request it will ever see. */
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    if (!video->encode_stop) {
+        queued = xQueueSend(video->variant_requests, &request_ptr, 0) == pdPASS;
+    }
+    xSemaphoreGive(video->feed_lock);
+    if (queued) {
+        xTaskNotifyGive(video->encode_worker);
+        xSemaphoreTake(request.done, portMAX_DELAY);
+    }
+    vSemaphoreDelete(request.done);
+    ESP_RETURN_ON_FALSE(queued, ESP_ERR_NO_MEM, TAG, "video%d: too many stream variant requests", video->index);
+    ESP_RETURN_ON_ERROR(request.result, TAG, "video%d: stream variant %" PRIu32 "x%" PRIu32 " q%d not available", video->index, width,
+                        height, quality);
+    *ret_variant = request.variant;
+    return ESP_OK;
+}
+
+void catflapcam_webcam_close_variant(catflapcam_webcam_video_t *video, catflapcam_webcam_variant_t *variant, bool latest)
+{
+    if (!video || !variant) {
+        return;
+    }
+    catflapcam_webcam_close_feed(video, &variant->feed, latest);
+}
+
+/* Takes the newest JPEG of `feed` newer than `after_seq` without waiting; ESP_ERR_NOT_FOUND when there is none yet. */
+esp_err_t catflapcam_webcam_acquire_feed_jpeg(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, uint64_t after_seq,
+                                              catflapcam_webcam_jpeg_t **ret_jpeg)
+{
+    catflapcam_webcam_jpeg_t *jpeg = NULL;
+
+    ESP_RETURN_ON_FALSE(video && feed && ret_jpeg, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+        catflapcam_webcam_jpeg_t *entry = &feed->cache[i];
+        if (entry->seq > after_seq && (!jpeg || entry->seq > jpeg->seq)) {
+            jpeg = entry;
+        }
+    }
+    if (jpeg) {
+        jpeg->refcount++;
+        feed->hits++;
+    }
+    xSemaphoreGive(video->feed_lock);
+
+    *ret_jpeg = jpeg;
+    return jpeg ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+void catflapcam_webcam_release_feed_jpeg(catflapcam_webcam_video_t *video, catflapcam_webcam_jpeg_t *jpeg)
+{
+    if (!video || !jpeg) {
+        return;
+    }
+    xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+    if (jpeg->refcount > 0) {
+        jpeg->refcount--;
+    }
+    xSemaphoreGive(video->feed_lock);
+}
+
+/*
+ * Encodes each new frame once for every feed that has readers, then wakes the reader task, so encoding,
+ * decoding and resizing never hold up the stream sockets. Frames captured while a pass runs are skipped;
+ * the next pass takes the newest one. Requested stream variants are built between passes.
+ */
+static void encode_worker_task(void *arg)
+{
+    catflapcam_webcam_video_t *video = (catflapcam_webcam_video_t *)arg;
+    variant_request_t *request = NULL;
+
+    while (1) {
+        catflapcam_frame_t *frame = NULL;
+        catflapcam_webcam_jpeg_t *jpeg;
+        bool published = false;
+
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+        bool stop = video->encode_stop;
+        xSemaphoreGive(video->feed_lock);
+        while (xQueueReceive(video->variant_requests, &request, 0) == pdPASS) {
+            build_requested_variant(video, request, stop);
+        }
+        if (stop) {
+            break;
+        }
+        if (catflapcam_frame_broker_acquire(video->broker, video->encode_sub, 0, &frame) != ESP_OK) {
+            continue;
+        }
+
+        if ((jpeg = feed_claim(video, &video->stream_feed)) != NULL) {
+            published |= feed_publish(video, &video->stream_feed, jpeg, frame, encode_stream_jpeg(video, frame, jpeg));
+        }
+        if ((jpeg = feed_claim(video, &video->roi_feed)) != NULL) {
+            published |= feed_publish(video, &video->roi_feed, jpeg, frame, encode_roi_jpeg(video, frame, jpeg));
+        }
+        for (int i = 0; i < CATFLAPCAM_STREAM_VARIANT_MAX; i++) {
+            xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+            catflapcam_webcam_variant_t *variant = video->variants[i];
+            jpeg = variant ? feed_claim_locked(&variant->feed) : NULL;
+            xSemaphoreGive(video->feed_lock);
+            if (jpeg) {
+                published |= feed_publish(video, &variant->feed, jpeg, frame, encode_variant_jpeg(variant, frame, jpeg));
+            }
+        }
+        catflapcam_frame_broker_release(video->broker, frame);
+
+        xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+        TaskHandle_t notify = video->feed_notify;
+        xSemaphoreGive(video->feed_lock);
+        if (published && notify) {
+            xTaskNotifyGive(notify);
+        }
+    }
+
+    xSemaphoreGive(video->encode_worker_stopped);
+    vTaskDelete(NULL);
+}
+
+static esp_err_t init_encode_worker(catflapcam_webcam_video_t *video)
+{
+    char task_name[16];
+
+    video->encode_worker_stopped = xSemaphoreCreateBinary();
+    ESP_RETURN_ON_FALSE(video->encode_worker_stopped, ESP_ERR_NO_MEM, TAG, "failed to create encode stop semaphore");
+    video->variant_requests = xQueueCreate(CATFLAPCAM_STREAM_MAX_CLIENTS, sizeof(variant_request_t *));
+    ESP_RETURN_ON_FALSE(video->variant_requests, ESP_ERR_NO_MEM, TAG, "failed to create variant request queue");
+    ESP_RETURN_ON_ERROR(catflapcam_frame_broker_subscribe(video->broker, &video->encode_sub), TAG, "failed to subscribe encode task");
+
+    snprintf(task_name, sizeof(task_name), "encode%d", video->index);
+    ESP_RETURN_ON_FALSE(xTaskCreate(encode_worker_task, task_name, CATFLAPCAM_ENCODE_TASK_STACK_SIZE, video,
+                                    CATFLAPCAM_ENCODE_TASK_PRIORITY, &video->encode_worker) == pdPASS,
+                        ESP_FAIL, TAG, "failed to create encode task");
+    return ESP_OK;
+}
+
+static void deinit_encode_worker(catflapcam_webcam_video_t *video)
+{
+    if (video->encode_worker) {
+        xSemaphoreTake(video->feed_lock, portMAX_DELAY);
+        video->encode_stop = true;
+        xSemaphoreGive(video->feed_lock);
+        xTaskNotifyGive(video->encode_worker);
+        if (xSemaphoreTake(video->encode_worker_stopped, pdMS_TO_TICKS(CATFLAPCAM_SNAPSHOT_DONE_WAIT_MS)) != pdPASS) {
+            ESP_LOGE(TAG, "video%d: encode task did not stop, leaking stream feeds", video->index);
+            return;
+        }
+        video->encode_worker = NULL;
+    }
+    if (video->encode_sub) {
+        catflapcam_frame_broker_unsubscribe(video->broker, video->encode_sub);
+        video->encode_sub = NULL;
+    }
+    if (video->encode_worker_stopped) {
+        vSemaphoreDelete(video->encode_worker_stopped);
+        video->encode_worker_stopped = NULL;
+    }
+    if (video->variant_requests) {
+        vQueueDelete(video->variant_requests);
+        video->variant_requests = NULL;
+    }
+    free_roi_feed(video);
+    if (video->feed_lock) {
+        vSemaphoreDelete(video->feed_lock);
+        video->feed_lock = NULL;
+    }
+}
+
+/*
+ * JPEG sources are decoded, downscaled and re-encoded for snapshots. Without an encoder that accepts the
+ * decoder output, snapshots fall back to storing the captured frame.
+ */
+static void init_jpeg_snapshot_encoder(catflapcam_webcam_video_t *video)
+{
+    catflapcam_encoder_config_t snapshot_encoder_config = {
+        .width = CATFLAPCAM_SNAPSHOT_WIDTH,
+        .height = CATFLAPCAM_SNAPSHOT_HEIGHT,
+        .pixel_format = CATFLAPCAM_JPEG_SCALER_PIXEL_FORMAT,
+        .quality = CATFLAPCAM_SNAPSHOT_JPEG_QUALITY,
+    };
+
+    if (catflapcam_encoder_init(&snapshot_encoder_config, &video->snapshot_encoder_handle) != ESP_OK) {
+        ESP_LOGW(TAG, "video%d: no snapshot encoder for decoded JPEG frames", video->index);
+        video->snapshot_encoder_handle = NULL;
+        return;
+    }
+    if (catflapcam_encoder_alloc_output_buffer(video->snapshot_encoder_handle, &video->snapshot_out_buf, &video->snapshot_out_size) != ESP_OK) {
+        ESP_LOGW(TAG, "video%d: failed to alloc snapshot output buf", video->index);
+        catflapcam_encoder_deinit(video->snapshot_encoder_handle);
+        video->snapshot_encoder_handle = NULL;
+    }
+}
+
 static esp_err_t init_web_cam_video(catflapcam_webcam_video_t *video, const catflapcam_webcam_video_config_t *config)
 {
     int fd;
@@ -445,6 +1738,9 @@ static esp_err_t init_web_cam_video(catflapcam_webcam_video_t *video, const catf
 
     if (video->pixel_format == V4L2_PIX_FMT_JPEG) {
         ESP_GOTO_ON_ERROR(catflapcam_webcam_set_camera_jpeg_quality(video, CATFLAPCAM_JPEG_ENC_QUALITY), fail0, TAG, "failed to set jpeg quality");
+        if (video->width != CATFLAPCAM_SNAPSHOT_WIDTH || video->height != CATFLAPCAM_SNAPSHOT_HEIGHT) {
+            init_jpeg_snapshot_encoder(video);
+        }
     } else {
         catflapcam_encoder_config_t encoder_config = {0};
         catflapcam_encoder_config_t snapshot_encoder_config = {0};
@@ -454,10 +1750,11 @@ static esp_err_t init_web_cam_video(catflapcam_webcam_video_t *video, const catf
         encoder_config.quality = CATFLAPCAM_JPEG_ENC_QUALITY;
         ESP_GOTO_ON_ERROR(catflapcam_encoder_init(&encoder_config, &video->encoder_handle), fail0, TAG, "failed to init encoder");
 
-        ESP_GOTO_ON_ERROR(catflapcam_encoder_alloc_output_buffer(video->encoder_handle, &video->jpeg_out_buf, &video->jpeg_out_size),
-                          fail1, TAG, "failed to alloc jpeg output buf");
-        ESP_GOTO_ON_ERROR(catflapcam_encoder_alloc_output_buffer(video->encoder_handle, &video->stream_out_buf, &video->stream_out_size),
-                          fail2, TAG, "failed to alloc stream output buf");
+        for (int i = 0; i < CATFLAPCAM_STREAM_JPEG_CACHE_SIZE; i++) {
+            catflapcam_webcam_jpeg_t *jpeg = &video->stream_feed.cache[i];
+            ESP_GOTO_ON_ERROR(catflapcam_encoder_alloc_output_buffer(video->encoder_handle, &jpeg->buf, &jpeg->buf_size),
+                              fail2, TAG, "failed to alloc stream jpeg cache buf");
+        }
 
         snapshot_encoder_config.width = CATFLAPCAM_SNAPSHOT_WIDTH;
         snapshot_encoder_config.height = CATFLAPCAM_SNAPSHOT_HEIGHT;
@@ -473,29 +1770,47 @@ static esp_err_t init_web_cam_video(catflapcam_webcam_video_t *video, const catf
     video->sem = xSemaphoreCreateBinary();
     ESP_GOTO_ON_FALSE(video->sem, ESP_ERR_NO_MEM, fail2, TAG, "failed to create semaphore");
     xSemaphoreGive(video->sem);
-    video->io_mutex = xSemaphoreCreateMutex();
-    ESP_GOTO_ON_FALSE(video->io_mutex, ESP_ERR_NO_MEM, fail2, TAG, "failed to create camera io mutex");
+    video->snapshot_lock = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(video->snapshot_lock, ESP_ERR_NO_MEM, fail2, TAG, "failed to create snapshot lock");
+    video->feed_lock = xSemaphoreCreateMutex();
+    ESP_GOTO_ON_FALSE(video->feed_lock, ESP_ERR_NO_MEM, fail2, TAG, "failed to create stream feed lock");
+
+    catflapcam_frame_broker_config_t broker_config = {
+        .source = {
+            .dequeue = v4l2_frame_dequeue,
+            .requeue = v4l2_frame_requeue,
+            .dequeue_ready = v4l2_frame_dequeue_ready,
+            .ctx = video,
+        },
+        .frame_capacity = video->buffer_size,
+        .index = video->index,
+        .zero_copy = video->pixel_format == V4L2_PIX_FMT_JPEG,
+        .max_pinned = CATFLAPCAM_CAMERA_VIDEO_BUFFER_NUMBER > 2 ? CATFLAPCAM_CAMERA_VIDEO_BUFFER_NUMBER - 2 : 0,
+    };
+    ESP_GOTO_ON_ERROR(catflapcam_frame_broker_new(&broker_config, &video->broker), fail2, TAG, "failed to create frame broker");
+    ESP_GOTO_ON_ERROR(catflapcam_frame_broker_subscribe(video->broker, &video->snapshot_sub), fail2, TAG, "failed to subscribe snapshot path");
+    ESP_GOTO_ON_ERROR(init_snapshot_pipeline(video), fail2, TAG, "failed to init snapshot pipeline");
+    ESP_GOTO_ON_ERROR(init_encode_worker(video), fail2, TAG, "failed to init encode task");
     return ESP_OK;
 
 fail2:
-    if (video->io_mutex) {
-        vSemaphoreDelete(video->io_mutex);
-        video->io_mutex = NULL;
+    deinit_encode_worker(video);
+    deinit_snapshot_pipeline(video);
+    if (video->broker) {
+        catflapcam_frame_broker_free(video->broker);
+        video->broker = NULL;
+        video->snapshot_sub = NULL;
     }
-    if (video->stream_out_buf) {
-        if (video->pixel_format != V4L2_PIX_FMT_JPEG && video->encoder_handle) {
-            catflapcam_encoder_free_output_buffer(video->encoder_handle, video->stream_out_buf);
-        } else {
-            free(video->stream_out_buf);
-        }
-        video->stream_out_buf = NULL;
-        video->stream_out_size = 0;
+    if (video->snapshot_lock) {
+        vSemaphoreDelete(video->snapshot_lock);
+        video->snapshot_lock = NULL;
     }
-    if (video->snapshot_resize_buf) {
-        free(video->snapshot_resize_buf);
-        video->snapshot_resize_buf = NULL;
-        video->snapshot_resize_buf_size = 0;
+    if (video->sem) {
+        vSemaphoreDelete(video->sem);
+        video->sem = NULL;
     }
+    free_stream_variants(video);
+    free_stream_jpeg_cache(video);
     if (video->snapshot_out_buf) {
         if (video->snapshot_encoder_handle) {
             catflapcam_encoder_free_output_buffer(video->snapshot_encoder_handle, video->snapshot_out_buf);
@@ -505,11 +1820,6 @@ fail2:
         video->snapshot_out_buf = NULL;
         video->snapshot_out_size = 0;
     }
-    if (video->pixel_format != V4L2_PIX_FMT_JPEG) {
-        catflapcam_encoder_free_output_buffer(video->encoder_handle, video->jpeg_out_buf);
-        video->jpeg_out_buf = NULL;
-    }
-fail1:
     if (video->snapshot_encoder_handle) {
         catflapcam_encoder_deinit(video->snapshot_encoder_handle);
         video->snapshot_encoder_handle = NULL;
@@ -527,20 +1837,22 @@ fail0:
 
 static esp_err_t deinit_web_cam_video(catflapcam_webcam_video_t *video)
 {
+    deinit_encode_worker(video);
+    deinit_snapshot_pipeline(video);
+    if (video->broker) {
+        catflapcam_frame_broker_free(video->broker);
+        video->broker = NULL;
+        video->snapshot_sub = NULL;
+    }
     if (video->sem) {
         vSemaphoreDelete(video->sem);
         video->sem = NULL;
     }
-    if (video->io_mutex) {
-        vSemaphoreDelete(video->io_mutex);
-        video->io_mutex = NULL;
+    if (video->snapshot_lock) {
+        vSemaphoreDelete(video->snapshot_lock);
+        video->snapshot_lock = NULL;
     }
 
-    if (video->snapshot_resize_buf) {
-        free(video->snapshot_resize_buf);
-        video->snapshot_resize_buf = NULL;
-        video->snapshot_resize_buf_size = 0;
-    }
     if (video->snapshot_out_buf) {
         if (video->snapshot_encoder_handle) {
             catflapcam_encoder_free_output_buffer(video->snapshot_encoder_handle, video->snapshot_out_buf);
@@ -550,22 +1862,14 @@ static esp_err_t deinit_web_cam_video(catflapcam_webcam_video_t *video)
         video->snapshot_out_buf = NULL;
         video->snapshot_out_size = 0;
     }
-    if (video->stream_out_buf) {
-        if (video->pixel_format != V4L2_PIX_FMT_JPEG && video->encoder_handle) {
-            catflapcam_encoder_free_output_buffer(video->encoder_handle, video->stream_out_buf);
-        } else {
-            free(video->stream_out_buf);
-        }
-        video->stream_out_buf = NULL;
-        video->stream_out_size = 0;
-    }
+    free_stream_variants(video);
+    free_stream_jpeg_cache(video);
 
     if (video->snapshot_encoder_handle) {
         catflapcam_encoder_deinit(video->snapshot_encoder_handle);
         video->snapshot_encoder_handle = NULL;
     }
     if (video->pixel_format != V4L2_PIX_FMT_JPEG) {
-        catflapcam_encoder_free_output_buffer(video->encoder_handle, video->jpeg_out_buf);
         catflapcam_encoder_deinit(video->encoder_handle);
     }
 
@@ -610,12 +1914,15 @@ esp_err_t catflapcam_webcam_new(const catflapcam_webcam_video_config_t *config,
     for (i = 0; i < config_count; i++) {
         if (catflapcam_webcam_is_valid_video(&wc->video[i])) {
             ESP_GOTO_ON_ERROR(ioctl(wc->video[i].fd, VIDIOC_STREAMON, &type), fail1, TAG, "failed to start stream");
+            ESP_GOTO_ON_ERROR(catflapcam_frame_broker_start(wc->video[i].broker), fail2, TAG, "failed to start frame broker");
         }
     }
 
     *ret_wc = wc;
     return ESP_OK;
 
+fail2:
+    ioctl(wc->video[i].fd, VIDIOC_STREAMOFF, &type);
 fail1:
     for (int j = i - 1; j >= 0; j--) {
         if (catflapcam_webcam_is_valid_video(&wc->video[j])) {
@@ -635,12 +1942,15 @@ fail0:
 
 void catflapcam_webcam_free(catflapcam_webcam_t *web_cam)
 {
+    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
     if (!web_cam) {
         return;
     }
 
     for (int i = 0; i < web_cam->video_count; i++) {
         if (catflapcam_webcam_is_valid_video(&web_cam->video[i])) {
+            ioctl(web_cam->video[i].fd, VIDIOC_STREAMOFF, &type);
             deinit_web_cam_video(&web_cam->video[i]);
         }
     }
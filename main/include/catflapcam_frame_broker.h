@@ -0,0 +1,81 @@
+#ifndef CATFLAPCAM_FRAME_BROKER_H
+#define CATFLAPCAM_FRAME_BROKER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef struct catflapcam_frame_broker *catflapcam_frame_broker_handle_t;
+typedef struct catflapcam_frame_subscriber catflapcam_frame_subscriber_t;
+
+typedef struct catflapcam_frame_source_buf {
+    uint32_t index;
+    const uint8_t *data;
+    uint32_t size;
+} catflapcam_frame_source_buf_t;
+
+typedef struct catflapcam_frame_source {
+    esp_err_t (*dequeue)(void *ctx, catflapcam_frame_source_buf_t *buf);
+    esp_err_t (*requeue)(void *ctx, const catflapcam_frame_source_buf_t *buf);
+    /* optional: dequeues an already completed buffer without blocking, ESP_ERR_NOT_FOUND when there is none */
+    esp_err_t (*dequeue_ready)(void *ctx, catflapcam_frame_source_buf_t *buf);
+    void *ctx;
+} catflapcam_frame_source_t;
+
+typedef struct catflapcam_frame {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t capacity;
+    uint64_t seq;
+    int64_t capture_us;
+    uint32_t refcount;
+} catflapcam_frame_t;
+
+typedef struct catflapcam_frame_broker_config {
+    catflapcam_frame_source_t source;
+    uint32_t frame_capacity;
+    uint8_t index;
+    bool zero_copy;          /* publish source buffers in place instead of copying them into slots */
+    uint8_t max_pinned;      /* source buffers that may be held out of the capture queue at once */
+} catflapcam_frame_broker_config_t;
+
+typedef struct catflapcam_frame_broker_stats {
+    uint64_t frames_captured;
+    uint64_t frames_dropped;
+    uint64_t frames_pinned;
+    uint64_t pin_fallbacks;
+    uint64_t frames_skipped;    /* completed source buffers requeued unread because a newer one was ready */
+    uint32_t subscribers;
+} catflapcam_frame_broker_stats_t;
+
+esp_err_t catflapcam_frame_broker_new(const catflapcam_frame_broker_config_t *config, catflapcam_frame_broker_handle_t *ret_broker);
+esp_err_t catflapcam_frame_broker_start(catflapcam_frame_broker_handle_t broker);
+void catflapcam_frame_broker_free(catflapcam_frame_broker_handle_t broker);
+
+esp_err_t catflapcam_frame_broker_subscribe(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t **ret_sub);
+void catflapcam_frame_broker_unsubscribe(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub);
+
+/*
+ * While at least one subscriber is in latest-frame mode, the capture task drains every completed source buffer
+ * on each wakeup and publishes only the newest, so frames never wait in the capture queue behind older ones.
+ */
+void catflapcam_frame_broker_set_latest(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub, bool latest);
+
+/*
+ * Also sends `task` a task notification for every published frame, so one task can serve many subscribers
+ * without blocking in catflapcam_frame_broker_acquire(). Pass NULL to stop.
+ */
+void catflapcam_frame_broker_set_notify(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub, TaskHandle_t task);
+
+/*
+ * Returns the newest published frame that the subscriber has not seen yet, waiting up to `wait` ticks for one.
+ * The frame stays valid until catflapcam_frame_broker_release() is called.
+ */
+esp_err_t catflapcam_frame_broker_acquire(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub,
+                                          TickType_t wait, catflapcam_frame_t **ret_frame);
+void catflapcam_frame_broker_release(catflapcam_frame_broker_handle_t broker, catflapcam_frame_t *frame);
+void catflapcam_frame_broker_get_stats(catflapcam_frame_broker_handle_t broker, catflapcam_frame_broker_stats_t *stats);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef CATFLAPCAM_JPEG_SCALER_H
+#define CATFLAPCAM_JPEG_SCALER_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "linux/videodev2.h"
+#include "catflapcam_resize.h"
+
+/* Pixel format of the frames produced by catflapcam_jpeg_scaler_process(). */
+#define CATFLAPCAM_JPEG_SCALER_PIXEL_FORMAT V4L2_PIX_FMT_RGB565
+
+typedef struct catflapcam_jpeg_scaler *catflapcam_jpeg_scaler_handle_t;
+
+typedef struct catflapcam_jpeg_scaler_config {
+    uint32_t src_width;
+    uint32_t src_height;
+    uint32_t dst_width;
+    uint32_t dst_height;
+    catflapcam_resize_mode_t mode;
+    uint32_t crop_x;            /* source rectangle mapped onto the destination, in source pixels; */
+    uint32_t crop_y;            /* a zero crop_width or crop_height means the whole frame */
+    uint32_t crop_width;
+    uint32_t crop_height;
+} catflapcam_jpeg_scaler_config_t;
+
+/*
+ * Opens a JPEG decoder whose IDCT output is already scaled down by 1/2, 1/4 or 1/8, so a full-resolution
+ * frame is never materialised, and a resize plan that takes the decoded frame to the exact destination size.
+ * The decoder, its output buffer and the resize tables are kept for the lifetime of the scaler.
+ */
+esp_err_t catflapcam_jpeg_scaler_new(const catflapcam_jpeg_scaler_config_t *config, catflapcam_jpeg_scaler_handle_t *ret_scaler);
+void catflapcam_jpeg_scaler_free(catflapcam_jpeg_scaler_handle_t scaler);
+esp_err_t catflapcam_jpeg_scaler_process(catflapcam_jpeg_scaler_handle_t scaler, const uint8_t *jpeg, uint32_t jpeg_size,
+                                         uint8_t *dst, uint32_t dst_size, uint32_t *ret_size);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef CATFLAPCAM_RESIZE_H
+#define CATFLAPCAM_RESIZE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    CATFLAPCAM_RESIZE_NEAREST = 0,
+    CATFLAPCAM_RESIZE_BILINEAR,
+    CATFLAPCAM_RESIZE_AREA,
+} catflapcam_resize_mode_t;
+
+typedef struct catflapcam_resize *catflapcam_resize_handle_t;
+
+typedef struct catflapcam_resize_config {
+    uint32_t pixel_format;
+    catflapcam_resize_mode_t mode;
+    uint32_t src_width;
+    uint32_t src_height;
+    uint32_t dst_width;
+    uint32_t dst_height;
+    uint32_t crop_x;            /* source rectangle mapped onto the destination; */
+    uint32_t crop_y;            /* a zero crop_width or crop_height means the whole frame */
+    uint32_t crop_width;
+    uint32_t crop_height;
+} catflapcam_resize_config_t;
+
+int catflapcam_resize_bytes_per_pixel(uint32_t pixel_format);
+
+/*
+ * Builds a resize plan for one (source, destination) geometry. Source offsets and fixed-point weights are
+ * computed here once, so catflapcam_resize_process() only runs the row kernels.
+ */
+esp_err_t catflapcam_resize_new(const catflapcam_resize_config_t *config, catflapcam_resize_handle_t *ret_resize);
+void catflapcam_resize_free(catflapcam_resize_handle_t resize);
+esp_err_t catflapcam_resize_process(catflapcam_resize_handle_t resize, const uint8_t *src, uint32_t src_size,
+                                    uint8_t *dst, uint32_t dst_size, uint32_t *ret_size);
+
+#endif
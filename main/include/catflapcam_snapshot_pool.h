@@ -0,0 +1,64 @@
+#ifndef CATFLAPCAM_SNAPSHOT_POOL_H
+#define CATFLAPCAM_SNAPSHOT_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "main.h"
+
+typedef struct catflapcam_snapshot_pool catflapcam_snapshot_pool_t;
+
+typedef struct catflapcam_snapshot_job {
+    catflapcam_snapshot_pool_t *pool;
+    uint8_t *buf;
+    uint32_t buf_size;
+    uint32_t size;
+    uint64_t frame_seq;
+    int64_t capture_us;
+    int64_t submit_us;
+    int64_t grab_us;
+    SemaphoreHandle_t done;
+    esp_err_t result;
+    bool with_preroll;
+    bool busy;
+    bool waited;
+    bool finished;
+} catflapcam_snapshot_job_t;
+
+struct catflapcam_snapshot_pool {
+    catflapcam_snapshot_job_t jobs[CATFLAPCAM_SNAPSHOT_QUEUE_LEN];
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t free;
+};
+
+/* Allocates `CATFLAPCAM_SNAPSHOT_QUEUE_LEN` jobs with a PSRAM buffer of `buf_size` bytes each. */
+esp_err_t catflapcam_snapshot_pool_init(catflapcam_snapshot_pool_t *pool, uint32_t buf_size);
+void catflapcam_snapshot_pool_deinit(catflapcam_snapshot_pool_t *pool);
+
+/*
+ * Takes a free job, waiting up to `wait` for one; ESP_ERR_TIMEOUT when all are in use. A `waited` job is
+ * handed to catflapcam_snapshot_pool_wait() once finished, any other one goes straight back to the pool.
+ */
+esp_err_t catflapcam_snapshot_pool_claim(catflapcam_snapshot_pool_t *pool, bool waited, TickType_t wait, catflapcam_snapshot_job_t **ret_job);
+
+/* Gives back a claimed job that was never submitted. */
+void catflapcam_snapshot_pool_release(catflapcam_snapshot_job_t *job);
+
+/* Whether someone still waits on the job; a waiter that timed out no longer does. */
+bool catflapcam_snapshot_pool_is_waited(catflapcam_snapshot_job_t *job);
+
+/* Records the job's result and wakes its waiter, or recycles the job when nobody waits for it any more. */
+void catflapcam_snapshot_pool_finish(catflapcam_snapshot_job_t *job, esp_err_t result);
+
+/*
+ * Waits up to `wait` for a waited job to finish and returns its result. On a timeout the job is handed back,
+ * and catflapcam_snapshot_pool_finish() recycles it; either way the caller must not touch it again.
+ */
+esp_err_t catflapcam_snapshot_pool_wait(catflapcam_snapshot_job_t *job, TickType_t wait);
+
+/* Waits up to `wait` per job until every job is back, e.g. before the pool is freed; ESP_ERR_TIMEOUT otherwise. */
+esp_err_t catflapcam_snapshot_pool_drain(catflapcam_snapshot_pool_t *pool, TickType_t wait);
+
+#endif
@@ -6,11 +6,90 @@
 #include <stdint.h>
 #include "esp_err.h"
 
+#define CATFLAPCAM_STORAGE_SOURCE_UNKNOWN 0xFF
+
+typedef struct catflapcam_storage_blob {
+    const uint8_t *data;
+    size_t len;
+    int64_t timestamp_ms;       /* capture time (epoch ms), 0 for the time of the save */
+    uint8_t source;             /* camera index, or CATFLAPCAM_STORAGE_SOURCE_UNKNOWN */
+} catflapcam_storage_blob_t;
+
+/* Where a snapshot's JPEG bytes live: `size` bytes starting at `offset` in the file at `path`. */
+typedef struct catflapcam_storage_snapshot_loc {
+    char path[128];
+    uint32_t offset;
+    uint32_t size;
+    uint64_t seq;
+    int64_t timestamp_ms;       /* capture time (epoch ms), 0 when unknown */
+} catflapcam_storage_snapshot_loc_t;
+
+/* One snapshot as listed from the index. */
+typedef struct catflapcam_storage_snapshot_info {
+    char name[64];
+    uint64_t seq;
+    int64_t timestamp_ms;       /* capture time (epoch ms), 0 when unknown */
+    uint32_t size;              /* 0 until known for snapshots found by a directory scan */
+    uint8_t source;
+} catflapcam_storage_snapshot_info_t;
+
+/* Selects snapshots for catflapcam_storage_list_snapshots(); a zeroed query with `source` -1 selects all. */
+typedef struct catflapcam_storage_query {
+    uint64_t before_seq;        /* only seqs below this, 0 = from the newest */
+    int64_t from_ms;            /* capture time range (epoch ms, inclusive), 0 = open */
+    int64_t to_ms;
+    int source;                 /* camera index, -1 = any */
+} catflapcam_storage_query_t;
+
+/* Snapshots to delete by seq and capture time (epoch ms), all bounds inclusive; a zero bound is open. */
+typedef struct catflapcam_storage_range {
+    uint64_t from_seq;
+    uint64_t to_seq;
+    int64_t from_ms;
+    int64_t to_ms;
+} catflapcam_storage_range_t;
+
+typedef void (*catflapcam_storage_progress_cb_t)(uint32_t deleted, uint32_t remaining, void *arg);
+
+/* Card usage as the retention policy sees it. */
+typedef struct catflapcam_storage_usage {
+    uint32_t snapshots;
+    uint64_t snapshot_bytes;    /* snapshots found by a directory scan count once their size is known */
+    uint64_t free_bytes;        /* 0 while unknown */
+    uint64_t evicted;           /* snapshots evicted since boot */
+} catflapcam_storage_usage_t;
+
 esp_err_t catflapcam_storage_init(void);
 bool catflapcam_storage_is_ready(void);
 esp_err_t catflapcam_storage_save_snapshot(const uint8_t *jpg, size_t jpg_len);
-char *catflapcam_storage_list_json(size_t limit);
-esp_err_t catflapcam_storage_resolve_snapshot_path(const char *name, char *out_path, size_t out_path_len);
+esp_err_t catflapcam_storage_save_snapshots(const catflapcam_storage_blob_t *blobs, size_t count, size_t *saved);
+
+/*
+ * Copies up to `max` snapshots matching `query` out of the index, newest first. The time range is found by
+ * binary search. The lock is held for a bounded number of entries, so fewer than `max` may come back with
+ * more left: `ret_next_seq` is the `before_seq` to continue from, 0 once nothing older can match.
+ * `ret_total` is the number of snapshots in the index.
+ */
+esp_err_t catflapcam_storage_list_snapshots(const catflapcam_storage_query_t *query, catflapcam_storage_snapshot_info_t *infos,
+                                           size_t max, size_t *ret_count, uint64_t *ret_next_seq, uint32_t *ret_total);
+esp_err_t catflapcam_storage_locate_snapshot(const char *name, catflapcam_storage_snapshot_loc_t *loc);
 esp_err_t catflapcam_storage_delete_snapshot(const char *name);
 
+/*
+ * Deletes every snapshot inside `range` straight off the index, in batches of consecutive entries with one
+ * journal sync each. `progress` runs after every batch with the storage lock released, so it may block on
+ * the network. Snapshots saved during the call are never part of the range. `ret_deleted` counts what was
+ * deleted even when an error stops the call part way.
+ */
+esp_err_t catflapcam_storage_delete_range(const catflapcam_storage_range_t *range, catflapcam_storage_progress_cb_t progress, void *arg,
+                                          uint32_t *ret_deleted);
+void catflapcam_storage_get_usage(catflapcam_storage_usage_t *usage);
+
+/*
+ * Writes `count` synthetic JPEGs of each benchmark size through both the cluster-aligned snapshot path and
+ * plain stdio, into a scratch directory that is removed afterwards. Returns JSON with MB/s and p50/p99
+ * latency per size and path; the caller frees it.
+ */
+esp_err_t catflapcam_storage_run_benchmark(uint32_t count, char **ret_json);
+
 #endif
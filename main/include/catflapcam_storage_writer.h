@@ -0,0 +1,56 @@
+#ifndef CATFLAPCAM_STORAGE_WRITER_H
+#define CATFLAPCAM_STORAGE_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "catflapcam_storage.h"
+
+/* Upper bounds (ms) of the write latency histogram; the last bucket counts everything slower. */
+#define CATFLAPCAM_STORAGE_WRITER_LATENCY_BOUNDS_MS {10, 25, 50, 100, 250, 500, 1000}
+#define CATFLAPCAM_STORAGE_WRITER_LATENCY_BUCKETS   8
+
+typedef enum {
+    CATFLAPCAM_STORAGE_WRITER_REJECT = 0,       /* fail with ESP_ERR_NO_MEM when the queue is full */
+    CATFLAPCAM_STORAGE_WRITER_DROP_OLDEST,      /* drop queued writes, oldest first, until the new one fits */
+} catflapcam_storage_writer_policy_t;
+
+/*
+ * Completion callback for a submitted batch. Runs with the writer lock held, on the writer task or on the
+ * task whose submit dropped the batch, so it must not block on the card or submit again.
+ */
+typedef void (*catflapcam_storage_writer_done_cb_t)(esp_err_t result, size_t saved, void *ctx);
+
+typedef struct catflapcam_storage_writer_stats {
+    uint32_t queued;            /* writes waiting for the writer task */
+    uint32_t queued_bytes;
+    uint32_t max_queued;
+    uint64_t writes;            /* writes fully committed */
+    uint64_t failed;            /* writes the card did not take completely */
+    uint64_t rejected;
+    uint64_t dropped;
+    uint64_t batches;
+    uint64_t snapshots;
+    uint64_t bytes;
+    uint32_t bytes_per_sec;     /* card throughput while committing */
+    uint32_t latency_ms[CATFLAPCAM_STORAGE_WRITER_LATENCY_BUCKETS]; /* submit to commit */
+} catflapcam_storage_writer_stats_t;
+
+/*
+ * Starts the task that owns all snapshot writes. Submitted JPEGs are copied into a bounded PSRAM queue,
+ * so callers can reuse their buffers as soon as catflapcam_storage_writer_submit() returns. The task
+ * commits whatever is queued as one storage batch, with a single eviction pass and journal sync.
+ */
+esp_err_t catflapcam_storage_writer_start(void);
+
+/*
+ * Queues one batch of snapshots. With `wait_ms` 0 the call returns once the batch is queued; otherwise it
+ * waits up to `wait_ms` for the batch to be on the card and fills in `saved`. A timed out wait returns
+ * ESP_ERR_TIMEOUT and the write still completes in the background. A queued batch reports its outcome
+ * through `done_cb` when one is given, which needs `wait_ms` 0.
+ */
+esp_err_t catflapcam_storage_writer_submit(const catflapcam_storage_blob_t *blobs, size_t count, catflapcam_storage_writer_policy_t policy,
+                                           uint32_t wait_ms, size_t *saved, catflapcam_storage_writer_done_cb_t done_cb, void *done_ctx);
+void catflapcam_storage_writer_get_stats(catflapcam_storage_writer_stats_t *stats);
+
+#endif
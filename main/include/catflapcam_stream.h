@@ -0,0 +1,63 @@
+#ifndef CATFLAPCAM_STREAM_H
+#define CATFLAPCAM_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "catflapcam_webcam.h"
+
+/* Upper bounds (ms) of the per-viewer frame gap histogram; the last bucket counts everything slower. */
+#define CATFLAPCAM_STREAM_GAP_BOUNDS_MS {50, 100, 200, 500, 1000, 2000}
+#define CATFLAPCAM_STREAM_GAP_BUCKETS   7
+
+typedef struct catflapcam_stream_stats {
+    uint32_t clients;
+    uint64_t frames_sent;
+    uint64_t spills;            /* parts copied out of a shared frame because their client was slow */
+    uint64_t clients_dropped;   /* clients closed for not taking data within the send timeout */
+} catflapcam_stream_stats_t;
+
+typedef struct catflapcam_stream_options {
+    bool latest;                /* unpaced unless `fps` is set, and the broker skips stale buffers */
+    bool roi;
+    uint32_t fps;               /* 0: default pacing */
+    uint32_t kbps;              /* 0: no bandwidth limit */
+    uint32_t width;             /* 0: sensor size; otherwise a downscaled variant shared by all its viewers */
+    uint32_t height;
+    uint8_t quality;
+} catflapcam_stream_options_t;
+
+typedef struct catflapcam_stream_client_stats {
+    int source;
+    uint32_t fps;
+    uint32_t kbps;
+    uint32_t interval_ms;       /* current gap between part starts, including congestion backoff */
+    uint32_t send_ms;           /* average time the socket took to drain a part */
+    bool congested;
+    uint64_t frames_sent;
+    uint64_t frames_skipped;    /* captured frames the client never got */
+    uint64_t bytes_sent;
+    uint32_t gap_max_ms;        /* longest time between two parts finishing, e.g. while snapshots are written */
+    uint32_t gap_ms[CATFLAPCAM_STREAM_GAP_BUCKETS];
+} catflapcam_stream_client_stats_t;
+
+/* Starts the task that sends the MJPEG streams of all cameras to all clients. */
+esp_err_t catflapcam_stream_start(void);
+
+/*
+ * Takes over the connection of a /stream request: formats the response header, detaches the socket from the
+ * httpd worker and hands both to the stream task, which sends the header as the client's first part. The
+ * handler returns once the client is queued, after the encode task has built a new variant if one was asked
+ * for. Fails with ESP_ERR_NO_MEM when all client or variant slots are taken, ESP_ERR_INVALID_ARG for a variant
+ * size the camera cannot make and ESP_ERR_NOT_SUPPORTED when the camera cannot stream its region of interest or
+ * variants; the request is untouched then.
+ */
+esp_err_t catflapcam_stream_attach(httpd_req_t *req, catflapcam_webcam_video_t *video, const catflapcam_stream_options_t *options);
+void catflapcam_stream_get_stats(catflapcam_stream_stats_t *stats);
+
+/* Fills at most `max` entries, one per connected client, and returns how many were filled. */
+size_t catflapcam_stream_get_client_stats(catflapcam_stream_client_stats_t *stats, size_t max);
+
+#endif
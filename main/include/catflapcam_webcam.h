@@ -6,23 +6,72 @@
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
 #include "catflapcam_video_common.h"
+#include "catflapcam_frame_broker.h"
+#include "catflapcam_jpeg_scaler.h"
+#include "catflapcam_resize.h"
+#include "catflapcam_snapshot_pool.h"
 #include "main.h"
 
+typedef struct catflapcam_webcam_jpeg {
+    uint8_t *buf;
+    uint32_t buf_size;
+    uint32_t size;
+    uint64_t seq;
+    int64_t capture_us;
+    uint32_t refcount;
+} catflapcam_webcam_jpeg_t;
+
+/*
+ * JPEGs of one kind of stream, encoded by the camera's encode task once per frame while the feed has readers.
+ * A cache entry is published with the sequence number of its frame once it is complete.
+ */
+typedef struct catflapcam_webcam_feed {
+    catflapcam_webcam_jpeg_t cache[CATFLAPCAM_STREAM_JPEG_CACHE_SIZE];
+    uint32_t users;
+    uint64_t hits;      /* JPEGs handed to readers */
+    uint64_t misses;    /* encoder runs */
+    uint64_t dropped;   /* frames not encoded because the encoder was busy or every entry was still being sent */
+} catflapcam_webcam_feed_t;
+
+/* Region of interest in 1/CATFLAPCAM_ROI_UNITS of the frame width and height. */
+typedef struct catflapcam_webcam_roi {
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;
+    uint16_t height;
+} catflapcam_webcam_roi_t;
+
+/* A downscaled stream size, encoded once per frame by the encode task for all clients that ask for it. */
+typedef struct catflapcam_webcam_variant {
+    uint32_t width;
+    uint32_t height;
+    uint8_t quality;
+    catflapcam_resize_handle_t resize;
+    catflapcam_jpeg_scaler_handle_t scaler;
+    catflapcam_encoder_handle_t encoder;
+    uint8_t *raw;
+    uint32_t raw_size;
+    catflapcam_webcam_feed_t feed;
+} catflapcam_webcam_variant_t;
+
+typedef struct catflapcam_webcam_preroll_entry {
+    uint8_t *buf;
+    uint32_t size;
+    uint64_t seq;
+    int64_t capture_us;
+} catflapcam_webcam_preroll_entry_t;
+
 typedef struct catflapcam_webcam_video {
     int fd;
     uint8_t index;
 
     catflapcam_encoder_handle_t encoder_handle;
     catflapcam_encoder_handle_t snapshot_encoder_handle;
-    uint8_t *jpeg_out_buf;
-    uint32_t jpeg_out_size;
-    uint8_t *stream_out_buf;
-    uint32_t stream_out_size;
     uint8_t *snapshot_out_buf;
     uint32_t snapshot_out_size;
-    uint8_t *snapshot_resize_buf;
-    uint32_t snapshot_resize_buf_size;
 
     uint8_t *buffer[CATFLAPCAM_CAMERA_VIDEO_BUFFER_NUMBER];
     uint32_t buffer_len[CATFLAPCAM_CAMERA_VIDEO_BUFFER_NUMBER];
@@ -35,9 +84,53 @@ typedef struct catflapcam_webcam_video {
 
     uint32_t frame_rate;
 
+    catflapcam_frame_broker_handle_t broker;
+    catflapcam_frame_subscriber_t *snapshot_sub;
+
+    catflapcam_webcam_feed_t stream_feed;
+    catflapcam_webcam_feed_t roi_feed;
+    uint8_t *roi_raw;
+    SemaphoreHandle_t feed_lock;
+    TaskHandle_t feed_notify;
+    uint32_t feed_readers;
+    uint32_t feed_latest;
+    catflapcam_frame_subscriber_t *encode_sub;
+    TaskHandle_t encode_worker;
+    SemaphoreHandle_t encode_worker_stopped;
+    bool encode_stop;
+
+    catflapcam_webcam_variant_t *variants[CATFLAPCAM_STREAM_VARIANT_MAX];
+    QueueHandle_t variant_requests;
+
+    catflapcam_webcam_roi_t roi;
+    catflapcam_resize_handle_t snapshot_resize;
+    catflapcam_jpeg_scaler_handle_t snapshot_scaler;
+    SemaphoreHandle_t resize_lock;
+
+    catflapcam_snapshot_pool_t snapshot_pool;
+    QueueHandle_t snapshot_queue;
+    TaskHandle_t snapshot_worker;
+    SemaphoreHandle_t snapshot_worker_stopped;
+
+    catflapcam_frame_subscriber_t *preroll_sub;
+    catflapcam_webcam_preroll_entry_t *preroll;
+    uint8_t *preroll_arena;
+    uint8_t *preroll_scratch;
+    uint32_t preroll_len;
+    uint32_t preroll_slot_size;
+    uint32_t preroll_head;
+    uint64_t preroll_flushed_seq;
+    uint64_t preroll_skipped;
+
+    SemaphoreHandle_t burst_lock;
+    catflapcam_frame_subscriber_t *burst_sub;
+    uint8_t *burst_arena;
+    uint8_t *burst_scratch;
+    uint8_t *burst_out_buf;
+    uint32_t burst_out_size;
+
     SemaphoreHandle_t sem;
-    SemaphoreHandle_t io_mutex;
-    volatile bool capture_priority_active;
+    SemaphoreHandle_t snapshot_lock;
     uint32_t support_control_jpeg_quality : 1;
 } catflapcam_webcam_video_t;
 
@@ -53,7 +146,21 @@ typedef struct catflapcam_webcam_video_config {
 bool catflapcam_webcam_is_valid_video(catflapcam_webcam_video_t *video);
 char *catflapcam_webcam_get_cameras_json(catflapcam_webcam_t *web_cam);
 esp_err_t catflapcam_webcam_set_camera_jpeg_quality(catflapcam_webcam_video_t *video, int quality);
-esp_err_t catflapcam_webcam_capture_snapshot(catflapcam_webcam_video_t *video);
+esp_err_t catflapcam_webcam_capture_snapshot(catflapcam_webcam_video_t *video, bool with_preroll);
+esp_err_t catflapcam_webcam_submit_snapshot(catflapcam_webcam_video_t *video, bool with_preroll, catflapcam_snapshot_job_t **ret_job);
+esp_err_t catflapcam_webcam_wait_snapshot(catflapcam_webcam_video_t *video, catflapcam_snapshot_job_t *job, TickType_t wait);
+esp_err_t catflapcam_webcam_capture_burst(catflapcam_webcam_video_t *video, uint32_t count, uint32_t interval_ms, uint32_t *ret_saved);
+esp_err_t catflapcam_webcam_set_roi(catflapcam_webcam_video_t *video, const catflapcam_webcam_roi_t *roi);
+void catflapcam_webcam_get_roi(catflapcam_webcam_video_t *video, catflapcam_webcam_roi_t *roi);
+esp_err_t catflapcam_webcam_open_feed(catflapcam_webcam_video_t *video, bool roi, bool latest, TaskHandle_t notify,
+                                      catflapcam_webcam_feed_t **ret_feed);
+void catflapcam_webcam_close_feed(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, bool latest);
+esp_err_t catflapcam_webcam_acquire_feed_jpeg(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, uint64_t after_seq,
+                                              catflapcam_webcam_jpeg_t **ret_jpeg);
+void catflapcam_webcam_release_feed_jpeg(catflapcam_webcam_video_t *video, catflapcam_webcam_jpeg_t *jpeg);
+esp_err_t catflapcam_webcam_open_variant(catflapcam_webcam_video_t *video, uint32_t width, uint32_t height, uint8_t quality,
+                                         bool latest, TaskHandle_t notify, catflapcam_webcam_variant_t **ret_variant);
+void catflapcam_webcam_close_variant(catflapcam_webcam_video_t *video, catflapcam_webcam_variant_t *variant, bool latest);
 esp_err_t catflapcam_webcam_new(const catflapcam_webcam_video_config_t *config, int config_count, catflapcam_webcam_t **ret_wc);
 void catflapcam_webcam_free(catflapcam_webcam_t *web_cam);
 
@@ -5,6 +5,25 @@
 #include <stdint.h>
 
 #define CATFLAPCAM_CAMERA_VIDEO_BUFFER_NUMBER  CONFIG_CATFLAPCAM_CAMERA_VIDEO_BUFFER_NUMBER
+#define CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER    CONFIG_CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER
+
+#if CONFIG_CATFLAPCAM_PREROLL_ENABLE
+#define CATFLAPCAM_PREROLL_FRAMES              CONFIG_CATFLAPCAM_PREROLL_FRAMES
+#define CATFLAPCAM_PREROLL_INTERVAL_MS         CONFIG_CATFLAPCAM_PREROLL_INTERVAL_MS
+#define CATFLAPCAM_PREROLL_BUDGET_KB           CONFIG_CATFLAPCAM_PREROLL_BUDGET_KB
+#else
+#define CATFLAPCAM_PREROLL_FRAMES              0
+#define CATFLAPCAM_PREROLL_INTERVAL_MS         0
+#define CATFLAPCAM_PREROLL_BUDGET_KB           0
+#endif
+
+#if CONFIG_CATFLAPCAM_SNAPSHOT_RESIZE_NEAREST
+#define CATFLAPCAM_SNAPSHOT_RESIZE_MODE        CATFLAPCAM_RESIZE_NEAREST
+#elif CONFIG_CATFLAPCAM_SNAPSHOT_RESIZE_BILINEAR
+#define CATFLAPCAM_SNAPSHOT_RESIZE_MODE        CATFLAPCAM_RESIZE_BILINEAR
+#else
+#define CATFLAPCAM_SNAPSHOT_RESIZE_MODE        CATFLAPCAM_RESIZE_AREA
+#endif
 
 #define CATFLAPCAM_JPEG_ENC_QUALITY            CONFIG_CATFLAPCAM_JPEG_COMPRESSION_QUALITY
 
@@ -19,17 +38,58 @@
 #define CATFLAPCAM_ULTRASONIC_MIN_INTERVAL_MS  CONFIG_CATFLAPCAM_ULTRASONIC_MIN_INTERVAL_MS
 #define CATFLAPCAM_ULTRASONIC_SOURCE_INDEX     CONFIG_CATFLAPCAM_ULTRASONIC_SOURCE_INDEX
 #define CATFLAPCAM_HTTP_MAX_BODY_SIZE          2048
-#define CATFLAPCAM_STREAM_ENC_WAIT_MS          20
+#define CATFLAPCAM_SNAPSHOT_SEND_BUF_SIZE      2048
+#define CATFLAPCAM_STREAM_ENC_WAIT_MS          100
+#define CATFLAPCAM_STREAM_JPEG_CACHE_SIZE      3
 #define CATFLAPCAM_CAPTURE_ENC_WAIT_MS         300
-#define CATFLAPCAM_STREAM_IO_WAIT_MS           2
-#define CATFLAPCAM_CAPTURE_IO_WAIT_MS          200
+#define CATFLAPCAM_CAPTURE_FRAME_WAIT_MS       1000
+#define CATFLAPCAM_CAPTURE_LOCK_WAIT_MS        200
+#define CATFLAPCAM_SNAPSHOT_QUEUE_LEN          3
+#define CATFLAPCAM_SNAPSHOT_DONE_WAIT_MS       5000
+#define CATFLAPCAM_SNAPSHOT_TASK_STACK_SIZE    (1024 * 6)
+#define CATFLAPCAM_SNAPSHOT_TASK_PRIORITY      4
+#define CATFLAPCAM_STORAGE_WRITER_QUEUE_LEN    16
+#define CATFLAPCAM_STORAGE_WRITER_QUEUE_KB     CONFIG_CATFLAPCAM_STORAGE_WRITER_QUEUE_KB
+#define CATFLAPCAM_STORAGE_WRITER_BATCH_MAX    32
+#define CATFLAPCAM_STORAGE_WRITER_TASK_STACK_SIZE (1024 * 6)
+#define CATFLAPCAM_STORAGE_WRITER_TASK_PRIORITY 4
+#define CATFLAPCAM_BURST_MAX_FRAMES            16
+#define CATFLAPCAM_BURST_MAX_INTERVAL_MS       1000
+#define CATFLAPCAM_BURST_ARENA_SIZE            (2 * 1024 * 1024)
+#define CATFLAPCAM_ROI_UNITS                   1000
+#define CATFLAPCAM_NVS_NAMESPACE               "catflapcam"
+#define CATFLAPCAM_FRAME_BROKER_TASK_STACK_SIZE (1024 * 4)
+#define CATFLAPCAM_FRAME_BROKER_TASK_PRIORITY  6
+#define CATFLAPCAM_FRAME_BROKER_BUF_ALIGN      128
+#define CATFLAPCAM_FRAME_BROKER_PIN_MAX_MS     200
 #define CATFLAPCAM_STREAM_SERVER_STACK_SIZE    (1024 * 7)
+#define CATFLAPCAM_STREAM_ACCEPT_STACK_SIZE    (1024 * 4)
 #define CATFLAPCAM_STREAM_FRAME_INTERVAL_MS    50
+#define CATFLAPCAM_STREAM_MAX_CLIENTS          CONFIG_CATFLAPCAM_STREAM_MAX_CLIENTS
+#define CATFLAPCAM_STREAM_TASK_STACK_SIZE      (1024 * 7)
+#define CATFLAPCAM_STREAM_TASK_PRIORITY        5
+#define CATFLAPCAM_ENCODE_TASK_STACK_SIZE      (1024 * 6)
+#define CATFLAPCAM_ENCODE_TASK_PRIORITY        4
+#define CATFLAPCAM_STREAM_POLL_MS              5
+#define CATFLAPCAM_STREAM_HOLD_MAX_MS          100
+#define CATFLAPCAM_STREAM_MAX_FPS              60
+#define CATFLAPCAM_STREAM_MAX_KBPS             100000
+#define CATFLAPCAM_STREAM_BUCKET_MS            500
+#define CATFLAPCAM_STREAM_VARIANT_MAX          3
+#define CATFLAPCAM_STREAM_VARIANT_ALIGN        16
 #define CATFLAPCAM_HTTP_SEND_TIMEOUT_S         4
+#define CATFLAPCAM_HTTP_MAX_URI_HANDLERS       16
+#define CATFLAPCAM_SNAPSHOT_LIST_LIMIT         200
+#define CATFLAPCAM_SNAPSHOT_LIST_MAX_LIMIT     1000
+#define CATFLAPCAM_SNAPSHOT_LIST_PAGE          32
+#define CATFLAPCAM_JSON_STREAM_BUF_SIZE        1024
 
 #define STREAM_CONTENT_TYPE "multipart/x-mixed-replace;boundary=" CATFLAPCAM_PART_BOUNDARY
+#define STREAM_RESPONSE_HEAD "HTTP/1.1 200 OK\r\nContent-Type: " STREAM_CONTENT_TYPE "\r\nAccess-Control-Allow-Origin: *\r\n" \
+                             "Cache-Control: no-store\r\nX-Framerate: %" PRIu32 "\r\nConnection: close\r\n\r\n"
 #define STREAM_BOUNDARY "\r\n--" CATFLAPCAM_PART_BOUNDARY "\r\n"
-#define STREAM_PART "Content-Type: image/jpeg\r\nContent-Length: %" PRIu32 "\r\nX-Timestamp: %ld.%09ld\r\n\r\n"
+#define STREAM_PART "Content-Type: image/jpeg\r\nContent-Length: %" PRIu32 "\r\nX-Timestamp: %ld.%09ld\r\n" \
+                    "X-Capture-Timestamp: %ld.%06ld\r\nX-Frame-Seq: %" PRIu64 "\r\n\r\n"
 
 extern const uint8_t index_html_gz_start[] asm("_binary_index_html_gz_start");
 extern const uint8_t index_html_gz_end[] asm("_binary_index_html_gz_end");
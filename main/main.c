@@ -14,6 +14,7 @@
 #include "catflapcam_video_common.h"
 #include "catflapcam_http_server.h"
 #include "catflapcam_storage.h"
+#include "catflapcam_storage_writer.h"
 #include "catflapcam_ultrasonic.h"
 #include "catflapcam_wifi.h"
 
@@ -88,6 +89,9 @@ void app_main(void)
     catflapcam_webcam_t *web_cam = NULL;
     ESP_ERROR_CHECK(catflapcam_webcam_new(config, config_count, &web_cam));
     esp_err_t storage_err = catflapcam_storage_init();
+    if (storage_err == ESP_OK) {
+        storage_err = catflapcam_storage_writer_start();
+    }
     if (storage_err != ESP_OK) {
         ESP_LOGW(TAG, "SD snapshot storage unavailable: %s", esp_err_to_name(storage_err));
     }
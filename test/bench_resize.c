@@ -0,0 +1,326 @@
+/*
+ * Benchmarks the snapshot resize plan against the per-pixel nearest-neighbour loops it replaced, for a
+ * 1920x1080 source scaled to the 224x224 snapshot in every supported pixel format. Each filter reports
+ * source Mpix/s and PSNR against an exact floating-point box filter of the same frame; the frame is a zone
+ * plate over a gradient, so aliasing shows up as lost PSNR.
+ *
+ * Usage: bench_resize [seconds per run]
+ */
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "linux/videodev2.h"
+#include "catflapcam_resize.h"
+#include "host_test.h"
+
+#define SRC_WIDTH   1920
+#define SRC_HEIGHT  1080
+#define DST_WIDTH   224
+#define DST_HEIGHT  224
+#define MAX_PLANES  3
+
+/* The resize functions the webcam module used before catflapcam_resize, kept verbatim as the baseline. */
+
+static void resize_nearest_gray(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h)
+{
+    for (int y = 0; y < dst_h; y++) {
+        int sy = (y * src_h) / dst_h;
+        const uint8_t *src_row = src + (sy * src_w);
+        uint8_t *dst_row = dst + (y * dst_w);
+        for (int x = 0; x < dst_w; x++) {
+            int sx = (x * src_w) / dst_w;
+            dst_row[x] = src_row[sx];
+        }
+    }
+}
+
+static void resize_nearest_rgb565(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h)
+{
+    const uint16_t *src16 = (const uint16_t *)src;
+    uint16_t *dst16 = (uint16_t *)dst;
+
+    for (int y = 0; y < dst_h; y++) {
+        int sy = (y * src_h) / dst_h;
+        const uint16_t *src_row = src16 + (sy * src_w);
+        uint16_t *dst_row = dst16 + (y * dst_w);
+        for (int x = 0; x < dst_w; x++) {
+            int sx = (x * src_w) / dst_w;
+            dst_row[x] = src_row[sx];
+        }
+    }
+}
+
+static void resize_nearest_rgb24(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h)
+{
+    for (int y = 0; y < dst_h; y++) {
+        int sy = (y * src_h) / dst_h;
+        const uint8_t *src_row = src + (sy * src_w * 3);
+        uint8_t *dst_row = dst + (y * dst_w * 3);
+        for (int x = 0; x < dst_w; x++) {
+            int sx = (x * src_w) / dst_w;
+            const uint8_t *src_px = src_row + (sx * 3);
+            uint8_t *dst_px = dst_row + (x * 3);
+            dst_px[0] = src_px[0];
+            dst_px[1] = src_px[1];
+            dst_px[2] = src_px[2];
+        }
+    }
+}
+
+static void resize_nearest_yuyv(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h)
+{
+    for (int y = 0; y < dst_h; y++) {
+        int sy = (y * src_h) / dst_h;
+        for (int x = 0; x < dst_w; x += 2) {
+            int sx0 = (x * src_w) / dst_w;
+            int sx1 = ((x + 1) * src_w) / dst_w;
+            int sx_even = sx0 & ~1;
+            int src_pair_offset = (sy * src_w + sx_even) * 2;
+
+            uint8_t y0 = src[src_pair_offset + 0];
+            uint8_t u = src[src_pair_offset + 1];
+            uint8_t y1 = src[src_pair_offset + 2];
+            uint8_t v = src[src_pair_offset + 3];
+
+            if (sx0 != sx_even) {
+                y0 = y1;
+            }
+            if (sx1 == sx_even) {
+                y1 = src[src_pair_offset + 0];
+            }
+
+            int dst_pair_offset = (y * dst_w + x) * 2;
+            dst[dst_pair_offset + 0] = y0;
+            dst[dst_pair_offset + 1] = u;
+            dst[dst_pair_offset + 2] = y1;
+            dst[dst_pair_offset + 3] = v;
+        }
+    }
+}
+
+typedef void (*baseline_fn_t)(const uint8_t *src, int src_w, int src_h, uint8_t *dst, int dst_w, int dst_h);
+
+/* Samples of one channel inside an interleaved row of 8-bit samples: `step` bytes apart from `offset`. */
+typedef struct {
+    uint32_t divisor;   /* samples per row are width / divisor */
+    uint32_t offset;
+    uint32_t step;
+} plane_t;
+
+typedef struct {
+    const char *name;
+    uint32_t pixel_format;
+    baseline_fn_t baseline;
+    plane_t planes[MAX_PLANES];
+    int plane_count;
+} format_t;
+
+static const format_t s_formats[] = {
+    {"GREY", V4L2_PIX_FMT_GREY, resize_nearest_gray, {{1, 0, 1}}, 1},
+    {"RGB565", V4L2_PIX_FMT_RGB565, resize_nearest_rgb565, {{1, 0, 3}, {1, 1, 3}, {1, 2, 3}}, 3},
+    {"RGB24", V4L2_PIX_FMT_RGB24, resize_nearest_rgb24, {{1, 0, 3}, {1, 1, 3}, {1, 2, 3}}, 3},
+    {"YUYV", V4L2_PIX_FMT_YUV422P, resize_nearest_yuyv, {{1, 0, 2}, {2, 1, 4}, {2, 3, 4}}, 3},
+};
+
+static const char *const s_mode_names[] = {"nearest", "bilinear", "area"};
+
+/* RGB565 is compared as RGB888, which is also what the resize plan filters it in. */
+static void to_samples(const format_t *format, const uint8_t *frame, uint32_t pixels, uint8_t *samples)
+{
+    if (format->pixel_format != V4L2_PIX_FMT_RGB565) {
+        memcpy(samples, frame, pixels * catflapcam_resize_bytes_per_pixel(format->pixel_format));
+        return;
+    }
+    for (uint32_t i = 0; i < pixels; i++) {
+        uint32_t v = frame[2 * i] | (frame[2 * i + 1] << 8);
+        uint32_t r = (v >> 11) & 0x1f;
+        uint32_t g = (v >> 5) & 0x3f;
+        uint32_t b = v & 0x1f;
+        samples[3 * i + 0] = (uint8_t)((r << 3) | (r >> 2));
+        samples[3 * i + 1] = (uint8_t)((g << 2) | (g >> 4));
+        samples[3 * i + 2] = (uint8_t)((b << 3) | (b >> 2));
+    }
+}
+
+/* A zone plate whose frequency reaches Nyquist in the corners, over a gradient, with a phase per channel. */
+static void make_source(const format_t *format, uint8_t *frame)
+{
+    int bpp = catflapcam_resize_bytes_per_pixel(format->pixel_format);
+    double k = M_PI / (2.0 * hypot(SRC_WIDTH / 2.0, SRC_HEIGHT / 2.0));
+
+    for (uint32_t y = 0; y < SRC_HEIGHT; y++) {
+        for (uint32_t x = 0; x < SRC_WIDTH; x++) {
+            double dx = x - SRC_WIDTH / 2.0;
+            double dy = y - SRC_HEIGHT / 2.0;
+            uint8_t c[3];
+            for (int i = 0; i < 3; i++) {
+                double v = 64.0 + 128.0 * (x + y) / (SRC_WIDTH + SRC_HEIGHT) + 60.0 * sin(k * (dx * dx + dy * dy) + i * 2.0);
+                c[i] = (uint8_t)lrint(fmin(fmax(v, 0.0), 255.0));
+            }
+            uint8_t *px = frame + ((size_t)y * SRC_WIDTH + x) * bpp;
+            switch (format->pixel_format) {
+            case V4L2_PIX_FMT_RGB565: {
+                uint32_t v = ((c[0] >> 3) << 11) | ((c[1] >> 2) << 5) | (c[2] >> 3);
+                px[0] = (uint8_t)v;
+                px[1] = (uint8_t)(v >> 8);
+                break;
+            }
+            case V4L2_PIX_FMT_YUV422P:
+                px[0] = c[0];
+                px[1] = (x % 2) ? c[2] : c[1];
+                break;
+            default:
+                memcpy(px, c, bpp);
+                break;
+            }
+        }
+    }
+}
+
+/* Coverage of source sample `j` by the box of destination sample `i`, for an exact box filter. */
+static double box_weight(uint32_t i, uint32_t j, uint32_t src_n, uint32_t dst_n)
+{
+    double scale = (double)src_n / dst_n;
+    double lo = fmax(i * scale, j);
+    double hi = fmin((i + 1) * scale, j + 1.0);
+
+    return hi > lo ? (hi - lo) / scale : 0.0;
+}
+
+static void reference_resize(const format_t *format, const uint8_t *src, uint32_t stride, double *dst)
+{
+    uint32_t dst_stride = DST_WIDTH * format->planes[0].step;
+    double *tmp = calloc((size_t)SRC_HEIGHT * dst_stride, sizeof(double));
+    TEST_CHECK(tmp);
+
+    for (int p = 0; p < format->plane_count; p++) {
+        const plane_t *plane = &format->planes[p];
+        uint32_t src_n = SRC_WIDTH / plane->divisor;
+        uint32_t dst_n = DST_WIDTH / plane->divisor;
+        for (uint32_t y = 0; y < SRC_HEIGHT; y++) {
+            for (uint32_t i = 0; i < dst_n; i++) {
+                double sum = 0.0;
+                uint32_t first = (uint32_t)floor((double)i * src_n / dst_n);
+                for (uint32_t j = first; j < src_n && j < (double)(i + 1) * src_n / dst_n; j++) {
+                    sum += box_weight(i, j, src_n, dst_n) * src[y * stride + j * plane->step + plane->offset];
+                }
+                tmp[y * dst_stride + i * plane->step + plane->offset] = sum;
+            }
+        }
+        for (uint32_t y = 0; y < DST_HEIGHT; y++) {
+            for (uint32_t i = 0; i < dst_n; i++) {
+                double sum = 0.0;
+                uint32_t first = (uint32_t)floor((double)y * SRC_HEIGHT / DST_HEIGHT);
+                for (uint32_t j = first; j < SRC_HEIGHT && j < (double)(y + 1) * SRC_HEIGHT / DST_HEIGHT; j++) {
+                    sum += box_weight(y, j, SRC_HEIGHT, DST_HEIGHT) * tmp[j * dst_stride + i * plane->step + plane->offset];
+                }
+                dst[y * dst_stride + i * plane->step + plane->offset] = sum;
+            }
+        }
+    }
+    free(tmp);
+}
+
+static double psnr(const format_t *format, const double *reference, const uint8_t *frame)
+{
+    static uint8_t samples[DST_WIDTH * DST_HEIGHT * 3];
+    uint32_t count = DST_WIDTH * DST_HEIGHT * format->planes[0].step;
+    double error = 0.0;
+
+    to_samples(format, frame, DST_WIDTH * DST_HEIGHT, samples);
+    for (uint32_t i = 0; i < count; i++) {
+        double d = samples[i] - reference[i];
+        error += d * d;
+    }
+    return error > 0.0 ? 10.0 * log10(255.0 * 255.0 / (error / count)) : INFINITY;
+}
+
+typedef struct {
+    const format_t *format;
+    const uint8_t *src;
+    uint8_t *dst;
+    catflapcam_resize_handle_t plan;
+} run_t;
+
+static void run_baseline(run_t *run)
+{
+    run->format->baseline(run->src, SRC_WIDTH, SRC_HEIGHT, run->dst, DST_WIDTH, DST_HEIGHT);
+}
+
+static void run_plan(run_t *run)
+{
+    uint32_t bpp = catflapcam_resize_bytes_per_pixel(run->format->pixel_format);
+    TEST_CHECK_OK(catflapcam_resize_process(run->plan, run->src, SRC_WIDTH * SRC_HEIGHT * bpp,
+                                            run->dst, DST_WIDTH * DST_HEIGHT * bpp, NULL));
+}
+
+/* Returns source Mpix/s; `dst` holds the last result. */
+static double measure(void (*fn)(run_t *run), run_t *run, double seconds)
+{
+    uint32_t frames = 0;
+    int64_t start = esp_timer_get_time();
+    int64_t elapsed;
+
+    do {
+        fn(run);
+        frames++;
+        elapsed = esp_timer_get_time() - start;
+    } while (elapsed < seconds * 1e6);
+    return (double)frames * SRC_WIDTH * SRC_HEIGHT / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.1;
+    uint8_t *src = malloc(SRC_WIDTH * SRC_HEIGHT * 3);
+    uint8_t *samples = malloc(SRC_WIDTH * SRC_HEIGHT * 3);
+    uint8_t *dst = malloc(DST_WIDTH * DST_HEIGHT * 3);
+    double *reference = malloc(DST_WIDTH * DST_HEIGHT * 3 * sizeof(double));
+    TEST_CHECK(src && samples && dst && reference);
+
+    printf("%ux%u -> %ux%u, source Mpix/s and PSNR against an exact box filter\n",
+           SRC_WIDTH, SRC_HEIGHT, DST_WIDTH, DST_HEIGHT);
+    for (size_t f = 0; f < sizeof(s_formats) / sizeof(s_formats[0]); f++) {
+        const format_t *format = &s_formats[f];
+        run_t run = {.format = format, .src = src, .dst = dst};
+
+        make_source(format, src);
+        to_samples(format, src, SRC_WIDTH * SRC_HEIGHT, samples);
+        reference_resize(format, samples, SRC_WIDTH * format->planes[0].step, reference);
+
+        double old_mpix = measure(run_baseline, &run, seconds);
+        double old_psnr = psnr(format, reference, dst);
+        printf("%-7s %-12s %8.1f Mpix/s %6.2f dB\n", format->name, "old nearest", old_mpix, old_psnr);
+
+        double mpix[3];
+        double quality[3];
+        for (int mode = CATFLAPCAM_RESIZE_NEAREST; mode <= CATFLAPCAM_RESIZE_AREA; mode++) {
+            catflapcam_resize_config_t config = {
+                .pixel_format = format->pixel_format,
+                .mode = mode,
+                .src_width = SRC_WIDTH,
+                .src_height = SRC_HEIGHT,
+                .dst_width = DST_WIDTH,
+                .dst_height = DST_HEIGHT,
+            };
+            TEST_CHECK_OK(catflapcam_resize_new(&config, &run.plan));
+            mpix[mode] = measure(run_plan, &run, seconds);
+            quality[mode] = psnr(format, reference, dst);
+            catflapcam_resize_free(run.plan);
+            printf("%-7s %-12s %8.1f Mpix/s %6.2f dB\n", format->name, s_mode_names[mode], mpix[mode], quality[mode]);
+        }
+
+        /* Loose enough for a loaded machine and a host with fast dividers: the table-driven nearest stays
+         * in the same range as the divides, and area averaging clearly beats point sampling. */
+        TEST_CHECK(mpix[CATFLAPCAM_RESIZE_NEAREST] > old_mpix * 0.5);
+        TEST_CHECK(quality[CATFLAPCAM_RESIZE_AREA] > old_psnr + 3.0);
+        TEST_CHECK(quality[CATFLAPCAM_RESIZE_AREA] > 30.0);
+    }
+
+    free(src);
+    free(samples);
+    free(dst);
+    free(reference);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * Measures snapshot save latency with the store full at 20000 files, before and after the in-RAM index.
+ * "before" replays what every save did on a full card without the index, in one flat directory: a readdir
+ * pass to find the oldest file, its unlink, a second readdir pass to recount, then the write. "after" calls
+ * catflapcam_storage_save_snapshot() on the files store with the same limit. Both run on the scratch
+ * directory standing in for the card, so only the shape of the work carries over to FAT on an SD card,
+ * not the absolute times.
+ *
+ * Usage: bench_storage_save [timed saves]
+ */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <ftw.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "esp_timer.h"
+#include "catflapcam_config.h"
+#include "catflapcam_storage.h"
+#include "host_test.h"
+
+#define SNAPSHOT_SIZE   1024
+#define BASELINE_DIR    CATFLAPCAM_SDCARD_MOUNT_POINT "-baseline"
+
+static uint8_t s_jpg[SNAPSHOT_SIZE];
+
+static void baseline_path(uint64_t seq, char *path, size_t len)
+{
+    snprintf(path, len, BASELINE_DIR "/snap-%020llu-20260101-000000.jpg", (unsigned long long)seq);
+}
+
+static bool baseline_seq(const char *name, uint64_t *seq)
+{
+    unsigned long long value;
+    if (sscanf(name, "snap-%20llu-", &value) != 1) {
+        return false;
+    }
+    *seq = value;
+    return true;
+}
+
+static void baseline_write(uint64_t seq)
+{
+    char path[160];
+    baseline_path(seq, path, sizeof(path));
+    FILE *fp = fopen(path, "wb");
+    TEST_CHECK(fp && fwrite(s_jpg, 1, sizeof(s_jpg), fp) == sizeof(s_jpg));
+    TEST_CHECK(fclose(fp) == 0);
+}
+
+/* One save on a full card without the index: find the oldest, unlink it, rescan, write. */
+static void baseline_save(uint64_t seq)
+{
+    DIR *dir = opendir(BASELINE_DIR);
+    TEST_CHECK(dir);
+    uint64_t oldest = UINT64_MAX;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint64_t s;
+        if (baseline_seq(entry->d_name, &s) && s < oldest) {
+            oldest = s;
+        }
+    }
+    closedir(dir);
+    TEST_CHECK(oldest != UINT64_MAX);
+
+    char path[160];
+    baseline_path(oldest, path, sizeof(path));
+    TEST_CHECK(unlink(path) == 0);
+
+    dir = opendir(BASELINE_DIR);
+    TEST_CHECK(dir);
+    uint64_t min_seq = UINT64_MAX;
+    uint64_t max_seq = 0;
+    uint32_t count = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        uint64_t s;
+        if (!baseline_seq(entry->d_name, &s)) {
+            continue;
+        }
+        min_seq = s < min_seq ? s : min_seq;
+        max_seq = s > max_seq ? s : max_seq;
+        count++;
+    }
+    closedir(dir);
+    TEST_CHECK(count > 0 && max_seq < seq && min_seq > oldest);
+
+    baseline_write(seq);
+}
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t lhs = *(const int64_t *)a;
+    int64_t rhs = *(const int64_t *)b;
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+/* Sorts the latencies and prints mean, p50 and p99 in ms; returns the p50 in us. */
+static int64_t report(const char *name, int64_t *latency_us, uint32_t count)
+{
+    int64_t total = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        total += latency_us[i];
+    }
+    qsort(latency_us, count, sizeof(latency_us[0]), compare_i64);
+    printf("%-7s mean %8.3f ms  p50 %8.3f ms  p99 %8.3f ms\n", name, total / 1000.0 / count,
+           latency_us[(count - 1) / 2] / 1000.0, latency_us[(count * 99 + 99) / 100 - 1] / 1000.0);
+    return latency_us[(count - 1) / 2];
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t files = CATFLAPCAM_SNAPSHOT_MAX_FILES;
+    uint32_t saves = argc > 1 ? (uint32_t)atoi(argv[1]) : 200;
+    int64_t *latency_us = calloc(saves, sizeof(int64_t));
+    TEST_CHECK(latency_us && saves > 0);
+
+    for (size_t i = 0; i < sizeof(s_jpg); i++) {
+        s_jpg[i] = (uint8_t)(i * 131 + 7);
+    }
+    s_jpg[0] = 0xff;
+    s_jpg[1] = 0xd8;
+    s_jpg[sizeof(s_jpg) - 2] = 0xff;
+    s_jpg[sizeof(s_jpg) - 1] = 0xd9;
+
+    nftw(BASELINE_DIR, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    nftw(CATFLAPCAM_SDCARD_MOUNT_POINT, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    printf("save latency with %u files of %d bytes, %u timed saves\n", files, SNAPSHOT_SIZE, saves);
+
+    TEST_CHECK(mkdir(BASELINE_DIR, 0775) == 0);
+    for (uint64_t seq = 1; seq <= files; seq++) {
+        baseline_write(seq);
+    }
+    for (uint32_t i = 0; i < saves; i++) {
+        int64_t start = esp_timer_get_time();
+        baseline_save(files + 1 + i);
+        latency_us[i] = esp_timer_get_time() - start;
+    }
+    int64_t before_p50 = report("before", latency_us, saves);
+    nftw(BASELINE_DIR, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    /* Fill up to the limit so every timed save also evicts, as it would on a full card. */
+    TEST_CHECK_OK(catflapcam_storage_init());
+    for (uint32_t i = 0; i < files; i++) {
+        TEST_CHECK_OK(catflapcam_storage_save_snapshot(s_jpg, sizeof(s_jpg)));
+    }
+    for (uint32_t i = 0; i < saves; i++) {
+        int64_t start = esp_timer_get_time();
+        TEST_CHECK_OK(catflapcam_storage_save_snapshot(s_jpg, sizeof(s_jpg)));
+        latency_us[i] = esp_timer_get_time() - start;
+    }
+    int64_t after_p50 = report("after", latency_us, saves);
+
+    catflapcam_storage_usage_t usage;
+    catflapcam_storage_get_usage(&usage);
+    TEST_CHECK(usage.evicted > 0);
+    TEST_CHECK(after_p50 < before_p50);
+    free(latency_us);
+    return 0;
+}
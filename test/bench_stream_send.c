@@ -0,0 +1,322 @@
+/*
+ * Loopback benchmark of the MJPEG send path. "before" sends each frame the way the httpd stream handler did,
+ * as three httpd_resp_send_chunk() calls (boundary, part header, JPEG), each one a chunk-size line, the data
+ * and a CRLF sent separately. "after" attaches the same TCP connection to the stream engine, which sends the
+ * preformatted head and the JPEG with one sendmsg(). The fake camera always has a new JPEG frame, so both run
+ * as fast as the reader drains the socket. Reports frames/s and the sender's CPU time per frame, which is the
+ * process CPU time minus the reader thread's.
+ *
+ * Usage: bench_stream_send [seconds per run]
+ */
+#define _GNU_SOURCE
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_http_server.h"
+#include "esp_timer.h"
+#include "catflapcam_stream.h"
+#include "catflapcam_webcam.h"
+#include "host_test.h"
+
+#define MAX_FRAME_SIZE  (256 * 1024)
+
+typedef struct {
+    const char *name;
+    uint32_t jpeg_size;     /* typical JPEG size at that resolution */
+} frame_size_t;
+
+static const frame_size_t s_sizes[] = {
+    {"224x224", 12 * 1024},
+    {"1080p", 240 * 1024},
+};
+
+/*
+ * Fake camera: every acquire returns a new frame holding the current JPEG. The next frame counts as published
+ * whenever the engine gives one back, so it is woken up as a real broker would on the next capture.
+ */
+struct catflapcam_frame_subscriber {
+    int unused;
+};
+
+static TaskHandle_t s_notify;
+
+static uint8_t s_jpeg[MAX_FRAME_SIZE];
+static catflapcam_frame_t s_frame = {.data = s_jpeg};
+
+esp_err_t catflapcam_frame_broker_subscribe(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t **ret_sub)
+{
+    *ret_sub = calloc(1, sizeof(catflapcam_frame_subscriber_t));
+    return *ret_sub ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void catflapcam_frame_broker_unsubscribe(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub)
+{
+    free(sub);
+}
+
+void catflapcam_frame_broker_set_latest(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub, bool latest)
+{
+}
+
+void catflapcam_frame_broker_set_notify(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub, TaskHandle_t task)
+{
+    s_notify = task;
+}
+
+esp_err_t catflapcam_frame_broker_acquire(catflapcam_frame_broker_handle_t broker, catflapcam_frame_subscriber_t *sub,
+                                          TickType_t wait, catflapcam_frame_t **ret_frame)
+{
+    s_frame.seq++;
+    s_frame.capture_us = esp_timer_get_time();
+    *ret_frame = &s_frame;
+    return ESP_OK;
+}
+
+void catflapcam_frame_broker_release(catflapcam_frame_broker_handle_t broker, catflapcam_frame_t *frame)
+{
+    if (s_notify) {
+        xTaskNotifyGive(s_notify);
+    }
+}
+
+/* The camera is a JPEG source streamed as captured, so the engine never opens a feed. */
+esp_err_t catflapcam_webcam_open_feed(catflapcam_webcam_video_t *video, bool roi, bool latest, TaskHandle_t notify,
+                                      catflapcam_webcam_feed_t **ret_feed)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void catflapcam_webcam_close_feed(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, bool latest)
+{
+}
+
+esp_err_t catflapcam_webcam_acquire_feed_jpeg(catflapcam_webcam_video_t *video, catflapcam_webcam_feed_t *feed, uint64_t after_seq,
+                                              catflapcam_webcam_jpeg_t **ret_jpeg)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+void catflapcam_webcam_release_feed_jpeg(catflapcam_webcam_video_t *video, catflapcam_webcam_jpeg_t *jpeg)
+{
+}
+
+esp_err_t catflapcam_webcam_open_variant(catflapcam_webcam_video_t *video, uint32_t width, uint32_t height, uint8_t quality,
+                                         bool latest, TaskHandle_t notify, catflapcam_webcam_variant_t **ret_variant)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+void catflapcam_webcam_close_variant(catflapcam_webcam_video_t *video, catflapcam_webcam_variant_t *variant, bool latest)
+{
+}
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *req, httpd_req_t **out)
+{
+    *out = malloc(sizeof(httpd_req_t));
+    TEST_CHECK(*out);
+    **out = *req;
+    return ESP_OK;
+}
+
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *req)
+{
+    free(req);
+    return ESP_OK;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *req)
+{
+    return (int)(intptr_t)req->aux;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    close(sockfd);
+    return ESP_OK;
+}
+
+typedef struct {
+    int fd;
+    uint64_t bytes;
+} reader_t;
+
+static void *reader_thread(void *arg)
+{
+    static uint8_t buf[64 * 1024];
+    reader_t *reader = arg;
+    ssize_t n;
+
+    while ((n = read(reader->fd, buf, sizeof(buf))) > 0) {
+        reader->bytes += n;
+    }
+    return NULL;
+}
+
+/* A connected loopback TCP pair; `server` stands for the socket httpd accepted. */
+static void loopback_pair(int *server, int *client)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    TEST_CHECK(listener >= 0 && bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0 && listen(listener, 1) == 0);
+    TEST_CHECK(getsockname(listener, (struct sockaddr *)&addr, &len) == 0);
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_CHECK(*client >= 0 && connect(*client, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    *server = accept(listener, NULL, NULL);
+    TEST_CHECK(*server >= 0);
+    close(listener);
+}
+
+static int64_t cpu_us(clockid_t clock)
+{
+    struct timespec ts;
+    TEST_CHECK(clock_gettime(clock, &ts) == 0);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+typedef struct {
+    pthread_t thread;
+    clockid_t clock;
+    reader_t reader;
+    int64_t wall_us;
+    int64_t process_us;
+    int64_t reader_us;
+    double frame_cpu_us;    /* result: sender CPU time per frame */
+} run_t;
+
+static void run_begin(run_t *run, int client)
+{
+    run->reader.fd = client;
+    TEST_CHECK(pthread_create(&run->thread, NULL, reader_thread, &run->reader) == 0);
+    TEST_CHECK(pthread_getcpuclockid(run->thread, &run->clock) == 0);
+    run->wall_us = esp_timer_get_time();
+    run->process_us = cpu_us(CLOCK_PROCESS_CPUTIME_ID);
+    run->reader_us = cpu_us(run->clock);
+}
+
+static void run_end(run_t *run, const char *size, const char *path, uint64_t frames)
+{
+    double wall_s = (esp_timer_get_time() - run->wall_us) / 1e6;
+    int64_t sender_us = (cpu_us(CLOCK_PROCESS_CPUTIME_ID) - run->process_us) - (cpu_us(run->clock) - run->reader_us);
+
+    TEST_CHECK(frames > 0);
+    run->frame_cpu_us = (double)sender_us / frames;
+    printf("%-8s %-7s %9.0f frames/s %8.1f us CPU/frame %8.1f MB/s\n", size, path, frames / wall_s,
+           run->frame_cpu_us, run->reader.bytes / wall_s / 1e6);
+}
+
+static void send_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, 0);
+        TEST_CHECK(n > 0);
+        p += n;
+        len -= n;
+    }
+}
+
+/* httpd_resp_send_chunk(): the chunk size line, the data and the CRLF, one send each. */
+static void send_chunk(int fd, const void *data, size_t len)
+{
+    char line[16];
+    int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+    send_all(fd, line, n);
+    send_all(fd, data, len);
+    send_all(fd, "\r\n", 2);
+}
+
+static double run_before(const frame_size_t *size, double seconds)
+{
+    int server;
+    int client;
+    run_t run = {0};
+    uint64_t frames = 0;
+
+    loopback_pair(&server, &client);
+    run_begin(&run, client);
+    int64_t end_us = run.wall_us + (int64_t)(seconds * 1e6);
+    do {
+        char part[256];
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        int len = snprintf(part, sizeof(part), STREAM_PART, size->jpeg_size, (long)ts.tv_sec, (long)ts.tv_nsec, 0L, 0L, frames);
+        send_chunk(server, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY));
+        send_chunk(server, part, len);
+        send_chunk(server, s_jpeg, size->jpeg_size);
+        frames++;
+    } while (esp_timer_get_time() < end_us);
+    run_end(&run, size->name, "before", frames);
+
+    close(server);
+    TEST_CHECK(pthread_join(run.thread, NULL) == 0);
+    close(client);
+    return run.frame_cpu_us;
+}
+
+static double run_after(const frame_size_t *size, double seconds)
+{
+    static catflapcam_webcam_video_t video = {
+        .pixel_format = V4L2_PIX_FMT_JPEG,
+        .frame_rate = 30,
+    };
+    catflapcam_stream_options_t options = {.latest = true};
+    catflapcam_stream_stats_t before;
+    catflapcam_stream_stats_t after;
+    int server;
+    int client;
+    run_t run = {0};
+
+    loopback_pair(&server, &client);
+    httpd_req_t req = {.aux = (void *)(intptr_t)server};
+    catflapcam_stream_get_stats(&before);
+    run_begin(&run, client);
+    TEST_CHECK_OK(catflapcam_stream_attach(&req, &video, &options));
+    usleep((useconds_t)(seconds * 1e6));
+    catflapcam_stream_get_stats(&after);
+    run_end(&run, size->name, "after", after.frames_sent - before.frames_sent);
+
+    /* The engine notices the closed peer on its next send and closes its end. */
+    shutdown(client, SHUT_RDWR);
+    TEST_CHECK(pthread_join(run.thread, NULL) == 0);
+    close(client);
+    do {
+        usleep(1000);
+        catflapcam_stream_get_stats(&after);
+    } while (after.clients > 0);
+    return run.frame_cpu_us;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t i = 0; i < sizeof(s_jpeg); i++) {
+        s_jpeg[i] = (uint8_t)(i * 131 + 7);
+    }
+    TEST_CHECK_OK(catflapcam_stream_start());
+
+    for (size_t i = 0; i < sizeof(s_sizes) / sizeof(s_sizes[0]); i++) {
+        const frame_size_t *size = &s_sizes[i];
+        s_jpeg[0] = 0xff;
+        s_jpeg[1] = 0xd8;
+        s_jpeg[size->jpeg_size - 2] = 0xff;
+        s_jpeg[size->jpeg_size - 1] = 0xd9;
+        s_frame.size = size->jpeg_size;
+
+        double before_us = run_before(size, seconds);
+        double after_us = run_after(size, seconds);
+        /* Loose, for a loaded machine: one sendmsg per frame must not cost more CPU than nine sends. */
+        TEST_CHECK(after_us <= before_us * 1.2);
+    }
+    return 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * Minimal assertions for the host tests. A failed check prints where it failed and exits non-zero, which is
+ * all ctest needs.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_CHECK(cond) do {                                                        \
+        if (!(cond)) {                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);  \
+            exit(1);                                                                  \
+        }                                                                             \
+    } while (0)
+
+#define TEST_CHECK_OK(expr) do {                                                      \
+        int rc_ = (expr);                                                             \
+        if (rc_ != 0) {                                                               \
+            fprintf(stderr, "%s:%d: %s returned 0x%x\n", __FILE__, __LINE__, #expr, rc_); \
+            exit(1);                                                                  \
+        }                                                                             \
+    } while (0)
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include "cJSON.h"
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "sd_pwr_ctrl_by_on_chip_ldo.h"
+#include "sdmmc_cmd.h"
+
+int catflapcam_host_log_verbose;
+
+__attribute__((constructor)) static void host_log_init(void)
+{
+    const char *verbose = getenv("CATFLAPCAM_HOST_LOG_VERBOSE");
+    catflapcam_host_log_verbose = verbose ? atoi(verbose) : 0;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static __thread char name[16];
+    snprintf(name, sizeof(name), "0x%x", code);
+    return name;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void)caps;
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return calloc(n, size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return realloc(ptr, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    (void)caps;
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void *heap_caps_aligned_calloc(size_t alignment, size_t n, size_t size, uint32_t caps)
+{
+    void *ptr = heap_caps_aligned_alloc(alignment, n * size, caps);
+    if (ptr) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    (void)caps;
+    return 64 * 1024 * 1024;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, uint8_t const *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path, const sdmmc_host_t *host_config, const void *slot_config,
+                                  const esp_vfs_fat_sdmmc_mount_config_t *mount_config, sdmmc_card_t **out_card)
+{
+    static sdmmc_card_t card;
+    (void)host_config;
+    (void)slot_config;
+    (void)mount_config;
+    mkdir(base_path, 0755);
+    *out_card = &card;
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_info(const char *base_path, uint64_t *out_total_bytes, uint64_t *out_free_bytes)
+{
+    struct statvfs st;
+    if (statvfs(base_path, &st) != 0) {
+        return ESP_FAIL;
+    }
+    *out_total_bytes = (uint64_t)st.f_blocks * st.f_frsize;
+    *out_free_bytes = (uint64_t)st.f_bavail * st.f_frsize;
+    return ESP_OK;
+}
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card)
+{
+    (void)stream;
+    (void)card;
+}
+
+esp_err_t sd_pwr_ctrl_new_on_chip_ldo(const sd_pwr_ctrl_ldo_config_t *config, sd_pwr_ctrl_handle_t *ret_handle)
+{
+    (void)config;
+    *ret_handle = NULL;
+    return ESP_OK;
+}
+
+static cJSON *json_node(void)
+{
+    return calloc(1, sizeof(cJSON));
+}
+
+static void json_attach(cJSON *parent, cJSON *item)
+{
+    cJSON **it = &parent->child;
+    while (*it) {
+        it = &(*it)->next;
+    }
+    *it = item;
+}
+
+cJSON *cJSON_CreateObject(void)
+{
+    return json_node();
+}
+
+cJSON *cJSON_CreateArray(void)
+{
+    return json_node();
+}
+
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *name, double number)
+{
+    (void)name;
+    (void)number;
+    cJSON *item = json_node();
+    json_attach(object, item);
+    return item;
+}
+
+cJSON *cJSON_AddStringToObject(cJSON *object, const char *name, const char *string)
+{
+    (void)string;
+    return cJSON_AddNumberToObject(object, name, 0);
+}
+
+int cJSON_AddItemToObject(cJSON *object, const char *name, cJSON *item)
+{
+    (void)name;
+    json_attach(object, item);
+    return 1;
+}
+
+int cJSON_AddItemToArray(cJSON *array, cJSON *item)
+{
+    json_attach(array, item);
+    return 1;
+}
+
+char *cJSON_PrintUnformatted(const cJSON *item)
+{
+    (void)item;
+    return strdup("{}");
+}
+
+void cJSON_Delete(cJSON *item)
+{
+    while (item) {
+        cJSON *next = item->next;
+        cJSON_Delete(item->child);
+        free(item);
+        item = next;
+    }
+}
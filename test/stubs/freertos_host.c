@@ -0,0 +1,350 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+typedef struct tskTaskControlBlock {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *arg;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t notify;
+} task_t;
+
+/* A semaphore is a queue without items: `count` tokens or items, at most `max`. */
+typedef struct QueueDefinition {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t count;
+    uint32_t max;
+    uint8_t *items;
+    uint32_t item_size;
+    uint32_t head;
+} semaphore_t;
+
+static pthread_mutex_t s_critical = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static __thread task_t *s_current;
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += ticks / 1000;
+    ts.tv_nsec += (long)(ticks % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Waits on `cond` until `ready` is non-zero or `ticks` pass; returns false on timeout. */
+static bool cond_wait_for(pthread_cond_t *cond, pthread_mutex_t *lock, const volatile uint32_t *ready, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks);
+    while (*ready == 0) {
+        if (ticks == 0) {
+            return false;
+        }
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(cond, lock);
+        } else if (pthread_cond_timedwait(cond, lock, &deadline) == ETIMEDOUT) {
+            return *ready != 0;
+        }
+    }
+    return true;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    (void)mux;
+    pthread_mutex_lock(&s_critical);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    (void)mux;
+    pthread_mutex_unlock(&s_critical);
+}
+
+static task_t *task_new(void)
+{
+    task_t *task = calloc(1, sizeof(task_t));
+    if (task) {
+        pthread_mutex_init(&task->lock, NULL);
+        cond_init(&task->cond);
+    }
+    return task;
+}
+
+static void *task_entry(void *arg)
+{
+    task_t *task = arg;
+    s_current = task;
+    task->fn(task->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg,
+                                   UBaseType_t priority, TaskHandle_t *ret_task, BaseType_t core_id)
+{
+    (void)name;
+    (void)stack_depth;
+    (void)priority;
+    (void)core_id;
+    task_t *task = task_new();
+    if (!task) {
+        return pdFAIL;
+    }
+    task->fn = fn;
+    task->arg = arg;
+    if (ret_task) {
+        *ret_task = task;
+    }
+    if (pthread_create(&task->thread, NULL, task_entry, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *ret_task)
+{
+    return xTaskCreatePinnedToCore(fn, name, stack_depth, arg, priority, ret_task, tskNO_AFFINITY);
+}
+
+/* Only self-deletion is supported, which is all the firmware does. The handle stays valid for late notifies. */
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL || task == s_current) {
+        pthread_exit(NULL);
+    }
+    abort();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    struct timespec ts = {
+        .tv_sec = ticks / 1000,
+        .tv_nsec = (long)(ticks % 1000) * 1000000L,
+    };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (TickType_t)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000L);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    /* Threads the test started itself become tasks on first use. */
+    if (!s_current) {
+        s_current = task_new();
+        s_current->thread = pthread_self();
+    }
+    return s_current;
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->lock);
+    task->notify++;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    task_t *task = xTaskGetCurrentTaskHandle();
+    uint32_t value = 0;
+
+    pthread_mutex_lock(&task->lock);
+    if (cond_wait_for(&task->cond, &task->lock, &task->notify, ticks)) {
+        value = task->notify;
+        task->notify = clear_on_exit ? 0 : task->notify - 1;
+    }
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+static SemaphoreHandle_t sem_new(UBaseType_t max, UBaseType_t initial)
+{
+    semaphore_t *sem = calloc(1, sizeof(semaphore_t));
+    if (sem) {
+        pthread_mutex_init(&sem->lock, NULL);
+        cond_init(&sem->cond);
+        sem->max = max;
+        sem->count = initial;
+    }
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return sem_new(1, 0);
+}
+
+/* No priority inheritance or recursion, so a mutex is a binary semaphore that starts given. */
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return sem_new(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max_count, UBaseType_t initial_count)
+{
+    return sem_new(max_count, initial_count);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    BaseType_t ret = pdFAIL;
+
+    pthread_mutex_lock(&sem->lock);
+    if (cond_wait_for(&sem->cond, &sem->lock, &sem->count, ticks)) {
+        sem->count--;
+        ret = pdPASS;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return ret;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    BaseType_t ret = pdFAIL;
+
+    pthread_mutex_lock(&sem->lock);
+    if (sem->count < sem->max) {
+        sem->count++;
+        pthread_cond_signal(&sem->cond);
+        ret = pdPASS;
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return ret;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    if (sem) {
+        pthread_mutex_destroy(&sem->lock);
+        pthread_cond_destroy(&sem->cond);
+        free(sem->items);
+        free(sem);
+    }
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    semaphore_t *queue = sem_new(length, 0);
+    if (queue) {
+        queue->item_size = item_size;
+        queue->items = calloc(length, item_size);
+        if (!queue->items) {
+            vSemaphoreDelete(queue);
+            return NULL;
+        }
+    }
+    return queue;
+}
+
+/* Waits until the queue has an item, or with `for_space` a free slot; returns false on timeout. */
+static bool queue_wait(semaphore_t *queue, bool for_space, TickType_t ticks)
+{
+    struct timespec deadline = deadline_after(ticks);
+    while (for_space ? queue->count >= queue->max : queue->count == 0) {
+        if (ticks == 0) {
+            return false;
+        }
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&queue->cond, &queue->lock);
+        } else if (pthread_cond_timedwait(&queue->cond, &queue->lock, &deadline) == ETIMEDOUT) {
+            return for_space ? queue->count < queue->max : queue->count > 0;
+        }
+    }
+    return true;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    BaseType_t ret = pdFAIL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue_wait(queue, true, ticks)) {
+        memcpy(queue->items + (queue->head + queue->count) % queue->max * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_broadcast(&queue->cond);
+        ret = pdPASS;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ret;
+}
+
+static BaseType_t queue_take(QueueHandle_t queue, void *item, TickType_t ticks, bool remove)
+{
+    BaseType_t ret = pdFAIL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue_wait(queue, false, ticks)) {
+        memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+        if (remove) {
+            queue->head = (queue->head + 1) % queue->max;
+            queue->count--;
+            pthread_cond_broadcast(&queue->cond);
+        }
+        ret = pdPASS;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ret;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return queue_take(queue, item, ticks, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    return queue_take(queue, item, ticks, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t spaces = queue->max - queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return spaces;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    vSemaphoreDelete(queue);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+/* Just enough of cJSON for the tested modules to link; printing yields "{}". */
+typedef struct cJSON {
+    struct cJSON *next;
+    struct cJSON *child;
+} cJSON;
+
+cJSON *cJSON_CreateObject(void);
+cJSON *cJSON_CreateArray(void);
+cJSON *cJSON_AddNumberToObject(cJSON *object, const char *name, double number);
+cJSON *cJSON_AddStringToObject(cJSON *object, const char *name, const char *string);
+int cJSON_AddItemToObject(cJSON *object, const char *name, cJSON *item);
+int cJSON_AddItemToArray(cJSON *array, cJSON *item);
+char *cJSON_PrintUnformatted(const cJSON *item);
+void cJSON_Delete(cJSON *item);
@@ -0,0 +1,24 @@
+#pragma once
+
+/* Host test stand-in for the gitignored board config; the card is a scratch directory set by the test target. */
+#define CATFLAPCAM_WIFI_SSID "host-test"
+#define CATFLAPCAM_WIFI_PASSWORD "host-test"
+#define CATFLAPCAM_WIFI_MAX_RETRY 6
+#define CATFLAPCAM_OTA_PASSWORD "host-test"
+
+#define CATFLAPCAM_SDCARD_ENABLE 1
+#ifndef CATFLAPCAM_SDCARD_MOUNT_POINT
+#define CATFLAPCAM_SDCARD_MOUNT_POINT "/tmp/catflapcam-host-sdcard"
+#endif
+#define CATFLAPCAM_SDCARD_SLOT 0
+#define CATFLAPCAM_SDCARD_BUS_WIDTH 4
+#define CATFLAPCAM_SDCARD_MAX_FREQ_KHZ 20000
+#define CATFLAPCAM_SDCARD_FORMAT_IF_MOUNT_FAILED 0
+#ifndef CATFLAPCAM_SNAPSHOT_MAX_FILES
+#define CATFLAPCAM_SNAPSHOT_MAX_FILES 64
+#endif
+#define CATFLAPCAM_SDCARD_USE_INTERNAL_LDO 1
+#define CATFLAPCAM_SDCARD_LDO_ID 4
+#define CATFLAPCAM_SNAPSHOT_WIDTH 224
+#define CATFLAPCAM_SNAPSHOT_HEIGHT 224
+#define CATFLAPCAM_SNAPSHOT_JPEG_QUALITY 100
@@ -0,0 +1,57 @@
+/*
+ * Fake of the ESP-IDF JPEG encoder driver. Engines are counted so tests can tell when the shared hardware
+ * engine is created and deleted; processing writes a minimal JPEG and fails on a deleted engine.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct jpeg_encoder_t *jpeg_encoder_handle_t;
+
+typedef enum {
+    JPEG_ENCODE_IN_FORMAT_RGB888,
+    JPEG_ENCODE_IN_FORMAT_RGB565,
+    JPEG_ENCODE_IN_FORMAT_GRAY,
+    JPEG_ENCODE_IN_FORMAT_YUV422,
+} jpeg_enc_input_format_t;
+
+typedef enum {
+    JPEG_DOWN_SAMPLING_YUV444,
+    JPEG_DOWN_SAMPLING_YUV422,
+    JPEG_DOWN_SAMPLING_YUV420,
+    JPEG_DOWN_SAMPLING_GRAY,
+} jpeg_down_sampling_type_t;
+
+typedef enum {
+    JPEG_DEC_ALLOC_INPUT_BUFFER,
+    JPEG_DEC_ALLOC_OUTPUT_BUFFER,
+} jpeg_dec_buffer_alloc_direction_t;
+
+typedef struct {
+    int timeout_ms;
+} jpeg_encode_engine_cfg_t;
+
+typedef struct {
+    uint32_t height;
+    uint32_t width;
+    jpeg_enc_input_format_t src_type;
+    jpeg_down_sampling_type_t sub_sample;
+    uint32_t image_quality;
+} jpeg_encode_cfg_t;
+
+typedef struct {
+    jpeg_dec_buffer_alloc_direction_t buffer_direction;
+} jpeg_encode_memory_alloc_cfg_t;
+
+esp_err_t jpeg_new_encoder_engine(const jpeg_encode_engine_cfg_t *enc_eng_cfg, jpeg_encoder_handle_t *ret_encoder);
+esp_err_t jpeg_del_encoder_engine(jpeg_encoder_handle_t encoder_engine);
+esp_err_t jpeg_encoder_process(jpeg_encoder_handle_t encoder_engine, const jpeg_encode_cfg_t *encode_cfg,
+                               const uint8_t *encode_inbuf, uint32_t inbuf_size, uint8_t *encode_outbuf,
+                               uint32_t outbuf_size, uint32_t *out_size);
+void *jpeg_alloc_encoder_mem(size_t size, const jpeg_encode_memory_alloc_cfg_t *mem_cfg, size_t *allocated_size);
+
+/* Fake only: engines alive now and created in total. */
+extern int jpeg_fake_engines_alive;
+extern int jpeg_fake_engines_created;
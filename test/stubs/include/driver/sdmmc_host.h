@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef void *sd_pwr_ctrl_handle_t;
+
+typedef struct {
+    int slot;
+    int max_freq_khz;
+    sd_pwr_ctrl_handle_t pwr_ctrl_handle;
+} sdmmc_host_t;
+
+typedef struct {
+    int width;
+    int flags;
+} sdmmc_slot_config_t;
+
+typedef struct {
+    struct {
+        uint32_t capacity;
+        uint32_t sector_size;
+    } csd;
+} sdmmc_card_t;
+
+#define SDMMC_HOST_DEFAULT() {0}
+#define SDMMC_SLOT_CONFIG_DEFAULT() {0}
+#define SDMMC_SLOT_FLAG_INTERNAL_PULLUP 1
@@ -0,0 +1,3 @@
+#pragma once
+
+/* Not needed by the host tests; present so the video component sources compile. */
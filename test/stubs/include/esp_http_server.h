@@ -0,0 +1,19 @@
+#pragma once
+
+#include "esp_err.h"
+
+/*
+ * Just the part of esp_http_server the stream engine uses once it owns a connection. A host test makes the
+ * request itself and keeps the client socket in `aux`; closing the session closes that socket.
+ */
+typedef void *httpd_handle_t;
+
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    void *aux;
+} httpd_req_t;
+
+esp_err_t httpd_req_async_handler_begin(httpd_req_t *req, httpd_req_t **out);
+esp_err_t httpd_req_async_handler_complete(httpd_req_t *req);
+int httpd_req_to_sockfd(httpd_req_t *req);
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Errors and warnings go to stderr; info and below only when CATFLAPCAM_HOST_LOG_VERBOSE is set. */
+extern int catflapcam_host_log_verbose;
+
+#define ESP_LOG_HOST(level, tag, fmt, ...) fprintf(stderr, level " (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...) ESP_LOG_HOST("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_LOG_HOST("W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) do { if (catflapcam_host_log_verbose) ESP_LOG_HOST("I", tag, fmt, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { if (catflapcam_host_log_verbose > 1) ESP_LOG_HOST("D", tag, fmt, ##__VA_ARGS__); } while (0)
+#define ESP_LOGV(tag, fmt, ...) do { if (catflapcam_host_log_verbose > 2) ESP_LOG_HOST("V", tag, fmt, ##__VA_ARGS__); } while (0)
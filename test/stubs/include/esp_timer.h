@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Microseconds since the test started, from CLOCK_MONOTONIC. */
+int64_t esp_timer_get_time(void);
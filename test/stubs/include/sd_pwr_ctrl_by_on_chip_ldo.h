@@ -0,0 +1,9 @@
+#pragma once
+
+#include "driver/sdmmc_host.h"
+
+typedef struct {
+    int ldo_chan_id;
+} sd_pwr_ctrl_ldo_config_t;
+
+esp_err_t sd_pwr_ctrl_new_on_chip_ldo(const sd_pwr_ctrl_ldo_config_t *config, sd_pwr_ctrl_handle_t *ret_handle);
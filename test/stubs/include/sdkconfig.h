@@ -0,0 +1,32 @@
+/*
+ * Host test configuration, mirroring the project sdkconfig for the options the tested modules read.
+ * Targets override single options with compile definitions.
+ */
+#pragma once
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_CATFLAPCAM_CAMERA_VIDEO_BUFFER_NUMBER 3
+#define CONFIG_CATFLAPCAM_FRAME_BROKER_SLOT_NUMBER 3
+#define CONFIG_CATFLAPCAM_SNAPSHOT_RESIZE_AREA 1
+#define CONFIG_CATFLAPCAM_PREROLL_ENABLE 1
+#define CONFIG_CATFLAPCAM_PREROLL_FRAMES 10
+#define CONFIG_CATFLAPCAM_PREROLL_INTERVAL_MS 200
+#define CONFIG_CATFLAPCAM_PREROLL_BUDGET_KB 512
+#if !CONFIG_CATFLAPCAM_SNAPSHOT_STORE_SEGMENTS
+#define CONFIG_CATFLAPCAM_SNAPSHOT_STORE_FILES 1
+#endif
+#ifndef CONFIG_CATFLAPCAM_SNAPSHOT_SEGMENT_SIZE_KB
+#define CONFIG_CATFLAPCAM_SNAPSHOT_SEGMENT_SIZE_KB 256
+#endif
+#ifndef CONFIG_CATFLAPCAM_SNAPSHOT_SEGMENT_COUNT
+#define CONFIG_CATFLAPCAM_SNAPSHOT_SEGMENT_COUNT 8
+#endif
+#define CONFIG_CATFLAPCAM_SNAPSHOT_BUDGET_MB 0
+#define CONFIG_CATFLAPCAM_SNAPSHOT_MIN_FREE_MB 0
+#define CONFIG_CATFLAPCAM_SNAPSHOT_RETENTION_HEADROOM_MB 0
+#define CONFIG_CATFLAPCAM_STORAGE_WRITER_QUEUE_KB 4096
+#define CONFIG_CATFLAPCAM_STREAM_MAX_CLIENTS 8
+#define CONFIG_CATFLAPCAM_JPEG_COMPRESSION_QUALITY 95
+#define CONFIG_CATFLAPCAM_HTTP_PART_BOUNDARY "123456789000000000000987654321"
+#define CONFIG_CATFLAPCAM_MDNS_INSTANCE "web-cam"
+#define CONFIG_CATFLAPCAM_MDNS_HOST_NAME "esp-web"
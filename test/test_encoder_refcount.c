@@ -0,0 +1,83 @@
+/*
+ * The hardware JPEG encoder is one engine shared by every encoder handle. Opening and evicting a downscaled
+ * stream variant must leave the main stream and snapshot encoders working, and the engine must only go away
+ * with the last handle.
+ */
+#include <stdint.h>
+#include <string.h>
+#include "driver/jpeg_encode.h"
+#include "catflapcam_video_common.h"
+#include "host_test.h"
+
+static catflapcam_encoder_handle_t open_encoder(uint32_t width, uint32_t height)
+{
+    catflapcam_encoder_config_t config = {
+        .width = width,
+        .height = height,
+        .pixel_format = V4L2_PIX_FMT_RGB565,
+        .quality = 80,
+    };
+    catflapcam_encoder_handle_t encoder = NULL;
+    TEST_CHECK_OK(catflapcam_encoder_init(&config, &encoder));
+    return encoder;
+}
+
+static esp_err_t encode(catflapcam_encoder_handle_t encoder, uint32_t width, uint32_t height)
+{
+    static uint8_t src[320 * 240 * 2];
+    uint8_t *out;
+    uint32_t out_size;
+    uint32_t size = 0;
+
+    TEST_CHECK(width * height * 2 <= sizeof(src));
+    TEST_CHECK_OK(catflapcam_encoder_alloc_output_buffer(encoder, &out, &out_size));
+    esp_err_t ret = catflapcam_encoder_process(encoder, src, width * height * 2, out, out_size, &size);
+    TEST_CHECK(ret != ESP_OK || (size >= 2 && out[0] == 0xff && out[1] == 0xd8));
+    catflapcam_encoder_free_output_buffer(encoder, out);
+    return ret;
+}
+
+int main(void)
+{
+    catflapcam_encoder_handle_t stream = open_encoder(320, 240);
+    catflapcam_encoder_handle_t snapshot = open_encoder(224, 224);
+    TEST_CHECK(jpeg_fake_engines_created == 1);
+
+    for (int round = 0; round < 3; round++) {
+        catflapcam_encoder_handle_t variant = open_encoder(160, 120);
+        TEST_CHECK_OK(encode(variant, 160, 120));
+        TEST_CHECK_OK(catflapcam_encoder_deinit(variant));
+
+        TEST_CHECK(jpeg_fake_engines_alive == 1);
+        TEST_CHECK_OK(encode(stream, 320, 240));
+        TEST_CHECK_OK(encode(snapshot, 224, 224));
+    }
+    TEST_CHECK(jpeg_fake_engines_created == 1);
+
+    /* A failed init must not take the engine down with it. */
+    catflapcam_encoder_config_t bad = {
+        .width = 64,
+        .height = 64,
+        .pixel_format = V4L2_PIX_FMT_JPEG,
+        .quality = 80,
+    };
+    catflapcam_encoder_handle_t none = NULL;
+    TEST_CHECK(catflapcam_encoder_init(&bad, &none) != ESP_OK);
+    TEST_CHECK_OK(encode(stream, 320, 240));
+
+    TEST_CHECK_OK(catflapcam_encoder_deinit(snapshot));
+    TEST_CHECK(jpeg_fake_engines_alive == 1);
+    TEST_CHECK_OK(encode(stream, 320, 240));
+    TEST_CHECK_OK(catflapcam_encoder_deinit(stream));
+    TEST_CHECK(jpeg_fake_engines_alive == 0);
+
+    /* The next encoder brings up a fresh engine. */
+    catflapcam_encoder_handle_t again = open_encoder(224, 224);
+    TEST_CHECK(jpeg_fake_engines_created == 2 && jpeg_fake_engines_alive == 1);
+    TEST_CHECK_OK(encode(again, 224, 224));
+    TEST_CHECK_OK(catflapcam_encoder_deinit(again));
+    TEST_CHECK(jpeg_fake_engines_alive == 0);
+
+    printf("encoder refcount: ok\n");
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Drives the frame broker from a fake source at a fixed frame rate and checks that every subscriber keeps
+ * receiving that rate, from one up to eight subscribers, in both the copy and the zero-copy path.
+ *
+ * Usage: test_frame_broker [source fps] [seconds per run]
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "catflapcam_frame_broker.h"
+#include "host_test.h"
+
+#define SOURCE_BUFS     3
+#define FRAME_SIZE      (64 * 1024)
+#define MAX_SUBSCRIBERS 8
+
+typedef struct {
+    uint8_t data[SOURCE_BUFS][FRAME_SIZE];
+    bool queued[SOURCE_BUFS];
+    uint32_t next;
+    int64_t period_us;
+    int64_t next_us;
+    pthread_mutex_t lock;
+} fake_source_t;
+
+typedef struct {
+    catflapcam_frame_broker_handle_t broker;
+    catflapcam_frame_subscriber_t *sub;
+    atomic_bool *stop;
+    uint32_t frames;
+    uint64_t last_seq;
+    bool in_order;
+} subscriber_t;
+
+/* Hands out the source buffers round robin at the configured rate, like a sensor with SOURCE_BUFS buffers. */
+static esp_err_t fake_dequeue(void *ctx, catflapcam_frame_source_buf_t *buf)
+{
+    fake_source_t *source = ctx;
+    int64_t now = esp_timer_get_time();
+
+    if (source->next_us > now) {
+        vTaskDelay(pdMS_TO_TICKS((source->next_us - now + 999) / 1000));
+    }
+    source->next_us += source->period_us;
+
+    pthread_mutex_lock(&source->lock);
+    uint32_t index = source->next;
+    bool queued = source->queued[index];
+    if (queued) {
+        source->queued[index] = false;
+        source->next = (index + 1) % SOURCE_BUFS;
+    }
+    pthread_mutex_unlock(&source->lock);
+    if (!queued) {
+        return ESP_ERR_TIMEOUT;
+    }
+    buf->index = index;
+    buf->data = source->data[index];
+    buf->size = FRAME_SIZE / 2 + index;
+    return ESP_OK;
+}
+
+static esp_err_t fake_requeue(void *ctx, const catflapcam_frame_source_buf_t *buf)
+{
+    fake_source_t *source = ctx;
+
+    pthread_mutex_lock(&source->lock);
+    source->queued[buf->index] = true;
+    pthread_mutex_unlock(&source->lock);
+    return ESP_OK;
+}
+
+/* Reads every frame it gets, as a stream client copying it out would, then releases it. */
+static void *subscriber_thread(void *arg)
+{
+    subscriber_t *s = arg;
+    volatile uint32_t sum = 0;
+
+    while (!atomic_load(s->stop)) {
+        catflapcam_frame_t *frame;
+        if (catflapcam_frame_broker_acquire(s->broker, s->sub, pdMS_TO_TICKS(100), &frame) != ESP_OK) {
+            continue;
+        }
+        for (uint32_t i = 0; i < frame->size; i += 64) {
+            sum += frame->data[i];
+        }
+        s->in_order = s->in_order && frame->seq > s->last_seq;
+        s->last_seq = frame->seq;
+        s->frames++;
+        catflapcam_frame_broker_release(s->broker, frame);
+    }
+    return NULL;
+}
+
+static double run(bool zero_copy, int subscribers, int fps, double seconds, catflapcam_frame_broker_stats_t *stats)
+{
+    static fake_source_t source;
+    subscriber_t subs[MAX_SUBSCRIBERS] = {0};
+    pthread_t threads[MAX_SUBSCRIBERS];
+    atomic_bool stop = false;
+
+    memset(source.queued, 1, sizeof(source.queued));
+    source.next = 0;
+    source.period_us = 1000000 / fps;
+    source.next_us = esp_timer_get_time();
+    pthread_mutex_init(&source.lock, NULL);
+
+    catflapcam_frame_broker_config_t config = {
+        .source = {
+            .dequeue = fake_dequeue,
+            .requeue = fake_requeue,
+            .ctx = &source,
+        },
+        .frame_capacity = FRAME_SIZE,
+        .zero_copy = zero_copy,
+        .max_pinned = SOURCE_BUFS - 2,
+    };
+    catflapcam_frame_broker_handle_t broker;
+    TEST_CHECK_OK(catflapcam_frame_broker_new(&config, &broker));
+    for (int i = 0; i < subscribers; i++) {
+        subs[i] = (subscriber_t) {
+            .broker = broker,
+            .stop = &stop,
+            .in_order = true,
+        };
+        TEST_CHECK_OK(catflapcam_frame_broker_subscribe(broker, &subs[i].sub));
+    }
+    TEST_CHECK_OK(catflapcam_frame_broker_start(broker));
+    for (int i = 0; i < subscribers; i++) {
+        pthread_create(&threads[i], NULL, subscriber_thread, &subs[i]);
+    }
+
+    /* Skip the first frames while the threads come up, then count over the window. */
+    vTaskDelay(pdMS_TO_TICKS(100));
+    uint32_t start[MAX_SUBSCRIBERS];
+    for (int i = 0; i < subscribers; i++) {
+        start[i] = __atomic_load_n(&subs[i].frames, __ATOMIC_RELAXED);
+    }
+    int64_t start_us = esp_timer_get_time();
+    vTaskDelay(pdMS_TO_TICKS((TickType_t)(seconds * 1000)));
+    double elapsed = (esp_timer_get_time() - start_us) / 1e6;
+    double min_fps = 1e9;
+    for (int i = 0; i < subscribers; i++) {
+        double sub_fps = (__atomic_load_n(&subs[i].frames, __ATOMIC_RELAXED) - start[i]) / elapsed;
+        min_fps = sub_fps < min_fps ? sub_fps : min_fps;
+    }
+
+    atomic_store(&stop, true);
+    for (int i = 0; i < subscribers; i++) {
+        pthread_join(threads[i], NULL);
+        TEST_CHECK(subs[i].in_order);
+    }
+    catflapcam_frame_broker_get_stats(broker, stats);
+    catflapcam_frame_broker_free(broker);
+    pthread_mutex_destroy(&source.lock);
+    return min_fps;
+}
+
+int main(int argc, char **argv)
+{
+    int fps = argc > 1 ? atoi(argv[1]) : 60;
+    double seconds = argc > 2 ? atof(argv[2]) : 0.5;
+
+    for (int zero_copy = 0; zero_copy <= 1; zero_copy++) {
+        for (int n = 1; n <= MAX_SUBSCRIBERS; n++) {
+            catflapcam_frame_broker_stats_t stats;
+            double min_fps = run(zero_copy, n, fps, seconds, &stats);
+            printf("%-9s subscribers=%d min fps=%.1f captured=%llu dropped=%llu pinned=%llu\n",
+                   zero_copy ? "zero-copy" : "copy", n, min_fps, (unsigned long long)stats.frames_captured,
+                   (unsigned long long)stats.frames_dropped, (unsigned long long)stats.frames_pinned);
+            /* Flat: every subscriber sees (almost) every frame, however many there are. */
+            TEST_CHECK(min_fps >= fps * 0.85);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+/*
+ * Exercises the snapshot job pool the way the capture path uses it: an HTTP waiter that may time out and
+ * hand its job back, and the storage writer finishing the job through its completion callback. Checks that
+ * every job comes back to the pool exactly once, that a handed back job never leaves a stale completion
+ * for its next user, and that the submitting worker does not wait for a slow card.
+ *
+ * Usage: test_snapshot_pool [race iterations per waiter]
+ */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "catflapcam_snapshot_pool.h"
+#include "catflapcam_storage_writer.h"
+#include "host_test.h"
+
+#define JOB_BUF_SIZE        4096
+#define FAKE_CARD_WRITE_MS  40
+#define WRITER_JOBS         64
+
+static atomic_int s_card_writes;
+
+/* Stands in for the SD card: every batch takes FAKE_CARD_WRITE_MS and is then fully saved. */
+esp_err_t catflapcam_storage_save_snapshots(const catflapcam_storage_blob_t *blobs, size_t count, size_t *saved)
+{
+    usleep(FAKE_CARD_WRITE_MS * 1000);
+    atomic_fetch_add(&s_card_writes, 1);
+    *saved = count;
+    return ESP_OK;
+}
+
+static void claim_all(catflapcam_snapshot_pool_t *pool, catflapcam_snapshot_job_t **jobs, bool waited, TickType_t wait)
+{
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        TEST_CHECK_OK(catflapcam_snapshot_pool_claim(pool, waited, wait, &jobs[i]));
+        TEST_CHECK(jobs[i]->busy && jobs[i]->waited == waited);
+    }
+}
+
+/* Takes every job once more and gives them all back, which only works if none is missing or stuck. */
+static void check_pool_full(catflapcam_snapshot_pool_t *pool)
+{
+    catflapcam_snapshot_job_t *jobs[CATFLAPCAM_SNAPSHOT_QUEUE_LEN];
+    catflapcam_snapshot_job_t *extra = NULL;
+
+    claim_all(pool, jobs, true, 0);
+    TEST_CHECK(catflapcam_snapshot_pool_claim(pool, true, 0, &extra) == ESP_ERR_TIMEOUT);
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        TEST_CHECK(xSemaphoreTake(jobs[i]->done, 0) != pdPASS);
+        catflapcam_snapshot_pool_release(jobs[i]);
+    }
+}
+
+static void test_claim_and_finish(void)
+{
+    catflapcam_snapshot_pool_t pool;
+    catflapcam_snapshot_job_t *jobs[CATFLAPCAM_SNAPSHOT_QUEUE_LEN];
+    catflapcam_snapshot_job_t *extra = NULL;
+
+    TEST_CHECK_OK(catflapcam_snapshot_pool_init(&pool, JOB_BUF_SIZE));
+
+    /* Exhausted pool: a claim times out instead of waiting for the card. */
+    claim_all(&pool, jobs, false, 0);
+    int64_t t0_us = esp_timer_get_time();
+    TEST_CHECK(catflapcam_snapshot_pool_claim(&pool, false, pdMS_TO_TICKS(20), &extra) == ESP_ERR_TIMEOUT);
+    TEST_CHECK(esp_timer_get_time() - t0_us >= 15000);
+
+    /* A job nobody waits for is recycled by whoever finishes it. */
+    catflapcam_snapshot_pool_finish(jobs[0], ESP_OK);
+    TEST_CHECK_OK(catflapcam_snapshot_pool_claim(&pool, true, 0, &extra));
+    TEST_CHECK(extra == jobs[0] && !extra->finished);
+
+    /* Finished before the waiter arrives: the result is still handed over. */
+    catflapcam_snapshot_pool_finish(extra, ESP_ERR_NO_MEM);
+    TEST_CHECK(catflapcam_snapshot_pool_wait(extra, 0) == ESP_ERR_NO_MEM);
+
+    /* Timed out waiter: the job stays busy until it finishes, then goes back without a waiter. */
+    TEST_CHECK_OK(catflapcam_snapshot_pool_claim(&pool, true, 0, &extra));
+    TEST_CHECK(catflapcam_snapshot_pool_wait(extra, pdMS_TO_TICKS(5)) == ESP_ERR_TIMEOUT);
+    TEST_CHECK(extra->busy && !catflapcam_snapshot_pool_is_waited(extra));
+    catflapcam_snapshot_pool_finish(extra, ESP_OK);
+    TEST_CHECK(!extra->busy);
+
+    for (int i = 1; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        catflapcam_snapshot_pool_release(jobs[i]);
+    }
+    check_pool_full(&pool);
+    TEST_CHECK_OK(catflapcam_snapshot_pool_drain(&pool, 0));
+    catflapcam_snapshot_pool_deinit(&pool);
+    printf("claim/finish/wait: ok\n");
+}
+
+typedef struct {
+    catflapcam_snapshot_job_t *job;
+    int delay_us;
+    esp_err_t result;
+} finisher_t;
+
+typedef struct {
+    catflapcam_snapshot_pool_t *pool;
+    int iterations;
+    int seed;
+    atomic_int *owners;
+    int completed;
+    int timed_out;
+} waiter_t;
+
+static void *finisher_thread(void *arg)
+{
+    finisher_t *f = arg;
+
+    usleep(f->delay_us);
+    catflapcam_snapshot_pool_finish(f->job, f->result);
+    free(f);
+    return NULL;
+}
+
+/*
+ * The HTTP side of the race: the finisher is timed to land just before, around or just after the waiter's
+ * deadline, so the completion often arrives between a timed out take and the pool lock.
+ */
+static void *waiter_thread(void *arg)
+{
+    waiter_t *w = arg;
+    unsigned seed = w->seed;
+
+    for (int i = 0; i < w->iterations; i++) {
+        catflapcam_snapshot_job_t *job = NULL;
+        TEST_CHECK_OK(catflapcam_snapshot_pool_claim(w->pool, true, portMAX_DELAY, &job));
+        int index = (int)(job - w->pool->jobs);
+        TEST_CHECK(atomic_exchange(&w->owners[index], 1) == 0);
+        TEST_CHECK(xSemaphoreTake(job->done, 0) != pdPASS);
+
+        finisher_t *f = calloc(1, sizeof(*f));
+        TEST_CHECK(f);
+        f->job = job;
+        f->delay_us = 500 + rand_r(&seed) % 1500;
+        f->result = (i & 1) ? ESP_FAIL : ESP_OK;
+        esp_err_t expected = f->result;
+        pthread_t thread;
+        TEST_CHECK(pthread_create(&thread, NULL, finisher_thread, f) == 0);
+        pthread_detach(thread);
+
+        atomic_store(&w->owners[index], 0);
+        esp_err_t ret = catflapcam_snapshot_pool_wait(job, pdMS_TO_TICKS(1));
+        if (ret == ESP_ERR_TIMEOUT) {
+            w->timed_out++;
+        } else {
+            TEST_CHECK(ret == expected);
+            w->completed++;
+        }
+    }
+    return NULL;
+}
+
+static void test_timeout_race(int iterations)
+{
+    catflapcam_snapshot_pool_t pool;
+    atomic_int owners[CATFLAPCAM_SNAPSHOT_QUEUE_LEN] = {0};
+    waiter_t waiters[CATFLAPCAM_SNAPSHOT_QUEUE_LEN];
+    pthread_t threads[CATFLAPCAM_SNAPSHOT_QUEUE_LEN];
+    int completed = 0;
+    int timed_out = 0;
+
+    TEST_CHECK_OK(catflapcam_snapshot_pool_init(&pool, JOB_BUF_SIZE));
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        waiters[i] = (waiter_t) {
+            .pool = &pool,
+            .iterations = iterations,
+            .seed = i + 1,
+            .owners = owners,
+        };
+        TEST_CHECK(pthread_create(&threads[i], NULL, waiter_thread, &waiters[i]) == 0);
+    }
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        pthread_join(threads[i], NULL);
+        completed += waiters[i].completed;
+        timed_out += waiters[i].timed_out;
+    }
+
+    /* Handed back jobs come home once their finisher runs; then the pool must be whole again. */
+    TEST_CHECK_OK(catflapcam_snapshot_pool_drain(&pool, pdMS_TO_TICKS(1000)));
+    TEST_CHECK(xSemaphoreTake(pool.free, 0) != pdPASS);
+    for (int i = 0; i < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; i++) {
+        TEST_CHECK(!pool.jobs[i].busy);
+        xSemaphoreGive(pool.free);
+    }
+    check_pool_full(&pool);
+    printf("timeout race: %d waits, %d completed, %d handed back\n", completed + timed_out, completed, timed_out);
+    TEST_CHECK(completed + timed_out == iterations * CATFLAPCAM_SNAPSHOT_QUEUE_LEN);
+    /* Both outcomes must actually have been exercised for the race to mean anything. */
+    TEST_CHECK(completed > 0 && timed_out > 0);
+    catflapcam_snapshot_pool_deinit(&pool);
+}
+
+static void job_write_done(esp_err_t result, size_t saved, void *ctx)
+{
+    catflapcam_snapshot_pool_finish((catflapcam_snapshot_job_t *)ctx, result);
+}
+
+/*
+ * The worker's side: jobs are queued on the real storage writer with a completion callback while the fake
+ * card is slow. Submitting must cost nothing like a card write, and every waiter still gets its result.
+ */
+static void test_writer_completion(void)
+{
+    catflapcam_snapshot_pool_t pool;
+    uint8_t jpeg[JOB_BUF_SIZE];
+    int64_t submit_max_us = 0;
+    int submitted = 0;
+    int saved = 0;
+    int abandoned = 0;
+
+    memset(jpeg, 0xa5, sizeof(jpeg));
+    TEST_CHECK_OK(catflapcam_snapshot_pool_init(&pool, JOB_BUF_SIZE));
+    TEST_CHECK_OK(catflapcam_storage_writer_start());
+
+    for (int i = 0; i < WRITER_JOBS; i += CATFLAPCAM_SNAPSHOT_QUEUE_LEN) {
+        catflapcam_snapshot_job_t *jobs[CATFLAPCAM_SNAPSHOT_QUEUE_LEN];
+        /* The job abandoned last round comes back only once its card write is done. */
+        claim_all(&pool, jobs, true, pdMS_TO_TICKS(5000));
+        for (int j = 0; j < CATFLAPCAM_SNAPSHOT_QUEUE_LEN; j++) {
+            catflapcam_storage_blob_t blob = {
+                .data = jpeg,
+                .len = sizeof(jpeg),
+            };
+            int64_t t0_us = esp_timer_get_time();
+            TEST_CHECK_OK(catflapcam_storage_writer_submit(&blob, 1, CATFLAPCAM_STORAGE_WRITER_REJECT, 0, NULL, job_write_done, jobs[j]));
+            submit_max_us = MAX(submit_max_us, esp_timer_get_time() - t0_us);
+            submitted++;
+        }
+        /* The last job of each round is abandoned by its waiter straight away, as a timed out HTTP request would. */
+        TEST_CHECK(catflapcam_snapshot_pool_wait(jobs[CATFLAPCAM_SNAPSHOT_QUEUE_LEN - 1], 0) == ESP_ERR_TIMEOUT);
+        abandoned++;
+        for (int j = 0; j < CATFLAPCAM_SNAPSHOT_QUEUE_LEN - 1; j++) {
+            TEST_CHECK_OK(catflapcam_snapshot_pool_wait(jobs[j], pdMS_TO_TICKS(5000)));
+            saved++;
+        }
+    }
+    TEST_CHECK_OK(catflapcam_snapshot_pool_drain(&pool, pdMS_TO_TICKS(5000)));
+
+    catflapcam_storage_writer_stats_t stats;
+    catflapcam_storage_writer_get_stats(&stats);
+    printf("writer completion: %d waited and %d abandoned saves, %llu writes in %d card batches, slowest submit %lld us\n", saved,
+           abandoned, (unsigned long long)stats.writes, atomic_load(&s_card_writes), (long long)submit_max_us);
+    TEST_CHECK(saved + abandoned == submitted);
+    TEST_CHECK(stats.writes == (uint64_t)submitted && stats.failed == 0);
+    TEST_CHECK(submit_max_us < FAKE_CARD_WRITE_MS * 1000 / 4);
+    catflapcam_snapshot_pool_deinit(&pool);
+}
+
+int main(int argc, char **argv)
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+
+    test_claim_and_finish();
+    test_timeout_race(iterations);
+    test_writer_completion();
+    return 0;
+}
@@ -0,0 +1,241 @@
+/*
+ * Replays a save/evict/delete/read workload against the snapshot store on a scratch directory, then restarts
+ * it twice: once replaying the journal and once without a journal, rebuilding the index from the directory
+ * or the segment headers. After every phase each listed snapshot must locate and read back byte for byte,
+ * and the newest snapshots that were not deleted must all be there. Built once per storage backend.
+ *
+ * Each phase runs in a child process because the store is only initialised once per boot.
+ */
+#define _GNU_SOURCE
+#include <ftw.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "catflapcam_config.h"
+#include "catflapcam_storage.h"
+#include "host_test.h"
+
+#define SNAPSHOT_MIN_SIZE   2000
+#define SNAPSHOT_MAX_SIZE   40000
+#define MAX_SNAPSHOTS       4096
+
+#if CONFIG_CATFLAPCAM_SNAPSHOT_STORE_SEGMENTS
+#define SEGMENT_STORE       1
+#else
+#define SEGMENT_STORE       0
+#endif
+
+/* Every snapshot starts with its own id, so a read can tell which one it got; the rest derives from the id. */
+static uint32_t snapshot_size(uint32_t id)
+{
+    return SNAPSHOT_MIN_SIZE + (id * 7919u) % (SNAPSHOT_MAX_SIZE - SNAPSHOT_MIN_SIZE);
+}
+
+static void fill_snapshot(uint32_t id, uint8_t *buf)
+{
+    uint32_t size = snapshot_size(id);
+    memcpy(buf, &id, sizeof(id));
+    for (uint32_t i = sizeof(id); i < size; i++) {
+        buf[i] = (uint8_t)(id * 31 + i * 7 + (i >> 9));
+    }
+}
+
+/* State shared with the phases through a file, since each one is a separate process. */
+typedef struct {
+    uint32_t next_id;
+    uint8_t deleted[MAX_SNAPSHOTS];
+} workload_t;
+
+static const char *state_path(void)
+{
+    return CATFLAPCAM_SDCARD_MOUNT_POINT "-workload";
+}
+
+static void load_state(workload_t *w)
+{
+    FILE *fp = fopen(state_path(), "rb");
+    memset(w, 0, sizeof(*w));
+    if (fp) {
+        TEST_CHECK(fread(w, sizeof(*w), 1, fp) == 1);
+        fclose(fp);
+    }
+}
+
+static void save_state(const workload_t *w)
+{
+    FILE *fp = fopen(state_path(), "wb");
+    TEST_CHECK(fp && fwrite(w, sizeof(*w), 1, fp) == 1);
+    fclose(fp);
+}
+
+/* Saves `count` snapshots in batches of one to three and deletes every eleventh one again. */
+static void save_workload(workload_t *w, uint32_t count)
+{
+    static uint8_t bufs[3][SNAPSHOT_MAX_SIZE];
+
+    for (uint32_t done = 0; done < count;) {
+        catflapcam_storage_blob_t blobs[3];
+        size_t batch = 1 + (w->next_id % 3);
+        batch = batch < count - done ? batch : count - done;
+        for (size_t i = 0; i < batch; i++) {
+            uint32_t id = w->next_id + i;
+            fill_snapshot(id, bufs[i]);
+            blobs[i] = (catflapcam_storage_blob_t) {
+                .data = bufs[i],
+                .len = snapshot_size(id),
+                .timestamp_ms = 1700000000000LL + id * 1000LL,
+                .source = id % 2,
+            };
+        }
+        size_t saved = 0;
+        TEST_CHECK_OK(catflapcam_storage_save_snapshots(blobs, batch, &saved));
+        TEST_CHECK(saved == batch);
+        w->next_id += batch;
+        done += batch;
+
+        if (w->next_id % 11 == 0) {
+            catflapcam_storage_snapshot_info_t info;
+            catflapcam_storage_query_t query = {.source = -1};
+            size_t n = 0;
+            uint64_t next = 0;
+            uint32_t total = 0;
+            TEST_CHECK_OK(catflapcam_storage_list_snapshots(&query, &info, 1, &n, &next, &total));
+            TEST_CHECK(n == 1);
+            TEST_CHECK_OK(catflapcam_storage_delete_snapshot(info.name));
+            w->deleted[w->next_id - 1] = 1;
+        }
+    }
+}
+
+/*
+ * Lists the whole index newest first and reads back every snapshot; returns how many there are, or -1 when
+ * the retention task evicted one between listing and reading it. A segment store rebuilt without its
+ * journal brings back deleted snapshots from segments not reused yet, which `rebuilt` accepts.
+ */
+static int verify_listing(workload_t *w, bool rebuilt)
+{
+    static catflapcam_storage_snapshot_info_t infos[64];
+    static uint8_t present[MAX_SNAPSHOTS];
+    static uint8_t expected[SNAPSHOT_MAX_SIZE];
+    static uint8_t actual[SNAPSHOT_MAX_SIZE];
+    catflapcam_storage_query_t query = {.source = -1};
+    uint32_t listed = 0;
+    uint32_t total = 0;
+    uint32_t last_id = UINT32_MAX;
+    uint64_t last_seq = UINT64_MAX;
+
+    memset(present, 0, sizeof(present));
+    do {
+        size_t n = 0;
+        uint64_t next = 0;
+        TEST_CHECK_OK(catflapcam_storage_list_snapshots(&query, infos, 64, &n, &next, &total));
+        for (size_t i = 0; i < n; i++) {
+            catflapcam_storage_snapshot_loc_t loc;
+            esp_err_t err = catflapcam_storage_locate_snapshot(infos[i].name, &loc);
+            if (err == ESP_ERR_NOT_FOUND) {
+                return -1;
+            }
+            TEST_CHECK_OK(err);
+            TEST_CHECK(loc.seq == infos[i].seq && loc.seq < last_seq);
+            TEST_CHECK(loc.size >= SNAPSHOT_MIN_SIZE && loc.size <= SNAPSHOT_MAX_SIZE);
+
+            FILE *fp = fopen(loc.path, "rb");
+            if (!fp && !SEGMENT_STORE) {
+                return -1;
+            }
+            TEST_CHECK(fp && fseek(fp, loc.offset, SEEK_SET) == 0 && fread(actual, 1, loc.size, fp) == loc.size);
+            fclose(fp);
+            uint32_t id;
+            memcpy(&id, actual, sizeof(id));
+            TEST_CHECK(id < w->next_id && id < last_id);
+            TEST_CHECK(!w->deleted[id] || (rebuilt && SEGMENT_STORE));
+            w->deleted[id] = 0;
+            present[id] = 1;
+            TEST_CHECK(loc.size == snapshot_size(id));
+            fill_snapshot(id, expected);
+            TEST_CHECK(memcmp(actual, expected, loc.size) == 0);
+            last_id = id;
+            last_seq = loc.seq;
+            listed++;
+        }
+        query.before_seq = next;
+    } while (query.before_seq != 0);
+    TEST_CHECK(listed == total);
+
+    /* Eviction only ever takes the oldest, so every snapshot newer than the oldest listed one is there. */
+    for (uint32_t id = last_id; listed && id < w->next_id; id++) {
+        TEST_CHECK(present[id] || w->deleted[id]);
+    }
+    return listed;
+}
+
+static uint32_t verify_store(workload_t *w, bool rebuilt)
+{
+    for (int attempt = 0; attempt < 5; attempt++) {
+        int listed = verify_listing(w, rebuilt);
+        if (listed >= 0) {
+            return listed;
+        }
+    }
+    TEST_CHECK(!"snapshots kept disappearing while verifying");
+    return 0;
+}
+
+typedef void (*phase_fn_t)(workload_t *w);
+
+static void run_phase(const char *name, phase_fn_t fn)
+{
+    pid_t pid = fork();
+    TEST_CHECK(pid >= 0);
+    if (pid == 0) {
+        workload_t w;
+        load_state(&w);
+        TEST_CHECK_OK(catflapcam_storage_init());
+        TEST_CHECK(catflapcam_storage_is_ready());
+        fn(&w);
+        save_state(&w);
+        printf("%s: %u snapshots saved, %u listed and verified\n", name, w.next_id, verify_store(&w, false));
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    TEST_CHECK(waitpid(pid, &status, 0) == pid);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void fill_store(workload_t *w)
+{
+    /* Enough to wrap the segment ring several times and to hit the file count limit. */
+    save_workload(w, 600);
+}
+
+static void reopen_store(workload_t *w)
+{
+    TEST_CHECK(verify_store(w, false) > 0);
+    save_workload(w, 150);
+}
+
+static void reopen_without_journal(workload_t *w)
+{
+    TEST_CHECK(verify_store(w, true) > 0);
+    save_workload(w, 150);
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+int main(void)
+{
+    nftw(CATFLAPCAM_SDCARD_MOUNT_POINT, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    unlink(state_path());
+
+    run_phase("fresh store", fill_store);
+    run_phase("journal replay", reopen_store);
+    TEST_CHECK(unlink(CATFLAPCAM_SDCARD_MOUNT_POINT "/" STORAGE_TEST_JOURNAL_NAME) == 0);
+    run_phase("rebuilt without journal", reopen_without_journal);
+    run_phase("journal replay after rebuild", reopen_store);
+    return 0;
+}